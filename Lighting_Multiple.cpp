@@ -16,6 +16,7 @@
 #include "Texture2D.h"
 #include "Camera.h"
 #include "Mesh.h"
+#include "PointShadowAtlas.h"
 
 
 // Global Variables
@@ -114,6 +115,31 @@ int main()
 		glm::vec3(5.0f,  3.8,  0.0f)
 	};
 
+	// Point light shadows.  Every lamp post head encloses its light, so its
+	// caster (6 + i in shadowCasters below) is the owner and does not shadow
+	// it.  Nothing moves in this scene, so once the faces are rendered they
+	// stay cached.
+	const float pointLightRadius = 12.0f;
+	PointShadowAtlas pointShadows;
+	if (!pointShadows.init(512, 3))
+	{
+		std::cerr << "Erreur creation point shadows !" << std::endl;
+		glfwTerminate();
+		return -1;
+	}
+	pointShadows.setFaceBudget(6);
+
+	int pointLightId[3];
+	for (int i = 0; i < 3; i++)
+		pointLightId[i] = pointShadows.addLight(pointLightPos[i], pointLightRadius, 6 + i);
+
+	std::vector<ShadowCaster> shadowCasters;
+	for (int i = 0; i < numModels; i++)
+	{
+		ShadowCaster caster = { &mesh[i], glm::translate(glm::mat4(1.0), modelPos[i]) * glm::scale(glm::mat4(1.0), modelScale[i]), true };
+		shadowCasters.push_back(caster);
+	}
+
 
 	double lastTime = glfwGetTime();
 
@@ -140,6 +166,10 @@ int main()
 		// Create the projection matrix
 		projection = glm::perspective(glm::radians(fpsCamera.getFOV()), (float)gWindowWidth / (float)gWindowHeight, 0.1f, 200.0f);
 
+		// Refresh the most important point shadow faces (at most 6 per frame)
+		pointShadows.update(fpsCamera, (float)gWindowWidth / (float)gWindowHeight, 0.1f, 200.0f, shadowCasters);
+		pointShadows.render(shadowCasters);
+
 		// update the view (camera) position
 		glm::vec3 viewPos;
 		viewPos.x = fpsCamera.getPosition().x;
@@ -188,6 +218,16 @@ int main()
 		lightingShader.setUniform("pointLights[2].linear", 0.22f);
 		lightingShader.setUniform("pointLights[2].exponent", 0.20f);
 
+		// Point light shadows (texture unit 1, unit 0 is the diffuse map)
+		pointShadows.bind(lightingShader, 1);
+		for (int i = 0; i < 3; i++)
+		{
+			std::ostringstream light;
+			light << "pointLights[" << i << "].";
+			lightingShader.setUniform((light.str() + "shadowSlot").c_str(), (GLint)pointShadows.getSlot(pointLightId[i]));
+			lightingShader.setUniform((light.str() + "shadowFar").c_str(), pointShadows.getFarPlane(pointLightId[i]));
+		}
+
 		// Spot light
 		glm::vec3 spotlightPos = fpsCamera.getPosition();
 
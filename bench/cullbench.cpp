@@ -0,0 +1,180 @@
+//-----------------------------------------------------------------------------
+// cullbench - DrawListBuilder frame build time over thread counts
+//
+// N objects with random transforms spread around the camera, random program,
+// texture, material and mesh ids.  Per frame:
+//  - build : frustum culling, screen sizes and sort keys of the visible
+//            objects into a lit queue and a depth queue, sorted
+//  - pack  : 32 bytes of per-draw data per visible object, in sorted order
+// for 1, 2, 4... threads up to the maximum (the calling thread plus workers;
+// 1 runs without a job system), in ms and speedup over 1 thread.  The build
+// ends with the radix sorts, which stay on one thread.  Times are the best of
+// the runs.  Results are written as JSON, progress goes to stderr.
+//
+//   cullbench [-n objects] [-t max threads] [-r runs] [-o out.json]
+//   (default: 100000 objects, 64 threads, 5 runs)
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include "DrawListBuilder.h"
+#include "JobSystem.h"
+#include "RenderQueue.h"
+#include "SceneTransforms.h"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const float WORLD_SIZE = 400.0f;	// objects within +-WORLD_SIZE of the camera on x and z
+
+	// Like DrawData in main.cpp
+	struct DrawData
+	{
+		unsigned long long handle;
+		int source;
+		float layer;
+		glm::vec4 rect;
+	};
+
+	double timeMs(const std::function<void()>& work)
+	{
+		Clock::time_point start = Clock::now();
+		work();
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Times every thread count and writes the JSON report
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	size_t count = 100000;
+	unsigned maxThreads = 64;
+	int runs = 5;
+	std::string outFile;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-n" && i + 1 < argc)
+			count = (size_t)std::max(1L, atol(argv[++i]));
+		else if (arg == "-t" && i + 1 < argc)
+			maxThreads = (unsigned)std::max(1, atoi(argv[++i]));
+		else if (arg == "-r" && i + 1 < argc)
+			runs = std::max(1, atoi(argv[++i]));
+		else if (arg == "-o" && i + 1 < argc)
+			outFile = argv[++i];
+		else
+		{
+			fprintf(stderr, "usage: cullbench [-n objects] [-t max threads] [-r runs] [-o out.json]\n");
+			return 1;
+		}
+	}
+
+	fprintf(stderr, "building %zu objects\n", count);
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	SceneTransforms scene;
+	scene.reserve(count);
+	std::vector<DrawListBuilder::Object> objects(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		scene.add(glm::vec3(unit(random) * WORLD_SIZE, unit(random) * 5.0f, unit(random) * WORLD_SIZE),
+				  glm::vec3(0.5f + unit(random) * 0.25f),
+				  glm::normalize(glm::quat(unit(random), unit(random), unit(random), unit(random))));
+
+		DrawListBuilder::Object& object = objects[i];
+		object.center = glm::vec3(unit(random), unit(random), unit(random)) * 0.1f;
+		object.radius = 1.0f + unit(random) * 0.5f;
+		object.pass = RenderQueue::PASS_OPAQUE;
+		object.program = (int)(random() % 4);
+		object.texture = (int)(random() % 256);
+		object.material = (int)(random() % 16);
+		object.mesh = (int)(random() % 1024);
+	}
+	scene.update();
+	std::vector<glm::mat4> worldMatrices;
+	std::vector<glm::mat3> normalMatrices;
+	scene.copyMatrices(worldMatrices, normalMatrices);
+
+	// A 60 degree camera at the center, far plane at the edge of the world
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 2.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, WORLD_SIZE);
+
+	std::vector<DrawData> drawData(count);
+	DrawListBuilder::PackFunction pack = [&drawData](size_t n, const RenderQueue::Packet& packet)
+	{
+		drawData[n].handle = (unsigned long long)packet.object;
+		drawData[n].source = RenderQueue::getTexture(packet.key) & 3;
+		drawData[n].layer = (float)RenderQueue::getMaterial(packet.key);
+		drawData[n].rect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	};
+
+	std::string json = "{\n";
+	json += "  \"objects\": " + std::to_string(count) + ",\n";
+	json += "  \"runs\": " + std::to_string(runs) + ",\n";
+	json += "  \"hardware_threads\": " + std::to_string(std::thread::hardware_concurrency()) + ",\n";
+	json += "  \"results\": [\n";
+
+	char line[512];
+	double baseMs = 0.0;
+	for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		// The calling thread is one of them
+		std::unique_ptr<JobSystem> jobs;
+		if (threads > 1)
+			jobs.reset(new JobSystem(threads - 1));
+
+		fprintf(stderr, "%u threads\n", threads);
+		DrawListBuilder builder;
+		RenderQueue queue, depthQueue;
+		queue.setDepthRange(0.1f, WORLD_SIZE);
+		depthQueue.setDepthRange(0.1f, WORLD_SIZE);
+
+		double buildMs = 1e30, packMs = 1e30, totalMs = 1e30;
+		for (int r = 0; r < runs; r++)
+		{
+			double build = timeMs([&] { builder.build(objects, worldMatrices, view, projection, queue, &depthQueue, jobs.get()); });
+			double packed = timeMs([&] { builder.pack(queue, pack, jobs.get()); });
+			buildMs = std::min(buildMs, build);
+			packMs = std::min(packMs, packed);
+			totalMs = std::min(totalMs, build + packed);
+		}
+		if (threads == 1)
+			baseMs = totalMs;
+
+		snprintf(line, sizeof(line),
+				 "%s    {\"threads\": %u, \"visible\": %zu, \"build_ms\": %.3f, \"pack_ms\": %.3f, \"total_ms\": %.3f, \"speedup\": %.2f}",
+				 threads == 1 ? "" : ",\n", threads, builder.getVisibleCount(), buildMs, packMs, totalMs, baseMs / totalMs);
+		json += line;
+	}
+	json += "\n  ]\n}\n";
+
+	if (outFile.empty())
+	{
+		fputs(json.c_str(), stdout);
+	}
+	else
+	{
+		std::ofstream out(outFile);
+		out << json;
+		if (!out)
+		{
+			fprintf(stderr, "cannot write %s\n", outFile.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}
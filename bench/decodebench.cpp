@@ -0,0 +1,349 @@
+//-----------------------------------------------------------------------------
+// decodebench - stb_image decode throughput and vertical flip cost
+//
+// Every image is read into memory once, then:
+//  - decode : each format's images decoded N times over 1, 2, 4... threads
+//             (a ThreadPool), in images/s and MB/s of
+//             file and of decoded RGBA
+//  - flip   : best of N per image of the three ways to put the bottom row
+//             first for GL:
+//               stbi_on_load : stbi_set_flip_vertically_on_load, timed as
+//                              the decode it slows down
+//               byte_loop    : the byte by byte swap of Texture2D::flipVertical
+//               row_swap     : whole rows swapped 16 bytes at a time (SSE2,
+//                              memcpy through a row buffer otherwise)
+// Results are written as JSON, progress goes to stderr.
+//
+//   decodebench [-n runs] [-t max threads] [-o out.json] [images...]
+//   (default: every image in textures/, 3 runs, one thread per core)
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DECODEBENCH_SSE2 1
+#include <emmintrin.h>
+const bool SIMD_ROW_SWAP = true;
+#else
+const bool SIMD_ROW_SWAP = false;
+#endif
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image/stb_image.h"
+
+#include "ThreadPool.h"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	struct Image
+	{
+		std::string name;
+		std::string format;			// lower case extension
+		std::vector<unsigned char> bytes;
+		int width, height;
+	};
+
+	double elapsedMs(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	double bestOf(int runs, const std::function<void()>& work)
+	{
+		double best = 1e30;
+		for (int i = 0; i < runs; i++)
+		{
+			Clock::time_point start = Clock::now();
+			work();
+			best = std::min(best, elapsedMs(start));
+		}
+		return best;
+	}
+
+	unsigned char* decode(const Image& image, int& width, int& height)
+	{
+		int components;
+		return stbi_load_from_memory(&image.bytes[0], (int)image.bytes.size(), &width, &height, &components, STBI_rgb_alpha);
+	}
+
+	// Same loop as Texture2D::flipVertical
+	void flipByteLoop(unsigned char* imageData, int width, int height)
+	{
+		int widthInBytes = width * 4;
+		unsigned char *top = NULL;
+		unsigned char *bottom = NULL;
+		unsigned char temp = 0;
+		int halfHeight = height / 2;
+		for (int row = 0; row < halfHeight; row++)
+		{
+			top = imageData + row * widthInBytes;
+			bottom = imageData + (height - row - 1) * widthInBytes;
+			for (int col = 0; col < widthInBytes; col++)
+			{
+				temp = *top;
+				*top = *bottom;
+				*bottom = temp;
+				top++;
+				bottom++;
+			}
+		}
+	}
+
+	void flipRowSwap(unsigned char* imageData, int width, int height, std::vector<unsigned char>& rowBuffer)
+	{
+		size_t rowBytes = (size_t)width * 4;
+		rowBuffer.resize(rowBytes);
+		for (int row = 0; row < height / 2; row++)
+		{
+			unsigned char* top = imageData + row * rowBytes;
+			unsigned char* bottom = imageData + (height - row - 1) * rowBytes;
+			size_t x = 0;
+#ifdef DECODEBENCH_SSE2
+			for (; x + 16 <= rowBytes; x += 16)
+			{
+				__m128i a = _mm_loadu_si128((const __m128i*)(top + x));
+				__m128i b = _mm_loadu_si128((const __m128i*)(bottom + x));
+				_mm_storeu_si128((__m128i*)(top + x), b);
+				_mm_storeu_si128((__m128i*)(bottom + x), a);
+			}
+#endif
+			size_t rest = rowBytes - x;
+			memcpy(&rowBuffer[0], top + x, rest);
+			memcpy(top + x, bottom + x, rest);
+			memcpy(bottom + x, &rowBuffer[0], rest);
+		}
+	}
+
+	// Decodes every image runs times on a pool of numThreads, wall clock ms
+	double timeDecode(const std::vector<const Image*>& images, int runs, unsigned numThreads)
+	{
+		ThreadPool pool(numThreads);
+		Clock::time_point start = Clock::now();
+		for (int run = 0; run < runs; run++)
+		{
+			for (size_t i = 0; i < images.size(); i++)
+			{
+				const Image* image = images[i];
+				pool.enqueue([image]
+				{
+					int width, height;
+					stbi_image_free(decode(*image, width, height));
+				});
+			}
+		}
+		pool.wait();
+		return elapsedMs(start);
+	}
+
+	std::string jsonString(const std::string& s)
+	{
+		std::string out = "\"";
+		for (size_t i = 0; i < s.size(); i++)
+		{
+			if (s[i] == '"' || s[i] == '\\')
+				out += '\\';
+			out += s[i];
+		}
+		return out + "\"";
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Runs both benchmarks and writes the JSON report
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	int runs = 3;
+	unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	std::string outFile;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-n" && i + 1 < argc)
+			runs = std::max(1, atoi(argv[++i]));
+		else if (arg == "-t" && i + 1 < argc)
+			maxThreads = (unsigned)std::max(1, atoi(argv[++i]));
+		else if (arg == "-o" && i + 1 < argc)
+			outFile = argv[++i];
+		else
+			files.push_back(arg);
+	}
+
+	if (files.empty())
+	{
+		std::error_code ec;
+		for (std::filesystem::directory_iterator it("textures", ec), end; !ec && it != end; it.increment(ec))
+		{
+			if (it->is_regular_file())
+				files.push_back(it->path().string());
+		}
+		std::sort(files.begin(), files.end());
+	}
+
+	// Read everything up front so the decode times leave the disk out
+	std::vector<Image> images;
+	std::vector<std::string> formats;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		std::ifstream in(files[i], std::ios::binary);
+		Image image;
+		image.bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		int components;
+		if (image.bytes.empty() || !stbi_info_from_memory(&image.bytes[0], (int)image.bytes.size(), &image.width, &image.height, &components))
+		{
+			fprintf(stderr, "skipping %s: %s\n", files[i].c_str(), image.bytes.empty() ? "cannot read" : stbi_failure_reason());
+			continue;
+		}
+
+		std::filesystem::path path(files[i]);
+		image.name = path.filename().string();
+		image.format = path.extension().string().substr(std::min<size_t>(1, path.extension().string().size()));
+		std::transform(image.format.begin(), image.format.end(), image.format.begin(), [](unsigned char c) { return (char)tolower(c); });
+		if (image.format == "jpeg")
+			image.format = "jpg";
+		if (std::find(formats.begin(), formats.end(), image.format) == formats.end())
+			formats.push_back(image.format);
+		images.push_back(image);
+	}
+	if (images.empty())
+	{
+		fprintf(stderr, "no image to decode\n");
+		return 1;
+	}
+
+	std::vector<unsigned> threadCounts;
+	for (unsigned n = 1; n < maxThreads; n *= 2)
+		threadCounts.push_back(n);
+	threadCounts.push_back(maxThreads);
+
+	std::string json = "{\n";
+	json += "  \"runs\": " + std::to_string(runs) + ",\n";
+	json += "  \"hardware_threads\": " + std::to_string(std::thread::hardware_concurrency()) + ",\n";
+	json += "  \"simd_row_swap\": " + std::string(SIMD_ROW_SWAP ? "true" : "false") + ",\n";
+
+	json += "  \"images\": [\n";
+	for (size_t i = 0; i < images.size(); i++)
+	{
+		const Image& image = images[i];
+		json += "    {\"name\": " + jsonString(image.name) + ", \"format\": " + jsonString(image.format) +
+				", \"width\": " + std::to_string(image.width) + ", \"height\": " + std::to_string(image.height) +
+				", \"file_bytes\": " + std::to_string(image.bytes.size()) + "}" + (i + 1 < images.size() ? ",\n" : "\n");
+	}
+	json += "  ],\n";
+
+	// Decode throughput per format and thread count
+	stbi_set_flip_vertically_on_load(0);
+	json += "  \"decode\": [\n";
+	for (size_t f = 0; f < formats.size(); f++)
+	{
+		std::vector<const Image*> formatImages;
+		double fileMB = 0.0, decodedMB = 0.0;
+		for (size_t i = 0; i < images.size(); i++)
+		{
+			if (images[i].format != formats[f])
+				continue;
+			formatImages.push_back(&images[i]);
+			fileMB += images[i].bytes.size() / (1024.0 * 1024.0);
+			decodedMB += (double)images[i].width * images[i].height * 4 / (1024.0 * 1024.0);
+		}
+
+		for (size_t t = 0; t < threadCounts.size(); t++)
+		{
+			fprintf(stderr, "decoding %s on %u threads\n", formats[f].c_str(), threadCounts[t]);
+			double seconds = timeDecode(formatImages, runs, threadCounts[t]) / 1000.0;
+			char line[512];
+			snprintf(line, sizeof(line),
+					 "    {\"format\": \"%s\", \"threads\": %u, \"images\": %d, \"seconds\": %.6f, \"images_per_s\": %.2f, "
+					 "\"file_mb_per_s\": %.2f, \"decoded_mb_per_s\": %.2f}",
+					 formats[f].c_str(), threadCounts[t], (int)formatImages.size() * runs, seconds,
+					 formatImages.size() * runs / seconds, fileMB * runs / seconds, decodedMB * runs / seconds);
+			json += line;
+			json += (f + 1 < formats.size() || t + 1 < threadCounts.size()) ? ",\n" : "\n";
+		}
+	}
+	json += "  ],\n";
+
+	// Flip methods, single threaded, summed over the images
+	fprintf(stderr, "timing flips\n");
+	double decodeMs = 0.0, flippedDecodeMs = 0.0, byteLoopMs = 0.0, rowSwapMs = 0.0, decodedMB = 0.0;
+	bool identical = true;
+	std::vector<unsigned char> rowBuffer;
+	for (size_t i = 0; i < images.size(); i++)
+	{
+		const Image& image = images[i];
+		int width, height;
+		decodeMs += bestOf(runs, [&] { stbi_image_free(decode(image, width, height)); });
+
+		stbi_set_flip_vertically_on_load(1);
+		unsigned char* flipped = decode(image, width, height);
+		flippedDecodeMs += bestOf(runs, [&] { stbi_image_free(decode(image, width, height)); });
+		stbi_set_flip_vertically_on_load(0);
+
+		unsigned char* pixels = decode(image, width, height);
+		size_t size = (size_t)width * height * 4;
+		std::vector<unsigned char> byteLoop(pixels, pixels + size), rowSwap(pixels, pixels + size);
+		byteLoopMs += bestOf(runs, [&] { flipByteLoop(&byteLoop[0], width, height); });
+		rowSwapMs += bestOf(runs, [&] { flipRowSwap(&rowSwap[0], width, height, rowBuffer); });
+
+		// An even number of runs flips the copies back: once more to compare
+		if (runs % 2 == 0)
+		{
+			flipByteLoop(&byteLoop[0], width, height);
+			flipRowSwap(&rowSwap[0], width, height, rowBuffer);
+		}
+		identical = identical && memcmp(flipped, &byteLoop[0], size) == 0 && memcmp(flipped, &rowSwap[0], size) == 0;
+		decodedMB += size / (1024.0 * 1024.0);
+
+		stbi_image_free(flipped);
+		stbi_image_free(pixels);
+	}
+
+	double stbiFlipMs = std::max(0.0, flippedDecodeMs - decodeMs);
+	char flip[1024];
+	snprintf(flip, sizeof(flip),
+			 "  \"flip\": {\n"
+			 "    \"decoded_mb\": %.2f,\n"
+			 "    \"identical\": %s,\n"
+			 "    \"methods\": [\n"
+			 "      {\"method\": \"stbi_on_load\", \"ms\": %.3f, \"decode_ms\": %.3f, \"flipped_decode_ms\": %.3f, \"mb_per_s\": %.2f},\n"
+			 "      {\"method\": \"byte_loop\", \"ms\": %.3f, \"mb_per_s\": %.2f},\n"
+			 "      {\"method\": \"row_swap\", \"ms\": %.3f, \"mb_per_s\": %.2f}\n"
+			 "    ]\n"
+			 "  }\n",
+			 decodedMB, identical ? "true" : "false",
+			 stbiFlipMs, decodeMs, flippedDecodeMs, stbiFlipMs > 0.0 ? decodedMB * 1000.0 / stbiFlipMs : 0.0,
+			 byteLoopMs, decodedMB * 1000.0 / byteLoopMs,
+			 rowSwapMs, decodedMB * 1000.0 / rowSwapMs);
+	json += flip;
+	json += "}\n";
+
+	if (outFile.empty())
+	{
+		fputs(json.c_str(), stdout);
+	}
+	else
+	{
+		std::ofstream out(outFile);
+		out << json;
+		if (!out)
+		{
+			fprintf(stderr, "cannot write %s\n", outFile.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,332 @@
+//-----------------------------------------------------------------------------
+// gpucullbench - GpuCuller against a CPU draw loop as the instances grow
+//
+// N crates on a grid behind a wall, seen from the ground in front of it while
+// the camera turns left and right, drawn depth only into a 1280x720 target on
+// a hidden window.  Per frame:
+//  - gpu : GpuCuller with compute shaders, both phases with the pyramid in
+//          between, one indirect draw per batch and phase (null without 4.3)
+//  - feedback : GpuCuller by transform feedback, the frustum only, one draw
+//          per batch
+//  - cpu : a frustum test per instance on the CPU, then a draw per visible
+//          instance with its matrix as a uniform
+// cpu_ms is the time the frame's calls take on the CPU, frame_ms the same up
+// to glFinish().  With a software driver the GPU work shows in cpu_ms wherever
+// the driver waits for it.  Times are medians over the frames, the visible
+// counts of GpuCuller are read back a few frames late.  Results are written
+// as JSON, progress goes to stderr.  Run from the build dir.
+//
+//   gpucullbench [-n max instances] [-f frames] [-o out.json]
+//   (default: 65536 instances, from 1024 by 4 times more, 32 frames)
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GLFW/glfw3.h"
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "GpuCuller.h"
+#include "Mesh.h"
+#include "ShaderProgram.h"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const int TARGET_WIDTH = 1280;
+	const int TARGET_HEIGHT = 720;
+	const float SPACING = 5.0f;				// between crates
+	const float WALL_DISTANCE = 40.0f;
+	const glm::vec3 EYE(0.0f, 3.0f, 0.0f);
+	const float FAR_PLANE = 2000.0f;
+	const int WARMUP_FRAMES = 4;			// the readbacks of GpuCuller catch up
+
+	double msSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	double median(std::vector<double> values)
+	{
+		std::sort(values.begin(), values.end());
+		return values.empty() ? 0.0 : values[values.size() / 2];
+	}
+
+	// Turning left and right around the view down the grid
+	glm::mat4 viewAt(int frame)
+	{
+		float yaw = 0.5f * std::sin(frame * 0.2f);
+		glm::vec3 look(std::sin(yaw), 0.0f, -std::cos(yaw));
+		return glm::lookAt(EYE, EYE + look, glm::vec3(0.0f, 1.0f, 0.0f));
+	}
+
+	// The wall first, then the crates row by row away from the camera
+	std::vector<glm::mat4> makeScene(size_t count)
+	{
+		std::vector<glm::mat4> matrices;
+		matrices.push_back(glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -WALL_DISTANCE)),
+									  glm::vec3(200.0f, 15.0f, 0.5f)));
+		const int side = (int)std::ceil(std::sqrt((double)count));
+		for (size_t i = 0; i < count; i++)
+		{
+			float x = ((int)(i % side) - 0.5f * side) * SPACING;
+			float z = -SPACING * (1 + (int)(i / side));
+			matrices.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(x, 0.0f, z)));
+		}
+		return matrices;
+	}
+
+	// The bounding sphere against the planes of the frustum
+	bool inFrustum(const glm::mat4& viewProjection, const glm::vec3& center, float radius)
+	{
+		glm::mat4 m = glm::transpose(viewProjection);
+		const glm::vec4 planes[6] = { m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[3] + m[2], m[3] - m[2] };
+		for (const glm::vec4& plane : planes)
+		{
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius * glm::length(glm::vec3(plane)))
+				return false;
+		}
+		return true;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Times both paths for every instance count and writes the JSON report
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	size_t maxCount = 65536;
+	int frames = 32;
+	std::string outFile;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-n" && i + 1 < argc)
+			maxCount = (size_t)std::max(1L, atol(argv[++i]));
+		else if (arg == "-f" && i + 1 < argc)
+			frames = std::max(1, atoi(argv[++i]));
+		else if (arg == "-o" && i + 1 < argc)
+			outFile = argv[++i];
+		else
+		{
+			fprintf(stderr, "usage: gpucullbench [-n max instances] [-f frames] [-o out.json]\n");
+			return 1;
+		}
+	}
+
+	if (!glfwInit())
+		return 1;
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+	GLFWwindow* window = glfwCreateWindow(64, 64, "gpucullbench", NULL, NULL);
+	if (window == NULL)
+	{
+		fprintf(stderr, "cannot create an OpenGL 3.3 context\n");
+		glfwTerminate();
+		return 1;
+	}
+	glfwMakeContextCurrent(window);
+
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK || !GpuCuller::isSupported(GpuCuller::METHOD_TRANSFORM_FEEDBACK))
+	{
+		fprintf(stderr, "GpuCuller is not supported\n");
+		glfwTerminate();
+		return 1;
+	}
+
+	std::string json;
+	{
+		// The OBJ load logs the file
+		std::streambuf* coutBuffer = std::cout.rdbuf(nullptr);
+		Mesh crate;
+		bool loaded = crate.loadOBJ("models/crate.obj");
+		std::cout.rdbuf(coutBuffer);
+
+		ShaderProgram depthShader;
+		GpuCuller culler, feedbackCuller;
+		const bool compute = GpuCuller::isSupported(GpuCuller::METHOD_COMPUTE);
+		if (!loaded || !depthShader.loadShaders("shaders/depth_prepass.vert", "shaders/depth_prepass.frag") ||
+			(compute && !culler.init(GpuCuller::METHOD_COMPUTE)) || !feedbackCuller.init(GpuCuller::METHOD_TRANSFORM_FEEDBACK))
+		{
+			fprintf(stderr, "cannot load models/crate.obj or the shaders, run from the build dir\n");
+			glfwTerminate();
+			return 1;
+		}
+
+		// Depth only target, a texture for the pyramid
+		GLuint depthTexture, framebuffer;
+		glGenTextures(1, &depthTexture);
+		glBindTexture(GL_TEXTURE_2D, depthTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, TARGET_WIDTH, TARGET_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+		glDrawBuffer(GL_NONE);
+		glViewport(0, 0, TARGET_WIDTH, TARGET_HEIGHT);
+		glEnable(GL_DEPTH_TEST);
+
+		const glm::mat4 projection = glm::perspective(glm::radians(60.0f), (float)TARGET_WIDTH / TARGET_HEIGHT, 0.1f, FAR_PLANE);
+		const glm::vec3 center = 0.5f * (crate.getBoundsMin() + crate.getBoundsMax());
+		const float radius = 0.5f * glm::length(crate.getBoundsMax() - crate.getBoundsMin());
+
+		json = "{\n";
+		json += "  \"target\": \"" + std::to_string(TARGET_WIDTH) + "x" + std::to_string(TARGET_HEIGHT) + "\",\n";
+		json += "  \"frames\": " + std::to_string(frames) + ",\n";
+		json += "  \"gl_version\": \"" + std::string((const char*)glGetString(GL_VERSION)) + "\",\n";
+		json += "  \"results\": [\n";
+		char line[1024];
+		bool first = true;
+		for (size_t count = std::min<size_t>(1024, maxCount); count <= maxCount; count *= 4)
+		{
+			fprintf(stderr, "%zu instances\n", count);
+			const std::vector<glm::mat4> matrices = makeScene(count);
+
+			// The wall and the crates in batches of their own
+			std::vector<GpuCuller::Instance> instances(matrices.size());
+			for (size_t i = 0; i < matrices.size(); i++)
+				instances[i] = {i == 0 ? 0 : 1, (int)i, crate.getBoundsMin(), crate.getBoundsMax()};
+			if (compute)
+			{
+				culler.setInstances(std::vector<Mesh*>(2, &crate), instances);
+				culler.invalidatePyramid();
+			}
+			feedbackCuller.setInstances(std::vector<Mesh*>(2, &crate), instances);
+
+			// A frame of a GpuCuller, the phases and the pyramid its method has
+			auto cullFrame = [&](GpuCuller& gpuCuller, const glm::mat4& view, std::vector<double>& cpuTimes,
+								 std::vector<double>& frameTimes, bool measured)
+			{
+				glClear(GL_DEPTH_BUFFER_BIT);
+				Clock::time_point start = Clock::now();
+				gpuCuller.setMatrices(matrices);
+				gpuCuller.cull(GpuCuller::PHASE_PREVIOUS, view, projection);
+				depthShader.use();
+				depthShader.setUniform("view", view);
+				depthShader.setUniform("projection", projection);
+				depthShader.setUniform("instanced", (GLint)1);
+				for (int b = 0; b < gpuCuller.getNumBatches(); b++)
+					gpuCuller.drawBatch(GpuCuller::PHASE_PREVIOUS, b, true);
+				if (gpuCuller.getMethod() == GpuCuller::METHOD_COMPUTE)
+				{
+					gpuCuller.buildPyramid(depthTexture, TARGET_WIDTH, TARGET_HEIGHT);
+					gpuCuller.cull(GpuCuller::PHASE_FIXUP, view, projection);
+					depthShader.use();
+					for (int b = 0; b < gpuCuller.getNumBatches(); b++)
+						gpuCuller.drawBatch(GpuCuller::PHASE_FIXUP, b, true);
+				}
+				Mesh::unbind();
+				double cpuMs = msSince(start);
+				glFinish();
+				if (measured)
+				{
+					cpuTimes.push_back(cpuMs);
+					frameTimes.push_back(msSince(start));
+				}
+			};
+
+			std::vector<double> gpuCpuMs, gpuFrameMs, feedbackCpuMs, feedbackFrameMs, loopCpuMs, loopFrameMs;
+			int gpuDraws = 0, loopDraws = 0, loopVisible = 0;
+			for (int frame = 0; frame < WARMUP_FRAMES + frames; frame++)
+			{
+				const glm::mat4 view = viewAt(frame);
+
+				// GpuCuller
+				if (compute)
+				{
+					cullFrame(culler, view, gpuCpuMs, gpuFrameMs, frame >= WARMUP_FRAMES);
+					gpuDraws = culler.getStats().drawCalls;
+				}
+				cullFrame(feedbackCuller, view, feedbackCpuMs, feedbackFrameMs, frame >= WARMUP_FRAMES);
+
+				// CPU loop
+				glClear(GL_DEPTH_BUFFER_BIT);
+				Clock::time_point start = Clock::now();
+				const glm::mat4 viewProjection = projection * view;
+				depthShader.setUniform("instanced", (GLint)0);
+				loopVisible = 0;
+				for (const glm::mat4& model : matrices)
+				{
+					// The wall is scaled, its sphere with it
+					float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+					if (!inFrustum(viewProjection, glm::vec3(model * glm::vec4(center, 1.0f)), radius * scale))
+						continue;
+					depthShader.setUniform("model", model);
+					crate.drawPositions();
+					loopVisible++;
+				}
+				double cpuMs = msSince(start);
+				glFinish();
+				if (frame >= WARMUP_FRAMES)
+				{
+					loopCpuMs.push_back(cpuMs);
+					loopFrameMs.push_back(msSince(start));
+				}
+				loopDraws = loopVisible;
+			}
+
+			char gpu[512] = "null";
+			if (compute)
+			{
+				const GpuCuller::Stats& stats = culler.getStats();
+				snprintf(gpu, sizeof(gpu),
+						 "{\"cpu_ms\": %.3f, \"frame_ms\": %.3f, \"draw_calls\": %d, \"batches\": %d, "
+						 "\"visible\": %d, \"fixup_visible\": %d, \"cull_gpu_ms\": %.3f}",
+						 median(gpuCpuMs), median(gpuFrameMs), gpuDraws, stats.batches,
+						 stats.visible[GpuCuller::PHASE_PREVIOUS], stats.visible[GpuCuller::PHASE_FIXUP], stats.gpuMs);
+			}
+			const GpuCuller::Stats& feedbackStats = feedbackCuller.getStats();
+			snprintf(line, sizeof(line),
+					 "%s    {\"instances\": %zu, \"gpu\": %s, "
+					 "\"feedback\": {\"cpu_ms\": %.3f, \"frame_ms\": %.3f, \"draw_calls\": %d, \"visible\": %d, \"cull_gpu_ms\": %.3f}, "
+					 "\"cpu_loop\": {\"cpu_ms\": %.3f, \"frame_ms\": %.3f, \"draw_calls\": %d, \"visible\": %d}}",
+					 first ? "" : ",\n", matrices.size(), gpu,
+					 median(feedbackCpuMs), median(feedbackFrameMs), feedbackStats.drawCalls,
+					 feedbackStats.visible[GpuCuller::PHASE_PREVIOUS], feedbackStats.gpuMs,
+					 median(loopCpuMs), median(loopFrameMs), loopDraws, loopVisible);
+			json += line;
+			first = false;
+		}
+		json += "\n  ]\n}\n";
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteTextures(1, &depthTexture);
+	}
+	glfwDestroyWindow(window);
+	glfwTerminate();
+
+	if (outFile.empty())
+	{
+		fputs(json.c_str(), stdout);
+	}
+	else
+	{
+		std::ofstream out(outFile);
+		out << json;
+		if (!out)
+		{
+			fprintf(stderr, "cannot write %s\n", outFile.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,240 @@
+//-----------------------------------------------------------------------------
+// jobbench - JobSystem overhead and scaling
+//
+// Overhead, with the default number of workers:
+//  - spawn        : N empty jobs spawned from the main thread, then waited for
+//  - spawn_nested : the same spawned by a job, onto its worker's own deque
+//                   (the others steal them)
+//  - chain        : N empty jobs, each depending on the previous one
+//  - parallel_for : an empty body over N items, one item per chunk
+// in ns per job (or chunk).
+//
+// Scaling, for 1, 2, 4... threads up to the maximum (the calling thread plus
+// workers; 1 runs without a job system):
+//  - compute    : parallelFor over items of pure arithmetic
+//  - transforms : SceneTransforms::update() of a million objects, all changed
+// in ms and speedup over 1 thread.  Thread counts above the hardware threads
+// are run anyway and show the cost of oversubscription.
+//
+// Times are the best of the runs.  Results are written as JSON, progress goes
+// to stderr.
+//
+//   jobbench [-n jobs] [-t max threads] [-r runs] [-o out.json]
+//   (default: 100000 jobs, 64 threads, 5 runs)
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "JobSystem.h"
+#include "SceneTransforms.h"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const size_t COMPUTE_ITEMS = 1 << 16;
+	const int COMPUTE_ITERATIONS = 500;	// per item, a few microseconds
+	const size_t COMPUTE_GRAIN = 64;
+	const size_t TRANSFORM_OBJECTS = 1000000;
+
+	double bestOf(int runs, const std::function<void()>& prepare, const std::function<void()>& work)
+	{
+		double best = 1e30;
+		for (int i = 0; i < runs; i++)
+		{
+			prepare();
+			Clock::time_point start = Clock::now();
+			work();
+			best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+		}
+		return best;
+	}
+
+	// Enough work that the compiler cannot drop it
+	float computeItems(size_t first, size_t last)
+	{
+		float sum = 0.0f;
+		for (size_t i = first; i < last; i++)
+		{
+			float x = (float)i;
+			for (int k = 0; k < COMPUTE_ITERATIONS; k++)
+				x = sqrtf(x * 0.5f + (float)k);
+			sum += x;
+		}
+		return sum;
+	}
+
+	void addResult(std::string& json, bool& first, const char* line)
+	{
+		json += first ? "" : ",\n";
+		json += line;
+		first = false;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Times every case and writes the JSON report
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	size_t count = 100000;
+	unsigned maxThreads = 64;
+	int runs = 5;
+	std::string outFile;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-n" && i + 1 < argc)
+			count = (size_t)std::max(1L, atol(argv[++i]));
+		else if (arg == "-t" && i + 1 < argc)
+			maxThreads = (unsigned)std::max(1, atoi(argv[++i]));
+		else if (arg == "-r" && i + 1 < argc)
+			runs = std::max(1, atoi(argv[++i]));
+		else if (arg == "-o" && i + 1 < argc)
+			outFile = argv[++i];
+		else
+		{
+			fprintf(stderr, "usage: jobbench [-n jobs] [-t max threads] [-r runs] [-o out.json]\n");
+			return 1;
+		}
+	}
+
+	std::string json = "{\n";
+	json += "  \"jobs\": " + std::to_string(count) + ",\n";
+	json += "  \"runs\": " + std::to_string(runs) + ",\n";
+	json += "  \"hardware_threads\": " + std::to_string(std::thread::hardware_concurrency()) + ",\n";
+
+	char line[512];
+	bool first = true;
+	{
+		JobSystem jobs;
+		std::atomic<size_t> executed(0);
+		std::vector<JobSystem::JobHandle> handles;
+		handles.reserve(count);
+
+		json += "  \"workers\": " + std::to_string(jobs.getNumWorkers()) + ",\n";
+		json += "  \"overhead\": [\n";
+
+		fprintf(stderr, "spawn\n");
+		double ms = bestOf(runs, [&] { handles.clear(); }, [&] {
+			for (size_t i = 0; i < count; i++)
+				handles.push_back(jobs.spawn([&executed] { executed++; }));
+			jobs.wait(handles);
+		});
+		snprintf(line, sizeof(line), "    {\"case\": \"spawn\", \"ms\": %.3f, \"ns_per_job\": %.1f}", ms, ms * 1e6 / count);
+		addResult(json, first, line);
+
+		fprintf(stderr, "spawn_nested\n");
+		size_t steals = jobs.getStealCount();
+		ms = bestOf(runs, [&] { handles.clear(); }, [&] {
+			JobSystem::JobHandle root = jobs.spawn([&] {
+				std::vector<JobSystem::JobHandle> children;
+				children.reserve(count);
+				for (size_t i = 0; i < count; i++)
+					children.push_back(jobs.spawn([&executed] { executed++; }));
+				jobs.wait(children);
+			});
+			jobs.wait(root);
+		});
+		snprintf(line, sizeof(line), "    {\"case\": \"spawn_nested\", \"ms\": %.3f, \"ns_per_job\": %.1f, \"steals_per_run\": %.0f}",
+				 ms, ms * 1e6 / count, (double)(jobs.getStealCount() - steals) / runs);
+		addResult(json, first, line);
+
+		fprintf(stderr, "chain\n");
+		ms = bestOf(runs, [&] { handles.clear(); }, [&] {
+			JobSystem::JobHandle previous;
+			for (size_t i = 0; i < count; i++)
+				previous = jobs.spawn([&executed] { executed++; }, std::vector<JobSystem::JobHandle>(1, previous));
+			jobs.wait(previous);
+		});
+		snprintf(line, sizeof(line), "    {\"case\": \"chain\", \"ms\": %.3f, \"ns_per_job\": %.1f}", ms, ms * 1e6 / count);
+		addResult(json, first, line);
+
+		fprintf(stderr, "parallel_for\n");
+		ms = bestOf(runs, [] {}, [&] {
+			jobs.parallelFor(0, count, 1, [&executed](size_t, size_t) { executed++; });
+		});
+		snprintf(line, sizeof(line), "    {\"case\": \"parallel_for\", \"ms\": %.3f, \"ns_per_chunk\": %.1f}", ms, ms * 1e6 / count);
+		addResult(json, first, line);
+		json += "\n  ],\n";
+	}
+
+	// Random transforms, like transformbench
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	SceneTransforms scene;
+	scene.reserve(TRANSFORM_OBJECTS);
+	for (size_t i = 0; i < TRANSFORM_OBJECTS; i++)
+		scene.add(glm::vec3(unit(random), unit(random), unit(random)) * 1000.0f, glm::vec3(1.0f + unit(random) * 0.5f),
+				  glm::normalize(glm::quat(unit(random), unit(random), unit(random), unit(random))));
+
+	json += "  \"scaling\": [\n";
+	first = true;
+	double computeBase = 0.0, transformBase = 0.0;
+	for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		// The calling thread is one of them
+		std::unique_ptr<JobSystem> jobs;
+		if (threads > 1)
+			jobs.reset(new JobSystem(threads - 1));
+
+		fprintf(stderr, "%u threads\n", threads);
+		volatile float sink = 0.0f;
+		double computeMs = bestOf(runs, [] {}, [&] {
+			if (!jobs)
+			{
+				sink = computeItems(0, COMPUTE_ITEMS);
+				return;
+			}
+			std::atomic<int> done(0);
+			jobs->parallelFor(0, COMPUTE_ITEMS, COMPUTE_GRAIN, [&](size_t from, size_t to) {
+				if (computeItems(from, to) >= 0.0f)
+					done++;
+			});
+			sink = (float)done;
+		});
+
+		double transformMs = bestOf(runs, [&] {
+			for (size_t i = 0; i < TRANSFORM_OBJECTS; i++)
+				scene.setScale((SceneTransforms::Entity)i, scene.getScale((SceneTransforms::Entity)i));
+		}, [&] { scene.update(jobs.get()); });
+
+		if (threads == 1)
+		{
+			computeBase = computeMs;
+			transformBase = transformMs;
+		}
+		snprintf(line, sizeof(line),
+				 "    {\"threads\": %u, \"compute_ms\": %.3f, \"compute_speedup\": %.2f, \"transforms_ms\": %.3f, \"transforms_speedup\": %.2f}",
+				 threads, computeMs, computeBase / computeMs, transformMs, transformBase / transformMs);
+		addResult(json, first, line);
+	}
+	json += "\n  ]\n}\n";
+
+	if (outFile.empty())
+	{
+		fputs(json.c_str(), stdout);
+	}
+	else
+	{
+		std::ofstream out(outFile);
+		out << json;
+		if (!out)
+		{
+			fprintf(stderr, "cannot write %s\n", outFile.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}
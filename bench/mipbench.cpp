@@ -0,0 +1,181 @@
+//-----------------------------------------------------------------------------
+// mipbench - CPU mip chains against glGenerateMipmap
+//
+// For every image, best of N runs:
+//  - gl     : glTexImage2D + glGenerateMipmap (what Texture2D used to do)
+//  - box / kaiser : MipGenerator, gamma correct, SSE2 and scalar
+//  - upload : allocating every level and filling it with glTexSubImage2D
+// The driver side is timed on the CPU around glFinish, on a hidden window.
+//
+//   mipbench [-n runs] [images...]		(default: every image in textures/)
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GLFW/glfw3.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image/stb_image.h"
+
+#include "MipGenerator.h"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	double bestOf(int runs, const std::function<void()>& work)
+	{
+		double best = 1e30;
+		for (int i = 0; i < runs; i++)
+		{
+			Clock::time_point start = Clock::now();
+			work();
+			best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+		}
+		return best;
+	}
+
+	double timeGenerateMipmap(int runs, const unsigned char* rgba, int width, int height)
+	{
+		return bestOf(runs, [&]
+		{
+			GLuint texture;
+			glGenTextures(1, &texture);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+			glGenerateMipmap(GL_TEXTURE_2D);
+			glFinish();
+			glDeleteTextures(1, &texture);
+		});
+	}
+
+	double timeCpuMips(int runs, const unsigned char* rgba, int width, int height, MipGenerator::Filter filter, bool simd,
+					   std::vector<MipGenerator::Level>& levels)
+	{
+		MipGenerator::setSimdEnabled(simd);
+		double ms = bestOf(runs, [&] { MipGenerator::generate(rgba, width, height, filter, true, levels); });
+		MipGenerator::setSimdEnabled(true);
+		return ms;
+	}
+
+	double timeUpload(int runs, const unsigned char* rgba, int width, int height, const std::vector<MipGenerator::Level>& levels)
+	{
+		return bestOf(runs, [&]
+		{
+			GLuint texture;
+			glGenTextures(1, &texture);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			for (size_t i = 0; i < levels.size(); i++)
+				glTexImage2D(GL_TEXTURE_2D, (GLint)i + 1, GL_RGBA8, levels[i].width, levels[i].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+			for (size_t i = 0; i < levels.size(); i++)
+				glTexSubImage2D(GL_TEXTURE_2D, (GLint)i + 1, 0, 0, levels[i].width, levels[i].height, GL_RGBA, GL_UNSIGNED_BYTE, &levels[i].pixels[0]);
+			glFinish();
+			glDeleteTextures(1, &texture);
+		});
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Runs the comparison on every image
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	int runs = 3;
+	std::vector<std::string> images;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-n" && i + 1 < argc)
+			runs = std::max(1, atoi(argv[++i]));
+		else
+			images.push_back(arg);
+	}
+
+	if (images.empty())
+	{
+		std::error_code ec;
+		for (std::filesystem::directory_iterator it("textures", ec), end; !ec && it != end; it.increment(ec))
+		{
+			if (it->is_regular_file())
+				images.push_back(it->path().string());
+		}
+		std::sort(images.begin(), images.end());
+	}
+
+	if (!glfwInit())
+		return 1;
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+	GLFWwindow* window = glfwCreateWindow(64, 64, "mipbench", NULL, NULL);
+	if (window == NULL)
+	{
+		fprintf(stderr, "Failed to create an OpenGL 3.3 context\n");
+		glfwTerminate();
+		return 1;
+	}
+	glfwMakeContextCurrent(window);
+
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK)
+	{
+		glfwTerminate();
+		return 1;
+	}
+
+	printf("%s / %s, best of %d runs, times in ms\n", (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION), runs);
+	printf("%-28s %11s %9s %9s %9s %9s %9s %9s\n", "image", "size", "gl", "box", "box c", "kaiser", "kaiser c", "upload");
+
+	double total[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+	for (size_t i = 0; i < images.size(); i++)
+	{
+		int width, height, components;
+		unsigned char* rgba = stbi_load(images[i].c_str(), &width, &height, &components, STBI_rgb_alpha);
+		if (rgba == NULL)
+			continue;
+
+		std::vector<MipGenerator::Level> levels;
+		double ms[6];
+		ms[0] = timeGenerateMipmap(runs, rgba, width, height);
+		ms[1] = timeCpuMips(runs, rgba, width, height, MipGenerator::FILTER_BOX, true, levels);
+		ms[2] = timeCpuMips(runs, rgba, width, height, MipGenerator::FILTER_BOX, false, levels);
+		ms[3] = timeCpuMips(runs, rgba, width, height, MipGenerator::FILTER_KAISER, true, levels);
+		ms[4] = timeCpuMips(runs, rgba, width, height, MipGenerator::FILTER_KAISER, false, levels);
+		ms[5] = timeUpload(runs, rgba, width, height, levels);
+		stbi_image_free(rgba);
+
+		char size[32];
+		snprintf(size, sizeof(size), "%dx%d", width, height);
+		printf("%-28s %11s", std::filesystem::path(images[i]).filename().string().c_str(), size);
+		for (int c = 0; c < 6; c++)
+		{
+			printf(" %9.2f", ms[c]);
+			total[c] += ms[c];
+		}
+		printf("\n");
+	}
+
+	printf("%-28s %11s", "total", "");
+	for (int c = 0; c < 6; c++)
+		printf(" %9.2f", total[c]);
+	printf("\n(box c / kaiser c: scalar path; cooked textures only pay the upload column at startup)\n");
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	return 0;
+}
@@ -0,0 +1,219 @@
+//-----------------------------------------------------------------------------
+// occlusionbench - OcclusionCuller cost and benefit over thread counts
+//
+// A city block grid of B x B buildings (boxes the size of
+// models/building_occluder.obj) with N small objects scattered in the streets,
+// seen from street level.  Per frame:
+//  - occlusion : setup and rasterization of the buildings in view
+//  - build     : DrawListBuilder culling with the occlusion tests
+// against a build with frustum culling only, for 1, 2, 4... threads up to the
+// maximum (the calling thread plus workers; 1 runs without a job system), with
+// AVX2 and with the scalar path.  Times are the best of the runs.  Results are
+// written as JSON, progress goes to stderr.
+//
+//   occlusionbench [-n objects] [-b buildings per side] [-t max threads] [-r runs] [-o out.json]
+//   (default: 100000 objects, 16 buildings, 64 threads, 5 runs)
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include "DrawListBuilder.h"
+#include "JobSystem.h"
+#include "OcclusionCuller.h"
+#include "RenderQueue.h"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const float BLOCK_SIZE = 48.0f;			// building spacing, the streets between
+	const glm::vec3 BUILDING_HALF_SIZE(16.5f, 25.0f, 7.0f);
+
+	double timeMs(const std::function<void()>& work)
+	{
+		Clock::time_point start = Clock::now();
+		work();
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	// 12 counter-clockwise triangles of a box centered on the origin
+	std::vector<glm::vec3> makeBox(const glm::vec3& halfSize)
+	{
+		glm::vec3 corners[8];
+		for (int c = 0; c < 8; c++)
+			corners[c] = glm::vec3(c & 1 ? halfSize.x : -halfSize.x, c & 2 ? halfSize.y : -halfSize.y, c & 4 ? halfSize.z : -halfSize.z);
+
+		// Faces -x, +x, -y, +y, -z, +z, seen from outside
+		const int quads[6][4] = { {0, 4, 6, 2}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 2, 3, 1}, {4, 5, 7, 6} };
+		std::vector<glm::vec3> triangles;
+		for (int f = 0; f < 6; f++)
+		{
+			const int* q = quads[f];
+			const int order[6] = { q[0], q[1], q[2], q[0], q[2], q[3] };
+			for (int i = 0; i < 6; i++)
+				triangles.push_back(corners[order[i]]);
+		}
+		return triangles;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Times every thread count with and without AVX2, writes the JSON report
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	size_t count = 100000;
+	int buildingsPerSide = 16;
+	unsigned maxThreads = 64;
+	int runs = 5;
+	std::string outFile;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-n" && i + 1 < argc)
+			count = (size_t)std::max(1L, atol(argv[++i]));
+		else if (arg == "-b" && i + 1 < argc)
+			buildingsPerSide = std::max(1, atoi(argv[++i]));
+		else if (arg == "-t" && i + 1 < argc)
+			maxThreads = (unsigned)std::max(1, atoi(argv[++i]));
+		else if (arg == "-r" && i + 1 < argc)
+			runs = std::max(1, atoi(argv[++i]));
+		else if (arg == "-o" && i + 1 < argc)
+			outFile = argv[++i];
+		else
+		{
+			fprintf(stderr, "usage: occlusionbench [-n objects] [-b buildings per side] [-t max threads] [-r runs] [-o out.json]\n");
+			return 1;
+		}
+	}
+
+	// Buildings on the grid, objects in the streets, both around the origin
+	fprintf(stderr, "building %d buildings and %zu objects\n", buildingsPerSide * buildingsPerSide, count);
+	const float halfExtent = 0.5f * buildingsPerSide * BLOCK_SIZE;
+	const std::vector<glm::vec3> box = makeBox(BUILDING_HALF_SIZE);
+	std::vector<OcclusionCuller::Occluder> occluders;
+	for (int z = 0; z < buildingsPerSide; z++)
+	{
+		for (int x = 0; x < buildingsPerSide; x++)
+		{
+			glm::vec3 center(-halfExtent + (x + 0.5f) * BLOCK_SIZE, BUILDING_HALF_SIZE.y, -halfExtent + (z + 0.5f) * BLOCK_SIZE);
+			occluders.push_back({&box, glm::translate(glm::mat4(1.0f), center)});
+		}
+	}
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<DrawListBuilder::Object> objects(count);
+	std::vector<glm::mat4> worldMatrices(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		// Along a street, x or z
+		float along = (unit(random) * 2.0f - 1.0f) * halfExtent;
+		float street = -halfExtent + (float)(random() % (buildingsPerSide + 1)) * BLOCK_SIZE + (unit(random) - 0.5f) * 8.0f;
+		glm::vec3 position = i % 2 == 0 ? glm::vec3(along, 1.0f, street) : glm::vec3(street, 1.0f, along);
+		worldMatrices[i] = glm::translate(glm::mat4(1.0f), position);
+
+		DrawListBuilder::Object& object = objects[i];
+		object.center = glm::vec3(0.0f);
+		object.radius = 0.5f + unit(random);
+		object.pass = RenderQueue::PASS_OPAQUE;
+		object.program = (int)(random() % 4);
+		object.texture = (int)(random() % 256);
+		object.material = (int)(random() % 16);
+		object.mesh = (int)(random() % 1024);
+	}
+
+	// At a crossing near the middle, looking down a street and across the blocks
+	const glm::vec3 eye(BLOCK_SIZE * 0.1f, 2.0f, BLOCK_SIZE * 0.1f);
+	glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(-0.5f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 2.0f * halfExtent);
+
+	std::string json = "{\n";
+	json += "  \"objects\": " + std::to_string(count) + ",\n";
+	json += "  \"occluders\": " + std::to_string(occluders.size()) + ",\n";
+	json += "  \"buffer\": \"" + std::to_string(OcclusionCuller::WIDTH) + "x" + std::to_string(OcclusionCuller::HEIGHT) + "\",\n";
+	json += "  \"runs\": " + std::to_string(runs) + ",\n";
+	json += "  \"hardware_threads\": " + std::to_string(std::thread::hardware_concurrency()) + ",\n";
+	json += "  \"avx2\": " + std::string(OcclusionCuller::hasSimd() ? "true" : "false") + ",\n";
+	json += "  \"results\": [\n";
+
+	const bool hasAvx2 = OcclusionCuller::hasSimd();
+	char line[512];
+	bool first = true;
+	for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		// The calling thread is one of them
+		std::unique_ptr<JobSystem> jobs;
+		if (threads > 1)
+			jobs.reset(new JobSystem(threads - 1));
+
+		DrawListBuilder builder;
+		RenderQueue queue;
+		queue.setDepthRange(0.1f, 2.0f * halfExtent);
+
+		// Frustum culling only
+		double frustumMs = 1e30;
+		for (int r = 0; r < runs; r++)
+			frustumMs = std::min(frustumMs, timeMs([&] { builder.build(objects, worldMatrices, view, projection, queue, nullptr, jobs.get()); }));
+		size_t frustumVisible = builder.getVisibleCount();
+
+		for (int simd = hasAvx2 ? 1 : 0; simd >= 0; simd--)
+		{
+			fprintf(stderr, "%u threads, %s\n", threads, simd ? "avx2" : "scalar");
+			OcclusionCuller::setSimdEnabled(simd != 0);
+			OcclusionCuller occlusion;
+			builder.setOcclusion(&occlusion);
+
+			double setupMs = 1e30, rasterMs = 1e30, buildMs = 1e30, totalMs = 1e30;
+			for (int r = 0; r < runs; r++)
+			{
+				occlusion.rasterize(occluders, view, projection, jobs.get());
+				double build = timeMs([&] { builder.build(objects, worldMatrices, view, projection, queue, nullptr, jobs.get()); });
+				const OcclusionCuller::Stats& stats = occlusion.getStats();
+				setupMs = std::min(setupMs, stats.setupMs);
+				rasterMs = std::min(rasterMs, stats.rasterMs);
+				buildMs = std::min(buildMs, build);
+				totalMs = std::min(totalMs, stats.setupMs + stats.rasterMs + build);
+			}
+			builder.setOcclusion(nullptr);
+
+			snprintf(line, sizeof(line),
+					 "%s    {\"threads\": %u, \"simd\": \"%s\", \"triangles\": %d, \"setup_ms\": %.3f, \"raster_ms\": %.3f, "
+					 "\"build_ms\": %.3f, \"total_ms\": %.3f, \"frustum_build_ms\": %.3f, \"frustum_visible\": %zu, "
+					 "\"visible\": %zu, \"occluded\": %zu}",
+					 first ? "" : ",\n", threads, simd ? "avx2" : "scalar", occlusion.getStats().triangles, setupMs, rasterMs,
+					 buildMs, totalMs, frustumMs, frustumVisible, builder.getVisibleCount(), builder.getOccludedCount());
+			json += line;
+			first = false;
+		}
+	}
+	json += "\n  ]\n}\n";
+	OcclusionCuller::setSimdEnabled(true);
+
+	if (outFile.empty())
+	{
+		fputs(json.c_str(), stdout);
+	}
+	else
+	{
+		std::ofstream out(outFile);
+		out << json;
+		if (!out)
+		{
+			fprintf(stderr, "cannot write %s\n", outFile.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}
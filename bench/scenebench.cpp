@@ -0,0 +1,205 @@
+//-----------------------------------------------------------------------------
+// scenebench - SceneFile load time by phase, text and binary forms
+//
+// Generates a scene of N instances with random transforms over a few hundred
+// meshes, textures and materials (asset files referenced under several names,
+// to exercise the deduplication), a sun and some point lights following
+// instances.  Saves it in both forms, then loads each for 1, 2, 4... threads
+// up to the maximum (the calling thread plus workers; 1 runs without a job
+// system).  Per load : read (file into memory), parse (statements or
+// records), resolve (names to indices, text only) and total, in ms, the best
+// of the runs.  Results are written as JSON, progress goes to stderr.
+//
+//   scenebench [-n instances] [-t max threads] [-r runs] [-d dir] [-o out.json]
+//   (default: 100000 instances, 64 threads, 5 runs, scene files in .)
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "JobSystem.h"
+#include "SceneFile.h"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const int NUM_MESHES = 256;
+	const int NUM_TEXTURES = 256;
+	const int NUM_MATERIALS = 64;
+	const int NUM_POINT_LIGHTS = 16;
+	const float WORLD_SIZE = 1000.0f;	// instances within +-WORLD_SIZE on x and z
+
+	struct Timing
+	{
+		double readMs, parseMs, resolveMs, totalMs;
+	};
+
+	void generate(size_t count, SceneFile& scene)
+	{
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+		// Every file added twice : the second returns the first's index
+		for (int i = 0; i < NUM_MESHES * 2; i++)
+			scene.addMesh("models/mesh" + std::to_string(i % NUM_MESHES) + ".obj");
+		for (int i = 0; i < NUM_TEXTURES * 2; i++)
+			scene.addTexture("textures/texture" + std::to_string(i % NUM_TEXTURES) + ".png");
+		for (int i = 0; i < NUM_MATERIALS; i++)
+		{
+			SceneFile::Material material = SceneFile::makeMaterial("material" + std::to_string(i));
+			material.ambient = glm::vec3(0.5f + unit(random) * 0.5f);
+			material.shininess = 16.0f + unit(random) * 8.0f;
+			scene.addMaterial(material);
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			SceneFile::Instance instance = SceneFile::makeInstance((int)(random() % NUM_MESHES),
+																   (int)(random() % (NUM_TEXTURES + 1)) - 1,
+																   (int)(random() % NUM_MATERIALS));
+			instance.position = glm::vec3(unit(random) * WORLD_SIZE, unit(random) * 5.0f, unit(random) * WORLD_SIZE);
+			instance.rotation = glm::normalize(glm::quat(unit(random), unit(random), unit(random), unit(random)));
+			instance.scale = glm::vec3(1.0f + unit(random) * 0.5f);
+			if (i % 100 == 0)
+			{
+				instance.spinAxis = glm::vec3(0.0f, 1.0f, 0.0f);
+				instance.spinSpeed = 45.0f;
+			}
+			scene.addInstance(instance);
+		}
+
+		scene.addLight(SceneFile::makeLight(SceneFile::LIGHT_SUN));
+		for (int i = 0; i < NUM_POINT_LIGHTS; i++)
+		{
+			SceneFile::Light light = SceneFile::makeLight(SceneFile::LIGHT_POINT);
+			light.instance = (int)(random() % count);
+			light.position = glm::vec3(0.0f, 1.0f, 0.0f);
+			scene.addLight(light);
+		}
+	}
+
+	Timing timeLoad(const std::string& fileName, JobSystem* jobs, int runs, size_t expected)
+	{
+		Timing best = { 1e30, 1e30, 1e30, 1e30 };
+		for (int r = 0; r < runs; r++)
+		{
+			SceneFile scene;
+			Clock::time_point start = Clock::now();
+			bool loaded = scene.load(fileName, jobs);
+			double totalMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			if (!loaded || scene.getInstances().size() != expected)
+			{
+				fprintf(stderr, "loading %s failed\n", fileName.c_str());
+				exit(1);
+			}
+
+			const SceneFile::Timings& timings = scene.getTimings();
+			best.readMs = std::min(best.readMs, timings.readMs);
+			best.parseMs = std::min(best.parseMs, timings.parseMs);
+			best.resolveMs = std::min(best.resolveMs, timings.resolveMs);
+			best.totalMs = std::min(best.totalMs, totalMs);
+		}
+		return best;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Times both forms for every thread count and writes the JSON report
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	size_t count = 100000;
+	unsigned maxThreads = 64;
+	int runs = 5;
+	std::string directory = ".";
+	std::string outFile;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-n" && i + 1 < argc)
+			count = (size_t)std::max(1L, atol(argv[++i]));
+		else if (arg == "-t" && i + 1 < argc)
+			maxThreads = (unsigned)std::max(1, atoi(argv[++i]));
+		else if (arg == "-r" && i + 1 < argc)
+			runs = std::max(1, atoi(argv[++i]));
+		else if (arg == "-d" && i + 1 < argc)
+			directory = argv[++i];
+		else if (arg == "-o" && i + 1 < argc)
+			outFile = argv[++i];
+		else
+		{
+			fprintf(stderr, "usage: scenebench [-n instances] [-t max threads] [-r runs] [-d dir] [-o out.json]\n");
+			return 1;
+		}
+	}
+
+	fprintf(stderr, "generating %zu instances\n", count);
+	const std::string textFile = (std::filesystem::path(directory) / "scenebench.scene").string();
+	const std::string binaryFile = (std::filesystem::path(directory) / "scenebench.sceneb").string();
+	{
+		SceneFile scene;
+		generate(count, scene);
+		if (!scene.saveText(textFile) || !scene.saveBinary(binaryFile))
+			return 1;
+	}
+
+	std::string json = "{\n";
+	json += "  \"instances\": " + std::to_string(count) + ",\n";
+	json += "  \"text_bytes\": " + std::to_string(std::filesystem::file_size(textFile)) + ",\n";
+	json += "  \"binary_bytes\": " + std::to_string(std::filesystem::file_size(binaryFile)) + ",\n";
+	json += "  \"runs\": " + std::to_string(runs) + ",\n";
+	json += "  \"hardware_threads\": " + std::to_string(std::thread::hardware_concurrency()) + ",\n";
+	json += "  \"results\": [\n";
+
+	char line[512];
+	bool first = true;
+	for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		// The calling thread is one of them
+		std::unique_ptr<JobSystem> jobs;
+		if (threads > 1)
+			jobs.reset(new JobSystem(threads - 1));
+
+		fprintf(stderr, "%u threads\n", threads);
+		for (int binary = 0; binary < 2; binary++)
+		{
+			Timing timing = timeLoad(binary ? binaryFile : textFile, jobs.get(), runs, count);
+			snprintf(line, sizeof(line),
+					 "%s    {\"threads\": %u, \"form\": \"%s\", \"read_ms\": %.3f, \"parse_ms\": %.3f, \"resolve_ms\": %.3f, \"total_ms\": %.3f}",
+					 first ? "" : ",\n", threads, binary ? "binary" : "text", timing.readMs, timing.parseMs, timing.resolveMs, timing.totalMs);
+			json += line;
+			first = false;
+		}
+	}
+	json += "\n  ]\n}\n";
+
+	std::error_code ec;
+	std::filesystem::remove(textFile, ec);
+	std::filesystem::remove(binaryFile, ec);
+
+	if (outFile.empty())
+	{
+		fputs(json.c_str(), stdout);
+	}
+	else
+	{
+		std::ofstream out(outFile);
+		out << json;
+		if (!out)
+		{
+			fprintf(stderr, "cannot write %s\n", outFile.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,291 @@
+//-----------------------------------------------------------------------------
+// streambench - scripted fly-through of a streamed world
+//
+// Flies a fixed path over a world from worldcook at 60 frames per second (a
+// lap around the world, a pass through the middle, then back and forth across
+// a cell border) and runs WorldPartition::update() each frame, on a hidden
+// window with nothing drawn; the loading jobs get the rest of each frame.  The
+// frame time is update() plus glFinish(), so the vertex buffer uploads are in
+// it.  Fails (exit code 1) when a frame takes
+// longer than the hitch threshold or the world's memory goes past the bound.
+// Results are written as JSON, progress goes to stderr.  Run from the build
+// dir, after cook_world.
+//
+//   streambench [-w world] [-r load radius] [-u unload radius] [-j jobs]
+//               [-b upload KB] [-v speed] [-t hitch ms] [-m memory MB] [-o out.json]
+//   (default: worlds/outdoor, radii 96 and 128, 4 jobs, 4096KB per frame,
+//    60 units/s, 16ms, 256MB)
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GLFW/glfw3.h"
+
+#include "JobSystem.h"
+#include "WorldPartition.h"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const float FRAME_STEP = 1.0f / 60.0f;
+	const float CAMERA_HEIGHT = 10.0f;
+	const int BORDER_CROSSINGS = 8;			// back and forth at the end of the path
+
+	struct Options
+	{
+		std::string world;
+		float loadRadius, unloadRadius;
+		int ioBudget;
+		size_t uploadBudget;
+		float speed;
+		double hitchMs;
+		size_t memoryBound;
+		std::string outFile;
+	};
+
+	bool parseOptions(int argc, char** argv, Options& options)
+	{
+		options.world = "worlds/outdoor";
+		options.loadRadius = 96.0f;
+		options.unloadRadius = 128.0f;
+		options.ioBudget = 4;
+		options.uploadBudget = 4096 * 1024;
+		options.speed = 60.0f;
+		options.hitchMs = 16.0;
+		options.memoryBound = 256 * 1024 * 1024;
+
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "-w" && i + 1 < argc)
+				options.world = argv[++i];
+			else if (arg == "-r" && i + 1 < argc)
+				options.loadRadius = (float)atof(argv[++i]);
+			else if (arg == "-u" && i + 1 < argc)
+				options.unloadRadius = (float)atof(argv[++i]);
+			else if (arg == "-j" && i + 1 < argc)
+				options.ioBudget = atoi(argv[++i]);
+			else if (arg == "-b" && i + 1 < argc)
+				options.uploadBudget = (size_t)atol(argv[++i]) * 1024;
+			else if (arg == "-v" && i + 1 < argc)
+				options.speed = (float)atof(argv[++i]);
+			else if (arg == "-t" && i + 1 < argc)
+				options.hitchMs = atof(argv[++i]);
+			else if (arg == "-m" && i + 1 < argc)
+				options.memoryBound = (size_t)atol(argv[++i]) * 1024 * 1024;
+			else if (arg == "-o" && i + 1 < argc)
+				options.outFile = argv[++i];
+			else
+				return false;
+		}
+		return options.speed > 0.0f;
+	}
+
+	// Waypoints on the ground plane, inside a world of the given half size
+	std::vector<glm::vec3> makePath(float halfSize, float cellSize)
+	{
+		float ring = halfSize * 0.6f;
+		std::vector<glm::vec3> path;
+		path.push_back(glm::vec3(-ring, CAMERA_HEIGHT, -ring));
+		path.push_back(glm::vec3( ring, CAMERA_HEIGHT, -ring));
+		path.push_back(glm::vec3( ring, CAMERA_HEIGHT,  ring));
+		path.push_back(glm::vec3(-ring, CAMERA_HEIGHT,  ring));
+		path.push_back(glm::vec3(-ring, CAMERA_HEIGHT, -ring));
+		path.push_back(glm::vec3( ring, CAMERA_HEIGHT,  ring));
+
+		// Half a cell either side of a border : the hysteresis keeps the cells
+		float border = std::floor(ring / cellSize) * cellSize;
+		for (int c = 0; c < BORDER_CROSSINGS; c++)
+			path.push_back(glm::vec3(border + (c % 2 == 0 ? -0.5f : 0.5f) * cellSize, CAMERA_HEIGHT, ring));
+		return path;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Flies the path and writes the JSON report
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		fprintf(stderr, "usage: streambench [-w world] [-r load radius] [-u unload radius] [-j jobs] [-b upload KB]\n"
+						"                   [-v speed] [-t hitch ms] [-m memory MB] [-o out.json]\n");
+		return 1;
+	}
+
+	if (!glfwInit())
+		return 1;
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+	GLFWwindow* window = glfwCreateWindow(64, 64, "streambench", NULL, NULL);
+	if (window == NULL)
+	{
+		fprintf(stderr, "cannot create a GL context\n");
+		glfwTerminate();
+		return 1;
+	}
+	glfwMakeContextCurrent(window);
+
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK)
+	{
+		glfwTerminate();
+		return 1;
+	}
+
+	int frames = 0, hitches = 0, peakCells = 0;
+	double maxMs = 0.0, totalMs = 0.0;
+	size_t peakCpu = 0, peakGpu = 0, peakTotal = 0;
+	std::vector<double> frameMs;
+	int loads = 0, unloads = 0, borderLoads = 0, borderUnloads = 0;
+	float distance = 0.0f;
+	bool crossing = false;
+	{
+		JobSystem jobs;
+		WorldPartition world(jobs);
+		if (!world.open(options.world))
+		{
+			glfwTerminate();
+			return 1;
+		}
+		world.setRadii(options.loadRadius, options.unloadRadius);
+		world.setIoBudget(options.ioBudget);
+		world.setUploadBudget(options.uploadBudget);
+
+		// The OBJ loads log every file
+		std::streambuf* coutBuffer = std::cout.rdbuf(nullptr);
+
+		int minX, minZ, maxX, maxZ;
+		world.getCellRange(minX, minZ, maxX, maxZ);
+		std::vector<glm::vec3> path = makePath(0.5f * std::min(maxX - minX + 1, maxZ - minZ + 1) * world.getCellSize(),
+											   world.getCellSize());
+
+		const size_t borderStart = path.size() - BORDER_CROSSINGS;
+		glm::vec3 position = path[0];
+		Clock::time_point frameStart = Clock::now();
+		for (size_t next = 1; next < path.size(); )
+		{
+			std::this_thread::sleep_until(frameStart);
+			frameStart += std::chrono::microseconds((long long)(FRAME_STEP * 1e6f));
+
+			// Past the first crossing the cells around the border are all loaded
+			if (next == borderStart + 1 && !crossing)
+			{
+				crossing = true;
+				borderLoads = -world.getStats().cellLoads;
+				borderUnloads = -world.getStats().cellUnloads;
+			}
+
+			glm::vec3 toNext = path[next] - position;
+			float step = options.speed * FRAME_STEP;
+			if (glm::length(toNext) <= step)
+			{
+				distance += glm::length(toNext);
+				position = path[next++];
+			}
+			else
+			{
+				distance += step;
+				position += toNext * (step / glm::length(toNext));
+			}
+
+			Clock::time_point start = Clock::now();
+			world.update(position);
+			glFinish();
+			double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+			const WorldPartition::Stats& stats = world.getStats();
+			frames++;
+			frameMs.push_back(ms);
+			totalMs += ms;
+			maxMs = std::max(maxMs, ms);
+			hitches += ms > options.hitchMs ? 1 : 0;
+			peakCpu = std::max(peakCpu, stats.cpuBytes);
+			peakGpu = std::max(peakGpu, stats.gpuBytes);
+			peakTotal = std::max(peakTotal, stats.cpuBytes + stats.gpuBytes);
+			peakCells = std::max(peakCells, stats.loadedCells);
+			if (frames % 600 == 0)
+				fprintf(stderr, "frame %d at %.0f %.0f : %d cells, %d pending, %d jobs, %.1fMB\n", frames, position.x, position.z,
+						stats.loadedCells, stats.pendingCells, stats.jobsInFlight, (stats.cpuBytes + stats.gpuBytes) / (1024.0 * 1024.0));
+		}
+		loads = world.getStats().cellLoads;
+		unloads = world.getStats().cellUnloads;
+		borderLoads += loads;
+		borderUnloads += unloads;
+
+		std::cout.rdbuf(coutBuffer);
+	}
+	glfwDestroyWindow(window);
+	glfwTerminate();
+
+	std::sort(frameMs.begin(), frameMs.end());
+	double p99Ms = frameMs.empty() ? 0.0 : frameMs[std::min(frameMs.size() - 1, frameMs.size() * 99 / 100)];
+	const bool pass = hitches == 0 && peakTotal <= options.memoryBound;
+
+	char buffer[2048];
+	snprintf(buffer, sizeof(buffer),
+			 "{\n"
+			 "  \"world\": \"%s\",\n"
+			 "  \"load_radius\": %.1f,\n"
+			 "  \"unload_radius\": %.1f,\n"
+			 "  \"io_jobs\": %d,\n"
+			 "  \"upload_kb\": %zu,\n"
+			 "  \"speed\": %.1f,\n"
+			 "  \"frames\": %d,\n"
+			 "  \"distance\": %.1f,\n"
+			 "  \"mean_ms\": %.3f,\n"
+			 "  \"p99_ms\": %.3f,\n"
+			 "  \"max_ms\": %.3f,\n"
+			 "  \"hitch_ms\": %.1f,\n"
+			 "  \"hitches\": %d,\n"
+			 "  \"peak_cpu_mb\": %.2f,\n"
+			 "  \"peak_gpu_mb\": %.2f,\n"
+			 "  \"peak_mb\": %.2f,\n"
+			 "  \"memory_bound_mb\": %zu,\n"
+			 "  \"peak_loaded_cells\": %d,\n"
+			 "  \"cell_loads\": %d,\n"
+			 "  \"cell_unloads\": %d,\n"
+			 "  \"border_loads\": %d,\n"
+			 "  \"border_unloads\": %d,\n"
+			 "  \"pass\": %s\n"
+			 "}\n",
+			 options.world.c_str(), options.loadRadius, options.unloadRadius, options.ioBudget, options.uploadBudget / 1024,
+			 options.speed, frames, distance, frames > 0 ? totalMs / frames : 0.0, p99Ms, maxMs, options.hitchMs, hitches,
+			 peakCpu / (1024.0 * 1024.0), peakGpu / (1024.0 * 1024.0), peakTotal / (1024.0 * 1024.0),
+			 options.memoryBound / (1024 * 1024), peakCells, loads, unloads, borderLoads, borderUnloads, pass ? "true" : "false");
+
+	if (options.outFile.empty())
+	{
+		fputs(buffer, stdout);
+	}
+	else
+	{
+		std::ofstream out(options.outFile);
+		out << buffer;
+		if (!out)
+		{
+			fprintf(stderr, "cannot write %s\n", options.outFile.c_str());
+			return 1;
+		}
+	}
+	if (!pass)
+		fprintf(stderr, "FAILED : %d frames over %.1fms, peak %.1fMB for a bound of %zuMB\n", hitches, options.hitchMs,
+				peakTotal / (1024.0 * 1024.0), options.memoryBound / (1024 * 1024));
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+//-----------------------------------------------------------------------------
+// transformbench - SceneTransforms update throughput
+//
+// N objects with random positions, rotations and scales:
+//  - glm_rebuild : what the render loop used to do, every world matrix built
+//                  with glm::translate * mat4_cast * glm::scale and every
+//                  normal matrix with transpose(inverse()), changed or not
+//  - scalar      : SceneTransforms::update() without SSE2, after changing a
+//                  fraction of the objects (spread at random)
+//  - simd        : the same with SSE2, four objects per register
+// for 100%, 10%, 1% and 0% of the objects changed per frame.  Times are the
+// best of the runs, in objects updated per second; the error is the largest
+// difference to the glm matrices.  Results are written as JSON, progress goes
+// to stderr.
+//
+//   transformbench [-n objects] [-r runs] [-o out.json]
+//   (default: 1000000 objects, 5 runs)
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/quaternion.hpp"
+#include "SceneTransforms.h"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const double DIRTY_FRACTIONS[] = { 1.0, 0.1, 0.01, 0.0 };
+
+	struct Transform
+	{
+		glm::vec3 position;
+		glm::quat rotation;
+		glm::vec3 scale;
+	};
+
+	double bestOf(int runs, const std::function<void()>& prepare, const std::function<void()>& work)
+	{
+		double best = 1e30;
+		for (int i = 0; i < runs; i++)
+		{
+			prepare();
+			Clock::time_point start = Clock::now();
+			work();
+			best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+		}
+		return best;
+	}
+
+	// The per frame loop of main.cpp before SceneTransforms
+	void glmRebuild(const std::vector<Transform>& transforms, std::vector<glm::mat4>& world, std::vector<glm::mat3>& normal)
+	{
+		for (size_t i = 0; i < transforms.size(); i++)
+		{
+			glm::mat4 model = glm::translate(glm::mat4(1.0f), transforms[i].position);
+			model = model * glm::mat4_cast(transforms[i].rotation);
+			model = glm::scale(model, transforms[i].scale);
+			world[i] = model;
+			normal[i] = glm::transpose(glm::inverse(glm::mat3(model)));
+		}
+	}
+
+	float maxError(const SceneTransforms& scene, const std::vector<glm::mat4>& world, const std::vector<glm::mat3>& normal)
+	{
+		float error = 0.0f;
+		for (size_t i = 0; i < world.size(); i++)
+		{
+			const glm::mat4& a = scene.getWorldMatrix((SceneTransforms::Entity)i);
+			const glm::mat3& b = scene.getNormalMatrix((SceneTransforms::Entity)i);
+			for (int c = 0; c < 4; c++)
+			{
+				for (int r = 0; r < 4; r++)
+				{
+					error = std::max(error, fabsf(a[c][r] - world[i][c][r]));
+					if (c < 3 && r < 3)
+						error = std::max(error, fabsf(b[c][r] - normal[i][c][r]));
+				}
+			}
+		}
+		return error;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Times every method and writes the JSON report
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	size_t count = 1000000;
+	int runs = 5;
+	std::string outFile;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-n" && i + 1 < argc)
+			count = (size_t)std::max(1L, atol(argv[++i]));
+		else if (arg == "-r" && i + 1 < argc)
+			runs = std::max(1, atoi(argv[++i]));
+		else if (arg == "-o" && i + 1 < argc)
+			outFile = argv[++i];
+		else
+		{
+			fprintf(stderr, "usage: transformbench [-n objects] [-r runs] [-o out.json]\n");
+			return 1;
+		}
+	}
+
+	// Scales between 0.1 and 10, away from zero like real objects
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::vector<Transform> transforms(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		transforms[i].position = glm::vec3(unit(random), unit(random), unit(random)) * 1000.0f;
+		transforms[i].rotation = glm::normalize(glm::quat(unit(random), unit(random), unit(random), unit(random)));
+		transforms[i].scale = glm::vec3(powf(10.0f, unit(random)), powf(10.0f, unit(random)), powf(10.0f, unit(random)));
+	}
+
+	fprintf(stderr, "building %zu objects\n", count);
+	SceneTransforms scene;
+	scene.reserve(count);
+	for (size_t i = 0; i < count; i++)
+		scene.add(transforms[i].position, transforms[i].scale, transforms[i].rotation);
+
+	std::vector<glm::mat4> world(count);
+	std::vector<glm::mat3> normal(count);
+	fprintf(stderr, "glm rebuild\n");
+	double glmMs = bestOf(runs, [] {}, [&] { glmRebuild(transforms, world, normal); });
+
+	std::string json = "{\n";
+	json += "  \"objects\": " + std::to_string(count) + ",\n";
+	json += "  \"runs\": " + std::to_string(runs) + ",\n";
+	json += "  \"simd_available\": " + std::string(SceneTransforms::hasSimd() ? "true" : "false") + ",\n";
+	json += "  \"results\": [\n";
+
+	char line[512];
+	snprintf(line, sizeof(line),
+			 "    {\"method\": \"glm_rebuild\", \"dirty_fraction\": 1.0, \"updated\": %zu, \"ms\": %.3f, \"objects_per_s\": %.0f, \"max_error\": 0.0}",
+			 count, glmMs, count * 1000.0 / glmMs);
+	json += line;
+
+	const char* METHODS[] = { "scalar", "simd" };
+	bool simd = SceneTransforms::hasSimd();
+	for (int m = 0; m < (simd ? 2 : 1); m++)
+	{
+		SceneTransforms::setSimdEnabled(m == 1);
+		for (size_t f = 0; f < sizeof(DIRTY_FRACTIONS) / sizeof(DIRTY_FRACTIONS[0]); f++)
+		{
+			// The same random objects change in every run
+			size_t numDirty = (size_t)(count * DIRTY_FRACTIONS[f]);
+			std::vector<int> dirty;
+			if (numDirty == count)
+			{
+				for (size_t i = 0; i < count; i++)
+					dirty.push_back((int)i);
+			}
+			else
+			{
+				std::uniform_int_distribution<int> pick(0, (int)count - 1);
+				for (size_t i = 0; i < numDirty; i++)
+					dirty.push_back(pick(random));
+			}
+
+			fprintf(stderr, "%s, %.0f%% changed\n", METHODS[m], DIRTY_FRACTIONS[f] * 100.0);
+			size_t updated = 0;
+			double ms = bestOf(runs,
+				[&] {
+					for (size_t i = 0; i < dirty.size(); i++)
+						scene.setRotation(dirty[i], transforms[dirty[i]].rotation);
+				},
+				[&] { updated = scene.update(); });
+
+			snprintf(line, sizeof(line),
+					 ",\n    {\"method\": \"%s\", \"dirty_fraction\": %.2f, \"updated\": %zu, \"ms\": %.3f, \"objects_per_s\": %.0f, \"max_error\": %g}",
+					 METHODS[m], DIRTY_FRACTIONS[f], updated, ms, ms > 0.0 ? updated * 1000.0 / ms : 0.0,
+					 maxError(scene, world, normal));
+			json += line;
+		}
+	}
+	SceneTransforms::setSimdEnabled(true);
+	json += "\n  ]\n}\n";
+
+	if (outFile.empty())
+	{
+		fputs(json.c_str(), stdout);
+	}
+	else
+	{
+		std::ofstream out(outFile);
+		out << json;
+		if (!out)
+		{
+			fprintf(stderr, "cannot write %s\n", outFile.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}
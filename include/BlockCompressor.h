@@ -0,0 +1,40 @@
+//-----------------------------------------------------------------------------
+// CPU block compressor for BC1, BC3, BC5 and BC7 (mode 6)
+//
+// Endpoints come from the principal axis of the block colors, then one
+// least squares refit.  The nearest palette entry search is vectorized with
+// SSE2 when available (scalar fallback otherwise) and images are split into
+// rows of blocks compressed in parallel on a thread pool.
+// Used by the offline texture cooker, not at runtime.
+//-----------------------------------------------------------------------------
+#ifndef BLOCK_COMPRESSOR_H
+#define BLOCK_COMPRESSOR_H
+
+#include "CompressedImage.h"
+#include "ThreadPool.h"
+
+class BlockCompressor
+{
+public:
+	explicit BlockCompressor(unsigned numThreads = 0);	// 0 = one per hardware thread
+
+	// Compresses tightly packed RGBA pixels into getLevelSize(format, width, height) bytes.
+	// BC5 stores the red and green channels.
+	void compress(const unsigned char* rgbaData, int width, int height, CompressedImage::Format format, unsigned char* output);
+
+	// Single 4x4 blocks, 16 RGBA pixels in row order
+	static void compressBlockBC1(const unsigned char* block, unsigned char* output);
+	static void compressBlockBC3(const unsigned char* block, unsigned char* output);
+	static void compressBlockBC5(const unsigned char* block, unsigned char* output);
+	static void compressBlockBC7(const unsigned char* block, unsigned char* output);
+
+	static bool hasSimd();
+	unsigned getNumThreads() const		{ return mPool.getNumThreads(); }
+
+private:
+	BlockCompressor(const BlockCompressor& rhs);
+	BlockCompressor& operator = (const BlockCompressor& rhs);
+
+	ThreadPool mPool;
+};
+#endif //BLOCK_COMPRESSOR_H
@@ -90,4 +90,17 @@ private:
 	// Camera parameters
 	float mRadius;
 };
+
+//--------------------------------------------------------------
+// Fixed Camera Class : set as a whole from another camera's
+// vectors (e.g. the camera of a frame snapshot)
+//--------------------------------------------------------------
+class FixedCamera : public Camera
+{
+public:
+
+	FixedCamera();
+
+	void set(const glm::vec3& position, const glm::vec3& look, const glm::vec3& right, const glm::vec3& up, float fov);
+};
 #endif //CAMERA_H
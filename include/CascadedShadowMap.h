@@ -0,0 +1,99 @@
+//-----------------------------------------------------------------------------
+// Cascaded shadow maps for a directional light
+//
+// Cascades are bounding spheres of camera frustum slices, snapped to a grid
+// in light space so they do not shimmer and only move in coarse steps.
+// Static casters are rendered into a cached depth array that is reused until
+// the light, a static caster or the cascade placement changes.  Dynamic
+// casters are drawn every frame on top of a copy of that cache.
+//-----------------------------------------------------------------------------
+#ifndef CASCADED_SHADOW_MAP_H
+#define CASCADED_SHADOW_MAP_H
+
+#include <vector>
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "glm/glm.hpp"
+
+#include "Camera.h"
+#include "ShadowCaster.h"
+#include "ShaderProgram.h"
+
+class CascadedShadowMap
+{
+public:
+	static const int MAX_CASCADES = 4;
+
+	 CascadedShadowMap();
+	~CascadedShadowMap();
+
+	bool init(int resolution = 2048, int numCascades = MAX_CASCADES);
+
+	void setLightDirection(const glm::vec3& direction);
+	void setShadowDistance(float distance)	{ mShadowDistance = distance; }
+	void setCasterDistance(float distance)	{ mCasterDistance = distance; }
+	void invalidateStatic()					{ mStaticDirty = true; }
+
+	// Fit the cascades to the camera frustum (call once per frame before render)
+	void update(const Camera& camera, float aspect, float nearPlane, float farPlane);
+
+	// Refresh the cached static layers if needed and draw the dynamic casters on top.
+	// The bound framebuffer and the viewport are left as they were.
+	void render(const std::vector<ShadowCaster>& casters);
+
+	// Binds the shadow map array and sets the cascade uniforms on the active shader
+	void bind(ShaderProgram& shader, GLuint texUnit);
+	void unbind(GLuint texUnit);
+
+	// Indices of the casters the last render() drew, including those skipped
+	// because their mesh was evicted: the caller keeps them resident
+	const std::vector<int>& getDrawnCasters() const	{ return mDrawnCasters; }
+
+	int getNumCascades() const				{ return mNumCascades; }
+	int getStaticDrawCount(int cascade) const	{ return mStaticDraws[cascade]; }
+	int getDynamicDrawCount(int cascade) const	{ return mDynamicDraws[cascade]; }
+	double getGpuTimeMs(int cascade) const	{ return mGpuTimeMs[cascade]; }
+
+private:
+	CascadedShadowMap(const CascadedShadowMap& rhs);
+	CascadedShadowMap& operator = (const CascadedShadowMap& rhs);
+
+	struct Cascade
+	{
+		glm::mat4 viewProj;
+		glm::vec3 snappedCenter;	// light space
+		float radius;
+		float splitFar;				// view space distance
+		bool staticValid;
+	};
+
+	void drawCasters(const std::vector<ShadowCaster>& casters, const glm::mat4& viewProj, bool staticPass, int& drawCount);
+	void collectQueries();
+
+	int mResolution;
+	int mNumCascades;
+	float mShadowDistance;
+	float mCasterDistance;
+	float mSplitLambda;
+	int mCacheSnapTexels;
+	bool mStaticDirty;
+
+	glm::vec3 mLightDir;
+	glm::mat4 mLightView;
+	Cascade mCascades[MAX_CASCADES];
+
+	GLuint mStaticDepth, mDepth;
+	GLuint mStaticFBO, mFBO;
+	ShaderProgram mDepthShader;
+
+	// Timer queries are double buffered so reading results never stalls
+	GLuint mQueries[2][MAX_CASCADES];
+	bool mQueryPending[2];
+	int mQueryFrame;
+
+	std::vector<int> mDrawnCasters;
+	int mStaticDraws[MAX_CASCADES];
+	int mDynamicDraws[MAX_CASCADES];
+	double mGpuTimeMs[MAX_CASCADES];
+};
+#endif //CASCADED_SHADOW_MAP_H
@@ -0,0 +1,72 @@
+//-----------------------------------------------------------------------------
+// Cooked image with its mip chain: block compressed (BC1, BC3, BC5, BC7) or
+// plain RGBA8 for textures that must not lose quality.
+//
+// Reads DDS (legacy FourCC and DX10 headers) and uncompressed-supercompression
+// KTX2 containers, and writes DDS.  Has no GL dependency so the offline tools
+// can use it; Texture2D maps the formats to GL internal formats.
+// Rows are expected bottom row first, like the uncompressed upload path, which
+// is how texcook stores them.
+//-----------------------------------------------------------------------------
+#ifndef COMPRESSED_IMAGE_H
+#define COMPRESSED_IMAGE_H
+
+#include <string>
+#include <vector>
+
+class CompressedImage
+{
+public:
+	enum Format
+	{
+		FORMAT_UNKNOWN,
+		FORMAT_BC1,		// RGB (1 bit alpha), 8 bytes per block
+		FORMAT_BC3,		// RGBA, 16 bytes per block
+		FORMAT_BC5,		// two channels (normal maps), 16 bytes per block
+		FORMAT_BC7,		// RGBA high quality, 16 bytes per block
+		FORMAT_RGBA8	// uncompressed, 4 bytes per pixel
+	};
+
+	struct Level
+	{
+		int width, height;
+		size_t offset, size;	// into getData()
+	};
+
+	CompressedImage();
+
+	bool loadFromFile(const std::string& fileName);
+	bool loadFromMemory(const unsigned char* bytes, size_t size, const std::string& name = "");
+	bool saveDDS(const std::string& fileName) const;
+
+	// Starts an empty image, levels are then appended largest first.
+	// The returned block storage stays valid until the next addLevel().
+	void create(Format format, bool srgb, int width, int height);
+	unsigned char* addLevel();
+
+	// True for the file extensions handled by loadFromFile (.dds, .ktx2)
+	static bool isContainerFile(const std::string& fileName);
+	static int getBlockBytes(Format format);	// 0 for uncompressed formats
+	static size_t getLevelSize(Format format, int width, int height);
+	static const char* getFormatName(Format format);
+
+	Format getFormat() const					{ return mFormat; }
+	bool isSRGB() const							{ return mSRGB; }
+	int getWidth() const						{ return mWidth; }
+	int getHeight() const						{ return mHeight; }
+	int getNumLevels() const					{ return (int)mLevels.size(); }
+	const Level& getLevel(int level) const		{ return mLevels[level]; }
+	const unsigned char* getData() const		{ return mData.empty() ? NULL : &mData[0]; }
+	size_t getDataSize() const					{ return mData.size(); }
+
+private:
+	bool parseDDS(const unsigned char* bytes, size_t size, const std::string& name);
+	bool parseKTX2(const unsigned char* bytes, size_t size, const std::string& name);
+
+	Format mFormat;
+	bool mSRGB;
+	int mWidth, mHeight;
+	std::vector<Level> mLevels;
+	std::vector<unsigned char> mData;
+};
+#endif //COMPRESSED_IMAGE_H
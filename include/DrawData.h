@@ -0,0 +1,27 @@
+//-----------------------------------------------------------------------------
+// Per-draw data of the lit pass, one entry of the std140 DrawBlock uniform
+// block of lighting_dir.frag.  drawblockcheck compares the offsets the driver
+// reports for the block with this layout.
+//-----------------------------------------------------------------------------
+#ifndef DRAW_DATA_H
+#define DRAW_DATA_H
+
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "glm/glm.hpp"
+
+// Where the diffuse map of a draw comes from
+enum TextureSource { TEXTURE_BOUND, TEXTURE_ARRAY, TEXTURE_BINDLESS };
+
+struct DrawData
+{
+	GLuint64 diffuseHandle;	// TEXTURE_BINDLESS
+	GLint textureSource;
+	GLfloat layer;			// TEXTURE_ARRAY : layer and rectangle of the array
+	glm::vec4 rect;
+};
+
+const int MAX_DRAWS = 64;	// per uniform buffer range (2KB, a multiple of any offset alignment), more in batches
+static_assert(sizeof(DrawData) == 32, "DrawData must match DrawBlock");
+
+#endif // DRAW_DATA_H
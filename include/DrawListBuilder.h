@@ -0,0 +1,89 @@
+//-----------------------------------------------------------------------------
+// Builds the draw lists of a frame on the job system
+//
+// Everything a frame needs before its GL calls is plain CPU work on data the
+// GL thread does not touch meanwhile: frustum culling of the objects' bounding
+// spheres, their size on screen (which picks texture mip levels), the
+// occlusion tests of an OcclusionCuller if one is set, the sort keys of the
+// visible objects, and after sorting, the per-draw data the shaders read.
+// build() splits the objects into chunks; each chunk writes the packets
+// of its visible objects into its own preallocated slice, so the threads never
+// share a list.  The slices are then copied together into the queues and
+// sorted.  pack() hands the sorted draws out again, in parallel, to fill the
+// per-draw buffers.  Only the submission is left to the GL thread.
+//-----------------------------------------------------------------------------
+#ifndef DRAW_LIST_BUILDER_H
+#define DRAW_LIST_BUILDER_H
+
+#include <functional>
+#include <vector>
+#include "glm/glm.hpp"
+#include "JobSystem.h"
+#include "OcclusionCuller.h"
+#include "RenderQueue.h"
+
+class DrawListBuilder
+{
+public:
+	// What to draw for an object, at the world matrix of the same index
+	struct Object
+	{
+		glm::vec3 center;		// object space bounding sphere
+		float radius;			// 0 : nothing to draw
+		RenderQueue::Pass pass;
+		int program, texture, material, mesh;
+	};
+
+	// Fills the per-draw data of draw drawIndex of the sorted queue, called
+	// from several threads at once
+	typedef std::function<void(size_t drawIndex, const RenderQueue::Packet& packet)> PackFunction;
+
+	 DrawListBuilder();
+	~DrawListBuilder();
+
+	// Clears and fills the queue with the visible objects, sorted.  The depth
+	// queue, if any, gets them too, keyed by depth only (a depth pre-pass).
+	// Runs on the calling thread alone without jobs.
+	void build(const std::vector<Object>& objects, const std::vector<glm::mat4>& worldMatrices,
+			   const glm::mat4& view, const glm::mat4& projection,
+			   RenderQueue& queue, RenderQueue* depthQueue, JobSystem* jobs);
+	void pack(const RenderQueue& queue, const PackFunction& pack, JobSystem* jobs);
+
+	// Tests the objects in the frustum against the occluders it last
+	// rasterized, from the same camera; null : no occlusion culling
+	void setOcclusion(const OcclusionCuller* occlusion)		{ mOcclusion = occlusion; }
+
+	// Of the last build() : projected diameter over the viewport height, 0 if
+	// culled, huge when the camera is inside the sphere
+	float getScreenSize(int object) const		{ return mScreenSize[object]; }
+	size_t getVisibleCount() const				{ return mVisibleCount; }
+	size_t getOccludedCount() const				{ return mOccludedCount; }		// in the frustum but hidden
+	double getBuildMs() const					{ return mBuildMs; }
+
+private:
+	DrawListBuilder(const DrawListBuilder& rhs);
+	DrawListBuilder& operator = (const DrawListBuilder& rhs);
+
+	void cullChunk(size_t first, size_t last);
+
+	// Inputs of the build in progress
+	const std::vector<Object>* mObjects;
+	const std::vector<glm::mat4>* mWorldMatrices;
+	const RenderQueue* mQueue;
+	const RenderQueue* mDepthQueue;
+	glm::mat4 mView;
+	glm::vec4 mPlanes[6];			// world space, normalized
+	float mProjectionScale;			// projection[1][1]
+	const OcclusionCuller* mOcclusion;
+
+	// A slice per chunk, sized for every object of the chunk
+	std::vector<RenderQueue::Packet> mSlices;
+	std::vector<RenderQueue::Packet> mDepthSlices;
+	std::vector<size_t> mSliceCounts;
+	std::vector<size_t> mOccludedCounts;
+	std::vector<float> mScreenSize;
+	size_t mVisibleCount;
+	size_t mOccludedCount;
+	double mBuildMs;
+};
+#endif //DRAW_LIST_BUILDER_H
@@ -0,0 +1,78 @@
+//-----------------------------------------------------------------------------
+// Dynamic resolution scaling
+//
+// The scene is rendered into an offscreen target whose used area is scaled
+// every frame so that the GPU frame time (measured with timer queries) stays
+// under a budget.  The result is upscaled to the backbuffer.
+//-----------------------------------------------------------------------------
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#define GLEW_STATIC
+#include "GL/glew.h"
+
+#include "GpuQuery.h"
+#include "ShaderProgram.h"
+
+class DynamicResolution
+{
+public:
+	enum UpscaleFilter
+	{
+		BILINEAR,
+		EDGE_AWARE		// bilinear + contrast adaptive sharpening
+	};
+
+	 DynamicResolution();
+	~DynamicResolution();
+
+	bool init(int outputWidth, int outputHeight);
+
+	// Configuration
+	void setScaleRange(float minScale, float maxScale);
+	void setTargetFrameTime(float milliseconds)	{ mTargetMs = milliseconds; }
+	void setFilter(UpscaleFilter filter)		{ mFilter = filter; }
+	void setEnabled(bool enabled)				{ mEnabled = enabled; }
+
+	// Binds the offscreen target at the current scale and starts the GPU timer.
+	// An empty output (a minimized window) keeps the targets of the last size;
+	// false when there are none yet, the frame must be skipped, endFrame() too.
+	bool beginFrame(int outputWidth, int outputHeight);
+
+	// Upscales to the backbuffer, stops the timer and updates the scale
+	void endFrame();
+
+	float getScale() const				{ return mScale; }
+	int getRenderWidth() const			{ return mRenderWidth; }
+	int getRenderHeight() const			{ return mRenderHeight; }
+	GLuint getDepthTexture() const		{ return mDepth; }		// of the rendered area, lower left
+	double getGpuTimeMs() const			{ return mGpuTimeMs; }
+	UpscaleFilter getFilter() const		{ return mFilter; }
+	bool isEnabled() const				{ return mEnabled; }
+
+private:
+	DynamicResolution(const DynamicResolution& rhs);
+	DynamicResolution& operator = (const DynamicResolution& rhs);
+
+	bool createTargets(int width, int height);
+	void destroyTargets();
+	void updateScale();
+
+	bool mEnabled;
+	UpscaleFilter mFilter;
+	float mMinScale, mMaxScale;
+	float mTargetMs;
+	float mScale;
+
+	int mOutputWidth, mOutputHeight;	// backbuffer (and offscreen allocation) size
+	int mRenderWidth, mRenderHeight;	// area actually rendered this frame
+
+	GLuint mFBO, mColor, mDepth;
+	GLuint mQuadVAO;
+	ShaderProgram mUpscaleShader;
+
+	GpuQuery mFrameTimer;
+	GLuint64 mLastResult;
+	double mGpuTimeMs;
+};
+#endif //DYNAMIC_RESOLUTION_H
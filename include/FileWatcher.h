@@ -0,0 +1,37 @@
+//-----------------------------------------------------------------------------
+// Directory change notifications
+//
+// Watches directories (not their subdirectories) for files that were written
+// or moved in, with inotify on Linux.  poll() never blocks: the render loop
+// calls it once per frame and reloads what changed.  Elsewhere watch() fails
+// and poll() reports nothing.
+//-----------------------------------------------------------------------------
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+class FileWatcher
+{
+public:
+	 FileWatcher();
+	~FileWatcher();
+
+	bool watch(const std::string& directory);
+
+	// Files changed since the last call, as <directory>/<name> with the
+	// directory as given to watch(), each once
+	std::vector<std::string> poll();
+
+	static bool isSupported();
+
+private:
+	FileWatcher(const FileWatcher& rhs);
+	FileWatcher& operator = (const FileWatcher& rhs);
+
+	int mFd;
+	std::map<int, std::string> mDirectories;	// watch descriptor -> directory
+};
+#endif //FILE_WATCHER_H
@@ -0,0 +1,88 @@
+//-----------------------------------------------------------------------------
+// Frame snapshots from the simulation thread to the render thread
+//
+// Each simulation step fills a FrameSnapshot - camera, object matrices,
+// lights - and publishes it; the render thread takes the newest one at the
+// start of a frame and only reads it.  They go through a triple buffer, so
+// the two threads run at their own rates without ever waiting for each other:
+// after a slow step the renderer draws the previous state again, during a
+// slow frame the steps it has no time for are dropped.
+//
+// Pipelining delays what is drawn.  Every snapshot carries the time its input
+// was sampled; the render thread measures how long the step took, how long
+// the snapshot waited to be picked up (the latency the pipeline adds), and
+// the total from input to present.
+//-----------------------------------------------------------------------------
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <vector>
+#include "glm/glm.hpp"
+#include "TripleBuffer.h"
+
+struct FrameSnapshot
+{
+	unsigned long long step;		// set by publish(), counts from 1
+	double time;					// simulation clock, seconds
+	double inputTime;				// FramePipeline::now() when the input of the step was sampled
+	double publishTime;				// set by publish()
+
+	// Camera
+	glm::vec3 cameraPosition;
+	glm::vec3 cameraLook;
+	glm::vec3 cameraRight;
+	glm::vec3 cameraUp;
+	float cameraFOV;				// degrees
+
+	// Transforms, by entity
+	std::vector<glm::mat4> worldMatrices;
+	std::vector<glm::mat3> normalMatrices;
+
+	// Lights
+	glm::vec3 sunDirection;
+	std::vector<glm::vec3> pointLights;		// positions, by light id
+};
+
+class FramePipeline
+{
+public:
+	// Render thread averages, in ms, and counts
+	struct Stats
+	{
+		double stepMs;			// input sampled -> snapshot published
+		double waitMs;			// published -> taken by the render thread
+		double latencyMs;		// input sampled -> frame presented
+		unsigned long long dropped;		// snapshots never drawn
+		unsigned long long repeated;	// frames drawing the previous snapshot again
+	};
+
+	 FramePipeline();
+	~FramePipeline();
+
+	// Seconds on a steady clock, for FrameSnapshot::inputTime
+	static double now();
+
+	// Simulation thread.  The snapshot is an older one, fill all of it.
+	FrameSnapshot& beginSnapshot()		{ return mSnapshots.getWriteSlot(); }
+	void publish();
+
+	// Render thread.  The newest snapshot, valid until the next acquire();
+	// one must have been published.  presented() once the frame drawing it
+	// has been swapped.
+	const FrameSnapshot& acquire();
+	void presented();
+	const Stats& getStats() const		{ return mStats; }
+
+private:
+	FramePipeline(const FramePipeline& rhs);
+	FramePipeline& operator = (const FramePipeline& rhs);
+
+	TripleBuffer<FrameSnapshot> mSnapshots;
+	unsigned long long mPublished;		// simulation thread
+
+	// Render thread
+	unsigned long long mLastStep;
+	Stats mStats;
+	bool mHasStats;
+};
+#endif //FRAME_PIPELINE_H
@@ -0,0 +1,191 @@
+//-----------------------------------------------------------------------------
+// GPU driven culling of instances against a hierarchical depth pyramid
+//
+// The instances are grouped into batches, one per mesh and state (texture,
+// material) set by the caller, and every batch is drawn with one indirect
+// draw per phase whatever its number of instances.  Bounds, batches and world
+// matrices live in shader storage buffers; a compute pass tests every
+// instance and appends the transforms of the visible ones to its batch's
+// range of an instance buffer (see InstanceTransform in Mesh.h) while
+// counting them in the batch's indirect command.  The CPU never sees which
+// instances are visible: per frame it uploads the matrices and resets one
+// command per batch and phase.
+//
+// Occlusion is tested against a pyramid of the farthest depth of the
+// previous frame, in two phases:
+//  - PHASE_PREVIOUS : the frustum, then the pyramid of the last frame seen
+//    with the last frame's camera.  What passes is drawn, what fails the
+//    pyramid alone is kept for the next phase.
+//  - PHASE_FIXUP : after buildPyramid() from the depth of the first phase,
+//    the instances kept are tested again with the current camera.  Those
+//    visible now (disoccluded since the last frame) are drawn too.
+// The pyramid of the first phase then serves the next frame.  Boxes crossing
+// the near plane or off the pyramid are visible.  This is METHOD_COMPUTE,
+// which needs OpenGL 4.3 (compute shaders, shader storage, indirect draws).
+//
+// METHOD_TRANSFORM_FEEDBACK tests the frustum alone on a 3.3 core context.
+// The instances go through a vertex shader as points with rasterization
+// discarded, and a geometry shader streams the transforms of the visible ones
+// into the batch's range by transform feedback, counted by a query per batch.
+// With query buffer objects and base instances the count is written into the
+// batch's indirect command on the GPU; otherwise drawBatch() waits for the
+// batch's count and draws that many instances from the batch's range.  Only
+// PHASE_PREVIOUS draws anything, buildPyramid() does nothing, and the world
+// matrices are read through a buffer texture, at most
+// GL_MAX_TEXTURE_BUFFER_SIZE / 4 of them.
+//-----------------------------------------------------------------------------
+#ifndef GPU_CULLER_H
+#define GPU_CULLER_H
+
+#include <vector>
+
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "glm/glm.hpp"
+#include "GpuQuery.h"
+#include "Mesh.h"
+#include "ShaderProgram.h"
+
+class GpuCuller
+{
+public:
+	enum Phase
+	{
+		PHASE_PREVIOUS,		// against the previous frame's pyramid
+		PHASE_FIXUP,		// what the first phase hid, against this frame's
+		NUM_PHASES
+	};
+
+	enum Method
+	{
+		METHOD_COMPUTE,				// frustum and depth pyramid, OpenGL 4.3
+		METHOD_TRANSFORM_FEEDBACK	// frustum only, OpenGL 3.3
+	};
+
+	struct Instance
+	{
+		int batch;
+		int matrix;					// index of setMatrices()
+		glm::vec3 boundsMin;		// object space
+		glm::vec3 boundsMax;
+	};
+
+	struct Stats
+	{
+		int batches;
+		int instances;
+		int visible[NUM_PHASES];	// read back a few frames late, or as drawn without query buffers
+		int drawCalls;				// of the frame so far
+		double gpuMs;				// culling and pyramid passes
+		double cpuMs;				// of the frame so far, draws excluded
+	};
+
+	 GpuCuller();
+	~GpuCuller();
+
+	static bool isSupported(Method method);
+	bool init(Method method);
+	Method getMethod() const			{ return mMethod; }
+
+	// The batches' meshes (they get the instance buffer) and every instance,
+	// in any order.  Call again whenever they change.
+	void setInstances(const std::vector<Mesh*>& batchMeshes, const std::vector<Instance>& instances);
+
+	// World matrices of the frame, starts a new frame
+	void setMatrices(const std::vector<glm::mat4>& worldMatrices);
+
+	// Culls a phase.  The indirect draws of the phase are ready after it.
+	// Leaves no program in use.
+	void cull(Phase phase, const glm::mat4& view, const glm::mat4& projection);
+
+	// From the depth rendered by the first phase, the lower left area of
+	// width x height texels of the depth texture.  Leaves no program in use.
+	void buildPyramid(GLuint depthTexture, int width, int height);
+	void invalidatePyramid()			{ mPyramidValid = false; }		// the next frame tests the frustum only
+
+	// Draws a batch's visible instances of a phase with its mesh's vertex
+	// array (positions only for depth passes), the program already in use
+	void drawBatch(Phase phase, int batch, bool positionsOnly);
+
+	int getNumBatches() const			{ return (int)mBatchMeshes.size(); }
+	const Stats& getStats() const		{ return mStats; }
+
+private:
+	GpuCuller(const GpuCuller& rhs);
+	GpuCuller& operator = (const GpuCuller& rhs);
+
+	// Level 0 of the pyramid, whatever the size of the depth (each texel
+	// keeps the farthest of the depth texels it covers)
+	static const int PYRAMID_WIDTH = 512;
+	static const int PYRAMID_HEIGHT = 256;
+	static const int READBACK_LATENCY = 3;
+
+	// std430 layouts of gpu_cull.comp, the instances the vertex attributes of
+	// instance_cull.vert
+	struct GpuInstance
+	{
+		glm::vec3 boundsMin;
+		GLuint matrix;
+		glm::vec3 boundsMax;
+		GLuint batch;
+	};
+	struct DrawCommand			// DrawArraysIndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint first;
+		GLuint baseInstance;
+	};
+
+	bool usesCommands() const			{ return mMethod == METHOD_COMPUTE || mQueryCounts; }
+	void resetCommands();
+	void createPyramid();
+	void readVisibleCounts();
+	void cullCompute(Phase phase);
+	void cullFeedback();
+
+	bool mInitialized;
+	Method mMethod;
+	ShaderProgram mCullShader;
+	ShaderProgram mPyramidShader;
+	ShaderProgram mFeedbackShader;
+
+	std::vector<Mesh*> mBatchMeshes;
+	std::vector<GLuint> mBatchFirst;		// of the batch's instances, sorted by batch
+	std::vector<GLuint> mBatchCount;
+	int mNumInstances;
+	int mNumMatrices;
+
+	GLuint mInstanceBuffer;		// GpuInstance
+	GLuint mMatrixBuffer;		// mat4 per matrix, every frame
+	GLuint mPendingBuffer;		// uint per instance, hidden by the previous pyramid only
+	GLuint mCommandBuffer;		// DrawCommand per phase and batch
+	GLuint mTransformBuffer;	// InstanceTransform, a range of every instance per phase
+	std::vector<DrawCommand> mCommands;
+
+	// Transform feedback : the instances as points, the matrices as a buffer
+	// texture and the number of visible instances of every batch
+	GLuint mFeedbackVAO;
+	GLuint mMatrixTexture;
+	GLint mMaxMatrices;
+	std::vector<GLuint> mFeedbackQueries;	// per batch, primitives written
+	bool mQueryCounts;						// written into the commands by the queries
+	std::vector<GLint> mVisibleCounts;		// read by drawBatch() otherwise, -1 until read
+
+	// Farthest depth, a full mip chain
+	GLuint mPyramid;
+	int mPyramidLevels;
+	bool mPyramidValid;
+	glm::mat4 mViewProjection;			// of this frame's cull
+	glm::mat4 mPyramidViewProjection;	// the camera the pyramid was rendered with
+
+	// Copies of the commands, read once their fence passed
+	GLuint mReadback[READBACK_LATENCY];
+	GLsync mReadbackFence[READBACK_LATENCY];
+	int mReadbackIndex;
+
+	GpuQuery mCullTimer[NUM_PHASES];
+	GpuQuery mPyramidTimer;
+	Stats mStats;
+};
+#endif //GPU_CULLER_H
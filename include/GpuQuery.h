@@ -0,0 +1,43 @@
+//-----------------------------------------------------------------------------
+// Ring of OpenGL query objects read back a few frames late so that fetching
+// the result never stalls the pipeline.  Works with any single result query
+// target (GL_TIME_ELAPSED, GL_SAMPLES_PASSED, pipeline statistics...).
+// GL_TIMESTAMP measures begin..end with two counters instead, which unlike
+// GL_TIME_ELAPSED may enclose other timer queries.
+//-----------------------------------------------------------------------------
+#ifndef GPU_QUERY_H
+#define GPU_QUERY_H
+
+#include <vector>
+#define GLEW_STATIC
+#include "GL/glew.h"
+
+class GpuQuery
+{
+public:
+	 GpuQuery();
+	~GpuQuery();
+
+	void init(GLenum target, int latency = 3);
+	void begin();
+	void end();
+
+	bool isValid() const		{ return !mQueries.empty(); }
+	bool hasResult() const		{ return mHasResult; }
+	GLuint64 getResult() const	{ return mResult; }		// latest available result
+
+private:
+	GpuQuery(const GpuQuery& rhs);
+	GpuQuery& operator = (const GpuQuery& rhs);
+
+	void poll(bool wait);
+	bool isTimestamp() const	{ return mTarget == GL_TIMESTAMP; }
+
+	GLenum mTarget;
+	std::vector<GLuint> mQueries;
+	std::vector<bool> mPending;
+	int mIndex;
+	bool mHasResult;
+	GLuint64 mResult;
+};
+#endif //GPU_QUERY_H
@@ -0,0 +1,26 @@
+//-----------------------------------------------------------------------------
+// A resource with a copy in video memory that can be dropped and loaded again
+// from the file it came from (see ResourceBudget)
+//-----------------------------------------------------------------------------
+#ifndef GPU_RESOURCE_H
+#define GPU_RESOURCE_H
+
+#include <cstddef>
+
+class GpuResource
+{
+public:
+	virtual ~GpuResource() {}
+
+	// Bytes held in system memory and (approximately) in video memory
+	virtual size_t getCpuMemorySize() const = 0;
+	virtual size_t getGpuMemorySize() const = 0;
+
+	virtual bool isResident() const = 0;
+	virtual bool canEvict() const = 0;		// knows the file to reload from
+
+	// Frees both copies, keeping what is needed to reload
+	virtual void evict() = 0;
+	virtual bool reload() = 0;
+};
+#endif //GPU_RESOURCE_H
@@ -0,0 +1,52 @@
+//-----------------------------------------------------------------------------
+// Image decoder backends
+//
+// Decodes PNG, JPEG, TGA... files held in memory to RGBA8.  stb_image handles
+// every format; faster backends are compiled in when CMake finds them
+// (libjpeg-turbo for JPEG, libspng for PNG) and take over the files they
+// recognise, with stb_image as the fallback when they fail.
+//
+// Decoders write into a buffer the caller provides, with any row pitch and
+// either row order, so an image can land straight in a mapped pixel buffer
+// already flipped for GL.  The decoders keep no state: any thread can use
+// them at once.
+//-----------------------------------------------------------------------------
+#ifndef IMAGE_DECODER_H
+#define IMAGE_DECODER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class ImageDecoder
+{
+public:
+	virtual ~ImageDecoder() {}
+
+	virtual const char* getName() const = 0;
+
+	// From the first bytes of the file
+	virtual bool canDecode(const unsigned char* data, size_t size) const = 0;
+
+	virtual bool readSize(const unsigned char* data, size_t size, int& width, int& height) const = 0;
+
+	// RGBA8 rows of pitch bytes (width * 4 at least) into dest, top row first,
+	// or bottom row first (as GL expects) when flip is true
+	virtual bool decode(const unsigned char* data, size_t size, unsigned char* dest, size_t pitch, bool flip) const = 0;
+
+	// The backend for these contents: the first built in one that recognises
+	// them, stb_image otherwise
+	static const ImageDecoder& find(const unsigned char* data, size_t size);
+	static const ImageDecoder& getDefault();		// stb_image
+
+	// Same with the fallback to stb_image when the backend fails
+	static bool getImageSize(const unsigned char* data, size_t size, int& width, int& height);
+	static bool decodeImage(const unsigned char* data, size_t size, unsigned char* dest, size_t pitch, bool flip);
+
+	// Reads and decodes a file into tightly packed RGBA8 rows
+	static bool loadFile(const std::string& fileName, std::vector<unsigned char>& rgba, int& width, int& height, bool flip);
+
+	// "libjpeg-turbo libspng stb_image": what this build can use
+	static std::string getBackendNames();
+};
+#endif //IMAGE_DECODER_H
@@ -0,0 +1,90 @@
+//-----------------------------------------------------------------------------
+// Work-stealing job system
+//
+// One deque per worker thread: a worker pushes the jobs it spawns to the back
+// of its own deque and pops from there (the most recent, still in cache),
+// while idle workers steal the oldest from the front of the others.  Jobs
+// spawned by other threads (the main thread) go through a shared queue.
+//
+// A job can wait for others to finish before it is queued.  wait() and
+// parallelFor() never just block: the calling thread runs queued jobs until
+// the ones it waits for are done, so the main thread helps instead of idling
+// and jobs may wait for jobs.
+//
+// Every thread outside the workers has its own group: the jobs it spawns,
+// and the jobs those spawn in turn.  Such a thread only helps with its own
+// group, so two threads sharing the system (simulation and rendering) never
+// run each other's jobs inside a wait().  Workers run jobs of any group.
+//
+// Background jobs may block for a long time (file reads, a staging buffer
+// the GL thread has to recycle) and only ever run on the workers, never
+// inside a wait(), so they cannot stall the thread that waits.
+//-----------------------------------------------------------------------------
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem
+{
+public:
+	struct Job;
+	typedef std::shared_ptr<Job> JobHandle;
+
+	explicit JobSystem(unsigned numWorkers = 0);	// 0 = one per hardware thread but the caller's
+	~JobSystem();									// finishes the queued jobs
+
+	JobHandle spawn(std::function<void()> task);
+	JobHandle spawn(std::function<void()> task, const std::vector<JobHandle>& dependencies);
+	JobHandle spawnBackground(std::function<void()> task);
+
+	bool isDone(const JobHandle& job) const;
+	void wait(const JobHandle& job);
+	void wait(const std::vector<JobHandle>& jobs);
+
+	// Calls body(first, last) over [begin, end) in chunks of grain items, on
+	// the workers and the calling thread, and returns when all are done
+	void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+	unsigned getNumWorkers() const		{ return (unsigned)mWorkers.size(); }
+	size_t getStealCount() const		{ return mSteals.load(); }
+
+private:
+	JobSystem(const JobSystem& rhs);
+	JobSystem& operator = (const JobSystem& rhs);
+
+	struct Worker
+	{
+		std::thread thread;
+		std::mutex mutex;
+		std::deque<JobHandle> jobs;
+	};
+
+	void workerLoop(int index);
+	void schedule(const JobHandle& job);
+	JobHandle findJob(bool background);
+	JobHandle takeJob(std::deque<JobHandle>& jobs, bool back, int group);
+	void execute(const JobHandle& job);
+
+	std::vector<std::unique_ptr<Worker> > mWorkers;
+	std::mutex mSharedMutex;
+	std::deque<JobHandle> mShared;			// spawned outside the workers
+	std::mutex mBackgroundMutex;
+	std::deque<JobHandle> mBackground;
+
+	// Idle workers sleep until a job is queued
+	std::mutex mWakeMutex;
+	std::condition_variable mWake;
+	std::atomic<int> mQueued;
+	std::atomic<int> mSleeping;
+	std::atomic<size_t> mSteals;
+	std::atomic<bool> mStop;
+};
+#endif //JOB_SYSTEM_H
@@ -1,5 +1,9 @@
 //-----------------------------------------------------------------------------
 // Basic Mesh class
+//
+// The vertices only live in the vertex buffers once uploaded.  A mesh can be
+// evicted (see ResourceBudget) and reloaded from its OBJ file; its bounds stay
+// valid meanwhile.
 //-----------------------------------------------------------------------------
 #ifndef MESH_H
 #define MESH_H
@@ -10,6 +14,7 @@
 #define GLEW_STATIC
 #include "GL/glew.h"	// Important - this header must come before glfw3 header
 #include "glm/glm.hpp"
+#include "GpuResource.h"
 
 
 struct Vertex
@@ -19,22 +24,67 @@ struct Vertex
 	glm::vec2 texCoords;
 };
 
-class Mesh
+// Per-instance vertex attributes of instanced draws (see GpuCuller) :
+// locations 3 to 6 the model matrix columns, 7 to 9 the normal matrix columns
+struct InstanceTransform
+{
+	glm::mat4 model;
+	glm::vec4 normal[3];	// xyz
+};
+
+class Mesh : public GpuResource
 {
 public:
 
 	 Mesh();
-	~Mesh();
+	virtual ~Mesh();
 
-	bool loadOBJ(const std::string& filename);
+	bool loadOBJ(const std::string& filename);	// parseOBJ() then upload()
+	bool parseOBJ(const std::string& filename);
+	bool upload();								// on the GL thread
 	void draw();
+	void drawPositions();	// position only stream for depth and shadow passes
+
+	// For draws sorted by mesh : bind() once, then drawBound() per draw
+	void bind();
+	void bindPositions();
+	void drawBound();
+	static void unbind();
+
+	// A buffer of InstanceTransform for the instanced draws of both vertex
+	// arrays, the first instance at offset bytes, kept across reloads; 0 : none
+	void setInstanceBuffer(GLuint buffer, GLintptr offset = 0);
+
+	bool isLoaded() const { return mLoaded; }
+	const std::string& getFileName() const { return mFileName; }
+	GLsizei getVertexCount() const { return mLoaded ? mVertexCount : 0; }
+
+	// GpuResource
+	virtual size_t getCpuMemorySize() const;
+	virtual size_t getGpuMemorySize() const;
+	virtual bool isResident() const { return mLoaded; }
+	virtual bool canEvict() const { return !mFileName.empty(); }
+	virtual void evict();
+	virtual bool reload();
+
+	// Object space axis aligned bounds of the loaded vertices
+	const glm::vec3& getBoundsMin() const { return mBoundsMin; }
+	const glm::vec3& getBoundsMax() const { return mBoundsMax; }
 
 private:
 
 	void initBuffers();
+	void deleteBuffers();
+	void bindInstanceAttributes(GLuint vertexArray);
 
 	bool mLoaded;
-	std::vector<Vertex> mVertices;
+	std::string mFileName;
+	std::vector<Vertex> mVertices;	// until uploaded
+	GLsizei mVertexCount;
+	glm::vec3 mBoundsMin, mBoundsMax;
 	GLuint mVBO, mVAO;
+	GLuint mPositionVBO, mPositionVAO;
+	GLuint mInstanceBuffer;
+	GLintptr mInstanceOffset;
 };
 #endif //MESH_H
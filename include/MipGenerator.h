@@ -0,0 +1,45 @@
+//-----------------------------------------------------------------------------
+// CPU mip chain generation for RGBA8 images
+//
+// Each level is filtered from the previous one kept in linear float, so
+// rounding does not accumulate down the chain.  With gamma correction the
+// color channels are decoded from sRGB before filtering and re-encoded after
+// (alpha always stays linear); this keeps small levels from going dark.
+// The separable box / Kaiser filters wrap around the edges like GL_REPEAT and
+// handle odd sizes.  RGBA float pixels are filtered 4 channels at a time with
+// SSE2 when available.
+//-----------------------------------------------------------------------------
+#ifndef MIP_GENERATOR_H
+#define MIP_GENERATOR_H
+
+#include <vector>
+
+class MipGenerator
+{
+public:
+	enum Filter
+	{
+		FILTER_BOX,		// exact area average, cheapest
+		FILTER_KAISER	// Kaiser windowed sinc, sharper small levels
+	};
+
+	struct Level
+	{
+		int width, height;
+		std::vector<unsigned char> pixels;	// tightly packed RGBA8
+	};
+
+	// Fills levels with mip 1 (half size) down to 1x1, the source itself is mip 0
+	static void generate(const unsigned char* rgbaData, int width, int height, Filter filter, bool gammaCorrect,
+						 std::vector<Level>& levels);
+
+	// Including mip 0
+	static int getNumLevels(int width, int height);
+
+	// SSE2 can be switched off to compare against the scalar path
+	static bool hasSimd();
+	static void setSimdEnabled(bool enabled);
+
+	static const char* getFilterName(Filter filter);
+};
+#endif //MIP_GENERATOR_H
@@ -0,0 +1,110 @@
+//-----------------------------------------------------------------------------
+// Software occlusion culling
+//
+// A few chosen occluders (low-poly proxies of large meshes: buildings, the
+// ground) are rasterized on the CPU into a small depth buffer, then objects
+// are tested against it before they are drawn.  The buffer holds 1/w, the
+// reciprocal of the view depth, which is linear in screen space: 0 is empty,
+// larger is closer.  The screen is split into tiles rasterized in parallel,
+// each tile running over the triangles that touch it, 8 pixels of a row at a
+// time with AVX2 when the CPU has it.  An 8x8 block level keeps the farthest
+// depth of each block, so most tests end on a block instead of its pixels.
+//
+// A test takes an object's bounding sphere: its rectangle on screen and its
+// nearest depth.  The object is occluded when every pixel of the rectangle is
+// closer than that.  Occluders are drawn at pixel centers; the proxies should
+// stay inside the meshes they stand for, or they hide what is visible.
+//
+// The proxy of a mesh file is <name>_occluder.obj next to it.
+//-----------------------------------------------------------------------------
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <string>
+#include <vector>
+#include "glm/glm.hpp"
+#include "JobSystem.h"
+
+class OcclusionCuller
+{
+public:
+	static const int WIDTH = 320;
+	static const int HEIGHT = 192;
+	static const int TILE_WIDTH = 64;		// rasterized by one job
+	static const int TILE_HEIGHT = 32;
+	static const int BLOCK_SIZE = 8;		// of the farthest depth level
+
+	struct Occluder
+	{
+		const std::vector<glm::vec3>* triangles;	// object space, 3 positions per triangle
+		glm::mat4 worldMatrix;
+	};
+
+	// Of the last rasterize()
+	struct Stats
+	{
+		int occluders;
+		int triangles;			// front facing, in front of the camera
+		double setupMs;			// transform, clipping and triangle setup
+		double rasterMs;		// tiles and block level
+	};
+
+	 OcclusionCuller();
+	~OcclusionCuller();
+
+	// Clears the buffer and draws the occluders.  The projection is a
+	// symmetric perspective.  Runs on the calling thread alone without jobs.
+	void rasterize(const std::vector<Occluder>& occluders, const glm::mat4& view, const glm::mat4& projection,
+				   JobSystem* jobs);
+
+	// A world space sphere against the last rasterize(); thread safe
+	bool isOccluded(const glm::vec3& center, float radius) const;
+
+	const float* getDepth() const		{ return mDepth.data(); }		// WIDTH x HEIGHT, bottom row first
+	const Stats& getStats() const		{ return mStats; }
+
+	// Triangles of <name>_occluder.obj for a mesh file; false without one
+	static std::string getOccluderFile(const std::string& meshFile);
+	static bool loadOccluder(const std::string& meshFile, std::vector<glm::vec3>& triangles);
+
+	// AVX2, when the CPU has it, can be switched off to compare against the scalar path
+	static bool hasSimd();
+	static void setSimdEnabled(bool enabled);
+
+private:
+	OcclusionCuller(const OcclusionCuller& rhs);
+	OcclusionCuller& operator = (const OcclusionCuller& rhs);
+
+	// Edge functions (inside when all >= 0) and 1/w at a pixel (x, y) of the
+	// buffer: a * x + b * y + c, pixel centers at + 0.5
+	struct Triangle
+	{
+		float edgeA[3], edgeB[3], edgeC[3];
+		float depthA, depthB, depthC;
+		int minX, minY, maxX, maxY;		// inclusive, clamped to the buffer
+	};
+
+	void setupOccluder(size_t occluder);
+	static bool setupTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, Triangle& triangle);
+	void rasterizeTile(int tile);
+
+	// Inputs of the rasterization in progress
+	const std::vector<Occluder>* mOccluders;
+	glm::mat4 mViewProjection;
+
+	// Two output slots per input triangle (a triangle clipped by the near
+	// plane may become two), in order of the occluders
+	std::vector<size_t> mTriangleOffsets;
+	std::vector<int> mTriangleCounts;
+	std::vector<Triangle> mTriangles;
+
+	std::vector<float> mDepth;			// WIDTH x HEIGHT
+	std::vector<float> mBlockDepth;		// farthest of each block
+
+	// For the tests
+	glm::mat4 mView;
+	float mProjectionX, mProjectionY;	// projection[0][0], [1][1]
+	float mNear;
+	Stats mStats;
+};
+#endif //OCCLUSION_CULLER_H
@@ -0,0 +1,69 @@
+//-----------------------------------------------------------------------------
+// Ring of mapped pixel unpack buffers for streaming texture uploads
+//
+// The ring is split into fixed size segments.  Worker threads acquire a mapped
+// segment, write texels straight into it and hand it back to the GL thread,
+// which sources glTexSubImage2D from it and fences it; the segment is mapped
+// again once the fence has signaled, so the copies run asynchronously and the
+// ring never overwrites data the GPU has not consumed yet.
+//
+// With GL 4.4 / ARB_buffer_storage one persistently mapped (coherent) buffer
+// holds every segment.  Otherwise each segment is its own buffer, orphaned and
+// mapped again with glMapBufferRange when recycled.
+//-----------------------------------------------------------------------------
+#ifndef PIXEL_BUFFER_RING_H
+#define PIXEL_BUFFER_RING_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+#define GLEW_STATIC
+#include "GL/glew.h"
+
+class PixelBufferRing
+{
+public:
+	 PixelBufferRing();
+	~PixelBufferRing();
+
+	// GL thread
+	bool init(size_t segmentSize, int numSegments, bool allowPersistent = true);
+	void update();							// recycles the segments whose fence has signaled
+	const GLvoid* beginUpload(int segment);	// binds GL_PIXEL_UNPACK_BUFFER, returns the offset of the segment
+	void endUpload(int segment);			// fences the copies issued since beginUpload
+
+	// Any thread.  acquire blocks until a segment is mapped, -1 once shut down.
+	int acquire();
+	unsigned char* getData(int segment) const	{ return mSegments[segment].data; }
+	void shutdown();						// wakes up and fails every pending acquire
+
+	bool isValid() const			{ return !mSegments.empty(); }
+	bool isPersistent() const		{ return mPersistent; }
+	size_t getSegmentSize() const	{ return mSegmentSize; }
+	int getNumSegments() const		{ return (int)mSegments.size(); }
+
+private:
+	PixelBufferRing(const PixelBufferRing& rhs);
+	PixelBufferRing& operator = (const PixelBufferRing& rhs);
+
+	struct Segment
+	{
+		GLuint buffer;			// shared by every segment when persistent
+		unsigned char* data;	// mapped pointer, NULL while the GPU owns it (orphaning)
+		GLsync fence;
+	};
+
+	void release(int segment);
+	void destroy();
+
+	std::vector<Segment> mSegments;
+	size_t mSegmentSize;
+	bool mPersistent;
+
+	std::deque<int> mAvailable;			// mapped and ready for writing
+	std::mutex mMutex;
+	std::condition_variable mSegmentReady;
+	bool mStop;
+};
+#endif //PIXEL_BUFFER_RING_H
@@ -0,0 +1,102 @@
+//-----------------------------------------------------------------------------
+// Omnidirectional point light shadows
+//
+// Every shadowed light owns a slot of 6 consecutive layers (one per cube face)
+// in a shared depth array.  Faces are rendered in a single layered pass per
+// light with a geometry shader.  A scheduler only refreshes the most important
+// dirty faces each frame (screen coverage, distance, motion) so the shadow
+// cost stays bounded by the face budget regardless of the number of lights.
+//-----------------------------------------------------------------------------
+#ifndef POINT_SHADOW_ATLAS_H
+#define POINT_SHADOW_ATLAS_H
+
+#include <vector>
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "glm/glm.hpp"
+
+#include "Camera.h"
+#include "ShadowCaster.h"
+#include "ShaderProgram.h"
+
+class PointShadowAtlas
+{
+public:
+	static const int NUM_FACES = 6;
+
+	 PointShadowAtlas();
+	~PointShadowAtlas();
+
+	bool init(int faceResolution = 512, int numSlots = 4);
+
+	// Returns a light id.  The owner, an index in the casters (e.g. a lamp around
+	// the light), never shadows its own light; -1 : none.
+	int addLight(const glm::vec3& position, float radius, int owner = -1);
+	void setLightPosition(int light, const glm::vec3& position);
+	void setFaceBudget(int facesPerFrame)	{ mFaceBudget = facesPerFrame; }
+
+	// Every face of every light needs a refresh, e.g. after a caster mesh was reloaded
+	void invalidate();
+
+	// Assigns slots and picks the faces to refresh this frame
+	void update(const Camera& camera, float aspect, float nearPlane, float farPlane, const std::vector<ShadowCaster>& casters);
+
+	// Renders the faces picked by update(), leaving the bound framebuffer and
+	// the viewport as they were
+	void render(const std::vector<ShadowCaster>& casters);
+
+	// Indices of the casters the last render() drew, including those skipped
+	// because their mesh was evicted: the caller keeps them resident
+	const std::vector<int>& getDrawnCasters() const	{ return mDrawnCasters; }
+
+	void bind(ShaderProgram& shader, GLuint texUnit);
+	void unbind(GLuint texUnit);
+
+	int getSlot(int light) const			{ return mLights[light].slot; }		// -1 when not shadowed this frame
+	float getFarPlane(int light) const		{ return mLights[light].radius; }
+	int getFacesRendered() const			{ return mFacesRendered; }
+	int getPendingFaces() const				{ return mPendingFaces; }
+	int getDrawCount() const				{ return mDrawCount; }
+
+private:
+	PointShadowAtlas(const PointShadowAtlas& rhs);
+	PointShadowAtlas& operator = (const PointShadowAtlas& rhs);
+
+	struct Light
+	{
+		glm::vec3 position;
+		float radius;
+		int owner;
+		int slot;
+		float importance;
+		bool dirty[NUM_FACES];
+		bool moved[NUM_FACES];
+		int dirtySince[NUM_FACES];
+		bool scheduled[NUM_FACES];
+	};
+
+	void markAllFaces(Light& light, bool moved);
+	void markCaster(int caster, const glm::vec3& center, float radius);
+	bool faceIntersectsSphere(const Light& light, int face, const glm::vec3& center, float radius) const;
+	glm::mat4 faceViewProj(const Light& light, int face) const;
+
+	int mFaceResolution;
+	int mNumSlots;
+	int mFaceBudget;
+	int mFrame;
+
+	std::vector<Light> mLights;
+	std::vector<int> mSlotOwner;		// light id per slot, -1 when free
+	std::vector<glm::mat4> mPrevModels;	// caster transforms seen last frame (motion detection)
+
+	GLuint mDepth;
+	GLuint mLayeredFBO, mLayerFBO;
+	ShaderProgram mDepthShader;
+
+	std::vector<int> mDrawnCasters;
+	std::vector<bool> mCasterDrawn;		// per caster, the last render() drew it
+	int mFacesRendered;
+	int mPendingFaces;
+	int mDrawCount;
+};
+#endif //POINT_SHADOW_ATLAS_H
@@ -0,0 +1,103 @@
+//-----------------------------------------------------------------------------
+// Draw packets sorted by 64-bit keys
+//
+// Each frame the renderer adds a packet per draw: small ids for the program,
+// texture, material and mesh it needs, its view depth and the caller's object
+// index.  They are packed into a key, most significant first:
+//   opaque      : pass | program | texture | material | mesh | depth
+//   transparent : pass | ~depth | program | texture | material | mesh
+// so a radix sort of the keys groups opaque draws by state, front to back
+// within a group (early depth rejection), and orders transparent draws back
+// to front for blending.  submit() walks the sorted packets and only calls
+// the callbacks of the state that differs from the previous packet, counting
+// the switches.
+//-----------------------------------------------------------------------------
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "JobSystem.h"
+
+class RenderQueue
+{
+public:
+	enum Pass
+	{
+		PASS_OPAQUE,
+		PASS_TRANSPARENT		// after every opaque draw
+	};
+
+	// Id ranges of the key fields
+	static const int MAX_PROGRAMS = 64;
+	static const int MAX_TEXTURES = 4096;
+	static const int MAX_MATERIALS = 256;
+	static const int MAX_MESHES = 4096;
+
+	struct Packet
+	{
+		uint64_t key;
+		int object;				// caller's index, handed back to the callbacks
+	};
+
+	// State changes, called with the first packet that needs the new state
+	struct Callbacks
+	{
+		std::function<void(const Packet&)> setProgram;
+		std::function<void(const Packet&)> setTexture;
+		std::function<void(const Packet&)> setMaterial;
+		std::function<void(const Packet&)> setMesh;
+		std::function<void(const Packet&)> draw;
+	};
+
+	struct Stats
+	{
+		int draws;
+		int programChanges;
+		int textureChanges;
+		int materialChanges;
+		int meshChanges;
+	};
+
+	 RenderQueue();
+	~RenderQueue();
+
+	// View depths beyond these are clamped
+	void setDepthRange(float nearPlane, float farPlane)	{ mNear = nearPlane; mFar = farPlane; }
+
+	void clear();
+	void add(Pass pass, int program, int texture, int material, int mesh, float depth, int object);
+	void sort(JobSystem* jobs = nullptr);	// large queues sort on the jobs, if given
+
+	// For filling from several threads : packets made anywhere, then copied
+	// into a block appended on one thread
+	Packet makePacket(Pass pass, int program, int texture, int material, int mesh, float depth, int object) const;
+	Packet* append(size_t count);
+
+	// Issues the packets in order; the stats are those of this call
+	const Stats& submit(const Callbacks& callbacks);
+
+	size_t size() const							{ return mPackets.size(); }
+	const Packet& getPacket(size_t index) const	{ return mPackets[index]; }
+	const Stats& getStats() const				{ return mStats; }
+
+	// Fields of a key
+	static Pass getPass(uint64_t key);
+	static int getProgram(uint64_t key);
+	static int getTexture(uint64_t key);
+	static int getMaterial(uint64_t key);
+	static int getMesh(uint64_t key);
+
+private:
+	RenderQueue(const RenderQueue& rhs);
+	RenderQueue& operator = (const RenderQueue& rhs);
+
+	void sortBlocks(JobSystem& jobs);
+
+	std::vector<Packet> mPackets;
+	std::vector<Packet> mScratch;		// radix sort ping-pong
+	float mNear, mFar;
+	Stats mStats;
+};
+#endif //RENDER_QUEUE_H
@@ -0,0 +1,80 @@
+//-----------------------------------------------------------------------------
+// Video memory budget of meshes and textures
+//
+// Accounts the system and video memory of the resources it is given, and the
+// free video memory the driver reports (GL_NVX_gpu_memory_info or
+// GL_ATI_meminfo, when available).  The renderer calls use() for every
+// resource it draws: an evicted one is reloaded from its file on the spot.
+// update(), once per frame, then evicts the least recently drawn resources
+// until the video memory in use fits the budget again.  Resources drawn this
+// frame are never evicted, so a frame that needs more than the budget keeps
+// everything it draws.
+//-----------------------------------------------------------------------------
+#ifndef RESOURCE_BUDGET_H
+#define RESOURCE_BUDGET_H
+
+#include <string>
+#include <vector>
+#include "GpuResource.h"
+
+class ResourceBudget
+{
+public:
+	 ResourceBudget();
+	~ResourceBudget();
+
+	// Video memory, 0 = no limit (the default)
+	void setMemoryBudget(size_t bytes)		{ mMemoryBudget = bytes; }
+
+	// Video memory of resources managed elsewhere (streamed textures, texture
+	// arrays), counted against the budget but never evicted here
+	void setExternalBytes(size_t bytes)		{ mExternalBytes = bytes; }
+
+	// The resources must outlive the budget or be removed first
+	void add(GpuResource* resource, const std::string& name);
+	void remove(GpuResource* resource);
+
+	// The resource is drawn this frame: reloads it if it was evicted.  False
+	// when it could not be reloaded.
+	bool use(GpuResource* resource);
+
+	// Refreshes the totals and evicts down to the budget.  Once per frame,
+	// on the thread that owns the GL context.
+	void update();
+
+	size_t getMemoryBudget() const			{ return mMemoryBudget; }
+	size_t getCpuBytes() const				{ return mCpuBytes; }
+	size_t getGpuBytes() const				{ return mGpuBytes; }		// including the external bytes
+	int getNumResident() const				{ return mNumResident; }
+	int getNumResources() const				{ return (int)mEntries.size(); }
+	int getEvictionCount() const			{ return mEvictions; }		// since the start
+	int getReloadCount() const				{ return mReloads; }
+
+	// Free video memory reported by the driver at the last update(), 0 when unknown
+	size_t getDriverFreeBytes() const		{ return mDriverFreeBytes; }
+	static size_t queryDriverFreeBytes();
+
+private:
+	ResourceBudget(const ResourceBudget& rhs);
+	ResourceBudget& operator = (const ResourceBudget& rhs);
+
+	struct Entry
+	{
+		GpuResource* resource;
+		std::string name;
+		int lastUsed;				// frame of the last use(), -1 never
+	};
+
+	int findEntry(const GpuResource* resource) const;
+	bool evictLeastRecent();
+
+	std::vector<Entry> mEntries;
+	size_t mMemoryBudget;
+	size_t mExternalBytes;
+	size_t mCpuBytes, mGpuBytes;
+	size_t mDriverFreeBytes;
+	int mNumResident;
+	int mEvictions, mReloads;
+	int mFrame;
+};
+#endif //RESOURCE_BUDGET_H
@@ -0,0 +1,125 @@
+//-----------------------------------------------------------------------------
+// Scene description : assets, instances, materials and lights
+//
+// Two forms of the same content.  The text form is for authoring, a statement
+// per line:
+//
+//   mesh <name> <obj file>
+//   texture <name> <image file>
+//   material <name> [ambient r g b] [specular r g b] [shininess s]
+//   instance <mesh> <texture or -> <material> [name n] [position x y z]
+//            [scale s | scale x y z] [rotate ax ay az degrees] [spin ax ay az degrees/s]
+//   light sun [direction x y z] [ambient r g b] [diffuse r g b] [specular r g b]
+//   light point [position x y z] [radius r] [follow <instance name>] [ambient ...]
+//
+// with # comments; names and files are single tokens.  A light following an instance is positioned relative to
+// it and never shadowed by it.  The binary form (from scenecook) stores the
+// same data as fixed size little endian records, without names.
+//
+// Meshes and textures are deduplicated by file: names declared for the same
+// file share one asset.  Large text files are split into chunks parsed on the
+// job system, binary instance records are decoded in parallel too.
+//-----------------------------------------------------------------------------
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+#include "JobSystem.h"
+
+class SceneFile
+{
+public:
+	struct Material
+	{
+		std::string name;
+		glm::vec3 ambient;
+		glm::vec3 specular;
+		float shininess;
+	};
+
+	struct Instance
+	{
+		int mesh;				// index of getMeshes()
+		int texture;			// index of getTextures(), -1 : none
+		int material;			// index of getMaterials()
+		glm::vec3 position;
+		glm::quat rotation;
+		glm::vec3 scale;
+		glm::vec3 spinAxis;		// normalized
+		float spinSpeed;		// degrees per second around spinAxis, 0 : static
+	};
+
+	enum LightType { LIGHT_SUN, LIGHT_POINT };
+
+	struct Light
+	{
+		LightType type;
+		glm::vec3 position;		// point : world position, or offset from the instance followed
+		glm::vec3 direction;	// sun
+		float radius;			// point : range of its shadows
+		int instance;			// point : followed, -1 : none
+		glm::vec3 ambient;
+		glm::vec3 diffuse;
+		glm::vec3 specular;
+	};
+
+	// Of the last load, in ms
+	struct Timings
+	{
+		double readMs;			// file into memory
+		double parseMs;			// statements or records
+		double resolveMs;		// names to indices (text only)
+	};
+
+	 SceneFile();
+	~SceneFile();
+
+	// Text or binary, told apart by the binary magic number.  Replaces the
+	// content; on failure the scene is left empty.
+	bool load(const std::string& fileName, JobSystem* jobs = nullptr);
+	bool saveText(const std::string& fileName) const;
+	bool saveBinary(const std::string& fileName) const;
+
+	// Building a scene in code.  Assets of a file added again return the
+	// index of the first.
+	void clear();
+	int addMesh(const std::string& fileName);
+	int addTexture(const std::string& fileName);
+	int addMaterial(const Material& material);
+	int addInstance(const Instance& instance);
+	int addLight(const Light& light);
+
+	static Material makeMaterial(const std::string& name);		// with the defaults
+	static Instance makeInstance(int mesh, int texture, int material);
+	static Light makeLight(LightType type);
+
+	const std::vector<std::string>& getMeshes() const		{ return mMeshes; }
+	const std::vector<std::string>& getTextures() const		{ return mTextures; }
+	const std::vector<Material>& getMaterials() const		{ return mMaterials; }
+	const std::vector<Instance>& getInstances() const		{ return mInstances; }
+	const std::vector<Light>& getLights() const				{ return mLights; }
+	const Timings& getTimings() const						{ return mTimings; }
+
+private:
+	SceneFile(const SceneFile& rhs);
+	SceneFile& operator = (const SceneFile& rhs);
+
+	struct TextChunk;
+
+	bool parseText(const std::string& text, const std::string& fileName, JobSystem* jobs);
+	bool parseBinary(const std::string& bytes, const std::string& fileName, JobSystem* jobs);
+
+	std::vector<std::string> mMeshes;
+	std::vector<std::string> mTextures;
+	std::vector<Material> mMaterials;
+	std::vector<Instance> mInstances;
+	std::vector<Light> mLights;
+	std::unordered_map<std::string, int> mMeshIndex;		// by file
+	std::unordered_map<std::string, int> mTextureIndex;
+	Timings mTimings;
+};
+#endif //SCENE_FILE_H
@@ -0,0 +1,76 @@
+//-----------------------------------------------------------------------------
+// Transforms of the scene objects, stored as structure of arrays
+//
+// Position, rotation (unit quaternion) and scale are kept one component per
+// array, so the matrices of four objects are built at once in SSE2 registers.
+// The world matrix (translate * rotate * scale) and the normal matrix (the
+// inverse transpose of its upper 3x3) are cached: setters only flag the
+// object, and update() rebuilds the flagged ones, skipping 32 unchanged
+// objects per test of the dirty bits.  Static objects cost nothing per frame.
+//-----------------------------------------------------------------------------
+#ifndef SCENE_TRANSFORMS_H
+#define SCENE_TRANSFORMS_H
+
+#include <cstdint>
+#include <vector>
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+#include "JobSystem.h"
+
+class SceneTransforms
+{
+public:
+	typedef int Entity;
+
+	 SceneTransforms();
+	~SceneTransforms();
+
+	void reserve(size_t count);
+	Entity add(const glm::vec3& position, const glm::vec3& scale = glm::vec3(1.0f),
+			   const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+	void clear();
+	size_t size() const							{ return mCount; }
+
+	void setPosition(Entity entity, const glm::vec3& position);
+	void setRotation(Entity entity, const glm::quat& rotation);		// normalized
+	void setScale(Entity entity, const glm::vec3& scale);			// no zero component
+	void setTransform(Entity entity, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+
+	glm::vec3 getPosition(Entity entity) const;
+	glm::quat getRotation(Entity entity) const;
+	glm::vec3 getScale(Entity entity) const;
+
+	// Rebuilds the matrices of the objects changed since the last call,
+	// returns how many.  Large updates are spread over the jobs, if given.
+	size_t update(JobSystem* jobs = nullptr);
+
+	const glm::mat4& getWorldMatrix(Entity entity) const	{ return mWorld[entity]; }
+	const glm::mat3& getNormalMatrix(Entity entity) const	{ return mNormal[entity]; }
+	bool isDirty(Entity entity) const		{ return (mDirty[entity >> 5] >> (entity & 31)) & 1; }
+
+	// The matrices of every entity, as of the last update (for another thread)
+	void copyMatrices(std::vector<glm::mat4>& world, std::vector<glm::mat3>& normal) const;
+
+	// SSE2 can be switched off to compare against the scalar path
+	static bool hasSimd();
+	static void setSimdEnabled(bool enabled);
+
+private:
+	SceneTransforms(const SceneTransforms& rhs);
+	SceneTransforms& operator = (const SceneTransforms& rhs);
+
+	void markDirty(Entity entity)			{ mDirty[entity >> 5] |= 1u << (entity & 31); }
+	size_t updateWords(size_t firstWord, size_t lastWord);
+	void updateOne(size_t index);
+	void updateFour(size_t first);
+
+	// Arrays are padded to a multiple of 4 with identity transforms
+	size_t mCount;
+	std::vector<float> mPosition[3];
+	std::vector<float> mRotation[4];	// x, y, z, w
+	std::vector<float> mScale[3];
+	std::vector<glm::mat4> mWorld;
+	std::vector<glm::mat3> mNormal;
+	std::vector<uint32_t> mDirty;		// a bit per object
+};
+#endif //SCENE_TRANSFORMS_H
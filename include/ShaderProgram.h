@@ -1,11 +1,17 @@
 //-----------------------------------------------------------------------------
 // GLSL shader manager class
+//
+// Programs can be rebuilt from their files while the application runs: the
+// new program compiles in the background (KHR/ARB_parallel_shader_compile)
+// and replaces the old one once linked.  A program that fails to build is
+// dropped and the old one keeps running.
 //-----------------------------------------------------------------------------
 #ifndef SHADER_H
 #define SHADER_H
 
 #include <string>
 #include <map>
+#include <vector>
 #define GLEW_STATIC
 #include "GL/glew.h"
 #include "glm/glm.hpp"
@@ -21,34 +27,70 @@ public:
 	enum ShaderType
 	{
 		VERTEX,
+		GEOMETRY,
 		FRAGMENT,
+		COMPUTE,
 		PROGRAM
 	};
 
-	// Only supports vertex and fragment (this series will only have those two)
+	// Vertex and fragment, optionally with a geometry shader in between.  The
+	// fragment shader may be NULL for a program only captured by transform
+	// feedback.
 	bool loadShaders(const char* vsFilename, const char* fsFilename);
+	bool loadShaders(const char* vsFilename, const char* gsFilename, const char* fsFilename);
+	bool loadComputeShader(const char* csFilename);		// GL 4.3 / ARB_compute_shader
 	void use();
 
+	// Outputs captured by transform feedback, interleaved in this order into
+	// the buffer bound to binding 0.  Set before loading, kept for reloads.
+	void setFeedbackVaryings(const std::vector<string>& names)	{ mFeedbackVaryings = names; }
+
 	GLuint getProgram() const;
 
 	void setUniform(const GLchar* name, const glm::vec2& v);
 	void setUniform(const GLchar* name, const glm::vec3& v);
 	void setUniform(const GLchar* name, const glm::vec4& v);
+	void setUniform(const GLchar* name, const glm::mat3& m);
 	void setUniform(const GLchar* name, const glm::mat4& m);
 	void setUniform(const GLchar* name, const GLfloat f);
 	void setUniform(const GLchar* name, const GLint v);
 	void setUniformSampler(const GLchar* name, const GLint& slot);
+	void setUniformBlock(const GLchar* name, GLuint binding);	// reads the buffer bound to GL_UNIFORM_BUFFER binding
 
 	// We are going to speed up looking for uniforms by keeping their locations in a map
 	GLint getUniformLocation(const GLchar * name);
 
+	// Hot reload : starts rebuilding every program that uses a shader file and
+	// returns how many.  updateReloads() swaps in the ones that are done, once
+	// per frame on the GL thread; it returns how many were replaced.
+	static int reloadFile(const string& fileName);
+	static int updateReloads();
+	bool isReloading() const	{ return mPending != 0; }
+
 private:
+	ShaderProgram(const ShaderProgram& rhs);
+	ShaderProgram& operator = (const ShaderProgram& rhs);
+
+	// Compiles and links without waiting for the result
+	GLuint buildProgram(GLuint shaders[PROGRAM]);
+	// Waits for the result, prints the logs and deletes the shaders; false when it failed
+	bool checkProgram(GLuint program, GLuint shaders[PROGRAM]);
+	bool isBuilt(GLuint program) const;
+	void replaceProgram(GLuint program);
+	void discardPending();
+	bool usesFile(const string& fileName) const;
 
 	string fileToString(const string& filename);
-	void  checkCompileErrors(GLuint shader, ShaderType type);
+	bool  checkCompileErrors(GLuint shader, ShaderType type);
 
 	
 	GLuint mHandle;
 	std::map<string, GLint> mUniformLocations;
+	std::map<string, GLuint> mUniformBlocks;	// set again on a new program
+
+	string mFileName[PROGRAM];			// per stage, empty for the stages not used
+	std::vector<string> mFeedbackVaryings;
+	GLuint mPending;					// program being rebuilt, 0 if none
+	GLuint mPendingShaders[PROGRAM];
 };
 #endif // SHADER_H
@@ -0,0 +1,28 @@
+//-----------------------------------------------------------------------------
+// A mesh instance submitted to the shadow map renderers
+//-----------------------------------------------------------------------------
+#ifndef SHADOW_CASTER_H
+#define SHADOW_CASTER_H
+
+#include "glm/glm.hpp"
+#include "Mesh.h"
+
+struct ShadowCaster
+{
+	Mesh* mesh;
+	glm::mat4 model;
+	bool isStatic;		// static casters may be cached between frames
+
+	// World space bounding sphere built from the mesh bounds and model matrix
+	void getBoundingSphere(glm::vec3& center, float& radius) const
+	{
+		glm::vec3 localCenter = (mesh->getBoundsMin() + mesh->getBoundsMax()) * 0.5f;
+		float localRadius = glm::length(mesh->getBoundsMax() - mesh->getBoundsMin()) * 0.5f;
+		float maxScale = glm::max(glm::length(glm::vec3(model[0])),
+						 glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+
+		center = glm::vec3(model * glm::vec4(localCenter, 1.0f));
+		radius = localRadius * maxScale;
+	}
+};
+#endif //SHADOW_CASTER_H
@@ -1,5 +1,15 @@
 //-----------------------------------------------------------------------------
 // Simple 2D texture class
+//
+// Loads common image formats (decoded to RGBA8, mip maps built on the CPU) or
+// cooked .dds/.ktx2 files made by texcook, which are uploaded as is with all
+// their mip levels.  Streaming loaders allocate the levels first and fill them
+// in bands of rows, typically from a pixel unpack buffer.  Levels can also be
+// made resident one at a time, coarsest first: GL_TEXTURE_BASE_LEVEL points at
+// the finest resident level and finer ones are freed again to save memory.
+// With ARB_bindless_texture, shaders can sample a texture through a resident
+// 64-bit handle instead of a texture unit.  A texture loaded from a file with
+// loadTexture() can be evicted and reloaded from it (see ResourceBudget).
 //-----------------------------------------------------------------------------
 #ifndef TEXTURE2D_H
 #define TEXTURE2D_H
@@ -7,22 +17,90 @@
 #define GLEW_STATIC
 #include "GL/glew.h"
 #include <string>
+#include <vector>
+#include "CompressedImage.h"
+#include "GpuResource.h"
+#include "MipGenerator.h"
 using std::string;
 
-class Texture2D
+class Texture2D : public GpuResource
 {
 public:
 	Texture2D();
 	virtual ~Texture2D();
 
 	bool loadTexture(const string& fileName, bool generateMipMaps = true);
+	bool uploadImage(const unsigned char* rgbaData, int width, int height, bool generateMipMaps = true);
+	bool uploadImage(const unsigned char* rgbaData, int width, int height, const std::vector<MipGenerator::Level>& mipLevels);
+	bool uploadCompressed(const CompressedImage& image);
+
+	// Storage for numLevels levels, to be filled with uploadRegion.  No unpack buffer may be bound.
+	bool allocate(CompressedImage::Format format, bool srgb, int width, int height, int numLevels);
+
+	// Same, level by level: create() allocates nothing and leaves the texture
+	// incomplete (it samples black) until setBaseLevel() points at a level
+	// whose coarser levels are all allocated and filled
+	bool create(CompressedImage::Format format, bool srgb, int width, int height, int numLevels);
+	void allocateLevel(int level);
+	void freeLevel(int level);
+	void setBaseLevel(int level);
+	// Rows y..y+height of a level (whole block rows when compressed); data is an
+	// offset when a GL_PIXEL_UNPACK_BUFFER is bound
+	void uploadRegion(int level, int y, int width, int height, const GLvoid* data, size_t size);
+
 	void bind(GLuint texUnit = 0);
 	void unbind(GLuint texUnit = 0);
 
+	// Flips a tightly packed RGBA image in place (stb loads top row first, GL expects bottom row first)
+	static void flipVertical(unsigned char* rgbaData, int width, int height);
+
+	// False when the driver lacks the extension for a block format
+	static bool isFormatSupported(CompressedImage::Format format, bool srgb);
+
+	// Approximate video memory used by all levels
+	size_t getMemorySize() const { return mMemorySize; }
+
+	GLuint getId() const						{ return mTexture; }
+	CompressedImage::Format getFormat() const	{ return mFormat; }
+	bool isSRGB() const							{ return mSrgb; }
+	int getWidth() const						{ return mWidth; }
+	int getHeight() const						{ return mHeight; }
+	int getNumLevels() const					{ return mNumLevels; }
+	bool isComplete() const						{ return mNumLevels > 0 && mBaseLevel == 0; }	// every level resident
+
+	// GL internal format of a cooked format, 0 if there is none
+	static GLenum getInternalFormat(CompressedImage::Format format, bool srgb);
+
+	// Bindless handle, made resident on first call; 0 without ARB_bindless_texture
+	// or storage.  From then on the levels and the sampling state are frozen:
+	// no more streaming.
+	GLuint64 getResidentHandle();
+	static bool isBindlessSupported()			{ return GLEW_ARB_bindless_texture != GL_FALSE; }
+
+	// GpuResource : only textures made by loadTexture() and without a bindless
+	// handle can be evicted
+	virtual size_t getCpuMemorySize() const		{ return 0; }
+	virtual size_t getGpuMemorySize() const		{ return mMemorySize; }
+	virtual bool isResident() const				{ return mTexture != 0; }
+	virtual bool canEvict() const				{ return !mFileName.empty() && mBindlessHandle == 0; }
+	virtual void evict();
+	virtual bool reload();
+
 private:
 	Texture2D(const Texture2D& rhs) {}
 	Texture2D& operator = (const Texture2D& rhs) {}
 
+	void setLevelParameters(int numLevels);
+
 	GLuint mTexture;
+	CompressedImage::Format mFormat;
+	GLenum mInternalFormat;
+	bool mSrgb;
+	int mWidth, mHeight;
+	int mNumLevels, mBaseLevel;
+	GLuint64 mBindlessHandle;
+	size_t mMemorySize;
+	string mFileName;				// set by loadTexture()
+	bool mGenerateMipMaps;
 };
 #endif //TEXTURE2D_H
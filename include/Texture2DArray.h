@@ -0,0 +1,59 @@
+//-----------------------------------------------------------------------------
+// 2D texture array class
+//
+// Layers of one size and format sharing a single texture object, so draws
+// with different images only change the layer they sample instead of the
+// bound texture.  Layers are filled from existing textures (GPU copies) or
+// from client memory / a pixel unpack buffer, level by level.
+//-----------------------------------------------------------------------------
+#ifndef TEXTURE2D_ARRAY_H
+#define TEXTURE2D_ARRAY_H
+
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "CompressedImage.h"
+#include "Texture2D.h"
+
+class Texture2DArray
+{
+public:
+	Texture2DArray();
+	virtual ~Texture2DArray();
+
+	// Storage for numLayers layers of numLevels levels, contents undefined
+	bool create(CompressedImage::Format format, bool srgb, int width, int height, int numLayers, int numLevels);
+
+	// Copies the first getNumLevels() levels of a texture of the same format
+	// into a layer, with its level 0 at texel x, y (multiples of 4 for block
+	// formats).  Every level copied must be resident.
+	bool copyTexture(const Texture2D& texture, int layer, int x, int y);
+
+	// A rectangle of a level of one layer; data is an offset when a
+	// GL_PIXEL_UNPACK_BUFFER is bound
+	void uploadRegion(int level, int layer, int x, int y, int width, int height, const GLvoid* data, size_t size);
+
+	void bind(GLuint texUnit = 0);
+	void unbind(GLuint texUnit = 0);
+
+	CompressedImage::Format getFormat() const	{ return mFormat; }
+	int getWidth() const						{ return mWidth; }
+	int getHeight() const						{ return mHeight; }
+	int getNumLayers() const					{ return mNumLayers; }
+	int getNumLevels() const					{ return mNumLevels; }
+	size_t getMemorySize() const				{ return mMemorySize; }
+
+	// Layers a driver can hold in one array (256 at least)
+	static int getMaxLayers();
+
+private:
+	Texture2DArray(const Texture2DArray& rhs);
+	Texture2DArray& operator = (const Texture2DArray& rhs);
+
+	GLuint mTexture;
+	CompressedImage::Format mFormat;
+	GLenum mInternalFormat;
+	int mWidth, mHeight;
+	int mNumLayers, mNumLevels;
+	size_t mMemorySize;
+};
+#endif //TEXTURE2D_ARRAY_H
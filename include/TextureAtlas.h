@@ -0,0 +1,80 @@
+//-----------------------------------------------------------------------------
+// Packs textures into the layers of texture arrays
+//
+// Textures of the same format are copied into shared Texture2DArrays, so a
+// batch of draws binds one array and selects each image with a layer index
+// and a rectangle of that layer:
+//  - textures of the same size take a whole layer each
+//  - power of two textures up to a quarter of the largest one across are
+//    packed several per layer, in aligned power of two cells (a quadtree
+//    filled in Z order), so that their mip levels never mix.  The array stops
+//    at the level where its smallest cell is one texel (one 4x4 block for
+//    block formats), and bilinear filtering reads half a texel into the
+//    neighbouring cell at the edges of a packed texture.
+// Every level of a texture must be resident when the atlas is built.  The
+// arrays hold copies: the textures can be released afterwards.
+//-----------------------------------------------------------------------------
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include <memory>
+#include <vector>
+#include "glm/glm.hpp"
+
+#include "Texture2D.h"
+#include "Texture2DArray.h"
+
+class TextureAtlas
+{
+public:
+	struct Placement
+	{
+		int array;			// -1 until built
+		int layer;
+		glm::vec4 rect;		// offset (xy) and scale (zw) of the texture in its layer, in texture coordinates
+	};
+
+	 TextureAtlas();
+	~TextureAtlas();
+
+	// Layers are at most this many texels across (2048 by default)
+	void setMaxLayerSize(int size)		{ mMaxLayerSize = size; }
+
+	// Adds a texture to the next build (the same texture once).  Returns its
+	// entry, or -1 for a texture that stays on its own: empty, incomplete or
+	// larger than a layer.
+	int add(const std::shared_ptr<Texture2D>& texture);
+
+	// Packs the entries added so far and copies them into new arrays
+	bool build();
+	void clear();
+
+	const Placement& getPlacement(int entry) const	{ return mEntries[entry].placement; }
+	int getNumEntries() const			{ return (int)mEntries.size(); }
+	int getNumArrays() const			{ return (int)mArrays.size(); }
+	Texture2DArray& getArray(int index)	{ return *mArrays[index]; }
+	int getNumLayers() const;			// of every array
+	size_t getMemorySize() const;
+
+private:
+	TextureAtlas(const TextureAtlas& rhs);
+	TextureAtlas& operator = (const TextureAtlas& rhs);
+
+	struct Entry
+	{
+		std::shared_ptr<Texture2D> texture;	// until built
+		int cell;							// power of two cell size when packable, 0 for a whole layer
+		int x, y;
+		Placement placement;
+	};
+
+	bool packCells(std::vector<int>& entries);
+	bool packLayers(std::vector<int>& entries);
+	bool createArray(const std::vector<int>& entries, int width, int height, int numLayers, int numLevels);
+
+	std::vector<Entry> mEntries;
+	std::vector<std::unique_ptr<Texture2DArray> > mArrays;
+	int mMaxLayerSize;
+	int mNumBuilt;						// entries already in an array
+};
+#endif //TEXTURE_ATLAS_H
@@ -0,0 +1,275 @@
+//-----------------------------------------------------------------------------
+// Texture loading and streaming service
+//
+// Textures are requested up front and loaded in one batch, in the background:
+//  1. files are read and hashed in parallel (path and content dedup)
+//  2. each unique image is decoded once (ImageDecoder), and its mip chain
+//     built on the CPU, in parallel as background jobs of the job system the
+//     loader shares with the rest of the application.  The jobs write the
+//     levels (flipped for GL, or as cooked), coarsest first, straight into a
+//     ring of mapped pixel buffers.  An image without mip levels that fits a
+//     segment is decoded right into it.
+//  3. update() on the GL thread issues glTexSubImage2D from the filled
+//     buffers, up to a byte budget per call, so a large image streams in over
+//     a few frames instead of stalling one
+// get() hands out an empty texture until the coarsest level of an image is in;
+// finer levels then sharpen it as they arrive (GL_TEXTURE_BASE_LEVEL).
+//
+// With a memory budget, only the small levels are loaded up front.  Each frame
+// the renderer reports the on-screen size of what it draws with markVisible();
+// update() then streams in the finest level each texture needs, one level at a
+// time, and evicts levels that are finer than needed, least recently seen
+// first, to stay within the budget.  The decoded levels stay in system memory
+// for that.
+//
+// Requests for the same path or for files with identical contents share a
+// single Texture2D.  With a cooked directory set, a block compressed .dds made
+// by texcook is used in place of the source image when one exists.
+//
+// reload() reads a file that changed on disk again with the next batch; only
+// that file's image is decoded again.
+//-----------------------------------------------------------------------------
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "JobSystem.h"
+#include "PixelBufferRing.h"
+#include "Texture2D.h"
+
+class TextureLoader
+{
+public:
+	typedef int Handle;
+	static const Handle INVALID_HANDLE = -1;
+
+	explicit TextureLoader(JobSystem& jobs);
+	~TextureLoader();
+
+	// Later requests for <any dir>/name.ext load <directory>/name.dds when it exists
+	void setCookedDirectory(const std::string& directory)	{ mCookedDirectory = directory; }
+
+	// Mip filter of the images that are not cooked (color textures: keep gamma correction on)
+	void setMipFilter(MipGenerator::Filter filter, bool gammaCorrect)	{ mMipFilter = filter; mGammaCorrectMips = gammaCorrect; }
+
+	// Pixel buffer bytes handed to the GL per update(), 0 = no limit
+	void setUploadBudget(size_t bytesPerUpdate)	{ mUploadBudget = bytesPerUpdate; }
+
+	// Staging ring, before the first load.  Persistently mapped when the driver allows it.
+	void setUploadRing(size_t segmentSize, int numSegments, bool allowPersistent = true);
+
+	// Video memory for textures, 0 = load every level (the default).  Set it
+	// before startLoading(): the images of a batch loaded without a budget
+	// keep every level and free their system memory copy.
+	void setMemoryBudget(size_t bytes)			{ mMemoryBudget = bytes; }
+
+	// Not while loading
+	Handle request(const std::string& fileName, bool generateMipMaps = true);
+
+	// Starts reading and decoding everything requested since the last call.
+	// This, update(), markVisible() and loadAll() must be called on the thread
+	// that owns the GL context.
+	void startLoading();
+
+	// Uploads what the workers have staged, within the budget, and streams
+	// levels in and out.  Call once per frame; true when textures became
+	// available through get().
+	bool update();
+	bool isLoading() const				{ return mLoading; }
+
+	// startLoading() then update() without budget until everything is uploaded
+	void loadAll();
+
+	// A texture was drawn this frame over about screenPixels pixels across
+	// (the projected size of the object, assuming its UVs span the texture once)
+	void markVisible(Handle handle, float screenPixels);
+
+	// Always returns a texture for a valid handle (empty while loading or if the file failed to load)
+	std::shared_ptr<Texture2D> get(Handle handle) const;
+
+	// Drops the texture of a request, and of every request sharing it, once it
+	// has been copied elsewhere (a TextureAtlas).  get() then returns the empty
+	// texture.  Not while loading.
+	void release(Handle handle);
+
+	// Loads a file again with the next startLoading(), for every request of
+	// it (by the path requested or the cooked one; a changed source replaces
+	// its cooked copy).  get() keeps returning the current texture until the
+	// new one has a level.  False when no request uses the file, while
+	// loading, or while a level of its image is streaming in (try again later).
+	bool reload(const std::string& fileName);
+	bool isRequested(const std::string& fileName) const	{ return !findFiles(fileName).empty(); }
+
+	// Stats of the last loadAll()
+	int getRequestCount() const			{ return mStats.requests; }
+	int getUniqueFileCount() const		{ return mStats.uniqueFiles; }
+	int getUniqueImageCount() const		{ return mStats.uniqueImages; }
+	int getCompressedCount() const		{ return mStats.compressedImages; }
+	size_t getMemorySize() const		{ return mStats.memorySize; }
+	int getUpdateCount() const			{ return mStats.updates; }	// update() calls it took
+	unsigned getNumThreads() const		{ return mJobs.getNumWorkers(); }
+
+	// Streaming state, refreshed by update()
+	size_t getResidentBytes() const		{ return mResidentBytes; }	// levels allocated in video memory
+	size_t getMemoryBudget() const		{ return mMemoryBudget; }
+	int getPendingLevels() const		{ return mPendingLevels; }	// needed by visible textures, not resident
+	int getStreamingLevels() const		{ return mStreamingLevels; }	// being read into the ring
+
+private:
+	TextureLoader(const TextureLoader& rhs);
+	TextureLoader& operator = (const TextureLoader& rhs);
+
+	struct File
+	{
+		std::string path;
+		std::string sourcePath;		// path as requested, differs from path when cooked
+		bool generateMipMaps;
+		std::vector<unsigned char> bytes;
+		unsigned long long hash;
+		int image;					// index into mImages once hashed
+		bool loaded;
+		bool reloading;				// get() keeps the previous texture meanwhile
+	};
+
+	struct Image
+	{
+		int index;					// in mImages
+		int file;					// first file with this content
+		bool generateMipMaps;
+		bool keepSource;			// source levels kept to stream levels back in
+		// Set by the decoding worker before its first upload, read only afterwards
+		CompressedImage::Format format;
+		bool srgb;
+		int width, height, numLevels;
+		int tailLevel;				// levels from here on are always resident
+		bool isCompressed;			// streamed from block compressed levels
+		std::vector<unsigned char> pixels;	// level 0 decoded (top row first)
+		std::vector<MipGenerator::Level> mipLevels;
+		CompressedImage compressed;	// parsed .dds/.ktx2 instead of pixels
+		// GL thread
+		bool created;
+		int residentLevel;			// finest uploaded level (the base level), numLevels when none
+		bool jobPending;			// a worker is staging levels of this image
+		bool failed;				// a job could not decode or stage it, until reload()
+		size_t jobBytes;			// video memory the job will allocate
+		int wantedLevel;			// finest level needed this frame
+		int lastVisible;			// frame of the last markVisible, -1 never
+		std::shared_ptr<Texture2D> texture;
+	};
+
+	// Rows of a level staged at offset in a ring segment
+	struct Upload
+	{
+		int image;
+		int level, y, width, height;
+		size_t offset, size;
+		bool levelDone;				// the level is complete after this one
+		bool jobDone;				// and so is the job that staged it
+		bool failed;				// nothing to upload, the job ended without its levels
+	};
+
+	// A filled segment, handed from a worker to the GL thread
+	struct Batch
+	{
+		int segment;
+		size_t used;
+		std::vector<Upload> uploads;
+	};
+
+	// Rows of one source level as they are copied into the ring
+	struct LevelSource
+	{
+		const unsigned char* data;
+		int width, height;
+		int blockHeight;			// 4 for block formats (rows are block rows)
+		size_t rowBytes;
+		bool flip;
+	};
+
+	struct Stats
+	{
+		int requests;
+		int uniqueFiles;
+		int uniqueImages;
+		int compressedImages;
+		size_t memorySize;
+		size_t uploadedBytes;
+		int updates;
+		double readMs, decodeMs;
+	};
+
+	static std::string canonicalPath(const std::string& fileName);
+	std::vector<int> findFiles(const std::string& fileName) const;	// by path or source path
+	std::string cookedPath(const std::string& fileName) const;
+	static unsigned long long hashBytes(const std::vector<unsigned char>& bytes);
+
+	void spawn(std::function<void()> task);
+
+	// Jobs
+	void decodeImage(Image* image, File* file);
+	bool decodeToRing(Image* image, const File* file, int width, int height);
+	bool stageLevels(Image* image, int coarsestLevel, int finestLevel);
+	bool streamLevel(Batch& batch, Image* image, int level);
+	LevelSource getLevelSource(const Image* image, int level) const;
+	static void releaseSource(Image* image);
+	void submit(Batch& batch);
+	void submitFailed(Batch& batch, const Image* image);
+
+	// GL thread
+	void dedupFiles();
+	bool uploadBatch(Batch& batch);
+	void updateResidency();
+	bool evictLevel(int keepImage);
+	int getWantedLevel(const Image& image) const;
+	static size_t getLevelSize(const Image& image, int level);
+	void publish();
+	void finishLoading();
+
+	JobSystem& mJobs;
+	std::vector<JobSystem::JobHandle> mJobHandles;	// until done, GL thread only
+	PixelBufferRing mRing;
+	size_t mSegmentSize;
+	int mNumSegments;
+	bool mAllowPersistent;
+	size_t mUploadBudget;
+	size_t mMemoryBudget;
+
+	bool mLoading;
+	bool mDeduped;
+	std::vector<int> mPendingFiles;		// files of the current batch
+	std::chrono::high_resolution_clock::time_point mLoadStart, mReadDone, mDecodeDone;
+	int mFrame;
+
+	// Shared with the workers
+	std::mutex mBatchMutex;
+	std::condition_variable mBatchReady;
+	std::deque<Batch> mBatches;			// filled segments, oldest first
+	int mReadJobs, mDecodeJobs;			// still running
+	std::atomic<bool> mCancel;
+
+	std::map<std::string, int> mFileByPath;
+	std::map<unsigned long long, int> mImageByHash;
+	std::vector<File> mFiles;
+	std::deque<Image> mImages;			// workers keep pointers to the images while new ones are added
+	std::vector<int> mRequestFile;		// handle -> file
+	std::vector<std::shared_ptr<Texture2D> > mFileTexture;	// what get() returns, GL thread only
+	std::shared_ptr<Texture2D> mEmpty;
+	std::string mCookedDirectory;
+	MipGenerator::Filter mMipFilter;
+	bool mGammaCorrectMips;
+
+	size_t mResidentBytes;
+	int mPendingLevels;
+	int mStreamingLevels;
+	Stats mStats;
+};
+#endif //TEXTURE_LOADER_H
@@ -0,0 +1,39 @@
+//-----------------------------------------------------------------------------
+// Minimal fixed size thread pool
+//-----------------------------------------------------------------------------
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned numThreads = 0);	// 0 = one per hardware thread
+	~ThreadPool();
+
+	void enqueue(std::function<void()> task);
+	void wait();	// blocks until every queued task has finished
+
+	unsigned getNumThreads() const { return (unsigned)mWorkers.size(); }
+
+private:
+	ThreadPool(const ThreadPool& rhs);
+	ThreadPool& operator = (const ThreadPool& rhs);
+
+	void workerLoop();
+
+	std::vector<std::thread> mWorkers;
+	std::deque<std::function<void()> > mTasks;
+	std::mutex mMutex;
+	std::condition_variable mTaskReady;
+	std::condition_variable mAllDone;
+	unsigned mActive;
+	bool mStop;
+};
+#endif //THREAD_POOL_H
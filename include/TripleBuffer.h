@@ -0,0 +1,78 @@
+//-----------------------------------------------------------------------------
+// Lock-free triple buffer between one writer and one reader thread
+//
+// Three slots: the writer fills one, the reader reads another, and the third
+// sits between them.  publish() swaps the written slot with the middle one and
+// flags it fresh; update() swaps the read slot with the middle one if it is
+// fresh.  Both are a single atomic exchange, so neither thread ever waits for
+// the other, the reader always gets the newest published slot, and slots the
+// reader had no time for are simply written over.
+//-----------------------------------------------------------------------------
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer();
+
+	// Writer.  The slot holds an older state, not the last published one:
+	// write all of it before publishing.
+	T& getWriteSlot()				{ return mSlots[mWrite]; }
+	void publish();
+
+	// Reader.  Takes the newest slot published since the last call, returns
+	// false (keeping the current slot) if there is none.
+	bool update();
+	const T& getReadSlot() const	{ return mSlots[mRead]; }
+
+private:
+	TripleBuffer(const TripleBuffer& rhs);
+	TripleBuffer& operator = (const TripleBuffer& rhs);
+
+	static const unsigned INDEX_MASK = 3;
+	static const unsigned FRESH = 4;
+
+	T mSlots[3];
+	std::atomic<unsigned> mMiddle;	// index of the middle slot, FRESH once published and until taken
+	unsigned mWrite;				// writer only
+	unsigned mRead;					// reader only
+};
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+template <typename T>
+TripleBuffer<T>::TripleBuffer()
+	: mMiddle(1),
+	  mWrite(0),
+	  mRead(2)
+{
+}
+
+//-----------------------------------------------------------------------------
+// The written slot becomes the middle one; the release makes its contents
+// visible to the reader that takes it
+//-----------------------------------------------------------------------------
+template <typename T>
+void TripleBuffer<T>::publish()
+{
+	mWrite = mMiddle.exchange(mWrite | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+}
+
+//-----------------------------------------------------------------------------
+// Only the writer sets FRESH, so once seen it stays set until the exchange
+//-----------------------------------------------------------------------------
+template <typename T>
+bool TripleBuffer<T>::update()
+{
+	if ((mMiddle.load(std::memory_order_relaxed) & FRESH) == 0)
+		return false;
+
+	mRead = mMiddle.exchange(mRead, std::memory_order_acq_rel) & INDEX_MASK;
+	return true;
+}
+#endif //TRIPLE_BUFFER_H
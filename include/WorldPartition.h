@@ -0,0 +1,171 @@
+//-----------------------------------------------------------------------------
+// World partition : a grid of scene cells streamed in around the camera
+//
+// A world is a directory (see worldcook):
+//
+//   world.index			cellsize <size>, cells <minX> <minZ> <maxX> <maxZ>
+//   palette.scene			the textures and materials every cell may use
+//   cell_<x>_<z>.sceneb	a SceneFile per cell, positions in world space
+//
+// Cell (x, z) covers [x, x + 1) * size on both axes; a cell without a file is
+// empty.  update(), once per frame on the GL thread, loads the cells closer
+// to the camera than the load radius and drops those farther than the unload
+// radius, so a camera moving back and forth along a cell border does not load
+// and drop the same cell over and over.
+//
+// Loading is asynchronous and ordered by distance, nearest first.  A cell file
+// is read and its matrices built in a background job, then the OBJ files of
+// its meshes not loaded yet (and their occluder proxies, if any) are parsed in
+// background jobs too; the number of such jobs in flight is the I/O budget.
+// The vertex buffers are created by update() itself, up to a byte budget per
+// call, and the cell shows up once all of its meshes are in.  Meshes are
+// shared by the cells that use them and freed with the last one.  Textures
+// are the palette's: the application loads them up front with its own.
+//-----------------------------------------------------------------------------
+#ifndef WORLD_PARTITION_H
+#define WORLD_PARTITION_H
+
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "glm/glm.hpp"
+#include "JobSystem.h"
+#include "Mesh.h"
+#include "OcclusionCuller.h"
+#include "SceneFile.h"
+
+class WorldPartition
+{
+public:
+	struct Instance
+	{
+		Mesh* mesh;
+		const std::vector<glm::vec3>* occluder;	// the mesh's OcclusionCuller proxy, null : none
+		int meshId;				// unique among the loaded meshes, below getMaxMeshId()
+		int texture;			// index of the palette's textures, -1 : none
+		int material;			// index of the palette's materials
+		glm::mat4 worldMatrix;
+		glm::mat3 normalMatrix;
+	};
+
+	struct Stats
+	{
+		int loadedCells;
+		int pendingCells;		// queued, reading or waiting for their meshes
+		int meshes;				// in memory, parsed or uploaded
+		int jobsInFlight;
+		size_t cpuBytes;		// parsed vertices and instances
+		size_t gpuBytes;		// vertex buffers
+		size_t uploadedBytes;	// by the last update()
+		int cellLoads, cellUnloads;		// since open()
+		double updateMs;		// of the last update()
+	};
+
+	explicit WorldPartition(JobSystem& jobs);
+	~WorldPartition();			// waits for its jobs
+
+	// Reads the index and the palette; false when the world cannot be used
+	bool open(const std::string& directory);
+	void close();
+	bool isOpen() const						{ return mOpen; }
+
+	// Distances on the ground plane from the camera to the cells' edges
+	void setRadii(float loadRadius, float unloadRadius);
+	void setIoBudget(int jobsInFlight)		{ mIoBudget = jobsInFlight > 0 ? jobsInFlight : 1; }
+	void setUploadBudget(size_t bytes)		{ mUploadBudget = bytes; }		// at least one mesh per update
+	// Mesh ids stay below it : past it a mesh is not loaded (as if it failed),
+	// its instances are left out and a warning is printed once
+	void setMaxMeshes(int meshes)			{ mMaxMeshes = std::max(meshes, 0); }
+
+	// Streams around the camera.  True when cells appeared or went away: the
+	// instances changed.
+	bool update(const glm::vec3& cameraPosition);
+
+	// Of every loaded cell, rebuilt by update() when it returns true
+	const std::vector<Instance>& getInstances() const		{ return mInstances; }
+	const SceneFile& getPalette() const						{ return mPalette; }
+	int getMaxMeshId() const								{ return (int)mMeshes.size(); }
+	float getCellSize() const								{ return mCellSize; }
+	void getCellRange(int& minX, int& minZ, int& maxX, int& maxZ) const;	// inclusive
+	const Stats& getStats() const							{ return mStats; }
+
+private:
+	WorldPartition(const WorldPartition& rhs);
+	WorldPartition& operator = (const WorldPartition& rhs);
+
+	enum CellState { CELL_QUEUED, CELL_READING, CELL_MESHES, CELL_LOADED };
+	enum MeshState { MESH_QUEUED, MESH_PARSING, MESH_PARSED, MESH_UPLOADED, MESH_FAILED };
+
+	// Written by the read job, mesh ids index its meshes until resolved
+	struct CellData
+	{
+		std::vector<std::string> meshes;
+		std::vector<Instance> instances;
+	};
+
+	struct Cell
+	{
+		int x, z;
+		CellState state;
+		float distance;
+		JobSystem::JobHandle job;
+		std::shared_ptr<CellData> data;
+		std::vector<int> meshes;			// slots of mMeshes, one reference each
+		std::vector<Instance> instances;
+	};
+
+	struct MeshSlot
+	{
+		std::string fileName;
+		std::unique_ptr<Mesh> mesh;
+		std::unique_ptr<std::vector<glm::vec3>> occluder;	// loaded with the mesh
+		MeshState state;
+		int refs;							// cells using it, freed at 0
+		float priority;						// distance of the nearest cell waiting for it
+		JobSystem::JobHandle job;
+	};
+
+	static long long cellKey(int x, int z)	{ return ((long long)x << 32) | (unsigned)z; }
+	std::string cellFileName(int x, int z) const;
+	float cellDistance(int x, int z, const glm::vec3& position) const;
+	void readCell(const std::string& fileName, CellData& data) const;
+
+	void pollJobs();
+	bool unloadFar(const glm::vec3& position);
+	void queueNear(const glm::vec3& position);
+	void startJobs();
+	void uploadMeshes();
+	bool finishCells();
+	void releaseMeshes(Cell& cell);
+	void freeUnusedMeshes();
+	int acquireMesh(const std::string& fileName);
+	int countJobsInFlight();
+
+	JobSystem& mJobs;
+	bool mOpen;
+	std::string mDirectory;
+	float mCellSize;
+	int mMinX, mMinZ, mMaxX, mMaxZ;			// inclusive
+	float mLoadRadius, mUnloadRadius;
+	int mIoBudget;
+	size_t mUploadBudget;
+	int mMaxMeshes;
+	bool mWarnedMaxMeshes;
+
+	SceneFile mPalette;
+	std::unordered_map<std::string, int> mPaletteTextures;	// by file
+	std::unordered_map<std::string, int> mPaletteMaterials;	// by name
+
+	std::unordered_map<long long, Cell> mCells;		// every cell not unloaded
+	std::vector<MeshSlot> mMeshes;
+	std::vector<int> mFreeMeshSlots;
+	std::unordered_map<std::string, int> mMeshIndex;		// slot by file
+	std::vector<JobSystem::JobHandle> mOrphanJobs;		// of cells dropped while reading
+
+	std::vector<Instance> mInstances;
+	Stats mStats;
+};
+#endif //WORLD_PARTITION_H
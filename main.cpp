@@ -7,17 +7,55 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
 #include <Camera.h>
+#include <CascadedShadowMap.h>
+#include <DrawData.h>
+#include <DrawListBuilder.h>
+#include <DynamicResolution.h>
+#include <FileWatcher.h>
+#include <FramePipeline.h>
+#include <GpuCuller.h>
+#include <GpuQuery.h>
+#include <ImageDecoder.h>
+#include <JobSystem.h>
 #include <Mesh.h>
+#include <OcclusionCuller.h>
+#include <PointShadowAtlas.h>
+#include <RenderQueue.h>
+#include <ResourceBudget.h>
+#include <SceneFile.h>
+#include <SceneTransforms.h>
 #include <ShaderProgram.h>
 #include <Texture2D.h>
+#include <TextureAtlas.h>
+#include <TextureLoader.h>
+#include <WorldPartition.h>
 
 // --- GLOBAL VARIABLES ---
 const char* APP_TITLE = "Ma Scene Finale";
 int gWindowWidth = 1024;
 int gWindowHeight = 768;
+std::atomic<int> gFramebufferWidth(1024);  // read by the render thread
+std::atomic<int> gFramebufferHeight(768);
 GLFWwindow * gWindow = nullptr;
 bool gWireframe = false;
+std::string gFrameStats; // appended to the window title by showFPS
+std::mutex gFrameStatsMutex; // written by the render thread, read by the main one
+std::atomic<int> gFramesRendered(0);
+std::atomic<bool> gDepthPrepass(true); // F2 toggles the depth-only pre-pass
+std::atomic<bool> gDynamicResolution(true); // F3 toggles dynamic resolution scaling
+std::atomic<bool> gEdgeAwareUpscale(true);  // F4 switches between bilinear and edge-aware upscaling
+std::atomic<bool> gOcclusionCulling(true);  // F5 toggles software occlusion culling
+std::atomic<bool> gGpuCulling(false);       // F6 toggles GPU driven culling
 
 // Background Color
 glm::vec4 gClearColor(0.1f, 0.1f, 0.1f, 1.0f); // Dark blue
@@ -27,13 +65,78 @@ FPSCamera fpsCamera(glm::vec3(0.0f, 2.0f, 10.0f));
 const float MOVE_SPEED = 5.0f;
 const float MOUSE_SENSITIVITY = 0.1f;
 
-// Scene Configuration
-const int numModels = 25;
-Mesh mesh[numModels];
-Texture2D texture[numModels];
-glm::vec3 modelPos[numModels];
-glm::vec3 modelScale[numModels];
+// Simulation : fixed step, and how far it may fall behind before skipping steps
+const double SIMULATION_STEP = 1.0 / 120.0;
+const double SIMULATION_MAX_LAG = 0.1;
 
+// Scene Configuration : the binary form from scenecook when it has been cooked
+const char* SCENE_FILE = "scenes/main.scene";
+const char* COOKED_SCENE_FILE = "scenes/main.sceneb";
+SceneTransforms sceneTransforms; // entity i is instance i of the scene, world and normal matrices cached
+
+// What a draw of the frame uses, a scene instance or a streamed one
+struct DrawItem
+{
+    Mesh* mesh;
+    int meshId;   // key id, unique per mesh
+    int texture;  // -1 : none
+    int material;
+    bool isStatic;
+    const std::vector<glm::vec3>* occluder; // OcclusionCuller proxy of the mesh, null : none
+};
+
+// Draws of the same mesh, texture and material, one indirect draw per GpuCuller phase
+struct DrawBatch
+{
+    Mesh* mesh;
+    int texture;  // -1 : none
+    int material;
+};
+
+// Sun shadows
+const int SHADOW_MAP_SIZE = 2048;
+const int SHADOW_CASCADES = 4;
+
+// Point light shadows
+const int POINT_SHADOW_SIZE = 512;
+const int POINT_SHADOW_SLOTS = 4;
+const int POINT_SHADOW_FACE_BUDGET = 6;       // cube faces refreshed per frame at most
+
+// Dynamic resolution : per axis scale range and GPU frame time budget
+const float DRS_MIN_SCALE = 0.5f;
+const float DRS_MAX_SCALE = 1.0f;
+const float DRS_TARGET_MS = 16.6f;
+
+// Texture streaming : pixel buffer bytes uploaded per frame at most, and video
+// memory for the mip levels the visible objects need
+const size_t TEXTURE_UPLOAD_BUDGET = 16 * 1024 * 1024;
+const size_t TEXTURE_MEMORY_BUDGET = 96 * 1024 * 1024;
+
+// Texture binding, once everything is loaded : bindless handles when the
+// driver has ARB_bindless_texture, otherwise textures up to the max size are
+// copied into the layers of a few arrays, otherwise one bind per draw.  Both
+// keep every mip level, so the memory budget above only applies to the last.
+const bool USE_BINDLESS_TEXTURES = true;
+const bool USE_TEXTURE_ARRAYS = true;
+const int TEXTURE_ARRAY_MAX_SIZE = 2048;
+
+// Video memory of meshes and textures together : the meshes drawn least
+// recently are evicted past it and reloaded from their OBJ file when drawn again
+const size_t RESOURCE_MEMORY_BUDGET = 256 * 1024 * 1024;
+
+// World partition : the cells of a world from cook_world, streamed in around
+// the camera when it exists.  They load within the load radius and go past the
+// unload radius, with so many file reads and OBJ parses in flight and so many
+// vertex bytes uploaded per frame at most.
+const char* WORLD_DIRECTORY = "worlds/outdoor";
+const float WORLD_LOAD_RADIUS = 96.0f;
+const float WORLD_UNLOAD_RADIUS = 128.0f;
+const int WORLD_IO_BUDGET = 4;
+const size_t WORLD_UPLOAD_BUDGET = 4 * 1024 * 1024;
+
+// Hot reload : shaders, models and textures saved in these directories are
+// loaded again while the scene runs (Linux only, through inotify)
+const char* WATCHED_DIRECTORIES[] = { "shaders", "models", "textures" };
 
 // --- PROTOTYPES ---
 bool initOpenGL();
@@ -54,246 +157,929 @@ int main() {
         return -1;
     }
 
-    // --- LOADING ASSETS ---
-    // OBJ 0 : Ground
-    mesh[0].loadOBJ("models/ground.obj");
-    texture[0].loadTexture("textures/ground.png", true);
-    modelPos[0] = glm::vec3(0.0f, 0.0f, 0.0f);
-    modelScale[0] = glm::vec3(0.15f, 0.15f, 0.15f);
-
-    // OBJ 1 : Bags
-    mesh[1].loadOBJ("models/bags.obj");
-    texture[1].loadTexture("textures/bags.png", true);
-    modelPos[1] = glm::vec3(2.0f, 0.0f, -2.5f);
-    modelScale[1] = glm::vec3(0.5f, 0.5f, 0.5f);
-
-    // OBJ 2 : Barrel
-    mesh[2].loadOBJ("models/fire_barrel.obj");
-    texture[2].loadTexture("textures/fire_barrel.png", true);
-    modelPos[2] = glm::vec3(0.0f, 0.0f, 2.0f);
-    modelScale[2] = glm::vec3(1.0f, 1.0f, 1.0f);
-
-    // OBJ 3 : Mattress
-    mesh[3].loadOBJ("models/mattress.obj");
-    texture[3].loadTexture("textures/mattress.png", true);
-    modelPos[3] = glm::vec3(2.0f, 0.0f, 0.0f);
-    modelScale[3] = glm::vec3(1.0f, 1.0f, 1.0f);
-
-    // OBJ 4 : Pirozhok
-    mesh[4].loadOBJ("models/pirozhok.obj");
-    texture[4].loadTexture("textures/pirozhok.png", true);
-    modelPos[4] = glm::vec3(-3.0f, 0.0f, 0.0f);
-    modelScale[4] = glm::vec3(0.04f, 0.04f, 0.04f);
-
-    // OBJ 5 : Mattress
-    mesh[5].loadOBJ("models/mattress.obj");
-    texture[5].loadTexture("textures/mattress.png", true);
-    modelPos[5] = glm::vec3(2.0f, 0.0f, 4.0f);
-    modelScale[5] = glm::vec3(1.0f, 1.0f, 1.0f);
-
-    // OBJ 6 : Pirozhok
-    mesh[6].loadOBJ("models/pirozhok.obj");
-    texture[6].loadTexture("textures/pirozhok.png", true);
-    modelPos[6] = glm::vec3(0.0f, 5.0f, -4.0f);
-    modelScale[6] = glm::vec3(0.04f, 0.04f, 0.04f);
-
-    // OBJ 7 : Bags
-    mesh[7].loadOBJ("models/bags.obj");
-    texture[7].loadTexture("textures/bags.png", true);
-    modelPos[7] = glm::vec3(-4.0f, 0.0f, 1.0f);
-    modelScale[7] = glm::vec3(0.4f, 0.4f, 0.4f);
-
-
-
-
-    // OBJ 8 : Fences back
-    mesh[8].loadOBJ("models/fence.obj");
-    texture[8].loadTexture("textures/fence.png", true);
-    modelPos[8] = glm::vec3(12.0f, 2.0f, 1.0f);
-    modelScale[8] = glm::vec3(1.0f, 1.0f, 1.0f);
-
-
-    // OBJ 9 : Fence front
-    mesh[9].loadOBJ("models/fence.obj");
-    texture[9].loadTexture("textures/fence.png", true);
-    modelPos[9] = glm::vec3(-12.0f, 2.0f, -6.0f);
-    modelScale[9] = glm::vec3(1.0f, 1.0f, 1.0f);
-
-
-    // OBJ 10 : Fences front
-    mesh[10].loadOBJ("models/fence.obj");
-    texture[10].loadTexture("textures/fence.png", true);
-    modelPos[10] = glm::vec3(-11.0f, 1.8f, 4.0f);
-    modelScale[10] = glm::vec3(1.0f, 1.0f, 1.0f);
-
-    // OBJ 11 : Fences back
-    mesh[11].loadOBJ("models/fence.obj");
-    texture[11].loadTexture("textures/fence.png", true);
-    modelPos[11] = glm::vec3(13.0f, 2.0f, -10.0f);
-    modelScale[11] = glm::vec3(1.0f, 1.0f, 1.0f);
-
-    // OBJ 12 : Fences back
-    mesh[12].loadOBJ("models/fence.obj");
-    texture[12].loadTexture("textures/fence.png", true);
-    modelPos[12] = glm::vec3(12.75f, 2.0f, 10.0f);
-    modelScale[12] = glm::vec3(1.0f, 1.0f, 1.0f);
-
-    // OBJ 13 : Fences front
-    mesh[13].loadOBJ("models/fence.obj");
-    texture[13].loadTexture("textures/fence.png", true);
-    modelPos[13] = glm::vec3(-11.75f, 1.8f, 12.5f);
-    modelScale[13] = glm::vec3(1.0f, 1.0f, 1.0f);
-
-    // OBJ 14 : Sign
-    mesh[14].loadOBJ("models/sign.obj");
-    texture[14].loadTexture("textures/sign.png", true);
-    modelPos[14] = glm::vec3(2.0f, 0.0f, 2.0f);
-    modelScale[14] = glm::vec3(1.0f, 1.0f, 1.0f);
-
-    // OBJ 15 : Buildings
-    mesh[15].loadOBJ("models/building.obj");
-    texture[15].loadTexture("textures/building.png", true);
-    modelPos[15] = glm::vec3(-30.0f, 0.0f, 2.0f);
-    modelScale[15] = glm::vec3(1.0f, 1.0f, 1.0f);
-
-    // OBJ 16 : Buildings
-    mesh[16].loadOBJ("models/building.obj");
-    texture[16].loadTexture("textures/building.png", true);
-    modelPos[16] = glm::vec3(30.0f, 0.0f, -40.0f);
-    modelScale[16] = glm::vec3(1.0f, 1.0f, 1.0f);
-
-    // OBJ 17 : Buildings
-    mesh[17].loadOBJ("models/building.obj");
-    texture[17].loadTexture("textures/building.png", true);
-    modelPos[17] = glm::vec3(0.0f, 0.0f, -30.0f);
-    modelScale[17] = glm::vec3(1.0f, 1.0f, 1.0f);
-
-    // OBJ 18 : ferris
-    mesh[18].loadOBJ("models/ferris.obj");
-    texture[18].loadTexture("textures/ferris.jpg", true);
-    modelPos[18] = glm::vec3(0.0f, 0.0f, 30.0f);
-    modelScale[18] = glm::vec3(10.0f, 10.0f, 10.0f);
-
-
-    // OBJ 19 : Energetic
-    mesh[19].loadOBJ("models/energetic.obj");
-    texture[19].loadTexture("textures/energetic.jpg", true);
-    modelPos[19] = glm::vec3(30.0f, 0.0f, 0.0f);
-    modelScale[19] = glm::vec3(11.0f, 11.0f, 11.0f);
-
-
+    // Depth pre-pass : position only stream and an empty fragment shader
+    ShaderProgram depthShader;
+    if (!depthShader.loadShaders("shaders/depth_prepass.vert", "shaders/depth_prepass.frag")) {
+        std::cerr << "Erreur chargement shaders !" << std::endl;
+        return -1;
+    }
+
+    // --- JOBS ---
+    // Workers for every hardware thread but this one, which helps while it
+    // waits; shared by mesh and texture loading and the transform updates
+    JobSystem jobs;
+
+    // --- LOADING THE SCENE ---
+    // Instances, materials and lights, and the files of the meshes and textures
+    // they use, each listed once however many instances share it
+    double loadStart = glfwGetTime();
+    SceneFile scene;
+    const char* sceneFile = std::filesystem::exists(COOKED_SCENE_FILE) ? COOKED_SCENE_FILE : SCENE_FILE;
+    if (!scene.load(sceneFile, &jobs) || scene.getInstances().empty()) {
+        std::cerr << "Erreur chargement scene !" << std::endl;
+        return -1;
+    }
+    const std::vector<SceneFile::Instance>& instances = scene.getInstances();
+    const int numInstances = (int)instances.size();
+    const int numMeshes = (int)scene.getMeshes().size();
+
+    // --- WORLD ---
+    // Cells stream in on the render thread; the textures and materials of its
+    // palette follow the scene's
+    WorldPartition world(jobs);
+    std::vector<std::string> textureFiles = scene.getTextures();
+    std::vector<SceneFile::Material> materials = scene.getMaterials();
+    const int worldTextureBase = (int)textureFiles.size();
+    const int worldMaterialBase = (int)materials.size();
+    if (std::filesystem::exists(std::filesystem::path(WORLD_DIRECTORY) / "world.index") && world.open(WORLD_DIRECTORY)) {
+        world.setRadii(WORLD_LOAD_RADIUS, WORLD_UNLOAD_RADIUS);
+        world.setIoBudget(WORLD_IO_BUDGET);
+        world.setUploadBudget(WORLD_UPLOAD_BUDGET);
+        const SceneFile& palette = world.getPalette();
+        textureFiles.insert(textureFiles.end(), palette.getTextures().begin(), palette.getTextures().end());
+        materials.insert(materials.end(), palette.getMaterials().begin(), palette.getMaterials().end());
+        std::cout << "World " << WORLD_DIRECTORY << ": " << palette.getTextures().size() << " textures, "
+                  << palette.getMaterials().size() << " materials" << std::endl;
+    }
+    const int numTextures = (int)textureFiles.size();
+    if (numMeshes > RenderQueue::MAX_MESHES || (int)materials.size() > RenderQueue::MAX_MATERIALS) {
+        std::cerr << "Erreur scene : plus de " << RenderQueue::MAX_MESHES << " meshes ou "
+                  << RenderQueue::MAX_MATERIALS << " materiaux !" << std::endl;
+        return -1;
+    }
+    // World meshes take the key ids after the scene's : the world leaves out
+    // (and warns about) the meshes past them, so both culling paths agree
+    if (world.isOpen()) {
+        world.setMaxMeshes(RenderQueue::MAX_MESHES - numMeshes);
+        if (numMeshes == RenderQueue::MAX_MESHES)
+            std::cerr << "Attention : pas de meshes de monde, la scene en utilise " << numMeshes << " !" << std::endl;
+    }
 
-    double lastTime = glfwGetTime();
+    // --- LOADING ASSETS ---
+    // Models and textures are only requested here, they are loaded in parallel below
+    TextureLoader textureLoader(jobs);
+    textureLoader.setCookedDirectory("textures/cooked"); // block compressed .dds from texcook, when built
+    std::vector<TextureLoader::Handle> textureHandle(numTextures);
+    for (int t = 0; t < numTextures; t++)
+        textureHandle[t] = textureLoader.request(textureFiles[t], true);
+
+    // OBJ files parsed on all cores, with the occluder proxies of those that
+    // have one, the vertex buffers created here
+    double meshStart = glfwGetTime();
+    std::unique_ptr<Mesh[]> mesh(new Mesh[numMeshes]);
+    std::vector<std::vector<glm::vec3>> occluderTriangles(numMeshes);
+    jobs.parallelFor(0, numMeshes, 1, [&](size_t first, size_t last) {
+        for (size_t m = first; m < last; m++) {
+            mesh[m].parseOBJ(scene.getMeshes()[m]);
+            OcclusionCuller::loadOccluder(scene.getMeshes()[m], occluderTriangles[m]);
+        }
+    });
+    double uploadStart = glfwGetTime();
+    for (int m = 0; m < numMeshes; m++)
+        mesh[m].upload();
+
+    // Meshes under the resource budget, the textures count against it
+    ResourceBudget resourceBudget;
+    resourceBudget.setMemoryBudget(RESOURCE_MEMORY_BUDGET);
+    for (int m = 0; m < numMeshes; m++)
+        resourceBudget.add(&mesh[m], mesh[m].getFileName());
+
+    // An entity per instance, in the same order
+    double instanceStart = glfwGetTime();
+    for (const SceneFile::Instance& instance : instances)
+        sceneTransforms.add(instance.position, instance.scale, instance.rotation);
+    std::vector<int> spinning; // the only matrices rebuilt each step
+    for (int i = 0; i < numInstances; i++) {
+        if (instances[i].spinSpeed != 0.0f)
+            spinning.push_back(i);
+    }
 
-    // --- Main Loop ---
-    while (!glfwWindowShouldClose(gWindow)) {
-        showFPS(gWindow);
+    const SceneFile::Timings& sceneTimings = scene.getTimings();
+    std::ostringstream loadStats;
+    loadStats.precision(2);
+    loadStats << std::fixed << "Scene " << sceneFile << ": " << numInstances << " instances, " << numMeshes << " meshes, "
+              << scene.getTextures().size() << " textures, " << scene.getMaterials().size() << " materials, " << scene.getLights().size() << " lights in "
+              << (glfwGetTime() - loadStart) * 1000.0 << "ms (read " << sceneTimings.readMs << " parse " << sceneTimings.parseMs
+              << " resolve " << sceneTimings.resolveMs << " meshes " << (uploadStart - meshStart) * 1000.0
+              << " upload " << (instanceStart - uploadStart) * 1000.0 << " instances " << (glfwGetTime() - instanceStart) * 1000.0
+              << ")";
+    std::cout << loadStats.str() << std::endl;
+
+    // Decode the unique images on all cores in the background, they stream in during the first frames
+    textureLoader.setUploadBudget(TEXTURE_UPLOAD_BUDGET);
+    const bool bindlessTextures = USE_BINDLESS_TEXTURES && Texture2D::isBindlessSupported();
+    const bool textureArrays = USE_TEXTURE_ARRAYS && !bindlessTextures;
+    std::cout << "Image decoders: " << ImageDecoder::getBackendNames() << std::endl;
+    std::cout << "Textures: " << (bindlessTextures ? "bindless" : textureArrays ? "texture arrays" : "one bind per draw") << std::endl;
+    textureLoader.setMemoryBudget(bindlessTextures || textureArrays ? 0 : TEXTURE_MEMORY_BUDGET);
+    textureLoader.startLoading();
+    std::vector<std::shared_ptr<Texture2D>> texture(numTextures);
+    for (int t = 0; t < numTextures; t++)
+        texture[t] = textureLoader.get(textureHandle[t]);
+
+    // Filled once everything is loaded, and again for reloaded textures : the
+    // bindless handle or the atlas entry of each texture (0 / -1 when it keeps
+    // binding its texture)
+    TextureAtlas textureAtlas;
+    textureAtlas.setMaxLayerSize(TEXTURE_ARRAY_MAX_SIZE);
+    bool texturesChanged = true;
+    std::vector<GLuint64> diffuseHandle(numTextures, 0);
+    std::vector<int> atlasEntry(numTextures, -1);
+
+    // Per-draw data buffer of the lit pass, on uniform buffer binding 0.  It
+    // holds every draw, and grows with the streamed cells; the shader sees
+    // MAX_DRAWS of them at a time.
+    std::vector<DrawData> drawData;
+    GLuint drawBuffer;
+    glGenBuffers(1, &drawBuffer);
+    lightingShader.setUniformBlock("DrawBlock", 0);
+
+    // Draws culled and sorted each frame : the lit pass by state then depth,
+    // the pre-pass by depth only.  The scene's instances come first, at the
+    // index of their entity, then the world's.
+    std::vector<DrawItem> drawItems;
+    std::vector<glm::mat4> drawMatrices;
+    std::vector<glm::mat3> drawNormals;
+    std::vector<DrawListBuilder::Object> drawObjects;
+    DrawListBuilder drawLists;
+    RenderQueue litQueue, prepassQueue;
+
+    // Proxies of the big meshes in view, drawn into a small depth buffer on
+    // the workers before the culling tests the draws against it
+    std::vector<OcclusionCuller::Occluder> occluders;
+    OcclusionCuller occlusion;
+    litQueue.setDepthRange(0.1f, 100.0f);
+    prepassQueue.setDepthRange(0.1f, 100.0f);
+
+    // GPU driven culling, in place of the above when on : the draws in
+    // batches, culled against a depth pyramid and counted on the GPU, or
+    // against the frustum alone by transform feedback without compute
+    // shaders.  The batches are built again when the draws change.
+    GpuCuller gpuCuller;
+    const GpuCuller::Method gpuCullMethod = GpuCuller::isSupported(GpuCuller::METHOD_COMPUTE)
+        ? GpuCuller::METHOD_COMPUTE : GpuCuller::METHOD_TRANSFORM_FEEDBACK;
+    const bool gpuCullingSupported = GpuCuller::isSupported(gpuCullMethod) && gpuCuller.init(gpuCullMethod);
+    const bool gpuCullFixup = gpuCullMethod == GpuCuller::METHOD_COMPUTE;   // the second phase, against the pyramid
+    std::cout << "GPU culling: ";
+    if (gpuCullingSupported)
+        std::cout << (gpuCullFixup ? "compute" : "transform feedback, frustum only") << " (F6)" << std::endl;
+    else
+        std::cout << "unavailable" << std::endl;
+    std::vector<DrawBatch> drawBatches;
+    std::vector<Mesh*> batchMeshes;
+    std::vector<GpuCuller::Instance> gpuInstances;
+    bool batchesChanged = true;
+    bool wasGpuCulling = false;
+
+
+    // --- SHADOWS ---
+    CascadedShadowMap sunShadows;
+    if (!sunShadows.init(SHADOW_MAP_SIZE, SHADOW_CASCADES)) {
+        std::cerr << "Erreur creation shadow maps !" << std::endl;
+        return -1;
+    }
+    std::vector<ShadowCaster> shadowCasters;
 
-        // Time handeling (DeltaTime)
-        double currentTime = glfwGetTime();
-        double deltaTime = currentTime - lastTime;
-        lastTime = currentTime;
+    PointShadowAtlas pointShadows;
+    if (!pointShadows.init(POINT_SHADOW_SIZE, POINT_SHADOW_SLOTS)) {
+        std::cerr << "Erreur creation point shadows !" << std::endl;
+        return -1;
+    }
+    pointShadows.setFaceBudget(POINT_SHADOW_FACE_BUDGET);
+
+    // Lights of the scene : the first sun, and every point light shadowed.  A
+    // light following an instance (a lamp inside it) is not shadowed by it.
+    SceneFile::Light sun = SceneFile::makeLight(SceneFile::LIGHT_SUN);
+    std::vector<SceneFile::Light> pointLights;
+    bool hasSun = false;
+    for (const SceneFile::Light& light : scene.getLights()) {
+        if (light.type == SceneFile::LIGHT_SUN && !hasSun) {
+            sun = light;
+            hasSun = true;
+        } else if (light.type == SceneFile::LIGHT_POINT) {
+            glm::vec3 position = light.position;
+            if (light.instance >= 0)
+                position += sceneTransforms.getPosition(light.instance);
+            pointShadows.addLight(position, light.radius, light.instance); // light id = index in pointLights
+            pointLights.push_back(light);
+        }
+    }
+    sunShadows.setLightDirection(sun.direction);
+    if (pointLights.size() > 1)
+        std::cout << "The lit shader has one point light, " << pointLights.size() - 1 << " more are ignored" << std::endl;
+
+    // --- DYNAMIC RESOLUTION ---
+    int fbWidth, fbHeight;
+    glfwGetFramebufferSize(gWindow, &fbWidth, &fbHeight);
+    DynamicResolution dynamicRes;
+    if (!dynamicRes.init(fbWidth, fbHeight)) {
+        std::cerr << "Erreur creation dynamic resolution !" << std::endl;
+        return -1;
+    }
+    dynamicRes.setScaleRange(DRS_MIN_SCALE, DRS_MAX_SCALE);
+    dynamicRes.setTargetFrameTime(DRS_TARGET_MS);
+
+    // Fragment shader invocation counters, to compare the two render modes
+    GpuQuery prepassQuery, litQuery;
+    if (GLEW_ARB_pipeline_statistics_query) {
+        prepassQuery.init(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+        litQuery.init(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+    }
 
+    // --- HOT RELOAD ---
+    FileWatcher fileWatcher;
+    if (FileWatcher::isSupported()) {
+        for (const char* directory : WATCHED_DIRECTORIES)
+            fileWatcher.watch(directory);
+    }
+    std::vector<std::string> changedTextures; // reloaded once the loader is idle
+
+    // --- SIMULATION ---
+    // This thread handles the events and steps the camera and the animation at
+    // a fixed rate.  Each step ends with a snapshot of everything the frame
+    // draws, published to the render thread.
+    FramePipeline framePipeline;
+    double simulationTime = 0.0;
+    auto simulate = [&]() {
         // Input Management
         glfwPollEvents();
-        update(deltaTime);
+        double inputTime = FramePipeline::now();
+        update(SIMULATION_STEP);
+
+        // Spinning instances, the only matrices rebuilt each step
+        simulationTime += SIMULATION_STEP;
+        for (int i : spinning) {
+            float angle = glm::radians(instances[i].spinSpeed * (float)simulationTime);
+            sceneTransforms.setRotation(i, glm::angleAxis(angle, instances[i].spinAxis) * instances[i].rotation);
+        }
+        sceneTransforms.update(&jobs);
+
+        FrameSnapshot& snapshot = framePipeline.beginSnapshot();
+        snapshot.time = simulationTime;
+        snapshot.inputTime = inputTime;
+        snapshot.cameraPosition = fpsCamera.getPosition();
+        snapshot.cameraLook = fpsCamera.getLook();
+        snapshot.cameraRight = fpsCamera.getRight();
+        snapshot.cameraUp = fpsCamera.getUp();
+        snapshot.cameraFOV = fpsCamera.getFOV();
+        sceneTransforms.copyMatrices(snapshot.worldMatrices, snapshot.normalMatrices);
+        snapshot.sunDirection = sun.direction;
+        snapshot.pointLights.resize(pointLights.size());
+        for (size_t p = 0; p < pointLights.size(); p++) {
+            snapshot.pointLights[p] = pointLights[p].position;
+            if (pointLights[p].instance >= 0) // the lamp moves with it
+                snapshot.pointLights[p] += sceneTransforms.getPosition(pointLights[p].instance);
+        }
+        framePipeline.publish();
+    };
+    simulate(); // the first frame has something to draw
+
+    // --- RENDER THREAD ---
+    // Takes over the GL context and draws the newest snapshot, as often as the
+    // GPU (and vsync) allow.  Neither thread ever waits for the other.
+    std::atomic<bool> rendering(true);
+    glfwMakeContextCurrent(NULL);
+    std::thread renderThread([&] {
+        glfwMakeContextCurrent(gWindow);
+        FixedCamera camera;
+        while (rendering) {
+            // Newest state of the simulation, read only
+            const FrameSnapshot& frame = framePipeline.acquire();
+
+            // A minimized window has a 0x0 framebuffer and no aspect ratio :
+            // the snapshot is dropped until it has a size again
+            fbWidth = gFramebufferWidth;
+            fbHeight = gFramebufferHeight;
+            if (fbWidth <= 0 || fbHeight <= 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            camera.set(frame.cameraPosition, frame.cameraLook, frame.cameraRight, frame.cameraUp, frame.cameraFOV);
+            const bool depthPrepass = gDepthPrepass; // the key callback may toggle it meanwhile
+            const bool gpuCulling = gGpuCulling && gpuCullingSupported;
+            const bool occlusionCulling = gOcclusionCulling && !gpuCulling;
+
+            // Files saved since the last frame : shader programs rebuild in the
+            // background, meshes reload now (unless evicted, they read the new file
+            // when drawn again), textures with the next loader batch
+            for (const std::string& path : fileWatcher.poll()) {
+                ShaderProgram::reloadFile(path);
+
+                bool meshChanged = false;
+                for (int m = 0; m < numMeshes; m++) {
+                    if (mesh[m].getFileName() == path && mesh[m].isResident())
+                        meshChanged = mesh[m].loadOBJ(path) || meshChanged;
+                }
+                if (meshChanged) {
+                    sunShadows.invalidateStatic();
+                    pointShadows.invalidate();
+                    batchesChanged = true; // new bounds
+                }
+
+                if (std::find(changedTextures.begin(), changedTextures.end(), path) == changedTextures.end())
+                    changedTextures.push_back(path);
+            }
+            ShaderProgram::updateReloads();
+
+            if (!changedTextures.empty() && !textureLoader.isLoading()) {
+                std::vector<std::string> retry;
+                bool reloaded = false;
+                for (const std::string& path : changedTextures) {
+                    if (textureLoader.reload(path))
+                        reloaded = true;
+                    else if (textureLoader.isRequested(path))
+                        retry.push_back(path); // a level is streaming in
+                }
+                changedTextures.swap(retry);
+                if (reloaded)
+                    textureLoader.startLoading();
+            }
 
-        // Cleaning screen buffers
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            // Textures finished streaming replace the empty ones, finer mips follow
+            // what was seen last frame.  A new texture needs a new handle or layer.
+            if (textureLoader.update()) {
+                for (int t = 0; t < numTextures; t++) {
+                    std::shared_ptr<Texture2D> loaded = textureLoader.get(textureHandle[t]);
+                    if (loaded != texture[t]) {
+                        texture[t] = loaded;
+                        diffuseHandle[t] = 0;
+                        atlasEntry[t] = -1;
+                    }
+                }
+                texturesChanged = true;
+            }
 
-        // -- RENDERING ZONE ---
-        // Activating the Shader
-        lightingShader.use();
+            // All loaded : make the textures resident, or pack them into arrays and
+            // let go of the originals.  After a reload only the new textures are
+            // added, in new arrays; the layers they replace stay until exit.
+            if (bindlessTextures && texturesChanged && !textureLoader.isLoading()) {
+                texturesChanged = false;
+                for (int t = 0; t < numTextures; t++) {
+                    if (diffuseHandle[t] == 0 && texture[t] && texture[t]->isComplete())
+                        diffuseHandle[t] = texture[t]->getResidentHandle();
+                }
+            }
+            if (textureArrays && texturesChanged && !textureLoader.isLoading()) {
+                texturesChanged = false;
+                bool added = false;
+                for (int t = 0; t < numTextures; t++) {
+                    if (atlasEntry[t] < 0) {
+                        atlasEntry[t] = textureAtlas.add(texture[t]);
+                        added = added || atlasEntry[t] >= 0;
+                    }
+                }
+                if (added)
+                    textureAtlas.build();
+
+                for (int t = 0; t < numTextures; t++) {
+                    if (atlasEntry[t] >= 0 && textureAtlas.getPlacement(atlasEntry[t]).array >= 0)
+                        textureLoader.release(textureHandle[t]);
+                    else
+                        atlasEntry[t] = -1;
+                }
+                for (int t = 0; t < numTextures; t++)
+                    texture[t] = textureLoader.get(textureHandle[t]);
+            }
 
-        // -- Calculating the Transformation Matrix --
-        // VIEW : Camera Position
-        glm::mat4 view = fpsCamera.getViewMatrix();
+            // Offscreen target at the current resolution scale
+            dynamicRes.setEnabled(gDynamicResolution);
+            dynamicRes.setFilter(gEdgeAwareUpscale ? DynamicResolution::EDGE_AWARE : DynamicResolution::BILINEAR);
+            if (!dynamicRes.beginFrame(fbWidth, fbHeight))
+                continue;
 
-        // PROJECTION : Perspective (FOV, Screen ratio, Near plane, Far plane)
-        glm::mat4 projection = glm::perspective(glm::radians(fpsCamera.getFOV()),
-                               (float)gWindowWidth / (float)gWindowHeight,
-                               0.1f, 100.0f);
+            // Cleaning screen buffers
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+            // World cells around the camera.  Cells in or out change the static shadows.
+            if (world.update(frame.cameraPosition)) {
+                sunShadows.invalidateStatic();
+                pointShadows.invalidate();
+                batchesChanged = true;
+            }
 
-        // -- Sending Uniforms to Shader --
-        // The shader should be actif
-        lightingShader.setUniform("view", view);
-        lightingShader.setUniform("projection", projection);
+            // Everything drawn this frame.  Only the spinning instances are
+            // dynamic, the rest stays in the shadow cache.
+            const std::vector<WorldPartition::Instance>& worldInstances = world.getInstances();
+            const int numDraws = numInstances + (int)worldInstances.size();
+            drawItems.resize(numDraws);
+            for (int i = 0; i < numInstances; i++)
+                drawItems[i] = {&mesh[instances[i].mesh], instances[i].mesh, instances[i].texture, instances[i].material, instances[i].spinSpeed == 0.0f,
+                                occluderTriangles[instances[i].mesh].empty() ? nullptr : &occluderTriangles[instances[i].mesh]};
+            for (size_t w = 0; w < worldInstances.size(); w++) {
+                const WorldPartition::Instance& instance = worldInstances[w];
+                drawItems[numInstances + w] = {instance.mesh, numMeshes + instance.meshId,
+                                               instance.texture >= 0 ? worldTextureBase + instance.texture : -1,
+                                               worldMaterialBase + instance.material, true, instance.occluder};
+            }
 
+            // The world's matrices after the scene's, when there is a world in view
+            if (!worldInstances.empty()) {
+                drawMatrices.assign(frame.worldMatrices.begin(), frame.worldMatrices.end());
+                drawNormals.assign(frame.normalMatrices.begin(), frame.normalMatrices.end());
+                for (const WorldPartition::Instance& instance : worldInstances) {
+                    drawMatrices.push_back(instance.worldMatrix);
+                    drawNormals.push_back(instance.normalMatrix);
+                }
+            }
+            const std::vector<glm::mat4>& worldMatrices = worldInstances.empty() ? frame.worldMatrices : drawMatrices;
+            const std::vector<glm::mat3>& normalMatrices = worldInstances.empty() ? frame.normalMatrices : drawNormals;
+
+            // A draw buffer range for every MAX_DRAWS draws
+            if ((int)drawData.size() < numDraws) {
+                const int numDrawBuffers = (numDraws + MAX_DRAWS - 1) / MAX_DRAWS;
+                drawData.resize(numDrawBuffers * MAX_DRAWS);
+                glBindBuffer(GL_UNIFORM_BUFFER, drawBuffer);
+                glBufferData(GL_UNIFORM_BUFFER, drawData.size() * sizeof(DrawData), NULL, GL_DYNAMIC_DRAW);
+                glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            }
 
-        // Uniforms of Lighting Directional
-        lightingShader.setUniform("viewPos", fpsCamera.getPosition());
+            shadowCasters.clear();
+            for (int i = 0; i < numDraws; i++)
+                shadowCasters.push_back({drawItems[i].mesh, worldMatrices[i], drawItems[i].isStatic});
+
+            // -- Calculating the Transformation Matrix --
+            // VIEW : Camera Position
+            glm::mat4 view = camera.getViewMatrix();
+
+            // PROJECTION : Perspective (FOV, Screen ratio, Near plane, Far plane)
+            const float aspect = (float)fbWidth / (float)fbHeight;
+            glm::mat4 projection = glm::perspective(glm::radians(camera.getFOV()),
+                                   aspect,
+                                   0.1f, 100.0f);
+
+            // -- BUILD PHASE --
+            // Key ids of the textures : 0 for bindless draws and instances
+            // without one (nothing to bind), then the arrays, then the textures
+            // bound per draw.
+            std::vector<Texture2D*> boundTextures;
+            std::vector<int> textureIds(numTextures, 0);
+            for (int t = 0; t < numTextures; t++) {
+                if (diffuseHandle[t] == 0 && atlasEntry[t] >= 0) {
+                    textureIds[t] = 1 + textureAtlas.getPlacement(atlasEntry[t]).array;
+                } else if (diffuseHandle[t] == 0 && texture[t]) {
+                    std::vector<Texture2D*>::iterator found = std::find(boundTextures.begin(), boundTextures.end(), texture[t].get());
+                    if (found == boundTextures.end())
+                        found = boundTextures.insert(found, texture[t].get());
+                    textureIds[t] = 1 + textureAtlas.getNumArrays() + (int)(found - boundTextures.begin());
+                }
+            }
 
-        // Properties of directional lighting (SUN)
-        lightingShader.setUniform("dirLight.direction", glm::vec3(0.0f, -1.0f, -1.0f)); // Comming from the top and back
-        lightingShader.setUniform("dirLight.ambient",   glm::vec3(0.001f, 0.001f, 0.001f));   // stale lighting everywhere
-        lightingShader.setUniform("dirLight.diffuse",   glm::vec3(0.9f, 0.9f, 0.9f));   // Shiny colour
-        lightingShader.setUniform("dirLight.specular",  glm::vec3(1.0f, 1.0f, 1.0f));   // Reflects in pure white
+            // Bounds and key ids of the draws
+            drawObjects.resize(numDraws);
+            for (int i = 0; i < numDraws; i++) {
+                const DrawItem& item = drawItems[i];
+                DrawListBuilder::Object& object = drawObjects[i];
+                object.center = 0.5f * (item.mesh->getBoundsMin() + item.mesh->getBoundsMax());
+                object.radius = 0.5f * glm::length(item.mesh->getBoundsMax() - item.mesh->getBoundsMin());
+                object.pass = RenderQueue::PASS_OPAQUE;
+                object.program = 0;
+                object.texture = item.texture >= 0 ? textureIds[item.texture] : 0;
+                object.material = item.material;
+                object.mesh = item.meshId;
+            }
 
-        // --- CONFIGURATION PIROZHOK 6 LIGHT (Point Light) ---
-        lightingShader.setUniform("pointLight.position", modelPos[6]);
+            // GPU culling : a batch per mesh, texture and material, in that order
+            // of the textures and materials.  Just turned on, the pyramid is of
+            // another frame.
+            if (gpuCulling && (batchesChanged || !wasGpuCulling || (int)gpuInstances.size() != numDraws)) {
+                std::map<std::tuple<int, int, Mesh*>, int> batchIds;
+                for (const DrawItem& item : drawItems)
+                    batchIds.emplace(std::make_tuple(item.texture, item.material, item.mesh), 0);
+                drawBatches.clear();
+                batchMeshes.clear();
+                for (auto& batch : batchIds) {
+                    batch.second = (int)drawBatches.size();
+                    drawBatches.push_back({std::get<2>(batch.first), std::get<0>(batch.first), std::get<1>(batch.first)});
+                    batchMeshes.push_back(std::get<2>(batch.first));
+                }
+
+                gpuInstances.resize(numDraws);
+                for (int i = 0; i < numDraws; i++) {
+                    const DrawItem& item = drawItems[i];
+                    gpuInstances[i] = {batchIds[std::make_tuple(item.texture, item.material, item.mesh)], i,
+                                       item.mesh->getBoundsMin(), item.mesh->getBoundsMax()};
+                }
+                gpuCuller.setInstances(batchMeshes, gpuInstances);
+                batchesChanged = false;
+            }
+            if (gpuCulling && !wasGpuCulling)
+                gpuCuller.invalidatePyramid();
+            wasGpuCulling = gpuCulling;
+
+            // Where a draw reads its diffuse map
+            auto packDrawData = [&](DrawData& data, int t) {
+                data.diffuseHandle = t >= 0 ? diffuseHandle[t] : 0;
+                data.textureSource = TEXTURE_BOUND;
+                data.layer = 0.0f;
+                data.rect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+                if (t >= 0 && diffuseHandle[t] != 0) {
+                    data.textureSource = TEXTURE_BINDLESS;
+                } else if (t >= 0 && atlasEntry[t] >= 0) {
+                    const TextureAtlas::Placement& placement = textureAtlas.getPlacement(atlasEntry[t]);
+                    data.textureSource = TEXTURE_ARRAY;
+                    data.layer = (GLfloat)placement.layer;
+                    data.rect = placement.rect;
+                }
+            };
+
+            // Every draw with a proxy occludes, the frustum drops the rest
+            occluders.clear();
+            if (occlusionCulling) {
+                for (int i = 0; i < numDraws; i++) {
+                    if (drawItems[i].occluder)
+                        occluders.push_back({drawItems[i].occluder, worldMatrices[i]});
+                }
+            }
+            drawLists.setOcclusion(occlusionCulling ? &occlusion : nullptr);
+
+            // Culling, sort keys and where each draw reads its diffuse map, on
+            // the workers while this thread renders the shadows.  The GPU
+            // culls on its own, only the batches' maps are left.
+            JobSystem::JobHandle buildJob = jobs.spawn([&] {
+                if (gpuCulling) {
+                    for (size_t b = 0; b < drawBatches.size(); b++)
+                        packDrawData(drawData[b], drawBatches[b].texture);
+                    return;
+                }
+                if (occlusionCulling)
+                    occlusion.rasterize(occluders, view, projection, &jobs);
+                drawLists.build(drawObjects, worldMatrices, view, projection, litQueue, &prepassQueue, &jobs);
+                drawLists.pack(litQueue, [&](size_t n, const RenderQueue::Packet& packet) {
+                    packDrawData(drawData[n], drawItems[packet.object].texture);
+                }, &jobs);
+            });
+
+            // GPU culling, first phase : against the last frame's pyramid
+            if (gpuCulling) {
+                gpuCuller.setMatrices(worldMatrices);
+                gpuCuller.cull(GpuCuller::PHASE_PREVIOUS, view, projection);
+            }
 
-        lightingShader.setUniform("pointLight.ambient",  glm::vec3(2.0f, 2.0f, 2.0f)); // Faible lueur jaune
-        lightingShader.setUniform("pointLight.diffuse",  glm::vec3(1.0f, 0.8f, 0.6f)); // Éclairage chaud fort
-        lightingShader.setUniform("pointLight.specular", glm::vec3(1.0f, 1.0f, 1.0f));
+            // -- SHADOW PASS --
+            sunShadows.update(camera, aspect, 0.1f, 100.0f);
+            sunShadows.render(shadowCasters);
+
+            for (size_t p = 0; p < frame.pointLights.size(); p++)
+                pointShadows.setLightPosition((int)p, frame.pointLights[p]);
+            pointShadows.update(camera, aspect, 0.1f, 100.0f, shadowCasters);
+            pointShadows.render(shadowCasters);
+
+            // Casters the shadows drew, or skipped because they were evicted :
+            // reloaded, the caches are redrawn with them next frame.  The
+            // world's meshes are its own.
+            const int reloads = resourceBudget.getReloadCount();
+            for (int c : sunShadows.getDrawnCasters()) {
+                if (c < numInstances)
+                    resourceBudget.use(drawItems[c].mesh);
+            }
+            for (int c : pointShadows.getDrawnCasters()) {
+                if (c < numInstances)
+                    resourceBudget.use(drawItems[c].mesh);
+            }
+            if (resourceBudget.getReloadCount() != reloads) {
+                sunShadows.invalidateStatic();
+                pointShadows.invalidate();
+            }
 
-        // Atténuation 50 unit distance
-        lightingShader.setUniform("pointLight.constant",  1.0f);
-        lightingShader.setUniform("pointLight.linear",    0.09f);
-        lightingShader.setUniform("pointLight.quadratic", 0.032f);
+            // -- SUBMIT PHASE --
+            // From here on only GL calls over the finished lists
+            jobs.wait(buildJob);
 
-        // -- Drawing Loop --
-        for (int i = 0; i < numModels; i++)
-        {
-            // Calculating model Matrix for given object
-            glm::mat4 model = glm::mat4(1.0f);
+            // Meshes the pre-pass and the lit pass draw : reloaded before the
+            // draws if they were evicted.  The GPU draws every batch.
+            if (gpuCulling) {
+                for (const DrawBatch& batch : drawBatches)
+                    resourceBudget.use(batch.mesh);
+            } else {
+                for (size_t n = 0; n < litQueue.size(); n++) {
+                    int i = litQueue.getPacket(n).object;
+                    if (i < numInstances)
+                        resourceBudget.use(drawItems[i].mesh);
+                }
+                for (size_t n = 0; depthPrepass && n < prepassQueue.size(); n++) {
+                    int i = prepassQueue.getPacket(n).object;
+                    if (i < numInstances)
+                        resourceBudget.use(drawItems[i].mesh);
+                }
+            }
+
+            // Mip levels the textures need at their current size on screen.  The
+            // CPU does not know which instances the GPU keeps : every batch's
+            // texture at full size.
+            if (gpuCulling) {
+                for (const DrawBatch& batch : drawBatches) {
+                    if (batch.texture >= 0)
+                        textureLoader.markVisible(textureHandle[batch.texture], (float)dynamicRes.getRenderHeight());
+                }
+            } else {
+                for (size_t n = 0; n < litQueue.size(); n++) {
+                    int i = litQueue.getPacket(n).object;
+                    if (drawItems[i].texture >= 0)
+                        textureLoader.markVisible(textureHandle[drawItems[i].texture], drawLists.getScreenSize(i) * dynamicRes.getRenderHeight());
+                }
+            }
+
+            // -- DEPTH PRE-PASS --
+            // Lays down the closest depth so the lit pass (GL_EQUAL, no depth
+            // writes) shades every pixel exactly once.
+            if (depthPrepass)
+            {
+                prepassQuery.begin();
+                depthShader.use();
+                depthShader.setUniform("view", view);
+                depthShader.setUniform("projection", projection);
+                depthShader.setUniform("instanced", (GLint)gpuCulling);
+
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                if (gpuCulling)
+                {
+                    // First phase, the pyramid from its depth, then what it uncovers
+                    for (int b = 0; b < gpuCuller.getNumBatches(); b++)
+                        gpuCuller.drawBatch(GpuCuller::PHASE_PREVIOUS, b, true);
+                    Mesh::unbind();
+                    if (gpuCullFixup) {
+                        gpuCuller.buildPyramid(dynamicRes.getDepthTexture(), dynamicRes.getRenderWidth(), dynamicRes.getRenderHeight());
+                        gpuCuller.cull(GpuCuller::PHASE_FIXUP, view, projection);
+                        depthShader.use();
+                        for (int b = 0; b < gpuCuller.getNumBatches(); b++)
+                            gpuCuller.drawBatch(GpuCuller::PHASE_FIXUP, b, true);
+                        Mesh::unbind();
+                    }
+                }
+                else
+                {
+                    for (size_t n = 0; n < prepassQueue.size(); n++) // front to back
+                    {
+                        int i = prepassQueue.getPacket(n).object;
+                        depthShader.setUniform("model", worldMatrices[i]);
+                        drawItems[i].mesh->drawPositions();
+                    }
+                }
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                prepassQuery.end();
+
+                glDepthFunc(GL_EQUAL);
+                glDepthMask(GL_FALSE);
+            }
+
+            // -- RENDERING ZONE ---
+            litQuery.begin();
 
-            // Position
-            model = glm::translate(model, modelPos[i]);
+            // Activating the Shader
+            lightingShader.use();
 
-            // Rotation simple animation for pirozhok
-            if (i == 6) {
-                model = glm::rotate(model, (float)glfwGetTime(), glm::vec3(0.3f, 1.0f, 0.7f));
-                lightingShader.setUniform("material.ambient", glm::vec3(2.0f, 2.0f, 2.0f));
-                lightingShader.setUniform("material.specular", glm::vec3(0.0f, 0.0f, 0.0f));
+            // -- Sending Uniforms to Shader --
+            // The shader should be actif
+            lightingShader.setUniform("view", view);
+            lightingShader.setUniform("projection", projection);
+            lightingShader.setUniform("instanced", (GLint)gpuCulling);
+
+
+            // Uniforms of Lighting Directional
+            lightingShader.setUniform("viewPos", camera.getPosition());
+
+            // Properties of directional lighting (SUN)
+            lightingShader.setUniform("dirLight.direction", frame.sunDirection); // Comming from the top and back
+            lightingShader.setUniform("dirLight.ambient",   sun.ambient);
+            lightingShader.setUniform("dirLight.diffuse",   sun.diffuse);
+            lightingShader.setUniform("dirLight.specular",  sun.specular);
+
+            // --- POINT LIGHT --- the first of the scene, black without one
+            const bool hasPointLight = !pointLights.empty();
+            const glm::vec3 black(0.0f);
+            lightingShader.setUniform("pointLight.position", hasPointLight ? frame.pointLights[0] : black);
+
+            lightingShader.setUniform("pointLight.ambient",  hasPointLight ? pointLights[0].ambient : black);
+            lightingShader.setUniform("pointLight.diffuse",  hasPointLight ? pointLights[0].diffuse : black);
+            lightingShader.setUniform("pointLight.specular", hasPointLight ? pointLights[0].specular : black);
+
+            // Atténuation 50 unit distance
+            lightingShader.setUniform("pointLight.constant",  1.0f);
+            lightingShader.setUniform("pointLight.linear",    0.09f);
+            lightingShader.setUniform("pointLight.quadratic", 0.032f);
+
+            // Sun shadow cascades on texture unit 1 (unit 0 is the diffuse map)
+            sunShadows.bind(lightingShader, 1);
+
+            // Point shadow atlas on texture unit 2
+            pointShadows.bind(lightingShader, 2);
+            lightingShader.setUniform("pointLight.shadowSlot", (GLint)(hasPointLight ? pointShadows.getSlot(0) : -1));
+            lightingShader.setUniform("pointLight.shadowFar", hasPointLight ? pointShadows.getFarPlane(0) : 1.0f);
+
+            // Per-draw data packed in the build phase, bound MAX_DRAWS at a time below
+            glBindBuffer(GL_UNIFORM_BUFFER, drawBuffer);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, (gpuCulling ? drawBatches.size() : litQueue.size()) * sizeof(DrawData), drawData.data());
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+            // Diffuse maps : a texture of their own on unit 0, or a layer of the texture array on unit 3
+            lightingShader.setUniformSampler("material.diffuseMap", 0);
+            lightingShader.setUniformSampler("material.diffuseArray", 3);
+            int boundArray = -1;
+            int textureBinds = 0;
+            int drawIndex = 0;
+
+            // -- Drawing Loop --
+            // Only the state that differs from the previous draw is set.  There is
+            // one program, already in use.  Texture : none to bind for bindless
+            // draws, an array or a texture of its own otherwise.
+            RenderQueue::Callbacks litCallbacks;
+            litCallbacks.setTexture = [&](const RenderQueue::Packet& packet) {
+                int t = drawItems[packet.object].texture;
+                if (drawData[drawIndex].textureSource == TEXTURE_ARRAY) {
+                    boundArray = textureAtlas.getPlacement(atlasEntry[t]).array;
+                    textureAtlas.getArray(boundArray).bind(3);
+                    textureBinds++;
+                } else if (drawData[drawIndex].textureSource == TEXTURE_BOUND && t >= 0 && texture[t]) {
+                    texture[t]->bind(0);
+                    textureBinds++;
+                }
+            };
+            litCallbacks.setMaterial = [&](const RenderQueue::Packet& packet) {
+                const SceneFile::Material& material = materials[RenderQueue::getMaterial(packet.key)];
+                lightingShader.setUniform("material.ambient", material.ambient);
+                lightingShader.setUniform("material.specular", material.specular);
+                lightingShader.setUniform("material.shininess", material.shininess);
+            };
+            litCallbacks.setMesh = [&](const RenderQueue::Packet& packet) {
+                drawItems[packet.object].mesh->bind();
+            };
+            litCallbacks.draw = [&](const RenderQueue::Packet& packet) {
+                int i = packet.object;
+                if (drawIndex % MAX_DRAWS == 0)
+                    glBindBufferRange(GL_UNIFORM_BUFFER, 0, drawBuffer, drawIndex * sizeof(DrawData), MAX_DRAWS * sizeof(DrawData));
+                lightingShader.setUniform("model", worldMatrices[i]);
+                lightingShader.setUniform("normalMatrix", normalMatrices[i]);
+                lightingShader.setUniform("drawIndex", (GLint)(drawIndex % MAX_DRAWS));
+                drawItems[i].mesh->drawBound();
+                drawIndex++;
+            };
+
+            // GPU culling : each batch's state then its indirect draw, phase by
+            // phase.  Without the pre-pass the first phase's depth is the lit
+            // pass's, the pyramid is built from it in between.
+            RenderQueue::Stats litStats = RenderQueue::Stats();
+            if (gpuCulling) {
+                auto drawPhase = [&](GpuCuller::Phase phase) {
+                    int lastTexture = -2, lastMaterial = -1;
+                    for (int b = 0; b < (int)drawBatches.size(); b++) {
+                        const DrawBatch& batch = drawBatches[b];
+                        const int t = batch.texture;
+                        if (t != lastTexture) {
+                            if (drawData[b].textureSource == TEXTURE_ARRAY) {
+                                boundArray = textureAtlas.getPlacement(atlasEntry[t]).array;
+                                textureAtlas.getArray(boundArray).bind(3);
+                                textureBinds++;
+                            } else if (drawData[b].textureSource == TEXTURE_BOUND && t >= 0 && texture[t]) {
+                                texture[t]->bind(0);
+                                textureBinds++;
+                            }
+                            lastTexture = t;
+                        }
+                        if (batch.material != lastMaterial) {
+                            const SceneFile::Material& material = materials[batch.material];
+                            lightingShader.setUniform("material.ambient", material.ambient);
+                            lightingShader.setUniform("material.specular", material.specular);
+                            lightingShader.setUniform("material.shininess", material.shininess);
+                            lastMaterial = batch.material;
+                        }
+                        if (b % MAX_DRAWS == 0)
+                            glBindBufferRange(GL_UNIFORM_BUFFER, 0, drawBuffer, b * sizeof(DrawData), MAX_DRAWS * sizeof(DrawData));
+                        lightingShader.setUniform("drawIndex", (GLint)(b % MAX_DRAWS));
+                        gpuCuller.drawBatch(phase, b, false);
+                    }
+                };
+                drawPhase(GpuCuller::PHASE_PREVIOUS);
+                if (gpuCullFixup) {
+                    if (!depthPrepass) {
+                        Mesh::unbind();
+                        gpuCuller.buildPyramid(dynamicRes.getDepthTexture(), dynamicRes.getRenderWidth(), dynamicRes.getRenderHeight());
+                        gpuCuller.cull(GpuCuller::PHASE_FIXUP, view, projection);
+                        lightingShader.use();
+                    }
+                    drawPhase(GpuCuller::PHASE_FIXUP);
+                }
             } else {
-                // Pour tous les autres objets, comportement normal
-                lightingShader.setUniform("material.ambient", glm::vec3(1.0f, 1.0f, 1.0f));
+                litStats = litQueue.submit(litCallbacks);
             }
+            Mesh::unbind();
+            if (boundArray >= 0)
+                textureAtlas.getArray(boundArray).unbind(3);
 
-            // scaling
-            model = glm::scale(model, modelScale[i]);
 
-            lightingShader.setUniform("model", model);
+            litQuery.end();
 
+            if (depthPrepass)
+            {
+                glDepthFunc(GL_LESS);
+                glDepthMask(GL_TRUE);
+            }
 
-            // If the floor (i==0), makes it less shiny
-            if (i == 0) {
-                lightingShader.setUniform("material.specular", glm::vec3(0.6f, 0.6f, 0.6f));
-                lightingShader.setUniform("material.shininess", 30.0f);
+            // Unbinding
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            sunShadows.unbind(1);
+            pointShadows.unbind(2);
+            glUseProgram(0);
+
+            // Upscale to the backbuffer
+            dynamicRes.endFrame();
+
+            // Shadow stats : static/dynamic draws and GPU time per cascade
+            std::ostringstream stats;
+            stats.precision(2);
+            stats << std::fixed << "| csm";
+            for (int c = 0; c < sunShadows.getNumCascades(); c++)
+                stats << " " << sunShadows.getStaticDrawCount(c) << "/" << sunShadows.getDynamicDrawCount(c)
+                      << " " << sunShadows.getGpuTimeMs(c) << "ms";
+            stats << " | " << (depthPrepass ? "prepass" : "forward") << " frag ";
+            if (litQuery.hasResult())
+                stats << litQuery.getResult() << (depthPrepass ? " + " : "")
+                      << (depthPrepass && prepassQuery.hasResult() ? std::to_string(prepassQuery.getResult()) : "");
+            else
+                stats << "n/a";
+            stats << " | drs " << dynamicRes.getScale() << " " << dynamicRes.getRenderWidth() << "x" << dynamicRes.getRenderHeight()
+                  << " gpu " << dynamicRes.getGpuTimeMs() << "ms";
+            stats << " | pls " << pointShadows.getFacesRendered() << " faces "
+                  << pointShadows.getPendingFaces() << " pending " << pointShadows.getDrawCount() << " draws";
+            stats << " | tex " << textureLoader.getResidentBytes() / (1024 * 1024) << "/"
+                  << textureLoader.getMemoryBudget() / (1024 * 1024) << "MB "
+                  << textureLoader.getPendingLevels() << " pending " << textureLoader.getStreamingLevels() << " streaming"
+                  << " | " << (bindlessTextures ? "bindless " : textureArrays ? "arrays " : "bound ") << textureBinds << " binds";
+            if (textureAtlas.getNumArrays() > 0)
+                stats << " " << textureAtlas.getNumArrays() << "/" << textureAtlas.getNumLayers() << " layers "
+                      << textureAtlas.getMemorySize() / (1024 * 1024) << "MB";
+            if (gpuCulling) {
+                const GpuCuller::Stats& gpuStats = gpuCuller.getStats();
+                stats << " | gpu cull " << (gpuCullFixup ? "" : "tf ") << gpuStats.visible[GpuCuller::PHASE_PREVIOUS] << "+" << gpuStats.visible[GpuCuller::PHASE_FIXUP]
+                      << "/" << gpuStats.instances << " visible " << gpuStats.batches << " batches " << gpuStats.drawCalls << " draws "
+                      << gpuStats.gpuMs << "ms gpu " << gpuStats.cpuMs << "ms cpu";
             } else {
-                lightingShader.setUniform("material.specular", glm::vec3(0.6f, 0.6f, 0.6f));
-                lightingShader.setUniform("material.shininess", 32.0f);
+                stats << " | queue " << litStats.draws << " draws " << litStats.programChanges << " prog "
+                      << litStats.textureChanges << " tex " << litStats.materialChanges << " mat " << litStats.meshChanges << " vao";
+                stats << " | build " << drawLists.getVisibleCount() << "/" << numDraws << " visible " << drawLists.getBuildMs() << "ms";
+            }
+            if (occlusionCulling) {
+                const OcclusionCuller::Stats& occlusionStats = occlusion.getStats();
+                stats << " | occlusion " << drawLists.getOccludedCount() << " hidden by " << occlusionStats.occluders << " occluders "
+                      << occlusionStats.triangles << " tris " << occlusionStats.setupMs << "+" << occlusionStats.rasterMs << "ms"
+                      << (OcclusionCuller::hasSimd() ? " avx2" : "");
+            }
+            if (world.isOpen()) {
+                const WorldPartition::Stats& worldStats = world.getStats();
+                stats << " | world " << worldStats.loadedCells << " cells " << worldStats.pendingCells << " pending "
+                      << worldStats.meshes << " meshes " << (worldStats.cpuBytes + worldStats.gpuBytes) / (1024 * 1024) << "MB "
+                      << worldStats.jobsInFlight << " jobs " << worldStats.updateMs << "ms";
             }
 
-            // Texture
-            lightingShader.setUniformSampler("material.diffuseMap", 0);
-            texture[i].bind(0);
+            // Least recently drawn meshes out when the budget is exceeded
+            resourceBudget.setExternalBytes(textureLoader.getResidentBytes() + textureAtlas.getMemorySize() + world.getStats().gpuBytes);
+            resourceBudget.update();
+            stats << " | res " << resourceBudget.getGpuBytes() / (1024 * 1024) << "/"
+                  << resourceBudget.getMemoryBudget() / (1024 * 1024) << "MB "
+                  << resourceBudget.getNumResident() << "/" << resourceBudget.getNumResources() << " meshes "
+                  << resourceBudget.getEvictionCount() << " evicted";
+            if (resourceBudget.getDriverFreeBytes() > 0)
+                stats << " " << resourceBudget.getDriverFreeBytes() / (1024 * 1024) << "MB free";
+            const FramePipeline::Stats& pipelineStats = framePipeline.getStats();
+            stats << " | sim " << (int)(1.0 / SIMULATION_STEP) << "Hz step " << pipelineStats.stepMs << "ms wait +"
+                  << pipelineStats.waitMs << "ms latency " << pipelineStats.latencyMs << "ms "
+                  << pipelineStats.dropped << " dropped " << pipelineStats.repeated << " repeated";
+            {
+                std::lock_guard<std::mutex> lock(gFrameStatsMutex);
+                gFrameStats = stats.str();
+            }
 
-            // Draw
-            mesh[i].draw();
-            texture[i].unbind(0);
+            // Swap buffers
+            glfwSwapBuffers(gWindow);
+            framePipeline.presented();
+            gFramesRendered++;
         }
+        glfwMakeContextCurrent(NULL);
+    });
 
+    // --- Main Loop ---
+    double nextStep = glfwGetTime();
+    while (!glfwWindowShouldClose(gWindow)) {
+        showFPS(gWindow);
 
-        // Unbinding
-        texture[0].unbind(0);
-        glUseProgram(0);
+        // Events are handled while waiting for the next step.  A simulation
+        // too far behind skips the steps it missed rather than catching up.
+        nextStep += SIMULATION_STEP;
+        double currentTime = glfwGetTime();
+        if (currentTime - nextStep > SIMULATION_MAX_LAG)
+            nextStep = currentTime;
+        while (currentTime < nextStep) {
+            glfwWaitEventsTimeout(nextStep - currentTime);
+            currentTime = glfwGetTime();
+        }
 
-        // Swap buffers
-        glfwSwapBuffers(gWindow);
+        simulate();
     }
 
+    rendering = false;
+    renderThread.join();
+    glfwMakeContextCurrent(gWindow);
+    glDeleteBuffers(1, &drawBuffer);
     endOpenGL();
     return 0;
 }
@@ -356,6 +1142,11 @@ bool initOpenGL()
 
     // Callbacks
     glfwSetKeyCallback(gWindow, glfw_onKey);
+    glfwSetFramebufferSizeCallback(gWindow, framebuffer_size_callback);
+    int fbWidth, fbHeight;
+    glfwGetFramebufferSize(gWindow, &fbWidth, &fbHeight);
+    gFramebufferWidth = fbWidth;
+    gFramebufferHeight = fbHeight;
 
     // Mouse capturing FPS mode
     glfwSetInputMode(gWindow, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -376,29 +1167,63 @@ void glfw_onKey(GLFWwindow* window, int key, int scancode, int action, int mode)
 {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, GL_TRUE);
+
+    // Toggle the depth pre-pass
+    if (key == GLFW_KEY_F2 && action == GLFW_PRESS) {
+        gDepthPrepass = !gDepthPrepass;
+        std::cout << "Depth pre-pass " << (gDepthPrepass ? "on" : "off") << std::endl;
+    }
+
+    // Toggle dynamic resolution / upscale filter
+    if (key == GLFW_KEY_F3 && action == GLFW_PRESS) {
+        gDynamicResolution = !gDynamicResolution;
+        std::cout << "Dynamic resolution " << (gDynamicResolution ? "on" : "off") << std::endl;
+    }
+    if (key == GLFW_KEY_F4 && action == GLFW_PRESS) {
+        gEdgeAwareUpscale = !gEdgeAwareUpscale;
+        std::cout << "Upscale filter " << (gEdgeAwareUpscale ? "edge-aware" : "bilinear") << std::endl;
+    }
+
+    // Toggle occlusion culling
+    if (key == GLFW_KEY_F5 && action == GLFW_PRESS) {
+        gOcclusionCulling = !gOcclusionCulling;
+        std::cout << "Occlusion culling " << (gOcclusionCulling ? "on" : "off") << std::endl;
+    }
+
+    // Toggle GPU driven culling, when the driver has it
+    if (key == GLFW_KEY_F6 && action == GLFW_PRESS) {
+        gGpuCulling = !gGpuCulling;
+        std::cout << "GPU culling " << (gGpuCulling ? "on" : "off") << std::endl;
+    }
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
-    // viewport matches the new window dimensions
-    glViewport(0, 0, width, height);
+    gWindowWidth = width;
+    gWindowHeight = height;
+
+    // The render thread owns the context : it sets the viewport from these
+    gFramebufferWidth = width;
+    gFramebufferHeight = height;
 }
 
 void showFPS(GLFWwindow* window) {
     static double prevSec = 0.0;
-    static int frameCount = 0;
     double currentSec = glfwGetTime();
     double elapsedSec = currentSec - prevSec;
     if (elapsedSec > 0.25) { // updates at 1 / 4 of a sec
         prevSec = currentSec;
+        int frameCount = gFramesRendered.exchange(0); // by the render thread
         double fps = (double) frameCount / elapsedSec;
         double msPerFrame = 1000.0 / fps;
         std::ostringstream outs;
         outs.precision(3);
         outs << std::fixed
             << "fps : " << fps << " "
-             << "ms : " << msPerFrame << "\n";
+             << "ms : " << msPerFrame << " ";
+        {
+            std::lock_guard<std::mutex> lock(gFrameStatsMutex);
+            outs << gFrameStats;
+        }
         glfwSetWindowTitle(window, outs.str().c_str());
-        frameCount = 0;
     }
-    frameCount++;
-}
\ No newline at end of file
+}
@@ -0,0 +1,8 @@
+//-----------------------------------------------------------------------------
+// Fragment shader for the depth pre-pass (depth is written implicitly)
+//-----------------------------------------------------------------------------
+#version 330 core
+
+void main()
+{
+}
@@ -0,0 +1,23 @@
+//-----------------------------------------------------------------------------
+// Vertex shader for the depth pre-pass
+//
+// The lit pass runs with GL_EQUAL, so gl_Position must be computed exactly
+// like in lighting_dir.vert (same expression, both declared invariant).
+//-----------------------------------------------------------------------------
+#version 330 core
+
+layout (location = 0) in vec3 pos;
+layout (location = 3) in mat4 instanceModel;	// GpuCuller's indirect draws
+
+uniform bool instanced;		// the model matrix per instance rather than per draw
+uniform mat4 model;			// model matrix
+uniform mat4 view;			// view matrix
+uniform mat4 projection;	// projection matrix
+
+invariant gl_Position;
+
+void main()
+{
+	mat4 world = instanced ? instanceModel : model;
+	gl_Position = projection * view *  world * vec4(pos, 1.0f);
+}
@@ -0,0 +1,53 @@
+//-----------------------------------------------------------------------------
+// Vertex shader culling instances with transform feedback (see GpuCuller)
+//
+// One point per instance, rasterization disabled: tests the instance's box
+// against the frustum and passes its transforms to instance_cull.geom, which
+// only emits the visible ones into the batch's range of the instance buffer.
+//-----------------------------------------------------------------------------
+#version 330 core
+
+layout (location = 0) in vec3 boundsMin;	// object space
+layout (location = 1) in int matrix;
+layout (location = 2) in vec3 boundsMax;
+
+uniform mat4 viewProjection;
+uniform samplerBuffer matrices;				// 4 columns per matrix
+
+out Instance
+{
+	flat int visible;
+	vec4 model[4];
+	vec4 normal[3];
+} instance;
+
+void main()
+{
+	mat4 model = mat4(texelFetch(matrices, matrix * 4 + 0),
+					  texelFetch(matrices, matrix * 4 + 1),
+					  texelFetch(matrices, matrix * 4 + 2),
+					  texelFetch(matrices, matrix * 4 + 3));
+
+	// Outside when every corner is beyond the same clip plane : every corner
+	// below -w gives highest < 0, every corner above w lowest > 0
+	mat4 modelViewProjection = viewProjection * model;
+	vec3 highest = vec3(-1e30f), lowest = vec3(1e30f);
+	for (int c = 0; c < 8; c++)
+	{
+		vec3 corner = vec3((c & 1) != 0 ? boundsMax.x : boundsMin.x,
+						   (c & 2) != 0 ? boundsMax.y : boundsMin.y,
+						   (c & 4) != 0 ? boundsMax.z : boundsMin.z);
+		vec4 clip = modelViewProjection * vec4(corner, 1.0f);
+		highest = max(highest, clip.xyz + clip.w);
+		lowest = min(lowest, clip.xyz - clip.w);
+	}
+	instance.visible = (any(lessThan(highest, vec3(0.0f))) || any(greaterThan(lowest, vec3(0.0f)))) ? 0 : 1;
+
+	mat3 normalMatrix = transpose(inverse(mat3(model)));
+	for (int c = 0; c < 4; c++)
+		instance.model[c] = model[c];
+	for (int c = 0; c < 3; c++)
+		instance.normal[c] = vec4(normalMatrix[c], 0.0f);
+
+	gl_Position = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+}
@@ -1,4 +1,5 @@
 #version 330 core
+#extension GL_ARB_bindless_texture : enable
 
 out vec4 frag_color;
 
@@ -7,8 +8,28 @@ struct Material {
 	sampler2D diffuseMap;
 	vec3 specular;
 	float shininess;
+	sampler2DArray diffuseArray;	// holds the diffuse map of TEXTURE_ARRAY draws
 };
 
+// Where the diffuse map of a draw comes from
+const int TEXTURE_BOUND = 0;		// material.diffuseMap
+const int TEXTURE_ARRAY = 1;		// a rectangle of a layer of material.diffuseArray
+const int TEXTURE_BINDLESS = 2;		// a resident handle (ARB_bindless_texture)
+
+// Per-draw data of the lit pass, must match DrawData in DrawData.h
+struct DrawData {
+	uvec2 diffuseHandle;
+	int textureSource;
+	float layer;
+	vec4 rect;		// offset (xy) and scale (zw) of the texture in its layer
+};
+
+const int MAX_DRAWS = 64;
+layout(std140) uniform DrawBlock {
+	DrawData draws[MAX_DRAWS];
+};
+uniform int drawIndex;
+
 // Le Soleil
 struct DirectionalLight {
 	vec3 direction;
@@ -28,19 +49,116 @@ struct PointLight {
 	vec3 ambient;
 	vec3 diffuse;
 	vec3 specular;
+
+	int shadowSlot;		// slot in the point shadow atlas, -1 when unshadowed
+	float shadowFar;	// shadow far plane (light radius)
 };
 
 in vec2 TexCoord;
 in vec3 FragPos;
 in vec3 Normal;
+in float ViewDepth;
 
 uniform DirectionalLight dirLight;
 uniform PointLight pointLight; // On ajoute notre lampe
 uniform Material material;
 uniform vec3 viewPos;
 
+// Ombres du soleil (cascaded shadow maps)
+#define MAX_CASCADES 4
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeViewProj[MAX_CASCADES];
+uniform float cascadeSplits[MAX_CASCADES];		// far distance of each cascade (view space)
+uniform float cascadeTexelSize[MAX_CASCADES];	// world size of a shadow map texel
+uniform int numCascades;
+
+// Returns 1.0 when fully lit, 0.0 when fully in shadow
+float CalcDirShadow(vec3 normal)
+{
+	if (numCascades == 0 || ViewDepth > cascadeSplits[numCascades - 1])
+		return 1.0;
+
+	int cascade = numCascades - 1;
+	for (int i = 0; i < numCascades; i++)
+	{
+		if (ViewDepth < cascadeSplits[i])
+		{
+			cascade = i;
+			break;
+		}
+	}
+
+	// Normal offset keeps surfaces at grazing angles from shadowing themselves
+	vec3 offsetPos = FragPos + normal * cascadeTexelSize[cascade] * 1.5;
+	vec4 lightPos = cascadeViewProj[cascade] * vec4(offsetPos, 1.0);
+	vec3 coords = lightPos.xyz / lightPos.w * 0.5 + 0.5;
+
+	// 3x3 PCF on top of the hardware bilinear compare
+	vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+	float lit = 0.0;
+	for (int x = -1; x <= 1; x++)
+		for (int y = -1; y <= 1; y++)
+			lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texel, float(cascade), coords.z));
+
+	return lit / 9.0;
+}
+
+// Ombres de la lampe (point shadow atlas, 6 faces par lampe)
+uniform sampler2DArrayShadow pointShadowMap;
+
+// Cube face basis, must match FACE_AXES / FACE_UPS in PointShadowAtlas.cpp
+const vec3 FACE_AXIS[6]  = vec3[](vec3( 1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0,-1, 0), vec3(0, 0, 1), vec3( 0, 0,-1));
+const vec3 FACE_RIGHT[6] = vec3[](vec3( 0, 0,-1), vec3( 0, 0, 1), vec3(1, 0, 0), vec3(1, 0, 0), vec3(1, 0, 0), vec3(-1, 0, 0));
+const vec3 FACE_UP[6]    = vec3[](vec3( 0,-1, 0), vec3( 0,-1, 0), vec3(0, 0, 1), vec3(0, 0,-1), vec3(0,-1, 0), vec3( 0,-1, 0));
+
+// Returns 1.0 when fully lit, 0.0 when fully in shadow
+float CalcPointShadow(PointLight light, vec3 normal)
+{
+	if (light.shadowSlot < 0)
+		return 1.0;
+
+	vec3 toFrag = FragPos + normal * 0.02 - light.position;
+	vec3 a = abs(toFrag);
+
+	int face;
+	if (a.x >= a.y && a.x >= a.z)
+		face = (toFrag.x > 0.0) ? 0 : 1;
+	else if (a.y >= a.z)
+		face = (toFrag.y > 0.0) ? 2 : 3;
+	else
+		face = (toFrag.z > 0.0) ? 4 : 5;
+
+	// Same projection as the face view/projection used to render the atlas
+	float major = dot(toFrag, FACE_AXIS[face]);
+	vec2 uv = vec2(dot(toFrag, FACE_RIGHT[face]), dot(toFrag, FACE_UP[face])) / major * 0.5 + 0.5;
+	float ref = length(toFrag) / light.shadowFar - 0.005;
+
+	return texture(pointShadowMap, vec4(uv, float(light.shadowSlot * 6 + face), ref));
+}
+
+// Diffuse texel of the current draw
+vec3 DiffuseColor()
+{
+	DrawData draw = draws[drawIndex];
+
+#ifdef GL_ARB_bindless_texture
+	if (draw.textureSource == TEXTURE_BINDLESS)
+		return vec3(texture(sampler2D(draw.diffuseHandle), TexCoord));
+#endif
+
+	if (draw.textureSource != TEXTURE_ARRAY)
+		return vec3(texture(material.diffuseMap, TexCoord));
+
+	// Packed textures repeat inside their rectangle.  The gradients of the
+	// unwrapped coordinates keep the mip level continuous across the wrap.
+	vec2 uv = draw.rect.xy + fract(TexCoord) * draw.rect.zw;
+	vec2 dx = dFdx(TexCoord) * draw.rect.zw;
+	vec2 dy = dFdy(TexCoord) * draw.rect.zw;
+	return vec3(textureGrad(material.diffuseArray, vec3(uv, draw.layer), dx, dy));
+}
+
 // Fonction pour calculer la lumière directionnelle
-vec3 CalcDirLight(DirectionalLight light, vec3 normal, vec3 viewDir)
+vec3 CalcDirLight(DirectionalLight light, vec3 normal, vec3 viewDir, vec3 color)
 {
 	vec3 lightDir = normalize(-light.direction);
 	// Diffuse
@@ -49,15 +167,17 @@ vec3 CalcDirLight(DirectionalLight light, vec3 normal, vec3 viewDir)
 	vec3 halfwayDir = normalize(lightDir + viewDir);
 	float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
 
-	vec3 ambient = light.ambient * material.ambient * vec3(texture(material.diffuseMap, TexCoord));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuseMap, TexCoord));
+	vec3 ambient = light.ambient * material.ambient * color;
+	vec3 diffuse = light.diffuse * diff * color;
 	vec3 specular = light.specular * spec * material.specular;
 
-	return (ambient + diffuse + specular);
+	float shadow = CalcDirShadow(normal);
+
+	return (ambient + shadow * (diffuse + specular));
 }
 
 // Fonction pour calculer la lumière ponctuelle (Lampe)
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color)
 {
 	vec3 lightDir = normalize(light.position - fragPos);
 
@@ -72,15 +192,17 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 	float distance = length(light.position - fragPos);
 	float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
 
-	vec3 ambient = light.ambient * material.ambient * vec3(texture(material.diffuseMap, TexCoord));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuseMap, TexCoord));
+	vec3 ambient = light.ambient * material.ambient * color;
+	vec3 diffuse = light.diffuse * diff * color;
 	vec3 specular = light.specular * spec * material.specular;
 
 	ambient *= attenuation;
 	diffuse *= attenuation;
 	specular *= attenuation;
 
-	return (ambient + diffuse + specular);
+	float shadow = CalcPointShadow(light, normal);
+
+	return (ambient + shadow * (diffuse + specular));
 }
 
 void main()
@@ -88,11 +210,14 @@ void main()
 	vec3 norm = normalize(Normal);
 	vec3 viewDir = normalize(viewPos - FragPos);
 
+	// Fetched once, shared by both lights
+	vec3 color = DiffuseColor();
+
 	// 1. On calcule le soleil
-	vec3 result = CalcDirLight(dirLight, norm, viewDir);
+	vec3 result = CalcDirLight(dirLight, norm, viewDir, color);
 
 	// 2. On AJOUTE la lumière du Pirozhok
-	result += CalcPointLight(pointLight, norm, FragPos, viewDir);
+	result += CalcPointLight(pointLight, norm, FragPos, viewDir, color);
 
 	frag_color = vec4(result, 1.0);
 }
\ No newline at end of file
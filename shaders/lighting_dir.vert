@@ -6,21 +6,30 @@
 layout (location = 0) in vec3 pos;			
 layout (location = 1) in vec3 normal;	
 layout (location = 2) in vec2 texCoord;
+layout (location = 3) in mat4 instanceModel;		// GpuCuller's indirect draws
+layout (location = 7) in mat3 instanceNormalMatrix;
 
+uniform bool instanced;		// the matrices per instance rather than per draw
 uniform mat4 model;			// model matrix
+uniform mat3 normalMatrix;	// transpose(inverse(mat3(model))), cached per object on the CPU
 uniform mat4 view;			// view matrix
 uniform mat4 projection;	// projection matrix
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoord;
+out float ViewDepth;	// distance along the view axis, used to pick a shadow cascade
+
+invariant gl_Position;	// must match depth_prepass.vert bit for bit (GL_EQUAL depth test)
 
 void main()
 {
-    FragPos = vec3(model * vec4(pos, 1.0f));			// vertex position in world space
-    Normal = mat3(transpose(inverse(model))) * normal;	// normal direction in world space
+	mat4 world = instanced ? instanceModel : model;
+    FragPos = vec3(world * vec4(pos, 1.0f));			// vertex position in world space
+    Normal = (instanced ? instanceNormalMatrix : normalMatrix) * normal;	// normal direction in world space
 
 	TexCoord = texCoord;
+	ViewDepth = -(view * world * vec4(pos, 1.0f)).z;
 
-	gl_Position = projection * view *  model * vec4(pos, 1.0f);
+	gl_Position = projection * view *  world * vec4(pos, 1.0f);
 }
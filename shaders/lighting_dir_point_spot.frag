@@ -35,6 +35,9 @@ struct PointLight
 	float constant;
 	float linear;
 	float exponent;
+
+	int shadowSlot;		// slot in the point shadow atlas, -1 when unshadowed
+	float shadowFar;	// shadow far plane (light radius)
 };
 
 struct SpotLight
@@ -65,12 +68,14 @@ uniform PointLight pointLights[MAX_POINT_LIGHTS];
 uniform SpotLight spotLight;
 uniform Material material;
 uniform vec3 viewPos;
+uniform sampler2DArrayShadow pointShadowMap;
 
 out vec4 frag_color;
 
 vec3 calcDirectionalLightColor(DirectionalLight light, vec3 normal, vec3 viewDir);
 vec3 calcPointLightColor(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 vec3 calcSpotLightColor(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+float calcPointShadow(PointLight light, vec3 normal, vec3 fragPos);
 
 //-----------------------------------------------------------------------------------------------
 // Main Shader Entry
@@ -138,8 +143,41 @@ vec3 calcPointLightColor(PointLight light, vec3 normal, vec3 fragPos, vec3 viewD
 
 	diffuse *= attenuation;
 	specular *= attenuation;
+
+	float shadow = calcPointShadow(light, normal, fragPos);
 	
-	return (diffuse + specular);
+	return shadow * (diffuse + specular);
+}
+
+//-----------------------------------------------------------------------------------------------
+// Look up the cube face of the point light in the shadow atlas.  Returns 1.0 when lit.
+// The face basis must match FACE_AXES / FACE_UPS in PointShadowAtlas.cpp
+//-----------------------------------------------------------------------------------------------
+const vec3 FACE_AXIS[6]  = vec3[](vec3( 1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0,-1, 0), vec3(0, 0, 1), vec3( 0, 0,-1));
+const vec3 FACE_RIGHT[6] = vec3[](vec3( 0, 0,-1), vec3( 0, 0, 1), vec3(1, 0, 0), vec3(1, 0, 0), vec3(1, 0, 0), vec3(-1, 0, 0));
+const vec3 FACE_UP[6]    = vec3[](vec3( 0,-1, 0), vec3( 0,-1, 0), vec3(0, 0, 1), vec3(0, 0,-1), vec3(0,-1, 0), vec3( 0,-1, 0));
+
+float calcPointShadow(PointLight light, vec3 normal, vec3 fragPos)
+{
+	if (light.shadowSlot < 0)
+		return 1.0;
+
+	vec3 toFrag = fragPos + normal * 0.02 - light.position;
+	vec3 a = abs(toFrag);
+
+	int face;
+	if (a.x >= a.y && a.x >= a.z)
+		face = (toFrag.x > 0.0) ? 0 : 1;
+	else if (a.y >= a.z)
+		face = (toFrag.y > 0.0) ? 2 : 3;
+	else
+		face = (toFrag.z > 0.0) ? 4 : 5;
+
+	float major = dot(toFrag, FACE_AXIS[face]);
+	vec2 uv = vec2(dot(toFrag, FACE_RIGHT[face]), dot(toFrag, FACE_UP[face])) / major * 0.5 + 0.5;
+	float ref = length(toFrag) / light.shadowFar - 0.005;
+
+	return texture(pointShadowMap, vec4(uv, float(light.shadowSlot * 6 + face), ref));
 }
 
 //------------------------------------------------------------------------------------------------
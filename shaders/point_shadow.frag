@@ -0,0 +1,14 @@
+//-----------------------------------------------------------------------------
+// Fragment shader for point light shadows (stores linear distance to light)
+//-----------------------------------------------------------------------------
+#version 330 core
+
+in vec3 FragWorldPos;
+
+uniform vec3 lightPos;
+uniform float farPlane;		// light radius
+
+void main()
+{
+	gl_FragDepth = length(FragWorldPos - lightPos) / farPlane;
+}
@@ -0,0 +1,17 @@
+//-----------------------------------------------------------------------------
+// Vertex shader for point light shadows (world space out, faces are
+// projected by the geometry shader)
+//-----------------------------------------------------------------------------
+#version 330 core
+
+layout (location = 0) in vec3 pos;
+
+uniform mat4 model;		// model matrix
+
+out vec3 WorldPos;
+
+void main()
+{
+	WorldPos = vec3(model * vec4(pos, 1.0f));
+	gl_Position = vec4(WorldPos, 1.0f);
+}
@@ -0,0 +1,8 @@
+//-----------------------------------------------------------------------------
+// Fragment shader for shadow map depth rendering (depth is written implicitly)
+//-----------------------------------------------------------------------------
+#version 330 core
+
+void main()
+{
+}
@@ -0,0 +1,14 @@
+//-----------------------------------------------------------------------------
+// Vertex shader for shadow map depth rendering
+//-----------------------------------------------------------------------------
+#version 330 core
+
+layout (location = 0) in vec3 pos;
+
+uniform mat4 model;				// model matrix
+uniform mat4 lightViewProj;		// light view * projection matrix
+
+void main()
+{
+	gl_Position = lightViewProj * model * vec4(pos, 1.0f);
+}
@@ -0,0 +1,56 @@
+//-----------------------------------------------------------------------------
+// Fragment shader for the dynamic resolution upscale
+//
+// filterMode 0 : bilinear
+// filterMode 1 : bilinear followed by contrast adaptive sharpening.  The
+//                sharpening amount drops where the local contrast is already
+//                high, so edges are restored without ringing.
+//-----------------------------------------------------------------------------
+#version 330 core
+
+in vec2 TexCoord;
+
+uniform sampler2D sceneColor;
+uniform vec2 uvScale;		// rendered area / texture size
+uniform vec2 texelSize;		// 1 / texture size
+uniform int filterMode;
+
+out vec4 frag_color;
+
+vec3 fetch(vec2 uv)
+{
+	// Stay inside the rendered area so we never blend in stale pixels
+	uv = clamp(uv, texelSize * 0.5, uvScale - texelSize * 0.5);
+	return texture(sceneColor, uv).rgb;
+}
+
+void main()
+{
+	vec2 uv = TexCoord * uvScale;
+	vec3 center = fetch(uv);
+
+	if (filterMode == 0)
+	{
+		frag_color = vec4(center, 1.0f);
+		return;
+	}
+
+	vec3 n = fetch(uv + vec2(0.0, texelSize.y));
+	vec3 s = fetch(uv - vec2(0.0, texelSize.y));
+	vec3 e = fetch(uv + vec2(texelSize.x, 0.0));
+	vec3 w = fetch(uv - vec2(texelSize.x, 0.0));
+
+	vec3 minRGB = min(center, min(min(n, s), min(e, w)));
+	vec3 maxRGB = max(center, max(max(n, s), max(e, w)));
+
+	// Amount of headroom before clipping, per channel (0 = strong edge)
+	vec3 amp = clamp(min(minRGB, 1.0 - maxRGB) / max(maxRGB, 1e-4), 0.0, 1.0);
+	amp = sqrt(amp);
+
+	// Sharpening strength grows as the render scale drops
+	float peak = -1.0 / mix(8.0, 5.0, clamp(1.0 - min(uvScale.x, uvScale.y), 0.0, 1.0));
+	vec3 wgt = amp * peak;
+
+	vec3 result = (center + (n + s + e + w) * wgt) / (1.0 + 4.0 * wgt);
+	frag_color = vec4(clamp(result, 0.0, 1.0), 1.0f);
+}
@@ -0,0 +1,14 @@
+//-----------------------------------------------------------------------------
+// Vertex shader for the dynamic resolution upscale (full screen triangle
+// generated from gl_VertexID, no vertex buffer needed)
+//-----------------------------------------------------------------------------
+#version 330 core
+
+out vec2 TexCoord;
+
+void main()
+{
+	vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	TexCoord = p;
+	gl_Position = vec4(p * 2.0f - 1.0f, 0.0f, 1.0f);
+}
@@ -0,0 +1,563 @@
+//-----------------------------------------------------------------------------
+// CPU block compressor for BC1, BC3, BC5 and BC7 (mode 6)
+//-----------------------------------------------------------------------------
+#include "BlockCompressor.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLOCK_COMPRESSOR_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// 16 pixels, one array per channel so 4 pixels fit a SIMD register
+	struct Block
+	{
+		float c[4][16];
+	};
+
+	// Weight of the first endpoint for each BC1 index
+	const float BC1_WEIGHTS[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+	// BC7 4 bit index interpolation weights (out of 64)
+	const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	void loadBlock(const unsigned char* rgba, Block& block)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 4; c++)
+				block.c[c][i] = rgba[i * 4 + c];
+		}
+	}
+
+	float clamp255(float v)
+	{
+		return std::min(255.0f, std::max(0.0f, v));
+	}
+
+	//-------------------------------------------------------------------------
+	// Picks the nearest palette entry for every pixel, returns the squared error
+	//-------------------------------------------------------------------------
+	float selectIndices(const Block& block, int channels, const float palette[][4], int paletteSize, int* indices)
+	{
+		float total = 0.0f;
+#ifdef BLOCK_COMPRESSOR_SSE2
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 pixels[4];
+			for (int c = 0; c < channels; c++)
+				pixels[c] = _mm_loadu_ps(&block.c[c][i]);
+
+			__m128 best = _mm_set1_ps(FLT_MAX);
+			__m128i bestIndex = _mm_setzero_si128();
+			for (int e = 0; e < paletteSize; e++)
+			{
+				__m128 dist = _mm_setzero_ps();
+				for (int c = 0; c < channels; c++)
+				{
+					__m128 d = _mm_sub_ps(pixels[c], _mm_set1_ps(palette[e][c]));
+					dist = _mm_add_ps(dist, _mm_mul_ps(d, d));
+				}
+
+				__m128i closer = _mm_castps_si128(_mm_cmplt_ps(dist, best));
+				best = _mm_min_ps(dist, best);
+				bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(e)), _mm_andnot_si128(closer, bestIndex));
+			}
+
+			_mm_storeu_si128((__m128i*)&indices[i], bestIndex);
+
+			float errors[4];
+			_mm_storeu_ps(errors, best);
+			total += errors[0] + errors[1] + errors[2] + errors[3];
+		}
+#else
+		for (int i = 0; i < 16; i++)
+		{
+			float best = FLT_MAX;
+			int bestIndex = 0;
+			for (int e = 0; e < paletteSize; e++)
+			{
+				float dist = 0.0f;
+				for (int c = 0; c < channels; c++)
+				{
+					float d = block.c[c][i] - palette[e][c];
+					dist += d * d;
+				}
+
+				if (dist < best)
+				{
+					best = dist;
+					bestIndex = e;
+				}
+			}
+
+			indices[i] = bestIndex;
+			total += best;
+		}
+#endif
+		return total;
+	}
+
+	//-------------------------------------------------------------------------
+	// Endpoints along the principal axis of the block (power iteration on the
+	// covariance matrix), pulled in by a fraction of the range.
+	//-------------------------------------------------------------------------
+	void fitEndpoints(const Block& block, int channels, float inset, float e0[4], float e1[4])
+	{
+		float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		float minC[4] = { 255.0f, 255.0f, 255.0f, 255.0f };
+		float maxC[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int c = 0; c < channels; c++)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				mean[c] += block.c[c][i];
+				minC[c] = std::min(minC[c], block.c[c][i]);
+				maxC[c] = std::max(maxC[c], block.c[c][i]);
+			}
+			mean[c] /= 16.0f;
+		}
+
+		float cov[4][4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			for (int j = 0; j < channels; j++)
+			{
+				for (int k = j; k < channels; k++)
+					cov[j][k] += (block.c[j][i] - mean[j]) * (block.c[k][i] - mean[k]);
+			}
+		}
+		for (int j = 0; j < channels; j++)
+		{
+			for (int k = 0; k < j; k++)
+				cov[j][k] = cov[k][j];
+		}
+
+		float axis[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int c = 0; c < channels; c++)
+			axis[c] = maxC[c] - minC[c];
+
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			float largest = 0.0f;
+			for (int j = 0; j < channels; j++)
+			{
+				for (int k = 0; k < channels; k++)
+					next[j] += cov[j][k] * axis[k];
+				largest = std::max(largest, std::fabs(next[j]));
+			}
+
+			if (largest == 0.0f)
+				break;
+			for (int c = 0; c < channels; c++)
+				axis[c] = next[c] / largest;
+		}
+
+		float length = 0.0f;
+		for (int c = 0; c < channels; c++)
+			length += axis[c] * axis[c];
+
+		if (length == 0.0f)
+		{
+			// Flat block
+			for (int c = 0; c < 4; c++)
+				e0[c] = e1[c] = mean[c];
+			return;
+		}
+
+		length = std::sqrt(length);
+		for (int c = 0; c < channels; c++)
+			axis[c] /= length;
+
+		float minT = FLT_MAX, maxT = -FLT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0.0f;
+			for (int c = 0; c < channels; c++)
+				t += (block.c[c][i] - mean[c]) * axis[c];
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+
+		float range = maxT - minT;
+		minT += range * inset;
+		maxT -= range * inset;
+		for (int c = 0; c < 4; c++)
+		{
+			e0[c] = (c < channels) ? clamp255(mean[c] + axis[c] * maxT) : mean[c];
+			e1[c] = (c < channels) ? clamp255(mean[c] + axis[c] * minT) : mean[c];
+		}
+	}
+
+	//-------------------------------------------------------------------------
+	// Least squares endpoints for a fixed set of indices
+	//-------------------------------------------------------------------------
+	bool refitEndpoints(const Block& block, int channels, const int* indices, const float* weights, float e0[4], float e1[4])
+	{
+		float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+		float ax[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		float bx[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; i++)
+		{
+			float a = weights[indices[i]];
+			float b = 1.0f - a;
+			aa += a * a;
+			bb += b * b;
+			ab += a * b;
+			for (int c = 0; c < channels; c++)
+			{
+				ax[c] += a * block.c[c][i];
+				bx[c] += b * block.c[c][i];
+			}
+		}
+
+		float det = aa * bb - ab * ab;
+		if (std::fabs(det) < 1e-6f)
+			return false;
+
+		for (int c = 0; c < channels; c++)
+		{
+			e0[c] = clamp255((ax[c] * bb - bx[c] * ab) / det);
+			e1[c] = clamp255((bx[c] * aa - ax[c] * ab) / det);
+		}
+		return true;
+	}
+
+	//-------------------------------------------------------------------------
+	// BC1 color part
+	//-------------------------------------------------------------------------
+	unsigned short pack565(const float color[4])
+	{
+		int r = (int)(clamp255(color[0]) * 31.0f / 255.0f + 0.5f);
+		int g = (int)(clamp255(color[1]) * 63.0f / 255.0f + 0.5f);
+		int b = (int)(clamp255(color[2]) * 31.0f / 255.0f + 0.5f);
+		return (unsigned short)((r << 11) | (g << 5) | b);
+	}
+
+	void unpack565(unsigned short packed, float color[4])
+	{
+		int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+		color[0] = (float)((r << 3) | (r >> 2));
+		color[1] = (float)((g << 2) | (g >> 4));
+		color[2] = (float)((b << 3) | (b >> 2));
+		color[3] = 255.0f;
+	}
+
+	// Orders the endpoints for the 4 color mode and picks the indices
+	float encodeBC1Indices(const Block& block, unsigned short& c0, unsigned short& c1, int* indices)
+	{
+		if (c0 < c1)
+			std::swap(c0, c1);
+
+		float palette[4][4];
+		unpack565(c0, palette[0]);
+		unpack565(c1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+			palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+		}
+
+		if (c0 == c1)
+		{
+			// Would decode in 3 color mode: stick to the first endpoint
+			return selectIndices(block, 3, palette, 1, indices);
+		}
+		return selectIndices(block, 3, palette, 4, indices);
+	}
+
+	void encodeBC1Color(const Block& block, unsigned char* output)
+	{
+		float e0[4], e1[4];
+		fitEndpoints(block, 3, 1.0f / 16.0f, e0, e1);
+
+		unsigned short c0 = pack565(e0), c1 = pack565(e1);
+		int indices[16];
+		float error = encodeBC1Indices(block, c0, c1, indices);
+
+		if (error > 0.0f && refitEndpoints(block, 3, indices, BC1_WEIGHTS, e0, e1))
+		{
+			unsigned short r0 = pack565(e0), r1 = pack565(e1);
+			int refitIndices[16];
+			float refitError = encodeBC1Indices(block, r0, r1, refitIndices);
+			if (refitError < error)
+			{
+				c0 = r0;
+				c1 = r1;
+				memcpy(indices, refitIndices, sizeof(indices));
+			}
+		}
+
+		unsigned bits = 0;
+		for (int i = 0; i < 16; i++)
+			bits |= (unsigned)indices[i] << (2 * i);
+
+		output[0] = (unsigned char)c0;
+		output[1] = (unsigned char)(c0 >> 8);
+		output[2] = (unsigned char)c1;
+		output[3] = (unsigned char)(c1 >> 8);
+		for (int i = 0; i < 4; i++)
+			output[4 + i] = (unsigned char)(bits >> (8 * i));
+	}
+
+	//-------------------------------------------------------------------------
+	// BC4 single channel block (alpha of BC3, each channel of BC5), 8 value mode
+	//-------------------------------------------------------------------------
+	void encodeBC4(const Block& block, int channel, unsigned char* output)
+	{
+		int lo = 255, hi = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int v = (int)block.c[channel][i];
+			lo = std::min(lo, v);
+			hi = std::max(hi, v);
+		}
+
+		output[0] = (unsigned char)hi;
+		output[1] = (unsigned char)lo;
+
+		unsigned long long bits = 0;
+		if (hi > lo)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				// Position on the evenly spaced ramp from lo (0) to hi (7), then BC4 index order
+				int step = (int)((block.c[channel][i] - lo) * 7.0f / (hi - lo) + 0.5f);
+				int index = (step == 7) ? 0 : (step == 0) ? 1 : 8 - step;
+				bits |= (unsigned long long)index << (3 * i);
+			}
+		}
+
+		for (int i = 0; i < 6; i++)
+			output[2 + i] = (unsigned char)(bits >> (8 * i));
+	}
+
+	//-------------------------------------------------------------------------
+	// BC7 mode 6: one subset, RGBA 7 bit endpoints with a shared bit each and
+	// 4 bit indices
+	//-------------------------------------------------------------------------
+	struct BitWriter
+	{
+		unsigned char* output;
+		int position;
+
+		void write(unsigned value, int bits)
+		{
+			for (int b = 0; b < bits; b++, position++)
+			{
+				if ((value >> b) & 1)
+					output[position >> 3] |= (unsigned char)(1 << (position & 7));
+			}
+		}
+	};
+
+	// Quantizes an endpoint to 7 bits per channel plus the p bit with the lowest error
+	void quantizeBC7Endpoint(const float endpoint[4], int quantized[4], int& pBit)
+	{
+		float bestError = FLT_MAX;
+		for (int p = 0; p < 2; p++)
+		{
+			int q[4];
+			float error = 0.0f;
+			for (int c = 0; c < 4; c++)
+			{
+				q[c] = std::min(127, std::max(0, (int)((endpoint[c] - p) * 0.5f + 0.5f)));
+				float d = endpoint[c] - (float)(q[c] * 2 + p);
+				error += d * d;
+			}
+
+			if (error < bestError)
+			{
+				bestError = error;
+				pBit = p;
+				memcpy(quantized, q, sizeof(q));
+			}
+		}
+	}
+
+	float encodeBC7Indices(const Block& block, const int q0[4], int p0, const int q1[4], int p1, int* indices)
+	{
+		float palette[16][4];
+		for (int e = 0; e < 16; e++)
+		{
+			int w = BC7_WEIGHTS4[e];
+			for (int c = 0; c < 4; c++)
+			{
+				int a = q0[c] * 2 + p0, b = q1[c] * 2 + p1;
+				palette[e][c] = (float)(((64 - w) * a + w * b + 32) >> 6);
+			}
+		}
+		return selectIndices(block, 4, palette, 16, indices);
+	}
+
+	void encodeBC7(const Block& block, unsigned char* output)
+	{
+		float e0[4], e1[4];
+		fitEndpoints(block, 4, 1.0f / 32.0f, e0, e1);
+
+		int q0[4], q1[4], p0, p1;
+		quantizeBC7Endpoint(e0, q0, p0);
+		quantizeBC7Endpoint(e1, q1, p1);
+
+		int indices[16];
+		float error = encodeBC7Indices(block, q0, p0, q1, p1, indices);
+
+		float weights[16];
+		for (int e = 0; e < 16; e++)
+			weights[e] = 1.0f - BC7_WEIGHTS4[e] / 64.0f;
+
+		if (error > 0.0f && refitEndpoints(block, 4, indices, weights, e0, e1))
+		{
+			int r0[4], r1[4], rp0, rp1, refitIndices[16];
+			quantizeBC7Endpoint(e0, r0, rp0);
+			quantizeBC7Endpoint(e1, r1, rp1);
+			float refitError = encodeBC7Indices(block, r0, rp0, r1, rp1, refitIndices);
+			if (refitError < error)
+			{
+				memcpy(q0, r0, sizeof(q0));
+				memcpy(q1, r1, sizeof(q1));
+				p0 = rp0;
+				p1 = rp1;
+				memcpy(indices, refitIndices, sizeof(indices));
+			}
+		}
+
+		// The first index is stored with 3 bits: its top bit must be 0
+		if (indices[0] >= 8)
+		{
+			for (int c = 0; c < 4; c++)
+				std::swap(q0[c], q1[c]);
+			std::swap(p0, p1);
+			for (int i = 0; i < 16; i++)
+				indices[i] = 15 - indices[i];
+		}
+
+		memset(output, 0, 16);
+		BitWriter writer = { output, 0 };
+		writer.write(1 << 6, 7);	// mode 6
+		for (int c = 0; c < 4; c++)
+		{
+			writer.write((unsigned)q0[c], 7);
+			writer.write((unsigned)q1[c], 7);
+		}
+		writer.write((unsigned)p0, 1);
+		writer.write((unsigned)p1, 1);
+		writer.write((unsigned)indices[0], 3);
+		for (int i = 1; i < 16; i++)
+			writer.write((unsigned)indices[i], 4);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+BlockCompressor::BlockCompressor(unsigned numThreads)
+	: mPool(numThreads)
+{
+}
+
+//-----------------------------------------------------------------------------
+// True when the palette search uses SSE2
+//-----------------------------------------------------------------------------
+bool BlockCompressor::hasSimd()
+{
+#ifdef BLOCK_COMPRESSOR_SSE2
+	return true;
+#else
+	return false;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Single block entry points
+//-----------------------------------------------------------------------------
+void BlockCompressor::compressBlockBC1(const unsigned char* rgba, unsigned char* output)
+{
+	Block block;
+	loadBlock(rgba, block);
+	encodeBC1Color(block, output);
+}
+
+void BlockCompressor::compressBlockBC3(const unsigned char* rgba, unsigned char* output)
+{
+	Block block;
+	loadBlock(rgba, block);
+	encodeBC4(block, 3, output);
+	encodeBC1Color(block, output + 8);
+}
+
+void BlockCompressor::compressBlockBC5(const unsigned char* rgba, unsigned char* output)
+{
+	Block block;
+	loadBlock(rgba, block);
+	encodeBC4(block, 0, output);
+	encodeBC4(block, 1, output + 8);
+}
+
+void BlockCompressor::compressBlockBC7(const unsigned char* rgba, unsigned char* output)
+{
+	Block block;
+	loadBlock(rgba, block);
+	encodeBC7(block, output);
+}
+
+//-----------------------------------------------------------------------------
+// Compresses a whole image.  Rows of blocks are spread over the pool; edge
+// blocks of sizes that are not a multiple of 4 repeat the last row/column.
+//-----------------------------------------------------------------------------
+void BlockCompressor::compress(const unsigned char* rgbaData, int width, int height, CompressedImage::Format format, unsigned char* output)
+{
+	void (*compressBlock)(const unsigned char*, unsigned char*) = NULL;
+	switch (format)
+	{
+	case CompressedImage::FORMAT_BC1:	compressBlock = compressBlockBC1; break;
+	case CompressedImage::FORMAT_BC3:	compressBlock = compressBlockBC3; break;
+	case CompressedImage::FORMAT_BC5:	compressBlock = compressBlockBC5; break;
+	case CompressedImage::FORMAT_BC7:	compressBlock = compressBlockBC7; break;
+	default: return;
+	}
+
+	int blocksX = std::max(1, (width + 3) / 4);
+	int blocksY = std::max(1, (height + 3) / 4);
+	int blockBytes = CompressedImage::getBlockBytes(format);
+
+	std::function<void(int, int)> compressRows = [=](int firstRow, int lastRow)
+	{
+		unsigned char block[64];
+		for (int by = firstRow; by < lastRow; by++)
+		{
+			for (int bx = 0; bx < blocksX; bx++)
+			{
+				for (int i = 0; i < 16; i++)
+				{
+					int x = std::min(bx * 4 + (i & 3), width - 1);
+					int y = std::min(by * 4 + (i >> 2), height - 1);
+					memcpy(&block[i * 4], &rgbaData[((size_t)y * width + x) * 4], 4);
+				}
+				compressBlock(block, output + ((size_t)by * blocksX + bx) * blockBytes);
+			}
+		}
+	};
+
+	// Small mip levels are not worth a trip through the pool
+	unsigned numThreads = mPool.getNumThreads();
+	if (numThreads < 2 || blocksX * blocksY < 256)
+	{
+		compressRows(0, blocksY);
+		return;
+	}
+
+	int rowsPerTask = std::max(1, blocksY / (int)(numThreads * 4));
+	for (int row = 0; row < blocksY; row += rowsPerTask)
+	{
+		int lastRow = std::min(blocksY, row + rowsPerTask);
+		mPool.enqueue([compressRows, row, lastRow] { compressRows(row, lastRow); });
+	}
+	mPool.wait();
+}
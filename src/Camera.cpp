@@ -71,6 +71,7 @@ FPSCamera::FPSCamera(glm::vec3 position, float yaw, float pitch)
 	mPosition = position;
 	mYaw = yaw;
 	mPitch = pitch;
+	updateCameraVectors();
 }
 
 //-----------------------------------------------------------------------------
@@ -180,3 +181,23 @@ void OrbitCamera::updateCameraVectors()
 	mPosition.y = mTargetPos.y + mRadius * sinf(mPitch);
 	mPosition.z = mTargetPos.z + mRadius * cosf(mPitch) * cosf(mYaw);
 }
+
+//------------------------------------------------------------
+// FixedCamera - Constructor
+//------------------------------------------------------------
+FixedCamera::FixedCamera()
+{
+}
+
+//------------------------------------------------------------
+// FixedCamera - Copies position, orientation and field of view
+//------------------------------------------------------------
+void FixedCamera::set(const glm::vec3& position, const glm::vec3& look, const glm::vec3& right, const glm::vec3& up, float fov)
+{
+	mPosition = position;
+	mLook = look;
+	mRight = right;
+	mUp = up;
+	mTargetPos = position + look;
+	mFOV = fov;
+}
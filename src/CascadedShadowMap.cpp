@@ -0,0 +1,355 @@
+//-----------------------------------------------------------------------------
+// Cascaded shadow maps for a directional light
+//-----------------------------------------------------------------------------
+#include "CascadedShadowMap.h"
+#include <iostream>
+#include <sstream>
+#include "glm/gtc/matrix_transform.hpp"
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+CascadedShadowMap::CascadedShadowMap()
+	: mResolution(0),
+	  mNumCascades(0),
+	  mShadowDistance(60.0f),
+	  mCasterDistance(100.0f),
+	  mSplitLambda(0.75f),
+	  mCacheSnapTexels(32),
+	  mStaticDirty(true),
+	  mLightDir(0.0f, -1.0f, 0.0f),
+	  mLightView(1.0f),
+	  mStaticDepth(0), mDepth(0),
+	  mStaticFBO(0), mFBO(0),
+	  mQueryFrame(0)
+{
+	for (int i = 0; i < MAX_CASCADES; i++)
+	{
+		mCascades[i].viewProj = glm::mat4(1.0f);
+		mCascades[i].snappedCenter = glm::vec3(0.0f);
+		mCascades[i].radius = 0.0f;
+		mCascades[i].splitFar = 0.0f;
+		mCascades[i].staticValid = false;
+		mStaticDraws[i] = mDynamicDraws[i] = 0;
+		mGpuTimeMs[i] = 0.0;
+		mQueries[0][i] = mQueries[1][i] = 0;
+	}
+	mQueryPending[0] = mQueryPending[1] = false;
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+CascadedShadowMap::~CascadedShadowMap()
+{
+	glDeleteQueries(2 * MAX_CASCADES, &mQueries[0][0]);
+	glDeleteFramebuffers(1, &mStaticFBO);
+	glDeleteFramebuffers(1, &mFBO);
+	glDeleteTextures(1, &mStaticDepth);
+	glDeleteTextures(1, &mDepth);
+}
+
+//-----------------------------------------------------------------------------
+// Creates the cached (static) and final depth arrays, one layer per cascade
+//-----------------------------------------------------------------------------
+bool CascadedShadowMap::init(int resolution, int numCascades)
+{
+	mResolution = resolution;
+	mNumCascades = glm::clamp(numCascades, 1, (int)MAX_CASCADES);
+
+	if (!mDepthShader.loadShaders("shaders/shadow_depth.vert", "shaders/shadow_depth.frag"))
+		return false;
+
+	GLuint* textures[2] = { &mStaticDepth, &mDepth };
+	for (int t = 0; t < 2; t++)
+	{
+		glGenTextures(1, textures[t]);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, *textures[t]);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, mResolution, mResolution, mNumCascades, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+
+	// Only the final array is sampled; hardware compare gives us bilinear PCF
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mDepth);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	GLuint* fbos[2] = { &mStaticFBO, &mFBO };
+	for (int f = 0; f < 2; f++)
+	{
+		glGenFramebuffers(1, fbos[f]);
+		glBindFramebuffer(GL_FRAMEBUFFER, *fbos[f]);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, *textures[f], 0, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cerr << "Shadow map framebuffer is incomplete!" << std::endl;
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			return false;
+		}
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenQueries(2 * MAX_CASCADES, &mQueries[0][0]);
+
+	mStaticDirty = true;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Sets the direction the light travels in.  Any change invalidates the cache.
+//-----------------------------------------------------------------------------
+void CascadedShadowMap::setLightDirection(const glm::vec3& direction)
+{
+	glm::vec3 dir = glm::normalize(direction);
+	if (dir == mLightDir)
+		return;
+
+	mLightDir = dir;
+
+	// Pick an up vector that is never parallel to the light
+	glm::vec3 up = (glm::abs(mLightDir.y) > 0.99f) ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	mLightView = glm::lookAt(glm::vec3(0.0f), mLightDir, up);
+
+	mStaticDirty = true;
+}
+
+//-----------------------------------------------------------------------------
+// Splits the view frustum and fits a stable, texel snapped ortho projection
+// around each slice.  Cascades only move in steps of mCacheSnapTexels texels
+// so the static cache survives small camera movements.
+//-----------------------------------------------------------------------------
+void CascadedShadowMap::update(const Camera& camera, float aspect, float nearPlane, float farPlane)
+{
+	float farDist = glm::min(farPlane, mShadowDistance);
+	float tanV = glm::tan(glm::radians(camera.getFOV()) * 0.5f);
+	float tanH = tanV * aspect;
+
+	const glm::vec3& pos = camera.getPosition();
+	const glm::vec3& look = camera.getLook();
+	const glm::vec3& right = camera.getRight();
+	const glm::vec3& up = camera.getUp();
+
+	float splitNear = nearPlane;
+	for (int c = 0; c < mNumCascades; c++)
+	{
+		// Practical split scheme: blend of logarithmic and uniform splits
+		float p = (float)(c + 1) / (float)mNumCascades;
+		float logSplit = nearPlane * glm::pow(farDist / nearPlane, p);
+		float uniformSplit = nearPlane + (farDist - nearPlane) * p;
+		float splitFar = glm::mix(uniformSplit, logSplit, mSplitLambda);
+
+		// Bounding sphere of the slice.  Its size does not depend on the camera
+		// orientation, so the projection does not change scale when rotating.
+		glm::vec3 corners[8];
+		for (int k = 0; k < 2; k++)
+		{
+			float d = (k == 0) ? splitNear : splitFar;
+			glm::vec3 center = pos + look * d;
+			glm::vec3 xs = right * (d * tanH);
+			glm::vec3 ys = up * (d * tanV);
+			corners[k * 4 + 0] = center - xs - ys;
+			corners[k * 4 + 1] = center + xs - ys;
+			corners[k * 4 + 2] = center + xs + ys;
+			corners[k * 4 + 3] = center - xs + ys;
+		}
+
+		glm::vec3 sphereCenter(0.0f);
+		for (int k = 0; k < 8; k++)
+			sphereCenter += corners[k];
+		sphereCenter /= 8.0f;
+
+		float radius = 0.0f;
+		for (int k = 0; k < 8; k++)
+			radius = glm::max(radius, glm::length(corners[k] - sphereCenter));
+		radius = glm::ceil(radius * 16.0f) / 16.0f;
+
+		// Pad the radius so that snapping the center by up to one step never
+		// uncovers part of the slice:  r' = r + k * texel,  texel = 2r' / res
+		float padScale = 1.0f - 2.0f * (float)mCacheSnapTexels / (float)mResolution;
+		float paddedRadius = radius / padScale;
+		float texelSize = 2.0f * paddedRadius / (float)mResolution;
+		float snapStep = texelSize * (float)mCacheSnapTexels;
+
+		glm::vec3 centerLS = glm::vec3(mLightView * glm::vec4(sphereCenter, 1.0f));
+		glm::vec3 snapped = glm::floor(centerLS / snapStep + glm::vec3(0.5f)) * snapStep;
+
+		Cascade& cascade = mCascades[c];
+		if (snapped != cascade.snappedCenter || paddedRadius != cascade.radius)
+			cascade.staticValid = false;
+
+		cascade.snappedCenter = snapped;
+		cascade.radius = paddedRadius;
+		cascade.splitFar = splitFar;
+
+		// View space looks down -Z so the depth range is centered on -snapped.z.
+		// The near plane is pulled back to catch casters outside the slice.
+		glm::mat4 lightProj = glm::ortho(snapped.x - paddedRadius, snapped.x + paddedRadius,
+										 snapped.y - paddedRadius, snapped.y + paddedRadius,
+										 -snapped.z - paddedRadius - mCasterDistance, -snapped.z + paddedRadius);
+		cascade.viewProj = lightProj * mLightView;
+
+		splitNear = splitFar;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Renders the shadow maps.  Static casters are only drawn into cascades whose
+// cache is stale, then each cascade is copied from the cache and the dynamic
+// casters are composited on top.
+//-----------------------------------------------------------------------------
+void CascadedShadowMap::render(const std::vector<ShadowCaster>& casters)
+{
+	mDrawnCasters.clear();
+	if (mNumCascades == 0)
+		return;
+
+	collectQueries();
+
+	if (mStaticDirty)
+	{
+		for (int c = 0; c < mNumCascades; c++)
+			mCascades[c].staticValid = false;
+		mStaticDirty = false;
+	}
+
+	// The caller's framebuffer and viewport are restored at the end
+	GLint framebuffer = 0;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glViewport(0, 0, mResolution, mResolution);
+
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.0f, 4.0f);
+
+	mDepthShader.use();
+
+	bool staticDrawn = false;
+	for (int c = 0; c < mNumCascades; c++)
+	{
+		Cascade& cascade = mCascades[c];
+		mStaticDraws[c] = 0;
+		mDynamicDraws[c] = 0;
+
+		glBeginQuery(GL_TIME_ELAPSED, mQueries[mQueryFrame][c]);
+
+		if (!cascade.staticValid)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, mStaticFBO);
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mStaticDepth, 0, c);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			drawCasters(casters, cascade.viewProj, true, mStaticDraws[c]);
+			cascade.staticValid = true;
+			staticDrawn = true;
+		}
+
+		// Copy the cached static depth into the sampled array ...
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, mStaticFBO);
+		glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mStaticDepth, 0, c);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mFBO);
+		glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mDepth, 0, c);
+		glBlitFramebuffer(0, 0, mResolution, mResolution, 0, 0, mResolution, mResolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+		// ... and draw the dynamic casters on top of it
+		glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+		drawCasters(casters, cascade.viewProj, false, mDynamicDraws[c]);
+
+		glEndQuery(GL_TIME_ELAPSED);
+	}
+
+	mQueryPending[mQueryFrame] = true;
+	mQueryFrame ^= 1;
+
+	// Every cascade draws every dynamic caster, the static ones with a cache refresh
+	for (size_t i = 0; i < casters.size(); i++)
+	{
+		if (casters[i].mesh != NULL && (!casters[i].isStatic || staticDrawn))
+			mDrawnCasters.push_back((int)i);
+	}
+
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)framebuffer);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+//-----------------------------------------------------------------------------
+// Draws either the static or the dynamic casters with the depth only shader
+//-----------------------------------------------------------------------------
+void CascadedShadowMap::drawCasters(const std::vector<ShadowCaster>& casters, const glm::mat4& viewProj, bool staticPass, int& drawCount)
+{
+	mDepthShader.setUniform("lightViewProj", viewProj);
+
+	for (size_t i = 0; i < casters.size(); i++)
+	{
+		const ShadowCaster& caster = casters[i];
+		if (caster.isStatic != staticPass || caster.mesh == NULL || !caster.mesh->isLoaded())
+			continue;
+
+		mDepthShader.setUniform("model", caster.model);
+		caster.mesh->drawPositions();
+		drawCount++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Reads the timer queries issued two frames ago (if the GPU is done with them)
+//-----------------------------------------------------------------------------
+void CascadedShadowMap::collectQueries()
+{
+	if (!mQueryPending[mQueryFrame])
+		return;
+
+	GLint available = 0;
+	glGetQueryObjectiv(mQueries[mQueryFrame][mNumCascades - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return;
+
+	for (int c = 0; c < mNumCascades; c++)
+	{
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(mQueries[mQueryFrame][c], GL_QUERY_RESULT, &elapsed);
+		mGpuTimeMs[c] = (double)elapsed / 1000000.0;
+	}
+	mQueryPending[mQueryFrame] = false;
+}
+
+//-----------------------------------------------------------------------------
+// Binds the shadow map array to the given texture unit and sets the cascade
+// uniforms.  NOTE: Shader must be currently active first.
+//-----------------------------------------------------------------------------
+void CascadedShadowMap::bind(ShaderProgram& shader, GLuint texUnit)
+{
+	glActiveTexture(GL_TEXTURE0 + texUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mDepth);
+
+	shader.setUniform("shadowMap", (GLint)texUnit);
+	shader.setUniform("numCascades", (GLint)mNumCascades);
+
+	for (int c = 0; c < mNumCascades; c++)
+	{
+		std::ostringstream index;
+		index << "[" << c << "]";
+
+		shader.setUniform(("cascadeViewProj" + index.str()).c_str(), mCascades[c].viewProj);
+		shader.setUniform(("cascadeSplits" + index.str()).c_str(), mCascades[c].splitFar);
+		shader.setUniform(("cascadeTexelSize" + index.str()).c_str(), 2.0f * mCascades[c].radius / (float)mResolution);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Unbinds the shadow map array from the given texture unit
+//-----------------------------------------------------------------------------
+void CascadedShadowMap::unbind(GLuint texUnit)
+{
+	glActiveTexture(GL_TEXTURE0 + texUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
@@ -0,0 +1,447 @@
+//-----------------------------------------------------------------------------
+// Cooked image with its mip chain (BC1, BC3, BC5, BC7 or RGBA8)
+//-----------------------------------------------------------------------------
+#include "CompressedImage.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+	// DDS
+	const unsigned DDS_MAGIC = 0x20534444;			// "DDS "
+	const unsigned DDS_HEADER_SIZE = 124;
+	const unsigned DDSD_CAPS = 0x1, DDSD_HEIGHT = 0x2, DDSD_WIDTH = 0x4, DDSD_PIXELFORMAT = 0x1000;
+	const unsigned DDSD_PITCH = 0x8, DDSD_MIPMAPCOUNT = 0x20000, DDSD_LINEARSIZE = 0x80000;
+	const unsigned DDPF_FOURCC = 0x4;
+	const unsigned DDSCAPS_COMPLEX = 0x8, DDSCAPS_TEXTURE = 0x1000, DDSCAPS_MIPMAP = 0x400000;
+	const unsigned DDS_DIMENSION_TEXTURE2D = 3;
+
+	const unsigned DXGI_BC1_UNORM = 71, DXGI_BC1_UNORM_SRGB = 72;
+	const unsigned DXGI_BC3_UNORM = 77, DXGI_BC3_UNORM_SRGB = 78;
+	const unsigned DXGI_BC5_UNORM = 83;
+	const unsigned DXGI_BC7_UNORM = 98, DXGI_BC7_UNORM_SRGB = 99;
+	const unsigned DXGI_R8G8B8A8_UNORM = 28, DXGI_R8G8B8A8_UNORM_SRGB = 29;
+
+	// KTX2
+	const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+	const unsigned VK_BC1_RGB_UNORM = 131, VK_BC1_RGB_SRGB = 132, VK_BC1_RGBA_UNORM = 133, VK_BC1_RGBA_SRGB = 134;
+	const unsigned VK_BC3_UNORM = 137, VK_BC3_SRGB = 138;
+	const unsigned VK_BC5_UNORM = 141;
+	const unsigned VK_BC7_UNORM = 145, VK_BC7_SRGB = 146;
+	const unsigned VK_R8G8B8A8_UNORM = 37, VK_R8G8B8A8_SRGB = 43;
+
+	unsigned fourCC(char a, char b, char c, char d)
+	{
+		return (unsigned)(unsigned char)a | ((unsigned)(unsigned char)b << 8) |
+			   ((unsigned)(unsigned char)c << 16) | ((unsigned)(unsigned char)d << 24);
+	}
+
+	// Both containers are little endian
+	unsigned readU32(const unsigned char* p)
+	{
+		return (unsigned)p[0] | ((unsigned)p[1] << 8) | ((unsigned)p[2] << 16) | ((unsigned)p[3] << 24);
+	}
+
+	unsigned long long readU64(const unsigned char* p)
+	{
+		return (unsigned long long)readU32(p) | ((unsigned long long)readU32(p + 4) << 32);
+	}
+
+	void writeU32(unsigned char* p, unsigned value)
+	{
+		p[0] = (unsigned char)value;
+		p[1] = (unsigned char)(value >> 8);
+		p[2] = (unsigned char)(value >> 16);
+		p[3] = (unsigned char)(value >> 24);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+CompressedImage::CompressedImage()
+	: mFormat(FORMAT_UNKNOWN),
+	  mSRGB(false),
+	  mWidth(0),
+	  mHeight(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+// Bytes per 4x4 block
+//-----------------------------------------------------------------------------
+int CompressedImage::getBlockBytes(Format format)
+{
+	switch (format)
+	{
+	case FORMAT_BC1:	return 8;
+	case FORMAT_BC3:
+	case FORMAT_BC5:
+	case FORMAT_BC7:	return 16;
+	default:			return 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Size of one mip level (partial blocks round up)
+//-----------------------------------------------------------------------------
+size_t CompressedImage::getLevelSize(Format format, int width, int height)
+{
+	if (format == FORMAT_RGBA8)
+		return (size_t)std::max(1, width) * std::max(1, height) * 4;
+
+	size_t blocksX = (size_t)std::max(1, (width + 3) / 4);
+	size_t blocksY = (size_t)std::max(1, (height + 3) / 4);
+	return blocksX * blocksY * getBlockBytes(format);
+}
+
+//-----------------------------------------------------------------------------
+// Human readable format name
+//-----------------------------------------------------------------------------
+const char* CompressedImage::getFormatName(Format format)
+{
+	switch (format)
+	{
+	case FORMAT_BC1:	return "BC1";
+	case FORMAT_BC3:	return "BC3";
+	case FORMAT_BC5:	return "BC5";
+	case FORMAT_BC7:	return "BC7";
+	case FORMAT_RGBA8:	return "RGBA8";
+	default:			return "unknown";
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Checks the extension of a file name
+//-----------------------------------------------------------------------------
+bool CompressedImage::isContainerFile(const std::string& fileName)
+{
+	size_t dot = fileName.find_last_of('.');
+	if (dot == std::string::npos)
+		return false;
+
+	std::string ext = fileName.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	return ext == "dds" || ext == "ktx2";
+}
+
+//-----------------------------------------------------------------------------
+// Starts a new image without levels
+//-----------------------------------------------------------------------------
+void CompressedImage::create(Format format, bool srgb, int width, int height)
+{
+	mFormat = format;
+	mSRGB = srgb;
+	mWidth = width;
+	mHeight = height;
+	mLevels.clear();
+	mData.clear();
+}
+
+//-----------------------------------------------------------------------------
+// Appends the next (half size) mip level and returns its block storage
+//-----------------------------------------------------------------------------
+unsigned char* CompressedImage::addLevel()
+{
+	Level level;
+	level.width = std::max(1, mWidth >> (int)mLevels.size());
+	level.height = std::max(1, mHeight >> (int)mLevels.size());
+	level.offset = mData.size();
+	level.size = getLevelSize(mFormat, level.width, level.height);
+
+	mLevels.push_back(level);
+	mData.resize(mData.size() + level.size);
+	return &mData[level.offset];
+}
+
+//-----------------------------------------------------------------------------
+// Reads a .dds or .ktx2 file
+//-----------------------------------------------------------------------------
+bool CompressedImage::loadFromFile(const std::string& fileName)
+{
+	std::ifstream fin(fileName, std::ios::in | std::ios::binary);
+	if (!fin)
+	{
+		std::cerr << "Error opening compressed texture '" << fileName << "'" << std::endl;
+		return false;
+	}
+
+	std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+	if (bytes.empty())
+	{
+		std::cerr << "Error reading compressed texture '" << fileName << "'" << std::endl;
+		return false;
+	}
+
+	return loadFromMemory(&bytes[0], bytes.size(), fileName);
+}
+
+//-----------------------------------------------------------------------------
+// Parses a container already in memory (detected from its magic number)
+//-----------------------------------------------------------------------------
+bool CompressedImage::loadFromMemory(const unsigned char* bytes, size_t size, const std::string& name)
+{
+	create(FORMAT_UNKNOWN, false, 0, 0);
+
+	if (size >= sizeof(KTX2_IDENTIFIER) && memcmp(bytes, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0)
+		return parseKTX2(bytes, size, name);
+
+	if (size >= 4 && readU32(bytes) == DDS_MAGIC)
+		return parseDDS(bytes, size, name);
+
+	std::cerr << "Error: '" << name << "' is not a DDS or KTX2 file" << std::endl;
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// DDS: magic, 124 byte header, optional 20 byte DX10 header, then the levels
+// back to back.
+//-----------------------------------------------------------------------------
+bool CompressedImage::parseDDS(const unsigned char* bytes, size_t size, const std::string& name)
+{
+	if (size < 4 + DDS_HEADER_SIZE || readU32(bytes + 4) != DDS_HEADER_SIZE)
+	{
+		std::cerr << "Error: invalid DDS header in '" << name << "'" << std::endl;
+		return false;
+	}
+
+	const unsigned char* header = bytes + 4;
+	unsigned flags = readU32(header + 4);
+	int height = (int)readU32(header + 8);
+	int width = (int)readU32(header + 12);
+	unsigned mipCount = (flags & DDSD_MIPMAPCOUNT) ? readU32(header + 24) : 1;
+	const unsigned char* pixelFormat = header + 72;
+	unsigned pfFlags = readU32(pixelFormat + 4);
+	unsigned pfFourCC = readU32(pixelFormat + 8);
+	unsigned caps2 = readU32(header + 108);
+
+	size_t dataOffset = 4 + DDS_HEADER_SIZE;
+	Format format = FORMAT_UNKNOWN;
+	bool srgb = false;
+
+	if (!(pfFlags & DDPF_FOURCC))
+	{
+		std::cerr << "Error: unsupported DDS pixel format in '" << name << "'" << std::endl;
+		return false;
+	}
+
+	if (pfFourCC == fourCC('D', 'X', 'T', '1'))
+		format = FORMAT_BC1;
+	else if (pfFourCC == fourCC('D', 'X', 'T', '5'))
+		format = FORMAT_BC3;
+	else if (pfFourCC == fourCC('A', 'T', 'I', '2') || pfFourCC == fourCC('B', 'C', '5', 'U'))
+		format = FORMAT_BC5;
+	else if (pfFourCC == fourCC('D', 'X', '1', '0'))
+	{
+		if (size < dataOffset + 20)
+		{
+			std::cerr << "Error: truncated DX10 header in '" << name << "'" << std::endl;
+			return false;
+		}
+
+		const unsigned char* dx10 = bytes + dataOffset;
+		unsigned dxgiFormat = readU32(dx10);
+		unsigned dimension = readU32(dx10 + 4);
+		unsigned arraySize = readU32(dx10 + 12);
+		dataOffset += 20;
+
+		if (dimension != DDS_DIMENSION_TEXTURE2D || arraySize > 1)
+		{
+			std::cerr << "Error: '" << name << "' is not a single 2D texture" << std::endl;
+			return false;
+		}
+
+		switch (dxgiFormat)
+		{
+		case DXGI_BC1_UNORM_SRGB:	srgb = true;	// fall through
+		case DXGI_BC1_UNORM:		format = FORMAT_BC1; break;
+		case DXGI_BC3_UNORM_SRGB:	srgb = true;	// fall through
+		case DXGI_BC3_UNORM:		format = FORMAT_BC3; break;
+		case DXGI_BC5_UNORM:		format = FORMAT_BC5; break;
+		case DXGI_BC7_UNORM_SRGB:	srgb = true;	// fall through
+		case DXGI_BC7_UNORM:		format = FORMAT_BC7; break;
+		case DXGI_R8G8B8A8_UNORM_SRGB:	srgb = true;	// fall through
+		case DXGI_R8G8B8A8_UNORM:	format = FORMAT_RGBA8; break;
+		default: break;
+		}
+	}
+
+	if (format == FORMAT_UNKNOWN)
+	{
+		std::cerr << "Error: unsupported DDS format in '" << name << "'" << std::endl;
+		return false;
+	}
+
+	if (caps2 != 0)
+	{
+		std::cerr << "Error: cube maps and volumes are not supported ('" << name << "')" << std::endl;
+		return false;
+	}
+
+	create(format, srgb, width, height);
+	mipCount = std::max(1u, mipCount);
+	size_t offset = dataOffset;
+	for (unsigned i = 0; i < mipCount; i++)
+	{
+		size_t levelSize = getLevelSize(format, std::max(1, width >> i), std::max(1, height >> i));
+		if (offset + levelSize > size)
+		{
+			std::cerr << "Error: truncated mip level " << i << " in '" << name << "'" << std::endl;
+			create(FORMAT_UNKNOWN, false, 0, 0);
+			return false;
+		}
+
+		memcpy(addLevel(), bytes + offset, levelSize);
+		offset += levelSize;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// KTX2: identifier, header, index, level index (largest level first), then
+// the levels at arbitrary offsets.  Only supercompression scheme 0 is read.
+//-----------------------------------------------------------------------------
+bool CompressedImage::parseKTX2(const unsigned char* bytes, size_t size, const std::string& name)
+{
+	const size_t headerSize = 12 + 9 * 4 + 4 * 4 + 2 * 8;
+	if (size < headerSize)
+	{
+		std::cerr << "Error: invalid KTX2 header in '" << name << "'" << std::endl;
+		return false;
+	}
+
+	const unsigned char* header = bytes + 12;
+	unsigned vkFormat = readU32(header);
+	int width = (int)readU32(header + 8);
+	int height = (int)readU32(header + 12);
+	unsigned depth = readU32(header + 16);
+	unsigned layerCount = readU32(header + 20);
+	unsigned faceCount = readU32(header + 24);
+	unsigned levelCount = std::max(1u, readU32(header + 28));
+	unsigned supercompression = readU32(header + 32);
+
+	Format format = FORMAT_UNKNOWN;
+	bool srgb = false;
+	switch (vkFormat)
+	{
+	case VK_BC1_RGB_SRGB:
+	case VK_BC1_RGBA_SRGB:	srgb = true;	// fall through
+	case VK_BC1_RGB_UNORM:
+	case VK_BC1_RGBA_UNORM:	format = FORMAT_BC1; break;
+	case VK_BC3_SRGB:		srgb = true;	// fall through
+	case VK_BC3_UNORM:		format = FORMAT_BC3; break;
+	case VK_BC5_UNORM:		format = FORMAT_BC5; break;
+	case VK_BC7_SRGB:		srgb = true;	// fall through
+	case VK_BC7_UNORM:		format = FORMAT_BC7; break;
+	case VK_R8G8B8A8_SRGB:	srgb = true;	// fall through
+	case VK_R8G8B8A8_UNORM:	format = FORMAT_RGBA8; break;
+	default: break;
+	}
+
+	if (format == FORMAT_UNKNOWN)
+	{
+		std::cerr << "Error: unsupported KTX2 format " << vkFormat << " in '" << name << "'" << std::endl;
+		return false;
+	}
+
+	if (supercompression != 0 || depth > 1 || layerCount > 1 || faceCount != 1 || height == 0)
+	{
+		std::cerr << "Error: '" << name << "' is not a plain 2D KTX2 texture" << std::endl;
+		return false;
+	}
+
+	if (size < headerSize + levelCount * 24)
+	{
+		std::cerr << "Error: truncated KTX2 level index in '" << name << "'" << std::endl;
+		return false;
+	}
+
+	create(format, srgb, width, height);
+	const unsigned char* levelIndex = bytes + headerSize;
+	for (unsigned i = 0; i < levelCount; i++)
+	{
+		unsigned long long offset = readU64(levelIndex + i * 24);
+		unsigned long long length = readU64(levelIndex + i * 24 + 8);
+		size_t levelSize = getLevelSize(format, std::max(1, width >> i), std::max(1, height >> i));
+		if (length != levelSize || offset + length > size)
+		{
+			std::cerr << "Error: invalid mip level " << i << " in '" << name << "'" << std::endl;
+			create(FORMAT_UNKNOWN, false, 0, 0);
+			return false;
+		}
+
+		memcpy(addLevel(), bytes + offset, levelSize);
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Writes a DDS file.  Linear BC1/BC3 use the legacy FourCC header every tool
+// understands, everything else a DX10 header.
+//-----------------------------------------------------------------------------
+bool CompressedImage::saveDDS(const std::string& fileName) const
+{
+	if (mFormat == FORMAT_UNKNOWN || mLevels.empty())
+		return false;
+
+	bool dx10 = mSRGB || mFormat == FORMAT_BC5 || mFormat == FORMAT_BC7 || mFormat == FORMAT_RGBA8;
+
+	unsigned char header[4 + DDS_HEADER_SIZE + 20];
+	memset(header, 0, sizeof(header));
+	writeU32(header, DDS_MAGIC);
+	writeU32(header + 4, DDS_HEADER_SIZE);
+	bool uncompressed = mFormat == FORMAT_RGBA8;
+	writeU32(header + 8, DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT |
+						 (uncompressed ? DDSD_PITCH : DDSD_LINEARSIZE));
+	writeU32(header + 12, (unsigned)mHeight);
+	writeU32(header + 16, (unsigned)mWidth);
+	writeU32(header + 20, uncompressed ? (unsigned)mWidth * 4 : (unsigned)mLevels[0].size);	// row pitch or top level size
+	writeU32(header + 28, (unsigned)mLevels.size());
+
+	unsigned char* pixelFormat = header + 4 + 72;
+	writeU32(pixelFormat, 32);
+	writeU32(pixelFormat + 4, DDPF_FOURCC);
+	if (dx10)
+		writeU32(pixelFormat + 8, fourCC('D', 'X', '1', '0'));
+	else
+		writeU32(pixelFormat + 8, mFormat == FORMAT_BC1 ? fourCC('D', 'X', 'T', '1') : fourCC('D', 'X', 'T', '5'));
+
+	unsigned caps = DDSCAPS_TEXTURE;
+	if (mLevels.size() > 1)
+		caps |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+	writeU32(header + 4 + 104, caps);
+
+	if (dx10)
+	{
+		unsigned dxgiFormat = 0;
+		switch (mFormat)
+		{
+		case FORMAT_BC1:	dxgiFormat = mSRGB ? DXGI_BC1_UNORM_SRGB : DXGI_BC1_UNORM; break;
+		case FORMAT_BC3:	dxgiFormat = mSRGB ? DXGI_BC3_UNORM_SRGB : DXGI_BC3_UNORM; break;
+		case FORMAT_BC5:	dxgiFormat = DXGI_BC5_UNORM; break;
+		case FORMAT_BC7:	dxgiFormat = mSRGB ? DXGI_BC7_UNORM_SRGB : DXGI_BC7_UNORM; break;
+		case FORMAT_RGBA8:	dxgiFormat = mSRGB ? DXGI_R8G8B8A8_UNORM_SRGB : DXGI_R8G8B8A8_UNORM; break;
+		default: break;
+		}
+
+		unsigned char* dx10Header = header + 4 + DDS_HEADER_SIZE;
+		writeU32(dx10Header, dxgiFormat);
+		writeU32(dx10Header + 4, DDS_DIMENSION_TEXTURE2D);
+		writeU32(dx10Header + 12, 1);	// array size
+	}
+
+	std::ofstream fout(fileName, std::ios::out | std::ios::binary);
+	if (!fout)
+	{
+		std::cerr << "Error creating '" << fileName << "'" << std::endl;
+		return false;
+	}
+
+	fout.write((const char*)header, dx10 ? sizeof(header) : sizeof(header) - 20);
+	fout.write((const char*)&mData[0], (std::streamsize)mData.size());
+	return (bool)fout;
+}
@@ -0,0 +1,192 @@
+//-----------------------------------------------------------------------------
+// Builds the draw lists of a frame on the job system
+//-----------------------------------------------------------------------------
+#include "DrawListBuilder.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	// Objects per chunk, and per-draw data items per packing job
+	const size_t CHUNK_SIZE = 1024;
+	const size_t PACK_GRAIN = 4096;
+
+	const float INSIDE_SCREEN_SIZE = 1e6f;
+}
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+DrawListBuilder::DrawListBuilder()
+	: mObjects(nullptr),
+	  mWorldMatrices(nullptr),
+	  mQueue(nullptr),
+	  mDepthQueue(nullptr),
+	  mProjectionScale(1.0f),
+	  mOcclusion(nullptr),
+	  mVisibleCount(0),
+	  mOccludedCount(0),
+	  mBuildMs(0.0)
+{
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+DrawListBuilder::~DrawListBuilder()
+{
+}
+
+//-----------------------------------------------------------------------------
+// Cull and key the chunks in parallel, then gather the slices (each at the
+// offset of the visible objects before it) and sort
+//-----------------------------------------------------------------------------
+void DrawListBuilder::build(const std::vector<Object>& objects, const std::vector<glm::mat4>& worldMatrices,
+							const glm::mat4& view, const glm::mat4& projection,
+							RenderQueue& queue, RenderQueue* depthQueue, JobSystem* jobs)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	mObjects = &objects;
+	mWorldMatrices = &worldMatrices;
+	mQueue = &queue;
+	mDepthQueue = depthQueue;
+	mView = view;
+	mProjectionScale = projection[1][1];
+
+	// Frustum planes (Gribb/Hartmann) in world space
+	glm::mat4 m = glm::transpose(projection * view);
+	mPlanes[0] = m[3] + m[0];
+	mPlanes[1] = m[3] - m[0];
+	mPlanes[2] = m[3] + m[1];
+	mPlanes[3] = m[3] - m[1];
+	mPlanes[4] = m[3] + m[2];
+	mPlanes[5] = m[3] - m[2];
+	for (int i = 0; i < 6; i++)
+		mPlanes[i] /= glm::length(glm::vec3(mPlanes[i]));
+
+	size_t count = std::min(objects.size(), worldMatrices.size());
+	size_t numChunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	mSlices.resize(count);
+	if (depthQueue)
+		mDepthSlices.resize(count);
+	mSliceCounts.assign(numChunks, 0);
+	mOccludedCounts.assign(numChunks, 0);
+	mScreenSize.resize(count);
+
+	std::function<void(size_t, size_t)> cull = [this](size_t first, size_t last) { cullChunk(first, last); };
+	if (jobs)
+		jobs->parallelFor(0, count, CHUNK_SIZE, cull);
+	else
+		cull(0, count);
+
+	// Slice offsets
+	std::vector<size_t> offsets(numChunks);
+	mVisibleCount = 0;
+	mOccludedCount = 0;
+	for (size_t c = 0; c < numChunks; c++)
+	{
+		offsets[c] = mVisibleCount;
+		mVisibleCount += mSliceCounts[c];
+		mOccludedCount += mOccludedCounts[c];
+	}
+
+	queue.clear();
+	RenderQueue::Packet* packets = queue.append(mVisibleCount);
+	RenderQueue::Packet* depthPackets = nullptr;
+	if (depthQueue)
+	{
+		depthQueue->clear();
+		depthPackets = depthQueue->append(mVisibleCount);
+	}
+
+	std::function<void(size_t, size_t)> gather = [&](size_t first, size_t last)
+	{
+		for (size_t c = first; c < last; c++)
+		{
+			size_t bytes = mSliceCounts[c] * sizeof(RenderQueue::Packet);
+			if (bytes == 0)
+				continue;
+			memcpy(packets + offsets[c], &mSlices[c * CHUNK_SIZE], bytes);
+			if (depthPackets)
+				memcpy(depthPackets + offsets[c], &mDepthSlices[c * CHUNK_SIZE], bytes);
+		}
+	};
+	if (jobs)
+		jobs->parallelFor(0, numChunks, 16, gather);
+	else
+		gather(0, numChunks);
+
+	queue.sort(jobs);
+	if (depthQueue)
+		depthQueue->sort(jobs);
+
+	mBuildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+//-----------------------------------------------------------------------------
+// Per-draw data in sorted order
+//-----------------------------------------------------------------------------
+void DrawListBuilder::pack(const RenderQueue& queue, const PackFunction& pack, JobSystem* jobs)
+{
+	std::function<void(size_t, size_t)> packRange = [&](size_t first, size_t last)
+	{
+		for (size_t n = first; n < last; n++)
+			pack(n, queue.getPacket(n));
+	};
+	if (jobs)
+		jobs->parallelFor(0, queue.size(), PACK_GRAIN, packRange);
+	else
+		packRange(0, queue.size());
+}
+
+//-----------------------------------------------------------------------------
+// Job : the objects of one chunk against the frustum, then the occluders.  The
+// world radius takes the largest scale of the world matrix.  An occluded
+// object keeps its screen size, so its textures stay resident.
+//-----------------------------------------------------------------------------
+void DrawListBuilder::cullChunk(size_t first, size_t last)
+{
+	size_t chunk = first / CHUNK_SIZE;
+	RenderQueue::Packet* slice = &mSlices[chunk * CHUNK_SIZE];
+	RenderQueue::Packet* depthSlice = mDepthQueue ? &mDepthSlices[chunk * CHUNK_SIZE] : nullptr;
+	size_t kept = 0, occluded = 0;
+
+	for (size_t i = first; i < last; i++)
+	{
+		const Object& object = (*mObjects)[i];
+		mScreenSize[i] = 0.0f;
+		if (object.radius <= 0.0f)
+			continue;
+
+		const glm::mat4& world = (*mWorldMatrices)[i];
+		glm::vec4 center = world * glm::vec4(object.center, 1.0f);
+		float scale = std::max(glm::dot(glm::vec3(world[0]), glm::vec3(world[0])),
+							   std::max(glm::dot(glm::vec3(world[1]), glm::vec3(world[1])),
+										glm::dot(glm::vec3(world[2]), glm::vec3(world[2]))));
+		float radius = object.radius * sqrtf(scale);
+
+		bool visible = true;
+		for (int p = 0; p < 6 && visible; p++)
+			visible = glm::dot(glm::vec3(mPlanes[p]), glm::vec3(center)) + mPlanes[p].w >= -radius;
+		if (!visible)
+			continue;
+
+		float depth = -(mView[0][2] * center.x + mView[1][2] * center.y + mView[2][2] * center.z + mView[3][2]);
+		mScreenSize[i] = depth > radius ? radius * mProjectionScale / depth : INSIDE_SCREEN_SIZE;
+		if (mOcclusion && mOcclusion->isOccluded(glm::vec3(center), radius))
+		{
+			occluded++;
+			continue;
+		}
+
+		slice[kept] = mQueue->makePacket(object.pass, object.program, object.texture, object.material, object.mesh, depth, (int)i);
+		if (depthSlice)
+			depthSlice[kept] = mDepthQueue->makePacket(object.pass, 0, 0, 0, 0, depth, (int)i);
+		kept++;
+	}
+	mSliceCounts[chunk] = kept;
+	mOccludedCounts[chunk] = occluded;
+}
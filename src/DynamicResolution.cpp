@@ -0,0 +1,207 @@
+//-----------------------------------------------------------------------------
+// Dynamic resolution scaling
+//-----------------------------------------------------------------------------
+#include "DynamicResolution.h"
+#include <iostream>
+#include "glm/glm.hpp"
+
+static const float HEADROOM = 0.9f;			// aim a little under the budget
+static const float DECREASE_GAIN = 0.5f;	// react quickly to spikes ...
+static const float INCREASE_GAIN = 0.1f;	// ... and recover slowly
+static const float DEAD_BAND = 0.05f;		// ignore changes smaller than 5%
+static const int SIZE_ALIGNMENT = 8;		// render sizes are multiples of 8 pixels
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+DynamicResolution::DynamicResolution()
+	: mEnabled(true),
+	  mFilter(EDGE_AWARE),
+	  mMinScale(0.5f), mMaxScale(1.0f),
+	  mTargetMs(16.0f),
+	  mScale(1.0f),
+	  mOutputWidth(0), mOutputHeight(0),
+	  mRenderWidth(0), mRenderHeight(0),
+	  mFBO(0), mColor(0), mDepth(0),
+	  mQuadVAO(0),
+	  mLastResult(0),
+	  mGpuTimeMs(0.0)
+{
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+DynamicResolution::~DynamicResolution()
+{
+	destroyTargets();
+	glDeleteVertexArrays(1, &mQuadVAO);
+}
+
+//-----------------------------------------------------------------------------
+// Loads the upscale shader and creates the offscreen target
+//-----------------------------------------------------------------------------
+bool DynamicResolution::init(int outputWidth, int outputHeight)
+{
+	if (!mUpscaleShader.loadShaders("shaders/upscale.vert", "shaders/upscale.frag"))
+		return false;
+
+	// The full screen triangle is generated from gl_VertexID, the VAO is empty
+	glGenVertexArrays(1, &mQuadVAO);
+
+	// Timestamps rather than GL_TIME_ELAPSED: the frame encloses other timer queries
+	mFrameTimer.init(GL_TIMESTAMP);
+
+	// Started minimized : the targets come with the first frame of some size
+	if (outputWidth <= 0 || outputHeight <= 0)
+		return true;
+	return createTargets(outputWidth, outputHeight);
+}
+
+//-----------------------------------------------------------------------------
+// Sets the allowed scale range (per axis, 1.0 = native resolution)
+//-----------------------------------------------------------------------------
+void DynamicResolution::setScaleRange(float minScale, float maxScale)
+{
+	mMinScale = glm::clamp(minScale, 0.1f, 1.0f);
+	mMaxScale = glm::clamp(maxScale, mMinScale, 1.0f);
+	mScale = glm::clamp(mScale, mMinScale, mMaxScale);
+}
+
+//-----------------------------------------------------------------------------
+// The offscreen target is allocated at the output size; lower scales only
+// use its lower left corner so changing the scale never reallocates.
+//-----------------------------------------------------------------------------
+bool DynamicResolution::createTargets(int width, int height)
+{
+	destroyTargets();
+
+	mOutputWidth = width;
+	mOutputHeight = height;
+
+	glGenTextures(1, &mColor);
+	glBindTexture(GL_TEXTURE_2D, mColor);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// A texture rather than a renderbuffer : GpuCuller builds its depth pyramid from it
+	glGenTextures(1, &mDepth);
+	glBindTexture(GL_TEXTURE_2D, mDepth);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &mFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mColor, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, mDepth, 0);
+
+	bool complete = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (!complete)
+		std::cerr << "Dynamic resolution framebuffer is incomplete!" << std::endl;
+
+	return complete;
+}
+
+//-----------------------------------------------------------------------------
+// Releases the offscreen target
+//-----------------------------------------------------------------------------
+void DynamicResolution::destroyTargets()
+{
+	glDeleteFramebuffers(1, &mFBO);
+	glDeleteTextures(1, &mColor);
+	glDeleteTextures(1, &mDepth);
+	mFBO = mColor = mDepth = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Binds the offscreen target and sets the viewport to the scaled size
+//-----------------------------------------------------------------------------
+bool DynamicResolution::beginFrame(int outputWidth, int outputHeight)
+{
+	// A 0x0 framebuffer would give an incomplete target and divisions by zero
+	bool empty = outputWidth <= 0 || outputHeight <= 0;
+	if (!empty && (outputWidth != mOutputWidth || outputHeight != mOutputHeight))
+		createTargets(outputWidth, outputHeight);
+	if (mFBO == 0)
+		return false;
+
+	float scale = mEnabled ? mScale : 1.0f;
+	mRenderWidth = glm::max(SIZE_ALIGNMENT, ((int)(mOutputWidth * scale) / SIZE_ALIGNMENT) * SIZE_ALIGNMENT);
+	mRenderHeight = glm::max(SIZE_ALIGNMENT, ((int)(mOutputHeight * scale) / SIZE_ALIGNMENT) * SIZE_ALIGNMENT);
+	mRenderWidth = glm::min(mRenderWidth, mOutputWidth);
+	mRenderHeight = glm::min(mRenderHeight, mOutputHeight);
+
+	mFrameTimer.begin();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+	glViewport(0, 0, mRenderWidth, mRenderHeight);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Upscales the rendered area to the whole backbuffer
+//-----------------------------------------------------------------------------
+void DynamicResolution::endFrame()
+{
+	if (mFBO == 0)
+		return;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, mOutputWidth, mOutputHeight);
+
+	glDisable(GL_DEPTH_TEST);
+
+	mUpscaleShader.use();
+	mUpscaleShader.setUniform("uvScale", glm::vec2((float)mRenderWidth / mOutputWidth, (float)mRenderHeight / mOutputHeight));
+	mUpscaleShader.setUniform("texelSize", glm::vec2(1.0f / mOutputWidth, 1.0f / mOutputHeight));
+	mUpscaleShader.setUniform("filterMode", (GLint)mFilter);
+	mUpscaleShader.setUniformSampler("sceneColor", 0);
+	glBindTexture(GL_TEXTURE_2D, mColor);
+
+	glBindVertexArray(mQuadVAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+	glEnable(GL_DEPTH_TEST);
+
+	mFrameTimer.end();
+	updateScale();
+}
+
+//-----------------------------------------------------------------------------
+// Scale controller.  Pixel cost is proportional to scale^2, so the scale that
+// would hit the target is scale * sqrt(target / measured).  We move towards it
+// quickly when over budget and slowly when under to avoid oscillation.
+//-----------------------------------------------------------------------------
+void DynamicResolution::updateScale()
+{
+	if (!mFrameTimer.hasResult() || mFrameTimer.getResult() == mLastResult)
+		return;
+
+	mLastResult = mFrameTimer.getResult();
+	mGpuTimeMs = (double)mLastResult / 1000000.0;
+
+	if (!mEnabled || mGpuTimeMs <= 0.0)
+		return;
+
+	float ratio = (mTargetMs * HEADROOM) / (float)mGpuTimeMs;
+	float desired = glm::clamp(mScale * glm::sqrt(ratio), mMinScale, mMaxScale);
+
+	if (glm::abs(desired - mScale) < mScale * DEAD_BAND)
+		return;
+
+	float gain = (desired < mScale) ? DECREASE_GAIN : INCREASE_GAIN;
+	mScale = glm::clamp(mScale + (desired - mScale) * gain, mMinScale, mMaxScale);
+}
@@ -0,0 +1,109 @@
+//-----------------------------------------------------------------------------
+// Directory change notifications
+//-----------------------------------------------------------------------------
+#include "FileWatcher.h"
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+FileWatcher::FileWatcher()
+	: mFd(-1)
+{
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+	if (mFd >= 0)
+		close(mFd);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Inotify instance on first use.  Files are reported once written and closed
+// (IN_CLOSE_WRITE) or renamed into the directory (IN_MOVED_TO), which is how
+// most editors save.
+//-----------------------------------------------------------------------------
+bool FileWatcher::watch(const std::string& directory)
+{
+#ifdef __linux__
+	if (mFd < 0)
+		mFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (mFd < 0)
+	{
+		std::cerr << "Error creating the file watcher: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	int wd = inotify_add_watch(mFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd < 0)
+	{
+		std::cerr << "Error watching '" << directory << "': " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	mDirectories[wd] = directory;
+	return true;
+#else
+	return false;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Drains the pending events
+//-----------------------------------------------------------------------------
+std::vector<std::string> FileWatcher::poll()
+{
+	std::vector<std::string> files;
+#ifdef __linux__
+	if (mFd < 0)
+		return files;
+
+	alignas(inotify_event) char buffer[4096];
+	for (;;)
+	{
+		ssize_t length = read(mFd, buffer, sizeof(buffer));
+		if (length <= 0)
+			break;	// EAGAIN: nothing more for now
+
+		for (ssize_t offset = 0; offset < length; )
+		{
+			const inotify_event* event = (const inotify_event*)(buffer + offset);
+			offset += sizeof(inotify_event) + event->len;
+
+			std::map<int, std::string>::const_iterator it = mDirectories.find(event->wd);
+			if (it == mDirectories.end() || event->len == 0 || (event->mask & IN_ISDIR))
+				continue;
+
+			std::string path = it->second + "/" + event->name;
+			if (std::find(files.begin(), files.end(), path) == files.end())
+				files.push_back(path);
+		}
+	}
+#endif
+	return files;
+}
+
+//-----------------------------------------------------------------------------
+// True where watch() can work
+//-----------------------------------------------------------------------------
+bool FileWatcher::isSupported()
+{
+#ifdef __linux__
+	return true;
+#else
+	return false;
+#endif
+}
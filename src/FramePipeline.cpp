@@ -0,0 +1,89 @@
+//-----------------------------------------------------------------------------
+// Frame snapshots from the simulation thread to the render thread
+//-----------------------------------------------------------------------------
+#include "FramePipeline.h"
+#include <chrono>
+
+namespace
+{
+	// Weight of a new sample in the running averages
+	const double SMOOTHING = 0.05;
+
+	void accumulate(double& average, double sample, bool first)
+	{
+		average = first ? sample : average + (sample - average) * SMOOTHING;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+FramePipeline::FramePipeline()
+	: mPublished(0),
+	  mLastStep(0),
+	  mHasStats(false)
+{
+	mStats.stepMs = 0.0;
+	mStats.waitMs = 0.0;
+	mStats.latencyMs = 0.0;
+	mStats.dropped = 0;
+	mStats.repeated = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+FramePipeline::~FramePipeline()
+{
+}
+
+//-----------------------------------------------------------------------------
+// Seconds since an arbitrary point, the same on every thread
+//-----------------------------------------------------------------------------
+double FramePipeline::now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//-----------------------------------------------------------------------------
+// Stamps the snapshot and hands it to the render thread
+//-----------------------------------------------------------------------------
+void FramePipeline::publish()
+{
+	FrameSnapshot& snapshot = mSnapshots.getWriteSlot();
+	snapshot.step = ++mPublished;
+	snapshot.publishTime = now();
+	mSnapshots.publish();
+}
+
+//-----------------------------------------------------------------------------
+// Takes the newest snapshot.  Steps published in between were dropped; with
+// none since the last frame, the same snapshot is drawn again.
+//-----------------------------------------------------------------------------
+const FrameSnapshot& FramePipeline::acquire()
+{
+	if (mSnapshots.update())
+	{
+		const FrameSnapshot& snapshot = mSnapshots.getReadSlot();
+		if (mLastStep != 0)
+			mStats.dropped += snapshot.step - mLastStep - 1;
+		mLastStep = snapshot.step;
+
+		accumulate(mStats.stepMs, (snapshot.publishTime - snapshot.inputTime) * 1000.0, !mHasStats);
+		accumulate(mStats.waitMs, (now() - snapshot.publishTime) * 1000.0, !mHasStats);
+	}
+	else
+	{
+		mStats.repeated++;
+	}
+	return mSnapshots.getReadSlot();
+}
+
+//-----------------------------------------------------------------------------
+// Age of the input on screen.  A repeated snapshot counts again, older.
+//-----------------------------------------------------------------------------
+void FramePipeline::presented()
+{
+	accumulate(mStats.latencyMs, (now() - mSnapshots.getReadSlot().inputTime) * 1000.0, !mHasStats);
+	mHasStats = true;
+}
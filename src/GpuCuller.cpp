@@ -0,0 +1,580 @@
+//-----------------------------------------------------------------------------
+// GPU driven culling of instances against a hierarchical depth pyramid
+//-----------------------------------------------------------------------------
+#include "GpuCuller.h"
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include "glm/gtc/type_ptr.hpp"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const GLuint CULL_GROUP_SIZE = 64;		// local_size_x of gpu_cull.comp
+	const GLuint PYRAMID_GROUP_SIZE = 8;	// local_size_x and y of hiz_build.comp
+
+	// Shader storage bindings of gpu_cull.comp
+	const GLuint INSTANCE_BINDING = 0;
+	const GLuint MATRIX_BINDING = 1;
+	const GLuint PENDING_BINDING = 2;
+	const GLuint COMMAND_BINDING = 3;
+	const GLuint TRANSFORM_BINDING = 4;
+
+	// Captured by instance_cull.geom, an InstanceTransform per visible instance
+	const char* const FEEDBACK_VARYINGS[] = { "model0", "model1", "model2", "model3", "normal0", "normal1", "normal2" };
+
+	double elapsedMs(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+GpuCuller::GpuCuller()
+	: mInitialized(false),
+	  mMethod(METHOD_COMPUTE),
+	  mNumInstances(0),
+	  mNumMatrices(0),
+	  mInstanceBuffer(0),
+	  mMatrixBuffer(0),
+	  mPendingBuffer(0),
+	  mCommandBuffer(0),
+	  mTransformBuffer(0),
+	  mFeedbackVAO(0),
+	  mMatrixTexture(0),
+	  mMaxMatrices(0),
+	  mQueryCounts(false),
+	  mPyramid(0),
+	  mPyramidLevels(0),
+	  mPyramidValid(false),
+	  mViewProjection(1.0f),
+	  mPyramidViewProjection(1.0f),
+	  mReadbackIndex(0),
+	  mStats()
+{
+	for (int r = 0; r < READBACK_LATENCY; r++)
+	{
+		mReadback[r] = 0;
+		mReadbackFence[r] = 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+GpuCuller::~GpuCuller()
+{
+	if (!mInitialized)
+		return;
+
+	for (int r = 0; r < READBACK_LATENCY; r++)
+	{
+		if (mReadbackFence[r] != 0)
+			glDeleteSync(mReadbackFence[r]);
+	}
+	glDeleteBuffers(READBACK_LATENCY, mReadback);
+
+	GLuint buffers[] = { mInstanceBuffer, mMatrixBuffer, mPendingBuffer, mCommandBuffer, mTransformBuffer };
+	glDeleteBuffers(5, buffers);
+	glDeleteTextures(1, &mPyramid);
+	glDeleteTextures(1, &mMatrixTexture);
+	glDeleteVertexArrays(1, &mFeedbackVAO);
+	if (!mFeedbackQueries.empty())
+		glDeleteQueries((GLsizei)mFeedbackQueries.size(), mFeedbackQueries.data());
+}
+
+//-----------------------------------------------------------------------------
+// Compute shaders, shader storage buffers and indirect draws with a base
+// instance, all core in 4.3.  Transform feedback, geometry shaders, buffer
+// textures and instanced arrays are all core in 3.3.
+//-----------------------------------------------------------------------------
+bool GpuCuller::isSupported(Method method)
+{
+	if (method == METHOD_TRANSFORM_FEEDBACK)
+		return GLEW_VERSION_3_3;
+	return (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_draw_indirect && GLEW_VERSION_4_2)
+		|| GLEW_VERSION_4_3;
+}
+
+//-----------------------------------------------------------------------------
+// Loads the method's shaders and creates the buffers, empty, and the pyramid
+// or the instances' vertex array
+//-----------------------------------------------------------------------------
+bool GpuCuller::init(Method method)
+{
+	mMethod = method;
+	if (mMethod == METHOD_COMPUTE)
+	{
+		if (!mCullShader.loadComputeShader("shaders/gpu_cull.comp") ||
+			!mPyramidShader.loadComputeShader("shaders/hiz_build.comp"))
+			return false;
+	}
+	else
+	{
+		mFeedbackShader.setFeedbackVaryings(std::vector<string>(std::begin(FEEDBACK_VARYINGS), std::end(FEEDBACK_VARYINGS)));
+		if (!mFeedbackShader.loadShaders("shaders/instance_cull.vert", "shaders/instance_cull.geom", NULL))
+			return false;
+		mQueryCounts = (GLEW_ARB_query_buffer_object || GLEW_VERSION_4_4) &&
+					   (GLEW_ARB_base_instance || GLEW_VERSION_4_2) && (GLEW_ARB_draw_indirect || GLEW_VERSION_4_0);
+	}
+
+	glGenBuffers(1, &mInstanceBuffer);
+	glGenBuffers(1, &mMatrixBuffer);
+	glGenBuffers(1, &mPendingBuffer);
+	glGenBuffers(1, &mCommandBuffer);
+	glGenBuffers(1, &mTransformBuffer);
+	glGenBuffers(READBACK_LATENCY, mReadback);
+
+	// Vertex arrays read the first record even in draws that are not instanced
+	glBindBuffer(GL_ARRAY_BUFFER, mTransformBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceTransform), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	if (mMethod == METHOD_COMPUTE)
+	{
+		createPyramid();
+	}
+	else
+	{
+		// The instances' records as the vertex attributes of instance_cull.vert
+		glGenVertexArrays(1, &mFeedbackVAO);
+		glBindVertexArray(mFeedbackVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GpuInstance), (GLvoid*)offsetof(GpuInstance, boundsMin));
+		glVertexAttribIPointer(1, 1, GL_INT, sizeof(GpuInstance), (GLvoid*)offsetof(GpuInstance, matrix));
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(GpuInstance), (GLvoid*)offsetof(GpuInstance, boundsMax));
+		for (GLuint attribute = 0; attribute < 3; attribute++)
+			glEnableVertexAttribArray(attribute);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		// Follows the matrix buffer through its new stores
+		glBindBuffer(GL_TEXTURE_BUFFER, mMatrixBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		glGenTextures(1, &mMatrixTexture);
+		glBindTexture(GL_TEXTURE_BUFFER, mMatrixTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, mMatrixBuffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		GLint maxTexels = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+		mMaxMatrices = maxTexels / 4;
+	}
+
+	mCullTimer[PHASE_PREVIOUS].init(GL_TIMESTAMP);
+	mCullTimer[PHASE_FIXUP].init(GL_TIMESTAMP);
+	mPyramidTimer.init(GL_TIMESTAMP);
+
+	mInitialized = true;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// R32F mip chain down to 1x1 at a fixed size: the area rendered changes with
+// the resolution scale, each texel covers its share of it
+//-----------------------------------------------------------------------------
+void GpuCuller::createPyramid()
+{
+	mPyramidLevels = 1;
+	while ((PYRAMID_WIDTH >> mPyramidLevels) > 0 || (PYRAMID_HEIGHT >> mPyramidLevels) > 0)
+		mPyramidLevels++;
+
+	glGenTextures(1, &mPyramid);
+	glBindTexture(GL_TEXTURE_2D, mPyramid);
+	glTexStorage2D(GL_TEXTURE_2D, mPyramidLevels, GL_R32F, PYRAMID_WIDTH, PYRAMID_HEIGHT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	mPyramidValid = false;
+}
+
+//-----------------------------------------------------------------------------
+// Sorts the instances by batch, each batch a contiguous range, and sizes the
+// buffers.  The instance buffer holds a range of every instance per phase.
+//-----------------------------------------------------------------------------
+void GpuCuller::setInstances(const std::vector<Mesh*>& batchMeshes, const std::vector<Instance>& instances)
+{
+	if (!mInitialized)
+		return;
+
+	Clock::time_point start = Clock::now();
+	const size_t numBatches = batchMeshes.size();
+	mBatchMeshes = batchMeshes;
+	mNumInstances = (int)instances.size();
+
+	// Counting sort by batch
+	mBatchCount.assign(numBatches, 0);
+	for (const Instance& instance : instances)
+		mBatchCount[instance.batch]++;
+	mBatchFirst.assign(numBatches, 0);
+	for (size_t b = 1; b < numBatches; b++)
+		mBatchFirst[b] = mBatchFirst[b - 1] + mBatchCount[b - 1];
+
+	std::vector<GLuint> next(mBatchFirst);
+	std::vector<GpuInstance> sorted(instances.size());
+	for (const Instance& instance : instances)
+	{
+		GpuInstance& record = sorted[next[instance.batch]++];
+		record.boundsMin = instance.boundsMin;
+		record.matrix = (GLuint)instance.matrix;
+		record.boundsMax = instance.boundsMax;
+		record.batch = (GLuint)instance.batch;
+	}
+
+	// Through the copy target, which both methods have
+	glBindBuffer(GL_COPY_WRITE_BUFFER, mInstanceBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, sorted.size() * sizeof(GpuInstance), sorted.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, mPendingBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, sorted.size() * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, mTransformBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, glm::max<size_t>(1, NUM_PHASES * sorted.size()) * sizeof(InstanceTransform), NULL,
+				 GL_DYNAMIC_COPY);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	mCommands.resize(NUM_PHASES * numBatches);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, mCommandBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, mCommands.size() * sizeof(DrawCommand), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	if (mMethod == METHOD_TRANSFORM_FEEDBACK && mFeedbackQueries.size() < numBatches)
+	{
+		size_t created = mFeedbackQueries.size();
+		mFeedbackQueries.resize(numBatches);
+		glGenQueries((GLsizei)(numBatches - created), &mFeedbackQueries[created]);
+	}
+	mVisibleCounts.assign(numBatches, 0);
+
+	// The readbacks in flight are of the old batches
+	for (int r = 0; r < READBACK_LATENCY; r++)
+	{
+		if (mReadbackFence[r] != 0)
+			glDeleteSync(mReadbackFence[r]);
+		mReadbackFence[r] = 0;
+		glBindBuffer(GL_COPY_WRITE_BUFFER, mReadback[r]);
+		glBufferData(GL_COPY_WRITE_BUFFER, mCommands.size() * sizeof(DrawCommand), NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	for (Mesh* mesh : mBatchMeshes)
+		mesh->setInstanceBuffer(mTransformBuffer);
+
+	mStats.batches = (int)numBatches;
+	mStats.instances = mNumInstances;
+	mStats.visible[PHASE_PREVIOUS] = mStats.visible[PHASE_FIXUP] = 0;
+	mStats.cpuMs = elapsedMs(start);
+}
+
+//-----------------------------------------------------------------------------
+// Uploads the frame's matrices into a new buffer store (the last frame's
+// draws may still read the old one) and clears the draw counts
+//-----------------------------------------------------------------------------
+void GpuCuller::setMatrices(const std::vector<glm::mat4>& worldMatrices)
+{
+	mStats.drawCalls = 0;
+	mStats.cpuMs = 0.0;
+	if (!mInitialized)
+		return;
+
+	Clock::time_point start = Clock::now();
+	mNumMatrices = (int)worldMatrices.size();
+	if (mMethod == METHOD_TRANSFORM_FEEDBACK && mNumMatrices > mMaxMatrices)
+		std::cerr << "GpuCuller: " << mNumMatrices << " matrices, the buffer texture holds " << mMaxMatrices << std::endl;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, mMatrixBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, glm::max<size_t>(1, worldMatrices.size()) * sizeof(glm::mat4), worldMatrices.data(),
+				 GL_STREAM_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	if (usesCommands())
+	{
+		resetCommands();
+	}
+	else
+	{
+		mVisibleCounts.assign(mBatchMeshes.size(), -1);
+		mStats.visible[PHASE_PREVIOUS] = 0;
+	}
+	mStats.cpuMs += elapsedMs(start);
+}
+
+//-----------------------------------------------------------------------------
+// Every command draws the whole mesh, no instance yet, from its batch's range
+// of its phase
+//-----------------------------------------------------------------------------
+void GpuCuller::resetCommands()
+{
+	const size_t numBatches = mBatchMeshes.size();
+	for (int phase = 0; phase < NUM_PHASES; phase++)
+	{
+		for (size_t b = 0; b < numBatches; b++)
+		{
+			DrawCommand& command = mCommands[phase * numBatches + b];
+			command.count = (GLuint)mBatchMeshes[b]->getVertexCount();
+			command.instanceCount = 0;
+			command.first = 0;
+			command.baseInstance = (GLuint)(phase * mNumInstances) + mBatchFirst[b];
+		}
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, mCommandBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, mCommands.size() * sizeof(DrawCommand), mCommands.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Culls with the method, the last phase then copies the counts to read back
+//-----------------------------------------------------------------------------
+void GpuCuller::cull(Phase phase, const glm::mat4& view, const glm::mat4& projection)
+{
+	if (!mInitialized || mNumInstances == 0)
+		return;
+	if (mMethod == METHOD_TRANSFORM_FEEDBACK && phase != PHASE_PREVIOUS)
+		return;		// no pyramid, every visible instance is drawn by the first phase
+
+	Clock::time_point start = Clock::now();
+	mCullTimer[phase].begin();
+
+	mViewProjection = projection * view;
+	if (mMethod == METHOD_COMPUTE)
+		cullCompute(phase);
+	else
+		cullFeedback();
+
+	mCullTimer[phase].end();
+
+	// Every phase counted : a copy of the commands to read a few frames later
+	const Phase lastPhase = mMethod == METHOD_COMPUTE ? PHASE_FIXUP : PHASE_PREVIOUS;
+	if (phase == lastPhase)
+	{
+		if (usesCommands())
+		{
+			readVisibleCounts();
+			glBindBuffer(GL_COPY_READ_BUFFER, mCommandBuffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, mReadback[mReadbackIndex]);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, mCommands.size() * sizeof(DrawCommand));
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			if (mReadbackFence[mReadbackIndex] != 0)
+				glDeleteSync(mReadbackFence[mReadbackIndex]);
+			mReadbackFence[mReadbackIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			mReadbackIndex = (mReadbackIndex + 1) % READBACK_LATENCY;
+		}
+
+		double gpuMs = 0.0;
+		for (int p = 0; p < NUM_PHASES; p++)
+			gpuMs += mCullTimer[p].hasResult() ? mCullTimer[p].getResult() / 1000000.0 : 0.0;
+		mStats.gpuMs = gpuMs + (mPyramidTimer.hasResult() ? mPyramidTimer.getResult() / 1000000.0 : 0.0);
+	}
+	mStats.cpuMs += elapsedMs(start);
+}
+
+//-----------------------------------------------------------------------------
+// One invocation per instance, the visible ones appended to their batch
+//-----------------------------------------------------------------------------
+void GpuCuller::cullCompute(Phase phase)
+{
+	// The first phase tests the last frame's pyramid, seen from its camera
+	mCullShader.use();
+	mCullShader.setUniform("viewProjection", mViewProjection);
+	mCullShader.setUniform("pyramidViewProjection", phase == PHASE_PREVIOUS ? mPyramidViewProjection : mViewProjection);
+	mCullShader.setUniform("phase", (GLint)phase);
+	mCullShader.setUniform("usePyramid", (GLint)(mPyramidValid ? 1 : 0));
+	mCullShader.setUniform("instanceCount", (GLint)mNumInstances);
+	mCullShader.setUniform("commandOffset", (GLint)(phase * mBatchMeshes.size()));
+	mCullShader.setUniform("pyramidLevels", (GLint)mPyramidLevels);
+	mCullShader.setUniformSampler("pyramid", 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, mPyramid);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_BINDING, mInstanceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATRIX_BINDING, mMatrixBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PENDING_BINDING, mPendingBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMAND_BINDING, mCommandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TRANSFORM_BINDING, mTransformBuffer);
+
+	glDispatchCompute((mNumInstances + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	// The draws read the commands and the transforms, the next phase the pending flags
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	for (GLuint binding = INSTANCE_BINDING; binding <= TRANSFORM_BINDING; binding++)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+}
+
+//-----------------------------------------------------------------------------
+// One point per instance with rasterization discarded, a capture per batch
+// into the batch's range, the points written counted by the batch's query
+//-----------------------------------------------------------------------------
+void GpuCuller::cullFeedback()
+{
+	mFeedbackShader.use();
+	mFeedbackShader.setUniform("viewProjection", mViewProjection);
+	mFeedbackShader.setUniformSampler("matrices", 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_BUFFER, mMatrixTexture);
+	glBindVertexArray(mFeedbackVAO);
+	glEnable(GL_RASTERIZER_DISCARD);
+
+	// The counts go straight into the commands' instance counts
+	if (mQueryCounts)
+		glBindBuffer(GL_QUERY_BUFFER, mCommandBuffer);
+
+	for (size_t b = 0; b < mBatchMeshes.size(); b++)
+	{
+		if (mBatchCount[b] == 0)
+		{
+			if (!mQueryCounts)
+				mVisibleCounts[b] = 0;
+			continue;
+		}
+
+		glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, mTransformBuffer, mBatchFirst[b] * sizeof(InstanceTransform),
+						  mBatchCount[b] * sizeof(InstanceTransform));
+		glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, mFeedbackQueries[b]);
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, (GLint)mBatchFirst[b], (GLsizei)mBatchCount[b]);
+		glEndTransformFeedback();
+		glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+
+		if (mQueryCounts)
+			glGetQueryObjectuiv(mFeedbackQueries[b], GL_QUERY_RESULT,
+								(GLuint*)(b * sizeof(DrawCommand) + offsetof(DrawCommand, instanceCount)));
+	}
+
+	if (mQueryCounts)
+		glBindBuffer(GL_QUERY_BUFFER, 0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glUseProgram(0);
+}
+
+//-----------------------------------------------------------------------------
+// Sums the instance counts of the newest readback the GPU is done with
+//-----------------------------------------------------------------------------
+void GpuCuller::readVisibleCounts()
+{
+	for (int age = 1; age <= READBACK_LATENCY; age++)
+	{
+		int r = (mReadbackIndex + READBACK_LATENCY - age) % READBACK_LATENCY;
+		if (mReadbackFence[r] == 0 || glClientWaitSync(mReadbackFence[r], 0, 0) == GL_TIMEOUT_EXPIRED)
+			continue;
+
+		std::vector<DrawCommand> commands(mCommands.size());
+		glBindBuffer(GL_COPY_READ_BUFFER, mReadback[r]);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, commands.size() * sizeof(DrawCommand), commands.data());
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		const size_t numBatches = mBatchMeshes.size();
+		for (int phase = 0; phase < NUM_PHASES; phase++)
+		{
+			mStats.visible[phase] = 0;
+			for (size_t b = 0; b < numBatches; b++)
+				mStats.visible[phase] += (int)commands[phase * numBatches + b].instanceCount;
+		}
+		return;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Level 0 from the depth texture, then every level from the one above, each
+// texel the farthest depth of the texels it covers
+//-----------------------------------------------------------------------------
+void GpuCuller::buildPyramid(GLuint depthTexture, int width, int height)
+{
+	if (!mInitialized || mMethod != METHOD_COMPUTE)
+		return;
+
+	Clock::time_point start = Clock::now();
+	mPyramidTimer.begin();
+
+	mPyramidShader.use();
+	mPyramidShader.setUniformSampler("depth", 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+
+	int sourceWidth = width, sourceHeight = height;
+	for (int level = 0; level < mPyramidLevels; level++)
+	{
+		const int levelWidth = glm::max(1, PYRAMID_WIDTH >> level);
+		const int levelHeight = glm::max(1, PYRAMID_HEIGHT >> level);
+		mPyramidShader.setUniform("fromDepth", (GLint)(level == 0 ? 1 : 0));
+		mPyramidShader.setUniform("sourceSize", glm::vec2((float)sourceWidth, (float)sourceHeight));
+		if (level > 0)
+			glBindImageTexture(0, mPyramid, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, mPyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+		glDispatchCompute((levelWidth + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE,
+						  (levelHeight + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		sourceWidth = levelWidth;
+		sourceHeight = levelHeight;
+	}
+
+	// The fix-up phase samples it next
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+	glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+
+	mPyramidTimer.end();
+
+	mPyramidViewProjection = mViewProjection;
+	mPyramidValid = true;
+	mStats.cpuMs += elapsedMs(start);
+}
+
+//-----------------------------------------------------------------------------
+// One indirect draw of the batch's command of the phase, or without query
+// buffers an instanced draw of the batch's count from the batch's range
+//-----------------------------------------------------------------------------
+void GpuCuller::drawBatch(Phase phase, int batch, bool positionsOnly)
+{
+	Mesh* mesh = mBatchMeshes[batch];
+	if (!mInitialized || !mesh->isLoaded())
+		return;
+	if (mMethod == METHOD_TRANSFORM_FEEDBACK && phase != PHASE_PREVIOUS)
+		return;
+
+	if (!usesCommands())
+	{
+		// The first draw of the frame waits for the count
+		if (mVisibleCounts[batch] < 0)
+		{
+			GLuint count = 0;
+			glGetQueryObjectuiv(mFeedbackQueries[batch], GL_QUERY_RESULT, &count);
+			mVisibleCounts[batch] = (GLint)count;
+			mStats.visible[PHASE_PREVIOUS] += (int)count;
+		}
+		if (mVisibleCounts[batch] == 0)
+			return;
+
+		mesh->setInstanceBuffer(mTransformBuffer, mBatchFirst[batch] * sizeof(InstanceTransform));
+		if (positionsOnly)
+			mesh->bindPositions();
+		else
+			mesh->bind();
+		glDrawArraysInstanced(GL_TRIANGLES, 0, mesh->getVertexCount(), mVisibleCounts[batch]);
+		mStats.drawCalls++;
+		return;
+	}
+
+	if (positionsOnly)
+		mesh->bindPositions();
+	else
+		mesh->bind();
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mCommandBuffer);
+	glDrawArraysIndirect(GL_TRIANGLES, (const GLvoid*)((phase * mBatchMeshes.size() + batch) * sizeof(DrawCommand)));
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	mStats.drawCalls++;
+}
@@ -0,0 +1,114 @@
+//-----------------------------------------------------------------------------
+// Ring of OpenGL query objects with delayed, non blocking readback
+//-----------------------------------------------------------------------------
+#include "GpuQuery.h"
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+GpuQuery::GpuQuery()
+	: mTarget(0),
+	  mIndex(0),
+	  mHasResult(false),
+	  mResult(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+GpuQuery::~GpuQuery()
+{
+	if (!mQueries.empty())
+		glDeleteQueries((GLsizei)mQueries.size(), &mQueries[0]);
+}
+
+//-----------------------------------------------------------------------------
+// Creates latency + 1 query objects (pairs for GL_TIMESTAMP) for the target
+//-----------------------------------------------------------------------------
+void GpuQuery::init(GLenum target, int latency)
+{
+	mTarget = target;
+	mQueries.resize((latency + 1) * (isTimestamp() ? 2 : 1));
+	mPending.assign(latency + 1, false);
+	glGenQueries((GLsizei)mQueries.size(), &mQueries[0]);
+}
+
+//-----------------------------------------------------------------------------
+// Starts the query for this frame
+//-----------------------------------------------------------------------------
+void GpuQuery::begin()
+{
+	if (mQueries.empty())
+		return;
+
+	// The ring wrapped around before the GPU finished: fetch it now (rare)
+	if (mPending[mIndex])
+		poll(true);
+
+	if (isTimestamp())
+		glQueryCounter(mQueries[mIndex * 2], GL_TIMESTAMP);
+	else
+		glBeginQuery(mTarget, mQueries[mIndex]);
+}
+
+//-----------------------------------------------------------------------------
+// Ends the query for this frame and collects any results that are ready
+//-----------------------------------------------------------------------------
+void GpuQuery::end()
+{
+	if (mQueries.empty())
+		return;
+
+	if (isTimestamp())
+		glQueryCounter(mQueries[mIndex * 2 + 1], GL_TIMESTAMP);
+	else
+		glEndQuery(mTarget);
+
+	mPending[mIndex] = true;
+	mIndex = (mIndex + 1) % (int)mPending.size();
+
+	poll(false);
+}
+
+//-----------------------------------------------------------------------------
+// Reads pending queries from oldest to newest, stopping at the first one
+// that is not available yet (unless wait is true)
+//-----------------------------------------------------------------------------
+void GpuQuery::poll(bool wait)
+{
+	int count = (int)mPending.size();
+	for (int i = 0; i < count; i++)
+	{
+		int q = (mIndex + i) % count;	// mIndex is the oldest slot
+		if (!mPending[q])
+			continue;
+
+		// The end counter completes last, so it tells us the pair is ready
+		GLuint last = isTimestamp() ? mQueries[q * 2 + 1] : mQueries[q];
+		if (!wait)
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(last, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				return;
+		}
+
+		if (isTimestamp())
+		{
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(mQueries[q * 2], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(mQueries[q * 2 + 1], GL_QUERY_RESULT, &end);
+			mResult = end - start;
+		}
+		else
+		{
+			glGetQueryObjectui64v(mQueries[q], GL_QUERY_RESULT, &mResult);
+		}
+		mPending[q] = false;
+		mHasResult = true;
+
+		if (wait && q == mIndex)
+			return;
+	}
+}
@@ -0,0 +1,307 @@
+//-----------------------------------------------------------------------------
+// Image decoder backends
+//-----------------------------------------------------------------------------
+#include "ImageDecoder.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image/stb_image.h"
+
+#ifdef HAVE_LIBJPEG_TURBO
+#include <csetjmp>
+#include <cstdio>
+#include <jpeglib.h>
+#endif
+
+#ifdef HAVE_LIBSPNG
+#include <spng.h>
+#endif
+
+namespace
+{
+	// Row y of an image of height rows in the requested order
+	unsigned char* getRow(unsigned char* dest, size_t pitch, int height, int y, bool flip)
+	{
+		return dest + (size_t)(flip ? height - 1 - y : y) * pitch;
+	}
+
+	//-------------------------------------------------------------------------
+	// stb_image : every format, decoded into its own buffer and copied
+	//-------------------------------------------------------------------------
+	class StbDecoder : public ImageDecoder
+	{
+	public:
+		virtual const char* getName() const { return "stb_image"; }
+
+		virtual bool canDecode(const unsigned char* /*data*/, size_t /*size*/) const
+		{
+			return true;	// the fallback
+		}
+
+		virtual bool readSize(const unsigned char* data, size_t size, int& width, int& height) const
+		{
+			int components;
+			return stbi_info_from_memory(data, (int)size, &width, &height, &components) != 0;
+		}
+
+		virtual bool decode(const unsigned char* data, size_t size, unsigned char* dest, size_t pitch, bool flip) const
+		{
+			int width, height, components;
+			unsigned char* pixels = stbi_load_from_memory(data, (int)size, &width, &height, &components, STBI_rgb_alpha);
+			if (pixels == NULL)
+				return false;
+
+			size_t rowBytes = (size_t)width * 4;
+			for (int y = 0; y < height; y++)
+				memcpy(getRow(dest, pitch, height, y, flip), pixels + y * rowBytes, rowBytes);
+
+			stbi_image_free(pixels);
+			return true;
+		}
+	};
+
+#if defined(HAVE_LIBJPEG_TURBO) && defined(JCS_EXTENSIONS)
+	//-------------------------------------------------------------------------
+	// libjpeg-turbo : SIMD JPEG decoding, scanlines straight into the
+	// destination (JCS_EXT_RGBA is a libjpeg-turbo extension)
+	//-------------------------------------------------------------------------
+	struct JpegError
+	{
+		jpeg_error_mgr manager;
+		jmp_buf jump;
+	};
+
+	void onJpegError(j_common_ptr info)
+	{
+		longjmp(((JpegError*)info->err)->jump, 1);
+	}
+
+	void onJpegMessage(j_common_ptr /*info*/)
+	{
+		// Corrupt data warnings: the image decodes anyway, as with stb_image
+	}
+
+	class JpegTurboDecoder : public ImageDecoder
+	{
+	public:
+		virtual const char* getName() const { return "libjpeg-turbo"; }
+
+		virtual bool canDecode(const unsigned char* data, size_t size) const
+		{
+			return size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+		}
+
+		virtual bool readSize(const unsigned char* data, size_t size, int& width, int& height) const
+		{
+			return run(data, size, NULL, 0, false, width, height);
+		}
+
+		virtual bool decode(const unsigned char* data, size_t size, unsigned char* dest, size_t pitch, bool flip) const
+		{
+			int width, height;
+			return run(data, size, dest, pitch, flip, width, height);
+		}
+
+	private:
+		// Reads the header, then the scanlines when there is a destination
+		static bool run(const unsigned char* data, size_t size, unsigned char* dest, size_t pitch, bool flip, int& width, int& height)
+		{
+			jpeg_decompress_struct info;
+			JpegError error;
+			info.err = jpeg_std_error(&error.manager);
+			error.manager.error_exit = onJpegError;
+			error.manager.output_message = onJpegMessage;
+			if (setjmp(error.jump))
+			{
+				jpeg_destroy_decompress(&info);
+				return false;
+			}
+
+			jpeg_create_decompress(&info);
+			jpeg_mem_src(&info, const_cast<unsigned char*>(data), (unsigned long)size);
+			jpeg_read_header(&info, TRUE);
+			width = (int)info.image_width;
+			height = (int)info.image_height;
+
+			if (dest != NULL)
+			{
+				info.out_color_space = JCS_EXT_RGBA;
+				jpeg_start_decompress(&info);
+				while (info.output_scanline < info.output_height)
+				{
+					JSAMPROW row = getRow(dest, pitch, height, (int)info.output_scanline, flip);
+					jpeg_read_scanlines(&info, &row, 1);
+				}
+				jpeg_finish_decompress(&info);
+			}
+
+			jpeg_destroy_decompress(&info);
+			return true;
+		}
+	};
+
+	const JpegTurboDecoder gJpegTurboDecoder;
+#endif
+
+#ifdef HAVE_LIBSPNG
+	//-------------------------------------------------------------------------
+	// libspng : PNG decoding with SIMD unfiltering, row by row into the
+	// destination (interlaced images go through a temporary image)
+	//-------------------------------------------------------------------------
+	class SpngDecoder : public ImageDecoder
+	{
+	public:
+		virtual const char* getName() const { return "libspng"; }
+
+		virtual bool canDecode(const unsigned char* data, size_t size) const
+		{
+			static const unsigned char SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+			return size >= 8 && memcmp(data, SIGNATURE, 8) == 0;
+		}
+
+		virtual bool readSize(const unsigned char* data, size_t size, int& width, int& height) const
+		{
+			spng_ctx* ctx = spng_ctx_new(0);
+			spng_ihdr ihdr;
+			bool result = ctx != NULL && spng_set_png_buffer(ctx, data, size) == 0 && spng_get_ihdr(ctx, &ihdr) == 0;
+			if (result)
+			{
+				width = (int)ihdr.width;
+				height = (int)ihdr.height;
+			}
+			spng_ctx_free(ctx);
+			return result;
+		}
+
+		virtual bool decode(const unsigned char* data, size_t size, unsigned char* dest, size_t pitch, bool flip) const
+		{
+			spng_ctx* ctx = spng_ctx_new(0);
+			spng_ihdr ihdr;
+			if (ctx == NULL || spng_set_png_buffer(ctx, data, size) != 0 || spng_get_ihdr(ctx, &ihdr) != 0)
+			{
+				spng_ctx_free(ctx);
+				return false;
+			}
+
+			int height = (int)ihdr.height;
+			size_t rowBytes = (size_t)ihdr.width * 4;
+			bool result = false;
+			if (ihdr.interlace_method == SPNG_INTERLACE_NONE)
+			{
+				int ret = spng_decode_image(ctx, NULL, 0, SPNG_FMT_RGBA8, SPNG_DECODE_TRNS | SPNG_DECODE_PROGRESSIVE);
+				while (ret == 0)
+				{
+					spng_row_info row;
+					ret = spng_get_row_info(ctx, &row);
+					if (ret == 0)
+						ret = spng_decode_row(ctx, getRow(dest, pitch, height, (int)row.row_num, flip), rowBytes);
+				}
+				result = ret == SPNG_EOI;
+			}
+			else
+			{
+				std::vector<unsigned char> pixels(rowBytes * height);
+				result = spng_decode_image(ctx, &pixels[0], pixels.size(), SPNG_FMT_RGBA8, SPNG_DECODE_TRNS) == 0;
+				for (int y = 0; result && y < height; y++)
+					memcpy(getRow(dest, pitch, height, y, flip), &pixels[y * rowBytes], rowBytes);
+			}
+
+			spng_ctx_free(ctx);
+			return result;
+		}
+	};
+
+	const SpngDecoder gSpngDecoder;
+#endif
+
+	const StbDecoder gStbDecoder;
+
+	// Tried in order, stb_image last since it takes anything
+	const ImageDecoder* const DECODERS[] =
+	{
+#if defined(HAVE_LIBJPEG_TURBO) && defined(JCS_EXTENSIONS)
+		&gJpegTurboDecoder,
+#endif
+#ifdef HAVE_LIBSPNG
+		&gSpngDecoder,
+#endif
+		&gStbDecoder
+	};
+}
+
+//-----------------------------------------------------------------------------
+// First backend to recognise the contents
+//-----------------------------------------------------------------------------
+const ImageDecoder& ImageDecoder::find(const unsigned char* data, size_t size)
+{
+	for (size_t i = 0; i < sizeof(DECODERS) / sizeof(DECODERS[0]); i++)
+	{
+		if (DECODERS[i]->canDecode(data, size))
+			return *DECODERS[i];
+	}
+	return gStbDecoder;
+}
+
+//-----------------------------------------------------------------------------
+// stb_image
+//-----------------------------------------------------------------------------
+const ImageDecoder& ImageDecoder::getDefault()
+{
+	return gStbDecoder;
+}
+
+//-----------------------------------------------------------------------------
+// Size from the header, with the backend found or stb_image
+//-----------------------------------------------------------------------------
+bool ImageDecoder::getImageSize(const unsigned char* data, size_t size, int& width, int& height)
+{
+	const ImageDecoder& decoder = find(data, size);
+	if (decoder.readSize(data, size, width, height))
+		return true;
+	return &decoder != &gStbDecoder && gStbDecoder.readSize(data, size, width, height);
+}
+
+//-----------------------------------------------------------------------------
+// Decodes with the backend found, or stb_image when it fails (an image it
+// does not support, such as a CMYK JPEG)
+//-----------------------------------------------------------------------------
+bool ImageDecoder::decodeImage(const unsigned char* data, size_t size, unsigned char* dest, size_t pitch, bool flip)
+{
+	const ImageDecoder& decoder = find(data, size);
+	if (decoder.decode(data, size, dest, pitch, flip))
+		return true;
+	return &decoder != &gStbDecoder && gStbDecoder.decode(data, size, dest, pitch, flip);
+}
+
+//-----------------------------------------------------------------------------
+// Whole file in memory, then decoded into rgba
+//-----------------------------------------------------------------------------
+bool ImageDecoder::loadFile(const std::string& fileName, std::vector<unsigned char>& rgba, int& width, int& height, bool flip)
+{
+	std::ifstream fin(fileName, std::ios::in | std::ios::binary);
+	if (!fin)
+		return false;
+	std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+	if (bytes.empty() || !getImageSize(&bytes[0], bytes.size(), width, height) || width <= 0 || height <= 0)
+		return false;
+
+	rgba.resize((size_t)width * height * 4);
+	return decodeImage(&bytes[0], bytes.size(), &rgba[0], (size_t)width * 4, flip);
+}
+
+//-----------------------------------------------------------------------------
+// Backends of this build, in the order they are tried
+//-----------------------------------------------------------------------------
+std::string ImageDecoder::getBackendNames()
+{
+	std::string names;
+	for (size_t i = 0; i < sizeof(DECODERS) / sizeof(DECODERS[0]); i++)
+	{
+		if (i > 0)
+			names += " ";
+		names += DECODERS[i]->getName();
+	}
+	return names;
+}
@@ -0,0 +1,384 @@
+//-----------------------------------------------------------------------------
+// Work-stealing job system
+//-----------------------------------------------------------------------------
+#include "JobSystem.h"
+#include <algorithm>
+
+namespace
+{
+	// Tries before an idle worker goes to sleep
+	const int IDLE_SPINS = 64;
+
+	// Worker the current thread is, -1 outside the workers
+	thread_local const JobSystem* tSystem = nullptr;
+	thread_local int tWorker = -1;
+
+	// Group of the jobs the current thread spawns : its own outside the
+	// workers, the one of the running job on a worker
+	std::atomic<int> sNextGroup(0);
+	thread_local int tGroup = -1;
+
+	int currentGroup()
+	{
+		if (tGroup < 0)
+			tGroup = sNextGroup++;
+		return tGroup;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// A task, the jobs waiting for it, and how many it still waits for itself
+//-----------------------------------------------------------------------------
+struct JobSystem::Job
+{
+	std::function<void()> task;
+	bool background;
+	int group;							// see currentGroup()
+	std::atomic<int> pending;			// unfinished dependencies, +1 while spawning
+	std::atomic<bool> done;
+	std::mutex mutex;					// guards dependents and the done transition
+	std::vector<JobHandle> dependents;
+};
+
+//-----------------------------------------------------------------------------
+// Constructor - starts the worker threads
+//-----------------------------------------------------------------------------
+JobSystem::JobSystem(unsigned numWorkers)
+	: mQueued(0),
+	  mSleeping(0),
+	  mSteals(0),
+	  mStop(false)
+{
+	if (numWorkers == 0)
+		numWorkers = std::max(2u, std::thread::hardware_concurrency()) - 1;
+
+	// Every deque exists before a worker may steal from it
+	for (unsigned i = 0; i < numWorkers; i++)
+		mWorkers.push_back(std::unique_ptr<Worker>(new Worker()));
+	for (unsigned i = 0; i < numWorkers; i++)
+		mWorkers[i]->thread = std::thread(&JobSystem::workerLoop, this, (int)i);
+}
+
+//-----------------------------------------------------------------------------
+// Destructor - finishes the queued jobs and joins the workers
+//-----------------------------------------------------------------------------
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mStop = true;
+	}
+	mWake.notify_all();
+
+	for (size_t i = 0; i < mWorkers.size(); i++)
+		mWorkers[i]->thread.join();
+}
+
+//-----------------------------------------------------------------------------
+// Queues a task
+//-----------------------------------------------------------------------------
+JobSystem::JobHandle JobSystem::spawn(std::function<void()> task)
+{
+	return spawn(task, std::vector<JobHandle>());
+}
+
+//-----------------------------------------------------------------------------
+// Queues a task once the dependencies are done
+//-----------------------------------------------------------------------------
+JobSystem::JobHandle JobSystem::spawn(std::function<void()> task, const std::vector<JobHandle>& dependencies)
+{
+	JobHandle job = std::make_shared<Job>();
+	job->task = task;
+	job->background = false;
+	job->group = currentGroup();
+	job->pending = (int)dependencies.size() + 1;
+	job->done = false;
+
+	for (size_t i = 0; i < dependencies.size(); i++)
+	{
+		const JobHandle& dependency = dependencies[i];
+		if (dependency)
+		{
+			std::lock_guard<std::mutex> lock(dependency->mutex);
+			if (!dependency->done)
+			{
+				dependency->dependents.push_back(job);
+				continue;
+			}
+		}
+		job->pending--;
+	}
+
+	if (--job->pending == 0)
+		schedule(job);
+	return job;
+}
+
+//-----------------------------------------------------------------------------
+// Queues a task that may block, for the workers only
+//-----------------------------------------------------------------------------
+JobSystem::JobHandle JobSystem::spawnBackground(std::function<void()> task)
+{
+	JobHandle job = std::make_shared<Job>();
+	job->task = task;
+	job->background = true;
+	job->group = currentGroup();
+	job->pending = 0;
+	job->done = false;
+	schedule(job);
+	return job;
+}
+
+//-----------------------------------------------------------------------------
+// True once the job has run (an empty handle is done)
+//-----------------------------------------------------------------------------
+bool JobSystem::isDone(const JobHandle& job) const
+{
+	return !job || job->done;
+}
+
+//-----------------------------------------------------------------------------
+// Runs other jobs until this one is done, only the caller's group outside the
+// workers
+//-----------------------------------------------------------------------------
+void JobSystem::wait(const JobHandle& job)
+{
+	while (!isDone(job))
+	{
+		JobHandle other = findJob(false);
+		if (other)
+			execute(other);
+		else
+			std::this_thread::yield();	// running on another thread, or a background dependency
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Runs other jobs until all of these are done
+//-----------------------------------------------------------------------------
+void JobSystem::wait(const std::vector<JobHandle>& jobs)
+{
+	for (size_t i = 0; i < jobs.size(); i++)
+		wait(jobs[i]);
+}
+
+//-----------------------------------------------------------------------------
+// The chunks are handed out through a shared counter rather than split up
+// front, so a slow chunk does not hold back the others.  The caller takes
+// chunks too: the loop completes even if every worker is busy elsewhere.
+//-----------------------------------------------------------------------------
+void JobSystem::parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body)
+{
+	if (end <= begin)
+		return;
+
+	grain = std::max<size_t>(grain, 1);
+	size_t numChunks = (end - begin + grain - 1) / grain;
+	if (numChunks == 1 || mWorkers.empty())
+	{
+		body(begin, end);
+		return;
+	}
+
+	std::atomic<size_t> nextChunk(0);
+	std::function<void()> runChunks = [&]
+	{
+		size_t chunk;
+		while ((chunk = nextChunk.fetch_add(1)) < numChunks)
+		{
+			size_t first = begin + chunk * grain;
+			body(first, std::min(end, first + grain));
+		}
+	};
+
+	// The caller is one of the threads
+	size_t numHelpers = std::min(numChunks - 1, mWorkers.size());
+	std::vector<JobHandle> helpers;
+	helpers.reserve(numHelpers);
+	for (size_t i = 0; i < numHelpers; i++)
+		helpers.push_back(spawn(runChunks));
+
+	runChunks();
+	wait(helpers);
+}
+
+//-----------------------------------------------------------------------------
+// Worker thread body : own jobs, shared ones, stolen ones, then background
+// ones; sleeps after a while without any
+//-----------------------------------------------------------------------------
+void JobSystem::workerLoop(int index)
+{
+	tSystem = this;
+	tWorker = index;
+
+	int idle = 0;
+	while (true)
+	{
+		JobHandle job = findJob(true);
+		if (job)
+		{
+			execute(job);
+			idle = 0;
+			continue;
+		}
+
+		if (mStop && mQueued == 0)
+			return;
+
+		if (++idle < IDLE_SPINS)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mWakeMutex);
+		mSleeping++;
+		mWake.wait(lock, [this] { return mQueued > 0 || mStop; });
+		mSleeping--;
+		idle = 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Queues a job whose dependencies are done.  A worker keeps what it spawns.
+//-----------------------------------------------------------------------------
+void JobSystem::schedule(const JobHandle& job)
+{
+	if (job->background)
+	{
+		std::lock_guard<std::mutex> lock(mBackgroundMutex);
+		mBackground.push_back(job);
+	}
+	else if (tSystem == this && tWorker >= 0)
+	{
+		Worker& worker = *mWorkers[tWorker];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.jobs.push_back(job);
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(mSharedMutex);
+		mShared.push_back(job);
+	}
+
+	// A worker about to sleep checks mQueued after counting itself in
+	// mSleeping, so either it sees the job or this sees it sleeping
+	mQueued++;
+	if (mSleeping > 0)
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mWake.notify_one();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Takes a queued job, or returns an empty handle.  Outside the workers only
+// the jobs of the caller's group are taken.
+//-----------------------------------------------------------------------------
+JobSystem::JobHandle JobSystem::findJob(bool background)
+{
+	JobHandle job;
+	int self = tSystem == this ? tWorker : -1;
+	int group = self >= 0 ? -1 : currentGroup();
+
+	if (self >= 0)
+	{
+		Worker& worker = *mWorkers[self];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		job = takeJob(worker.jobs, true, group);
+	}
+
+	if (!job)
+	{
+		std::lock_guard<std::mutex> lock(mSharedMutex);
+		job = takeJob(mShared, false, group);
+	}
+
+	// Steal the oldest job of another worker, starting after this one
+	int numWorkers = (int)mWorkers.size();
+	for (int i = 0; !job && i < numWorkers; i++)
+	{
+		int index = (self + 1 + i) % numWorkers;
+		if (index == self)
+			continue;
+
+		Worker& victim = *mWorkers[index];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		job = takeJob(victim.jobs, false, group);
+		if (job)
+			mSteals++;
+	}
+
+	if (!job && background)
+	{
+		std::lock_guard<std::mutex> lock(mBackgroundMutex);
+		if (!mBackground.empty())
+		{
+			job = mBackground.front();
+			mBackground.pop_front();
+		}
+	}
+
+	if (job)
+		mQueued--;
+	return job;
+}
+
+//-----------------------------------------------------------------------------
+// Takes the job at the back or the front of a locked queue, or with a group
+// (>= 0) the one of that group closest to that end
+//-----------------------------------------------------------------------------
+JobSystem::JobHandle JobSystem::takeJob(std::deque<JobHandle>& jobs, bool back, int group)
+{
+	JobHandle job;
+	if (group < 0)
+	{
+		if (!jobs.empty())
+		{
+			job = back ? jobs.back() : jobs.front();
+			if (back)
+				jobs.pop_back();
+			else
+				jobs.pop_front();
+		}
+		return job;
+	}
+
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		size_t index = back ? jobs.size() - 1 - i : i;
+		if (jobs[index]->group == group)
+		{
+			job = jobs[index];
+			jobs.erase(jobs.begin() + index);
+			break;
+		}
+	}
+	return job;
+}
+
+//-----------------------------------------------------------------------------
+// Runs a job, then queues the dependents it was the last dependency of.  The
+// jobs it spawns join its group.
+//-----------------------------------------------------------------------------
+void JobSystem::execute(const JobHandle& job)
+{
+	int group = tGroup;
+	tGroup = job->group;
+	job->task();
+	job->task = nullptr;	// frees the captures now
+	tGroup = group;
+
+	std::vector<JobHandle> dependents;
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->done = true;
+		dependents.swap(job->dependents);
+	}
+
+	for (size_t i = 0; i < dependents.size(); i++)
+	{
+		if (--dependents[i]->pending == 0)
+			schedule(dependents[i]);
+	}
+}
@@ -37,7 +37,16 @@ std::vector<std::string> split(std::string s, std::string t)
 // Constructor
 //-----------------------------------------------------------------------------
 Mesh::Mesh()
-	:mLoaded(false)
+	:mLoaded(false),
+	 mVertexCount(0),
+	 mBoundsMin(0.0f),
+	 mBoundsMax(0.0f),
+	 mVBO(0),
+	 mVAO(0),
+	 mPositionVBO(0),
+	 mPositionVAO(0),
+	 mInstanceBuffer(0),
+	 mInstanceOffset(0)
 {
 }
 
@@ -46,8 +55,7 @@ Mesh::Mesh()
 //-----------------------------------------------------------------------------
 Mesh::~Mesh()
 {
-	glDeleteVertexArrays(1, &mVAO);
-	glDeleteBuffers(1, &mVBO);
+	deleteBuffers();
 }
 
 //-----------------------------------------------------------------------------
@@ -62,6 +70,15 @@ Mesh::~Mesh()
 //  - only commands "v", "vt" and "f" are supported
 //-----------------------------------------------------------------------------
 bool Mesh::loadOBJ(const std::string& filename)
+{
+	return parseOBJ(filename) && upload();
+}
+
+//-----------------------------------------------------------------------------
+// Reads the OBJ file into the vertices and bounds.  No GL calls: any thread
+// may parse, one mesh per thread.
+//-----------------------------------------------------------------------------
+bool Mesh::parseOBJ(const std::string& filename)
 {
 	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
 	std::vector<glm::vec3> tempVertices;
@@ -78,7 +95,8 @@ bool Mesh::loadOBJ(const std::string& filename)
 			return false;
 		}
 
-		std::cout << "Loading OBJ file " << filename << " ..." << std::endl;
+		// One string, so lines of parallel loads do not interleave
+		std::cout << ("Loading OBJ file " + filename + " ...\n") << std::flush;
 
 		std::string lineBuffer;
 		while (std::getline(fin, lineBuffer))
@@ -156,8 +174,19 @@ bool Mesh::loadOBJ(const std::string& filename)
 		// Close the file
 		fin.close();
 
+		if (tempVertices.size() > 0)
+		{
+			mBoundsMin = mBoundsMax = tempVertices[0];
+			for (size_t i = 1; i < tempVertices.size(); i++)
+			{
+				mBoundsMin = glm::min(mBoundsMin, tempVertices[i]);
+				mBoundsMax = glm::max(mBoundsMax, tempVertices[i]);
+			}
+		}
+
 
 		// For each vertex of each triangle
+		mVertices.clear();
 		for (unsigned int i = 0; i < vertexIndices.size(); i++)
 		{
 			Vertex meshVertex;
@@ -185,22 +214,36 @@ bool Mesh::loadOBJ(const std::string& filename)
 			mVertices.push_back(meshVertex);
 		}
 
-		// Create and initialize the buffers
-		initBuffers();
-
-		return (mLoaded = true);
+		mFileName = filename;
+		return true;
 	}
 
 	// We shouldn't get here so return failure
 	return false;
 }
 
+//-----------------------------------------------------------------------------
+// Creates the buffers from the parsed vertices, which are not needed anymore
+//-----------------------------------------------------------------------------
+bool Mesh::upload()
+{
+	if (mVertices.empty())
+		return false;
+
+	initBuffers();
+	std::vector<Vertex>().swap(mVertices);
+	return (mLoaded = true);
+}
+
 //-----------------------------------------------------------------------------
 // Create and initialize the vertex buffer and vertex array object
 // Must have valid, non-empty std::vector of Vertex objects.
 //-----------------------------------------------------------------------------
 void Mesh::initBuffers()
 {
+	deleteBuffers();
+	mVertexCount = (GLsizei)mVertices.size();
+
 	glGenVertexArrays(1, &mVAO);
 	glGenBuffers(1, &mVBO);
 
@@ -219,9 +262,74 @@ void Mesh::initBuffers()
 	// Vertex Texture Coords
 	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)(6 * sizeof(GLfloat)));
 	glEnableVertexAttribArray(2);
+
+	// Tightly packed positions for depth only passes.  A third of the
+	// bandwidth of the full interleaved vertex.
+	std::vector<glm::vec3> positions(mVertices.size());
+	for (size_t i = 0; i < mVertices.size(); i++)
+		positions[i] = mVertices[i].position;
+
+	glGenVertexArrays(1, &mPositionVAO);
+	glGenBuffers(1, &mPositionVBO);
+
+	glBindVertexArray(mPositionVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, mPositionVBO);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), &positions[0], GL_STATIC_DRAW);
+
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+	glEnableVertexAttribArray(0);
 	
 	// unbind to make sure other code does not change it somewhere else
 	glBindVertexArray(0);
+
+	if (mInstanceBuffer != 0)
+	{
+		bindInstanceAttributes(mVAO);
+		bindInstanceAttributes(mPositionVAO);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Instance attributes of a vertex array, one InstanceTransform per instance
+//-----------------------------------------------------------------------------
+void Mesh::bindInstanceAttributes(GLuint vertexArray)
+{
+	glBindVertexArray(vertexArray);
+	if (mInstanceBuffer != 0)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+		for (GLuint column = 0; column < 7; column++)
+		{
+			glVertexAttribPointer(3 + column, column < 4 ? 4 : 3, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform),
+								  (GLvoid*)(mInstanceOffset + column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(3 + column, 1);
+			glEnableVertexAttribArray(3 + column);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	else
+	{
+		for (GLuint column = 0; column < 7; column++)
+			glDisableVertexAttribArray(3 + column);
+	}
+	glBindVertexArray(0);
+}
+
+//-----------------------------------------------------------------------------
+// Sets the instance attributes now if uploaded, otherwise with the upload
+//-----------------------------------------------------------------------------
+void Mesh::setInstanceBuffer(GLuint buffer, GLintptr offset)
+{
+	if (mVAO != 0 && buffer == mInstanceBuffer && offset == mInstanceOffset)
+		return;
+
+	mInstanceBuffer = buffer;
+	mInstanceOffset = offset;
+	if (mVAO != 0)
+	{
+		bindInstanceAttributes(mVAO);
+		bindInstanceAttributes(mPositionVAO);
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -232,7 +340,104 @@ void Mesh::draw()
 	if (!mLoaded) return;
 
 	glBindVertexArray(mVAO);
-	glDrawArrays(GL_TRIANGLES, 0, mVertices.size());
+	glDrawArrays(GL_TRIANGLES, 0, mVertexCount);
 	glBindVertexArray(0);
 }
 
+//-----------------------------------------------------------------------------
+// Binds the vertex array, kept bound for the following drawBound() calls
+//-----------------------------------------------------------------------------
+void Mesh::bind()
+{
+	glBindVertexArray(mVAO);
+}
+
+//-----------------------------------------------------------------------------
+// Binds the position only vertex array, for drawing it with other calls
+//-----------------------------------------------------------------------------
+void Mesh::bindPositions()
+{
+	glBindVertexArray(mPositionVAO);
+}
+
+//-----------------------------------------------------------------------------
+// Render the mesh with its vertex array already bound
+//-----------------------------------------------------------------------------
+void Mesh::drawBound()
+{
+	if (!mLoaded) return;
+
+	glDrawArrays(GL_TRIANGLES, 0, mVertexCount);
+}
+
+//-----------------------------------------------------------------------------
+// Unbinds the vertex array after bind()
+//-----------------------------------------------------------------------------
+void Mesh::unbind()
+{
+	glBindVertexArray(0);
+}
+
+//-----------------------------------------------------------------------------
+// Render the mesh using the position only stream
+//-----------------------------------------------------------------------------
+void Mesh::drawPositions()
+{
+	if (!mLoaded) return;
+
+	glBindVertexArray(mPositionVAO);
+	glDrawArrays(GL_TRIANGLES, 0, mVertexCount);
+	glBindVertexArray(0);
+}
+
+//-----------------------------------------------------------------------------
+// Deletes the vertex buffers and arrays, if any
+//-----------------------------------------------------------------------------
+void Mesh::deleteBuffers()
+{
+	glDeleteVertexArrays(1, &mVAO);
+	glDeleteBuffers(1, &mVBO);
+	glDeleteVertexArrays(1, &mPositionVAO);
+	glDeleteBuffers(1, &mPositionVBO);
+	mVAO = mVBO = mPositionVAO = mPositionVBO = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Vertices not uploaded yet
+//-----------------------------------------------------------------------------
+size_t Mesh::getCpuMemorySize() const
+{
+	return mVertices.capacity() * sizeof(Vertex);
+}
+
+//-----------------------------------------------------------------------------
+// Interleaved vertices plus the position only stream
+//-----------------------------------------------------------------------------
+size_t Mesh::getGpuMemorySize() const
+{
+	if (!mLoaded)
+		return 0;
+	return (size_t)mVertexCount * (sizeof(Vertex) + sizeof(glm::vec3));
+}
+
+//-----------------------------------------------------------------------------
+// Frees the buffers; the file name and the bounds are kept for reload()
+//-----------------------------------------------------------------------------
+void Mesh::evict()
+{
+	deleteBuffers();
+	std::vector<Vertex>().swap(mVertices);
+	mVertexCount = 0;
+	mLoaded = false;
+}
+
+//-----------------------------------------------------------------------------
+// Loads the OBJ file again
+//-----------------------------------------------------------------------------
+bool Mesh::reload()
+{
+	if (mFileName.empty())
+		return false;
+	return loadOBJ(mFileName);
+}
+
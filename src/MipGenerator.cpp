@@ -0,0 +1,356 @@
+//-----------------------------------------------------------------------------
+// CPU mip chain generation for RGBA8 images
+//-----------------------------------------------------------------------------
+#include "MipGenerator.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_GENERATOR_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	const float PI = 3.14159265358979f;
+	const float KAISER_WIDTH = 3.0f;	// half width, in destination pixels
+	const float KAISER_ALPHA = 4.0f;
+
+	bool gSimdEnabled = true;
+
+	//-------------------------------------------------------------------------
+	// sRGB <-> linear tables, built once
+	//-------------------------------------------------------------------------
+	struct SrgbTables
+	{
+		static const int ENCODE_SIZE = 65536;
+
+		float toLinear[256];
+		unsigned char toSrgb[ENCODE_SIZE];
+
+		SrgbTables()
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				float s = i / 255.0f;
+				toLinear[i] = (s <= 0.04045f) ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+			}
+
+			for (int i = 0; i < ENCODE_SIZE; i++)
+			{
+				float l = i / (float)(ENCODE_SIZE - 1);
+				float s = (l <= 0.0031308f) ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+				toSrgb[i] = (unsigned char)std::min(255, (int)(s * 255.0f + 0.5f));
+			}
+		}
+	};
+
+	const SrgbTables& srgbTables()
+	{
+		static const SrgbTables tables;
+		return tables;
+	}
+
+	//-------------------------------------------------------------------------
+	// 1D resampling kernel: for every destination pixel a list of source taps
+	//-------------------------------------------------------------------------
+	struct Tap
+	{
+		int index;
+		float weight;
+	};
+
+	struct Kernel
+	{
+		std::vector<Tap> taps;
+		std::vector<int> first;		// taps of pixel i are [first[i], first[i + 1])
+	};
+
+	float besselI0(float x)
+	{
+		// Power series, converges fast for the small arguments used here
+		float sum = 1.0f, term = 1.0f;
+		for (int k = 1; k < 20; k++)
+		{
+			term *= (x / (2.0f * k)) * (x / (2.0f * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	float kaiser(float x)
+	{
+		float t = x / KAISER_WIDTH;
+		if (t <= -1.0f || t >= 1.0f)
+			return 0.0f;
+
+		float sinc = (x == 0.0f) ? 1.0f : std::sin(PI * x) / (PI * x);
+		return sinc * besselI0(KAISER_ALPHA * std::sqrt(1.0f - t * t)) / besselI0(KAISER_ALPHA);
+	}
+
+	int wrap(int index, int size)
+	{
+		index %= size;
+		return index < 0 ? index + size : index;
+	}
+
+	void buildKernel(int srcSize, int dstSize, MipGenerator::Filter filter, Kernel& kernel)
+	{
+		kernel.taps.clear();
+		kernel.first.assign(1, 0);
+
+		float scale = srcSize / (float)dstSize;
+		for (int i = 0; i < dstSize; i++)
+		{
+			float center = (i + 0.5f) * scale;
+			size_t begin = kernel.taps.size();
+			float total = 0.0f;
+
+			if (filter == MipGenerator::FILTER_BOX || scale == 1.0f)
+			{
+				// Coverage of each source pixel by the destination footprint
+				float lo = center - 0.5f * scale, hi = center + 0.5f * scale;
+				for (int p = (int)std::floor(lo); p < (int)std::ceil(hi); p++)
+				{
+					float overlap = std::min((float)p + 1.0f, hi) - std::max((float)p, lo);
+					if (overlap <= 0.0f)
+						continue;
+
+					Tap tap = { wrap(p, srcSize), overlap };
+					kernel.taps.push_back(tap);
+					total += overlap;
+				}
+			}
+			else
+			{
+				float radius = KAISER_WIDTH * scale;
+				for (int p = (int)std::floor(center - radius); p <= (int)std::ceil(center + radius); p++)
+				{
+					float weight = kaiser((p + 0.5f - center) / scale);
+					if (weight == 0.0f)
+						continue;
+
+					Tap tap = { wrap(p, srcSize), weight };
+					kernel.taps.push_back(tap);
+					total += weight;
+				}
+			}
+
+			for (size_t t = begin; t < kernel.taps.size(); t++)
+				kernel.taps[t].weight /= total;
+			kernel.first.push_back((int)kernel.taps.size());
+		}
+	}
+
+	//-------------------------------------------------------------------------
+	// Filter passes on RGBA float rows.  A destination row is the vertical
+	// filter of whole source rows followed by the horizontal filter of that.
+	//-------------------------------------------------------------------------
+	void filterColumns(const float* const* srcRows, const Tap* taps, int numTaps, int width, float* dst)
+	{
+		size_t rowFloats = (size_t)width * 4;
+		std::fill(dst, dst + rowFloats, 0.0f);
+
+		for (int t = 0; t < numTaps; t++)
+		{
+			const float* srcRow = srcRows[t];
+			float weight = taps[t].weight;
+			size_t i = 0;
+#ifdef MIP_GENERATOR_SSE2
+			if (gSimdEnabled)
+			{
+				__m128 w = _mm_set1_ps(weight);
+				for (; i < rowFloats; i += 4)
+					_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(w, _mm_loadu_ps(srcRow + i))));
+			}
+#endif
+			for (; i < rowFloats; i++)
+				dst[i] += weight * srcRow[i];
+		}
+	}
+
+	void filterRow(const float* src, const Kernel& kernel, int dstWidth, float* dst)
+	{
+		for (int x = 0; x < dstWidth; x++)
+		{
+#ifdef MIP_GENERATOR_SSE2
+			if (gSimdEnabled)
+			{
+				__m128 sum = _mm_setzero_ps();
+				for (int t = kernel.first[x]; t < kernel.first[x + 1]; t++)
+				{
+					const Tap& tap = kernel.taps[t];
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(tap.weight), _mm_loadu_ps(src + tap.index * 4)));
+				}
+				_mm_storeu_ps(dst + x * 4, sum);
+				continue;
+			}
+#endif
+			float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int t = kernel.first[x]; t < kernel.first[x + 1]; t++)
+			{
+				const Tap& tap = kernel.taps[t];
+				for (int c = 0; c < 4; c++)
+					sum[c] += tap.weight * src[tap.index * 4 + c];
+			}
+			memcpy(dst + x * 4, sum, sizeof(sum));
+		}
+	}
+
+	//-------------------------------------------------------------------------
+	// RGBA8 <-> linear float
+	//-------------------------------------------------------------------------
+	void decode(const unsigned char* rgba, size_t numPixels, bool gammaCorrect, float* out)
+	{
+		const SrgbTables& tables = srgbTables();
+		for (size_t i = 0; i < numPixels * 4; i += 4)
+		{
+			for (int c = 0; c < 3; c++)
+				out[i + c] = gammaCorrect ? tables.toLinear[rgba[i + c]] : rgba[i + c] / 255.0f;
+			out[i + 3] = rgba[i + 3] / 255.0f;
+		}
+	}
+
+	void encode(const float* linear, size_t numPixels, bool gammaCorrect, unsigned char* rgba)
+	{
+		const SrgbTables& tables = srgbTables();
+		float colorScale = gammaCorrect ? (float)(SrgbTables::ENCODE_SIZE - 1) : 255.0f;
+		for (size_t i = 0; i < numPixels * 4; i += 4)
+		{
+			int q[4];
+#ifdef MIP_GENERATOR_SSE2
+			if (gSimdEnabled)
+			{
+				// Clamp (the Kaiser lobes overshoot), scale and round 4 channels at once
+				__m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(linear + i), _mm_setzero_ps()), _mm_set1_ps(1.0f));
+				__m128i rounded = _mm_cvtps_epi32(_mm_mul_ps(v, _mm_setr_ps(colorScale, colorScale, colorScale, 255.0f)));
+				_mm_storeu_si128((__m128i*)q, rounded);
+			}
+			else
+#endif
+			{
+				for (int c = 0; c < 4; c++)
+				{
+					float v = std::min(1.0f, std::max(0.0f, linear[i + c]));
+					q[c] = (int)std::nearbyint(v * (c < 3 ? colorScale : 255.0f));
+				}
+			}
+
+			for (int c = 0; c < 3; c++)
+				rgba[i + c] = gammaCorrect ? tables.toSrgb[q[c]] : (unsigned char)q[c];
+			rgba[i + 3] = (unsigned char)q[3];
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Number of levels down to 1x1
+//-----------------------------------------------------------------------------
+int MipGenerator::getNumLevels(int width, int height)
+{
+	int levels = 1;
+	for (int size = std::max(width, height); size > 1; size /= 2)
+		levels++;
+	return levels;
+}
+
+//-----------------------------------------------------------------------------
+// SIMD availability and switch
+//-----------------------------------------------------------------------------
+bool MipGenerator::hasSimd()
+{
+#ifdef MIP_GENERATOR_SSE2
+	return gSimdEnabled;
+#else
+	return false;
+#endif
+}
+
+void MipGenerator::setSimdEnabled(bool enabled)
+{
+	gSimdEnabled = enabled;
+}
+
+//-----------------------------------------------------------------------------
+// Human readable filter name
+//-----------------------------------------------------------------------------
+const char* MipGenerator::getFilterName(Filter filter)
+{
+	return filter == FILTER_KAISER ? "kaiser" : "box";
+}
+
+//-----------------------------------------------------------------------------
+// Builds the whole chain.  The source is decoded a row at a time when the
+// vertical filter reads every row once (box), or up front otherwise; each
+// level is kept in float as the source of the next one.
+//-----------------------------------------------------------------------------
+void MipGenerator::generate(const unsigned char* rgbaData, int width, int height, Filter filter, bool gammaCorrect,
+							std::vector<Level>& levels)
+{
+	levels.resize(getNumLevels(width, height) - 1);
+	if (levels.empty())
+		return;
+
+	std::vector<float> current, next, decodedRows, column, filtered;
+	std::vector<const float*> tapRows;
+	Kernel kernelX, kernelY;
+	int srcWidth = width, srcHeight = height;
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		int dstWidth = std::max(1, srcWidth / 2), dstHeight = std::max(1, srcHeight / 2);
+
+		buildKernel(srcWidth, dstWidth, filter, kernelX);
+		buildKernel(srcHeight, dstHeight, filter, kernelY);
+
+		// Level 0 is RGBA8: decode it whole unless every source row is used exactly once
+		bool decodeRows = false;
+		if (i == 0)
+		{
+			decodeRows = (int)kernelY.taps.size() == srcHeight;
+			if (!decodeRows)
+			{
+				current.resize((size_t)width * height * 4);
+				decode(rgbaData, (size_t)width * height, gammaCorrect, &current[0]);
+			}
+		}
+
+		size_t srcRowFloats = (size_t)srcWidth * 4;
+		column.resize(srcRowFloats);
+		filtered.resize((size_t)dstWidth * 4);
+		next.resize((size_t)dstWidth * dstHeight * 4);
+
+		Level& level = levels[i];
+		level.width = dstWidth;
+		level.height = dstHeight;
+		level.pixels.resize((size_t)dstWidth * dstHeight * 4);
+
+		for (int y = 0; y < dstHeight; y++)
+		{
+			int numTaps = kernelY.first[y + 1] - kernelY.first[y];
+			const Tap* taps = &kernelY.taps[kernelY.first[y]];
+
+			tapRows.resize(numTaps);
+			decodedRows.resize(numTaps * srcRowFloats);
+			for (int t = 0; t < numTaps; t++)
+			{
+				if (decodeRows)
+				{
+					decode(rgbaData + (size_t)taps[t].index * srcRowFloats, srcWidth, gammaCorrect, &decodedRows[t * srcRowFloats]);
+					tapRows[t] = &decodedRows[t * srcRowFloats];
+				}
+				else
+					tapRows[t] = &current[taps[t].index * srcRowFloats];
+			}
+
+			filterColumns(&tapRows[0], taps, numTaps, srcWidth, &column[0]);
+			float* dstRow = &next[(size_t)y * dstWidth * 4];
+			filterRow(&column[0], kernelX, dstWidth, dstRow);
+			encode(dstRow, dstWidth, gammaCorrect, &level.pixels[(size_t)y * dstWidth * 4]);
+		}
+
+		current.swap(next);
+		srcWidth = dstWidth;
+		srcHeight = dstHeight;
+	}
+}
@@ -0,0 +1,512 @@
+//-----------------------------------------------------------------------------
+// Software occlusion culling
+//-----------------------------------------------------------------------------
+#include "OcclusionCuller.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+// The AVX2 paths are compiled for their functions only and picked at run time,
+// so the rest of the build does not need the instruction set
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCCLUSION_AVX2 1
+#define OCCLUSION_AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_M_X64)
+#define OCCLUSION_AVX2 1
+#define OCCLUSION_AVX2_TARGET
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const int TILES_X = OcclusionCuller::WIDTH / OcclusionCuller::TILE_WIDTH;
+	const int TILES_Y = OcclusionCuller::HEIGHT / OcclusionCuller::TILE_HEIGHT;
+	const int BLOCKS_X = OcclusionCuller::WIDTH / OcclusionCuller::BLOCK_SIZE;
+	const int BLOCKS_Y = OcclusionCuller::HEIGHT / OcclusionCuller::BLOCK_SIZE;
+	static_assert(OcclusionCuller::WIDTH % OcclusionCuller::TILE_WIDTH == 0 && OcclusionCuller::HEIGHT % OcclusionCuller::TILE_HEIGHT == 0,
+				  "the tiles must cover the buffer");
+	static_assert(OcclusionCuller::TILE_WIDTH % OcclusionCuller::BLOCK_SIZE == 0 && OcclusionCuller::TILE_HEIGHT % OcclusionCuller::BLOCK_SIZE == 0,
+				  "a block must not straddle two tiles");
+	static_assert(OcclusionCuller::BLOCK_SIZE == 8, "a row of a block is one AVX2 register");
+
+	// Occluders per setup job
+	const size_t SETUP_GRAIN = 4;
+
+	bool gSimdEnabled = true;
+
+	bool detectAvx2()
+	{
+#if defined(OCCLUSION_AVX2) && defined(__GNUC__)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#elif defined(OCCLUSION_AVX2)
+		// The CPU has it (leaf 7) and the OS saves the registers (XCR0)
+		int info[4];
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+			return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return false;
+#endif
+	}
+
+	const bool gHasAvx2 = detectAvx2();
+
+	// 1/w of a triangle into the pixels of [minX, maxX] x [minY, maxY] its
+	// edge functions cover, keeping the closest
+	void rasterizeScalar(const float* edgeA, const float* edgeB, const float* edgeC,
+						 float depthA, float depthB, float depthC, float* depth,
+						 int minX, int maxX, int minY, int maxY)
+	{
+		for (int y = minY; y <= maxY; y++)
+		{
+			float* row = depth + y * OcclusionCuller::WIDTH;
+			for (int x = minX; x <= maxX; x++)
+			{
+				float fx = (float)x, fy = (float)y;
+				if (edgeA[0] * fx + edgeB[0] * fy + edgeC[0] < 0.0f ||
+					edgeA[1] * fx + edgeB[1] * fy + edgeC[1] < 0.0f ||
+					edgeA[2] * fx + edgeB[2] * fy + edgeC[2] < 0.0f)
+					continue;
+				row[x] = std::max(row[x], depthA * fx + depthB * fy + depthC);
+			}
+		}
+	}
+
+	float blockDepthScalar(const float* depth)
+	{
+		float farthest = depth[0];
+		for (int y = 0; y < OcclusionCuller::BLOCK_SIZE; y++)
+		{
+			for (int x = 0; x < OcclusionCuller::BLOCK_SIZE; x++)
+				farthest = std::min(farthest, depth[y * OcclusionCuller::WIDTH + x]);
+		}
+		return farthest;
+	}
+
+	// Any pixel of [firstX, lastX] of a block row not closer than depth
+	bool rowVisibleScalar(const float* row, float depth, int firstX, int lastX)
+	{
+		for (int x = firstX; x <= lastX; x++)
+		{
+			if (row[x] <= depth)
+				return true;
+		}
+		return false;
+	}
+
+#ifdef OCCLUSION_AVX2
+	// minX is a multiple of 8: whole registers up to maxX, which the tile
+	// contains.  A pixel is outside when any edge function is negative, that is
+	// when the sign bit of their or is set; its depth is then blended to 0.
+	OCCLUSION_AVX2_TARGET
+	void rasterizeAvx2(const float* edgeA, const float* edgeB, const float* edgeC,
+					   float depthA, float depthB, float depthC, float* depth,
+					   int minX, int maxX, int minY, int maxY)
+	{
+		const __m256 lanes = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 a0 = _mm256_set1_ps(edgeA[0]), a1 = _mm256_set1_ps(edgeA[1]), a2 = _mm256_set1_ps(edgeA[2]);
+		const __m256 da = _mm256_set1_ps(depthA);
+
+		for (int y = minY; y <= maxY; y++)
+		{
+			float fy = (float)y;
+			__m256 c0 = _mm256_set1_ps(edgeB[0] * fy + edgeC[0]);
+			__m256 c1 = _mm256_set1_ps(edgeB[1] * fy + edgeC[1]);
+			__m256 c2 = _mm256_set1_ps(edgeB[2] * fy + edgeC[2]);
+			__m256 dc = _mm256_set1_ps(depthB * fy + depthC);
+			float* row = depth + y * OcclusionCuller::WIDTH;
+
+			for (int x = minX; x <= maxX; x += 8)
+			{
+				__m256 fx = _mm256_add_ps(_mm256_set1_ps((float)x), lanes);
+				__m256 e0 = _mm256_add_ps(_mm256_mul_ps(a0, fx), c0);
+				__m256 e1 = _mm256_add_ps(_mm256_mul_ps(a1, fx), c1);
+				__m256 e2 = _mm256_add_ps(_mm256_mul_ps(a2, fx), c2);
+				__m256 outside = _mm256_or_ps(_mm256_or_ps(e0, e1), e2);
+				__m256 z = _mm256_blendv_ps(_mm256_add_ps(_mm256_mul_ps(da, fx), dc), zero, outside);
+				_mm256_storeu_ps(row + x, _mm256_max_ps(_mm256_loadu_ps(row + x), z));
+			}
+		}
+	}
+
+	OCCLUSION_AVX2_TARGET
+	float blockDepthAvx2(const float* depth)
+	{
+		__m256 farthest = _mm256_loadu_ps(depth);
+		for (int y = 1; y < OcclusionCuller::BLOCK_SIZE; y++)
+			farthest = _mm256_min_ps(farthest, _mm256_loadu_ps(depth + y * OcclusionCuller::WIDTH));
+		__m128 half = _mm_min_ps(_mm256_castps256_ps128(farthest), _mm256_extractf128_ps(farthest, 1));
+		half = _mm_min_ps(half, _mm_movehl_ps(half, half));
+		half = _mm_min_ss(half, _mm_shuffle_ps(half, half, 1));
+		return _mm_cvtss_f32(half);
+	}
+
+	// The 8 pixels of the block row at once, the columns outside [firstX, lastX] masked off
+	OCCLUSION_AVX2_TARGET
+	bool rowVisibleAvx2(const float* row, float depth, int firstX, int lastX)
+	{
+		int columns = (0xff << firstX) & (0xff >> (7 - lastX));
+		__m256 notCloser = _mm256_cmp_ps(_mm256_loadu_ps(row), _mm256_set1_ps(depth), _CMP_LE_OQ);
+		return (_mm256_movemask_ps(notCloser) & columns) != 0;
+	}
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+OcclusionCuller::OcclusionCuller()
+	: mOccluders(nullptr),
+	  mDepth(WIDTH * HEIGHT, 0.0f),
+	  mBlockDepth(BLOCKS_X * BLOCKS_Y, 0.0f),
+	  mProjectionX(1.0f),
+	  mProjectionY(1.0f),
+	  mNear(0.1f)
+{
+	mStats = Stats();
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+OcclusionCuller::~OcclusionCuller()
+{
+}
+
+//-----------------------------------------------------------------------------
+// Sets the occluders' triangles up in parallel, each into its own slots, then
+// rasterizes the tiles in parallel
+//-----------------------------------------------------------------------------
+void OcclusionCuller::rasterize(const std::vector<Occluder>& occluders, const glm::mat4& view, const glm::mat4& projection,
+								JobSystem* jobs)
+{
+	Clock::time_point start = Clock::now();
+
+	mOccluders = &occluders;
+	mViewProjection = projection * view;
+	mView = view;
+	mProjectionX = projection[0][0];
+	mProjectionY = projection[1][1];
+	mNear = projection[3][2] / (projection[2][2] - 1.0f);
+
+	size_t total = 0;
+	mTriangleOffsets.resize(occluders.size());
+	mTriangleCounts.assign(occluders.size(), 0);
+	for (size_t o = 0; o < occluders.size(); o++)
+	{
+		mTriangleOffsets[o] = total;
+		total += 2 * (occluders[o].triangles->size() / 3);
+	}
+	mTriangles.resize(total);
+
+	std::function<void(size_t, size_t)> setup = [this](size_t first, size_t last)
+	{
+		for (size_t o = first; o < last; o++)
+			setupOccluder(o);
+	};
+	if (jobs)
+		jobs->parallelFor(0, occluders.size(), SETUP_GRAIN, setup);
+	else
+		setup(0, occluders.size());
+
+	Clock::time_point setupEnd = Clock::now();
+
+	std::function<void(size_t, size_t)> raster = [this](size_t first, size_t last)
+	{
+		for (size_t t = first; t < last; t++)
+			rasterizeTile((int)t);
+	};
+	if (jobs)
+		jobs->parallelFor(0, TILES_X * TILES_Y, 1, raster);
+	else
+		raster(0, TILES_X * TILES_Y);
+
+	mStats.occluders = (int)occluders.size();
+	mStats.triangles = 0;
+	for (size_t o = 0; o < occluders.size(); o++)
+		mStats.triangles += mTriangleCounts[o];
+	mStats.setupMs = std::chrono::duration<double, std::milli>(setupEnd - start).count();
+	mStats.rasterMs = std::chrono::duration<double, std::milli>(Clock::now() - setupEnd).count();
+}
+
+//-----------------------------------------------------------------------------
+// The rectangle of the box around the sphere on screen, and its nearest
+// depth.  A block closer everywhere settles its part of the rectangle at
+// once, otherwise its pixels in the rectangle are compared.
+//-----------------------------------------------------------------------------
+bool OcclusionCuller::isOccluded(const glm::vec3& center, float radius) const
+{
+	glm::vec4 v = mView * glm::vec4(center, 1.0f);
+	float nearest = -v.z - radius;
+	float farthest = -v.z + radius;
+	if (nearest <= mNear)
+		return false;
+
+	// Off the view axis, the nearest depth projects farthest out
+	float left = v.x - radius, right = v.x + radius;
+	float bottom = v.y - radius, top = v.y + radius;
+	float minX = mProjectionX * left / (left < 0.0f ? nearest : farthest);
+	float maxX = mProjectionX * right / (right > 0.0f ? nearest : farthest);
+	float minY = mProjectionY * bottom / (bottom < 0.0f ? nearest : farthest);
+	float maxY = mProjectionY * top / (top > 0.0f ? nearest : farthest);
+
+	int x0 = std::max((int)std::floor((minX * 0.5f + 0.5f) * WIDTH), 0);
+	int x1 = std::min((int)std::floor((maxX * 0.5f + 0.5f) * WIDTH), WIDTH - 1);
+	int y0 = std::max((int)std::floor((minY * 0.5f + 0.5f) * HEIGHT), 0);
+	int y1 = std::min((int)std::floor((maxY * 0.5f + 0.5f) * HEIGHT), HEIGHT - 1);
+	if (x0 > x1 || y0 > y1)
+		return false;
+
+	const float depth = 1.0f / nearest;
+#ifdef OCCLUSION_AVX2
+	const bool simd = gSimdEnabled && gHasAvx2;
+#endif
+	for (int by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++)
+	{
+		for (int bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++)
+		{
+			if (mBlockDepth[by * BLOCKS_X + bx] > depth)
+				continue;
+
+			int firstX = std::max(x0 - bx * BLOCK_SIZE, 0);
+			int lastX = std::min(x1 - bx * BLOCK_SIZE, BLOCK_SIZE - 1);
+			int firstY = std::max(y0, by * BLOCK_SIZE);
+			int lastY = std::min(y1, by * BLOCK_SIZE + BLOCK_SIZE - 1);
+			for (int y = firstY; y <= lastY; y++)
+			{
+				const float* row = &mDepth[y * WIDTH + bx * BLOCK_SIZE];
+#ifdef OCCLUSION_AVX2
+				if (simd ? rowVisibleAvx2(row, depth, firstX, lastX) : rowVisibleScalar(row, depth, firstX, lastX))
+					return false;
+#else
+				if (rowVisibleScalar(row, depth, firstX, lastX))
+					return false;
+#endif
+			}
+		}
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Job : the triangles of one occluder to pixels.  Parts behind the near plane
+// are clipped away, back faces dropped.
+//-----------------------------------------------------------------------------
+void OcclusionCuller::setupOccluder(size_t occluder)
+{
+	const Occluder& source = (*mOccluders)[occluder];
+	const std::vector<glm::vec3>& positions = *source.triangles;
+	const glm::mat4 modelViewProjection = mViewProjection * source.worldMatrix;
+	Triangle* out = &mTriangles[mTriangleOffsets[occluder]];
+	int count = 0;
+
+	for (size_t t = 0; t + 2 < positions.size(); t += 3)
+	{
+		glm::vec4 corners[3];
+		for (int i = 0; i < 3; i++)
+			corners[i] = modelViewProjection * glm::vec4(positions[t + i], 1.0f);
+
+		// A triangle, or a quad when one corner is clipped
+		glm::vec4 polygon[4];
+		int numCorners = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			const glm::vec4& a = corners[i];
+			const glm::vec4& b = corners[(i + 1) % 3];
+			bool aInside = a.w >= mNear, bInside = b.w >= mNear;
+			if (aInside)
+				polygon[numCorners++] = a;
+			if (aInside != bInside)
+				polygon[numCorners++] = a + (b - a) * ((mNear - a.w) / (b.w - a.w));
+		}
+		if (numCorners < 3)
+			continue;
+
+		// Pixels, and 1/w
+		glm::vec3 screen[4];
+		for (int i = 0; i < numCorners; i++)
+		{
+			float invW = 1.0f / polygon[i].w;
+			screen[i] = glm::vec3((polygon[i].x * invW * 0.5f + 0.5f) * WIDTH, (polygon[i].y * invW * 0.5f + 0.5f) * HEIGHT, invW);
+		}
+		for (int i = 1; i + 1 < numCorners; i++)
+		{
+			if (setupTriangle(screen[0], screen[i], screen[i + 1], out[count]))
+				count++;
+		}
+	}
+	mTriangleCounts[occluder] = count;
+}
+
+//-----------------------------------------------------------------------------
+// Edge functions of a counter-clockwise triangle, positive inside, and the
+// plane of its 1/w, both evaluated at pixel centers.  False when it faces
+// away, has no area, or misses the buffer.
+//-----------------------------------------------------------------------------
+bool OcclusionCuller::setupTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, Triangle& triangle)
+{
+	float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	if (!(area > 0.0f))
+		return false;
+
+	triangle.minX = std::max((int)std::floor(std::min(a.x, std::min(b.x, c.x))), 0);
+	triangle.maxX = std::min((int)std::floor(std::max(a.x, std::max(b.x, c.x))), WIDTH - 1);
+	triangle.minY = std::max((int)std::floor(std::min(a.y, std::min(b.y, c.y))), 0);
+	triangle.maxY = std::min((int)std::floor(std::max(a.y, std::max(b.y, c.y))), HEIGHT - 1);
+	if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+		return false;
+
+	// Edge i is opposite to corner i, its function is that corner's weight times the area
+	const glm::vec3* corners[3] = { &a, &b, &c };
+	for (int i = 0; i < 3; i++)
+	{
+		const glm::vec3& p = *corners[(i + 1) % 3];
+		const glm::vec3& q = *corners[(i + 2) % 3];
+		triangle.edgeA[i] = p.y - q.y;
+		triangle.edgeB[i] = q.x - p.x;
+		triangle.edgeC[i] = -(triangle.edgeA[i] * p.x + triangle.edgeB[i] * p.y) + 0.5f * (triangle.edgeA[i] + triangle.edgeB[i]);
+	}
+
+	triangle.depthA = (triangle.edgeA[0] * a.z + triangle.edgeA[1] * b.z + triangle.edgeA[2] * c.z) / area;
+	triangle.depthB = (triangle.edgeB[0] * a.z + triangle.edgeB[1] * b.z + triangle.edgeB[2] * c.z) / area;
+	triangle.depthC = (triangle.edgeC[0] * a.z + triangle.edgeC[1] * b.z + triangle.edgeC[2] * c.z) / area;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Job : one tile, cleared, every triangle touching it drawn, then its blocks
+//-----------------------------------------------------------------------------
+void OcclusionCuller::rasterizeTile(int tile)
+{
+	const int x0 = (tile % TILES_X) * TILE_WIDTH, x1 = x0 + TILE_WIDTH - 1;
+	const int y0 = (tile / TILES_X) * TILE_HEIGHT, y1 = y0 + TILE_HEIGHT - 1;
+	float* depth = mDepth.data();
+	for (int y = y0; y <= y1; y++)
+		std::fill(depth + y * WIDTH + x0, depth + y * WIDTH + x1 + 1, 0.0f);
+
+#ifdef OCCLUSION_AVX2
+	const bool simd = gSimdEnabled && gHasAvx2;
+#endif
+	for (size_t o = 0; o < mTriangleCounts.size(); o++)
+	{
+		const Triangle* triangles = &mTriangles[mTriangleOffsets[o]];
+		for (int t = 0; t < mTriangleCounts[o]; t++)
+		{
+			const Triangle& triangle = triangles[t];
+			int minX = std::max(triangle.minX, x0), maxX = std::min(triangle.maxX, x1);
+			int minY = std::max(triangle.minY, y0), maxY = std::min(triangle.maxY, y1);
+			if (minX > maxX || minY > maxY)
+				continue;
+
+#ifdef OCCLUSION_AVX2
+			if (simd)
+			{
+				rasterizeAvx2(triangle.edgeA, triangle.edgeB, triangle.edgeC, triangle.depthA, triangle.depthB, triangle.depthC,
+							  depth, minX & ~7, maxX, minY, maxY);
+				continue;
+			}
+#endif
+			rasterizeScalar(triangle.edgeA, triangle.edgeB, triangle.edgeC, triangle.depthA, triangle.depthB, triangle.depthC,
+							depth, minX, maxX, minY, maxY);
+		}
+	}
+
+	for (int by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++)
+	{
+		for (int bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++)
+		{
+			const float* block = depth + by * BLOCK_SIZE * WIDTH + bx * BLOCK_SIZE;
+#ifdef OCCLUSION_AVX2
+			mBlockDepth[by * BLOCKS_X + bx] = simd ? blockDepthAvx2(block) : blockDepthScalar(block);
+#else
+			mBlockDepth[by * BLOCKS_X + bx] = blockDepthScalar(block);
+#endif
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// models/building.obj -> models/building_occluder.obj
+//-----------------------------------------------------------------------------
+std::string OcclusionCuller::getOccluderFile(const std::string& meshFile)
+{
+	std::filesystem::path path(meshFile);
+	path.replace_extension();
+	path += "_occluder.obj";
+	return path.generic_string();
+}
+
+//-----------------------------------------------------------------------------
+// Positions and faces of the proxy's OBJ file, polygons split into fans
+//-----------------------------------------------------------------------------
+bool OcclusionCuller::loadOccluder(const std::string& meshFile, std::vector<glm::vec3>& triangles)
+{
+	triangles.clear();
+	std::ifstream fin(getOccluderFile(meshFile));
+	if (!fin)
+		return false;
+
+	std::vector<glm::vec3> positions;
+	std::string line;
+	while (std::getline(fin, line))
+	{
+		std::istringstream tokens(line);
+		std::string command;
+		tokens >> command;
+		if (command == "v")
+		{
+			glm::vec3 position(0.0f);
+			tokens >> position.x >> position.y >> position.z;
+			positions.push_back(position);
+		}
+		else if (command == "f")
+		{
+			// v, v/vt, v//vn or v/vt/vn; negative indices count from the last position
+			std::vector<int> face;
+			std::string corner;
+			while (tokens >> corner)
+			{
+				int index = atoi(corner.c_str());
+				index = index < 0 ? (int)positions.size() + index : index - 1;
+				if (index < 0 || index >= (int)positions.size())
+				{
+					triangles.clear();
+					return false;
+				}
+				face.push_back(index);
+			}
+			for (size_t i = 1; i + 1 < face.size(); i++)
+			{
+				triangles.push_back(positions[face[0]]);
+				triangles.push_back(positions[face[i]]);
+				triangles.push_back(positions[face[i + 1]]);
+			}
+		}
+	}
+	return !triangles.empty();
+}
+
+//-----------------------------------------------------------------------------
+// AVX2 when the CPU has it and it is not switched off
+//-----------------------------------------------------------------------------
+bool OcclusionCuller::hasSimd()
+{
+	return gHasAvx2 && gSimdEnabled;
+}
+
+void OcclusionCuller::setSimdEnabled(bool enabled)
+{
+	gSimdEnabled = enabled;
+}
@@ -0,0 +1,218 @@
+//-----------------------------------------------------------------------------
+// Ring of mapped pixel unpack buffers for streaming texture uploads
+//-----------------------------------------------------------------------------
+#include "PixelBufferRing.h"
+#include <iostream>
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+PixelBufferRing::PixelBufferRing()
+	: mSegmentSize(0),
+	  mPersistent(false),
+	  mStop(false)
+{
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+PixelBufferRing::~PixelBufferRing()
+{
+	destroy();
+}
+
+//-----------------------------------------------------------------------------
+// Creates numSegments mapped segments of segmentSize bytes.  The persistent
+// mapping is used when the driver has it, unless allowPersistent is false.
+//-----------------------------------------------------------------------------
+bool PixelBufferRing::init(size_t segmentSize, int numSegments, bool allowPersistent)
+{
+	destroy();
+	if (segmentSize == 0 || numSegments <= 0)
+		return false;
+
+	mSegmentSize = segmentSize;
+	mStop = false;
+	mSegments.resize(numSegments);
+	for (int i = 0; i < numSegments; i++)
+	{
+		mSegments[i].buffer = 0;
+		mSegments[i].data = NULL;
+		mSegments[i].fence = 0;
+	}
+
+	mPersistent = allowPersistent && (GLEW_ARB_buffer_storage || GLEW_VERSION_4_4);
+	if (mPersistent)
+	{
+		GLsizeiptr totalSize = (GLsizeiptr)(segmentSize * numSegments);
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		GLuint buffer;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, totalSize, NULL, flags);
+		unsigned char* data = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, totalSize, flags);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		if (data == NULL)
+		{
+			// Some drivers refuse large persistent mappings: orphaning works everywhere
+			std::cerr << "Warning: persistent pixel buffer mapping failed, using orphaned buffers" << std::endl;
+			glDeleteBuffers(1, &buffer);
+			mPersistent = false;
+		}
+		else
+		{
+			for (int i = 0; i < numSegments; i++)
+			{
+				mSegments[i].buffer = buffer;
+				mSegments[i].data = data + segmentSize * i;
+			}
+		}
+	}
+
+	if (!mPersistent)
+	{
+		for (int i = 0; i < numSegments; i++)
+			glGenBuffers(1, &mSegments[i].buffer);
+	}
+
+	for (int i = 0; i < numSegments; i++)
+		release(i);
+
+	if (mAvailable.empty())
+	{
+		std::cerr << "Error mapping pixel buffers" << std::endl;
+		destroy();
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Unmaps and deletes every buffer.  The GPU must be done with them.
+//-----------------------------------------------------------------------------
+void PixelBufferRing::destroy()
+{
+	shutdown();
+
+	for (size_t i = 0; i < mSegments.size(); i++)
+	{
+		Segment& segment = mSegments[i];
+		if (segment.fence != 0)
+			glDeleteSync(segment.fence);
+
+		// The persistent buffer is deleted with the first segment, deleting maps it out
+		if (mPersistent && i > 0)
+			continue;
+
+		if (segment.data != NULL)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, segment.buffer);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &segment.buffer);
+	}
+
+	mSegments.clear();
+	mAvailable.clear();
+	mPersistent = false;
+}
+
+//-----------------------------------------------------------------------------
+// Maps a segment again (orphaning its previous storage) and makes it available
+// to acquire.  GL thread only.
+//-----------------------------------------------------------------------------
+void PixelBufferRing::release(int index)
+{
+	Segment& segment = mSegments[index];
+	if (!mPersistent)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, segment.buffer);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)mSegmentSize, NULL, GL_STREAM_DRAW);
+		segment.data = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)mSegmentSize,
+														GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (segment.data == NULL)
+			return;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mAvailable.push_back(index);
+	mSegmentReady.notify_one();
+}
+
+//-----------------------------------------------------------------------------
+// Polls the fences without waiting and recycles the segments the GPU is done with
+//-----------------------------------------------------------------------------
+void PixelBufferRing::update()
+{
+	for (size_t i = 0; i < mSegments.size(); i++)
+	{
+		Segment& segment = mSegments[i];
+		if (segment.fence == 0)
+			continue;
+
+		GLenum status = glClientWaitSync(segment.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			continue;
+
+		glDeleteSync(segment.fence);
+		segment.fence = 0;
+		release((int)i);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Binds a filled segment as the unpack buffer.  Pixel pointers passed to
+// glTexSubImage2D are then offsets from the returned value.
+//-----------------------------------------------------------------------------
+const GLvoid* PixelBufferRing::beginUpload(int index)
+{
+	Segment& segment = mSegments[index];
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, segment.buffer);
+	if (mPersistent)
+		return (const GLvoid*)(mSegmentSize * index);
+
+	if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE)
+		std::cerr << "Warning: pixel buffer contents lost while mapped" << std::endl;
+	segment.data = NULL;
+	return (const GLvoid*)0;
+}
+
+//-----------------------------------------------------------------------------
+// The segment is reused once the copies issued from it have completed
+//-----------------------------------------------------------------------------
+void PixelBufferRing::endUpload(int index)
+{
+	mSegments[index].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Waits for a mapped segment
+//-----------------------------------------------------------------------------
+int PixelBufferRing::acquire()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mSegmentReady.wait(lock, [this] { return mStop || !mAvailable.empty(); });
+	if (mStop)
+		return -1;
+
+	int index = mAvailable.front();
+	mAvailable.pop_front();
+	return index;
+}
+
+//-----------------------------------------------------------------------------
+// Makes every acquire return -1, so that writers can give up
+//-----------------------------------------------------------------------------
+void PixelBufferRing::shutdown()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mStop = true;
+	mSegmentReady.notify_all();
+}
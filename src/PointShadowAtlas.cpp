@@ -0,0 +1,503 @@
+//-----------------------------------------------------------------------------
+// Omnidirectional point light shadows
+//-----------------------------------------------------------------------------
+#include "PointShadowAtlas.h"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include "glm/gtc/matrix_transform.hpp"
+
+// Cube face axes and up vectors.  The fragment shaders rebuild the same face
+// basis to look up the shadow, keep them in sync with lighting_dir.frag.
+static const glm::vec3 FACE_AXES[PointShadowAtlas::NUM_FACES] = {
+	glm::vec3( 1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+	glm::vec3( 0.0f, 1.0f, 0.0f), glm::vec3( 0.0f,-1.0f, 0.0f),
+	glm::vec3( 0.0f, 0.0f, 1.0f), glm::vec3( 0.0f, 0.0f,-1.0f)
+};
+static const glm::vec3 FACE_UPS[PointShadowAtlas::NUM_FACES] = {
+	glm::vec3( 0.0f,-1.0f, 0.0f), glm::vec3( 0.0f,-1.0f, 0.0f),
+	glm::vec3( 0.0f, 0.0f, 1.0f), glm::vec3( 0.0f, 0.0f,-1.0f),
+	glm::vec3( 0.0f,-1.0f, 0.0f), glm::vec3( 0.0f,-1.0f, 0.0f)
+};
+
+static const float SHADOW_NEAR_PLANE = 0.05f;
+static const float MOVED_WEIGHT = 4.0f;		// faces dirtied by motion beat faces that are just stale
+static const float AGE_WEIGHT = 0.25f;		// keeps low priority faces from starving
+static const float SLOT_HYSTERESIS = 1.25f;	// a light must be this much more important to steal a slot
+
+//-----------------------------------------------------------------------------
+// Returns true if the sphere is at least partially inside the clip volume
+// described by viewProj (planes extracted with the Gribb/Hartmann method)
+//-----------------------------------------------------------------------------
+static bool sphereInFrustum(const glm::mat4& viewProj, const glm::vec3& center, float radius)
+{
+	glm::mat4 m = glm::transpose(viewProj);
+	glm::vec4 planes[6] = {
+		m[3] + m[0], m[3] - m[0],
+		m[3] + m[1], m[3] - m[1],
+		m[3] + m[2], m[3] - m[2]
+	};
+
+	for (int i = 0; i < 6; i++)
+	{
+		float len = glm::length(glm::vec3(planes[i]));
+		if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius * len)
+			return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Rough fraction of the screen covered by a sphere (clamped to 1)
+//-----------------------------------------------------------------------------
+static float screenCoverage(const glm::vec3& cameraPos, float projScale, const glm::vec3& center, float radius)
+{
+	float d = glm::max(glm::length(center - cameraPos), radius);
+	float projected = radius * projScale / d;
+	return glm::min(1.0f, projected * projected);
+}
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+PointShadowAtlas::PointShadowAtlas()
+	: mFaceResolution(0),
+	  mNumSlots(0),
+	  mFaceBudget(6),
+	  mFrame(0),
+	  mDepth(0),
+	  mLayeredFBO(0), mLayerFBO(0),
+	  mFacesRendered(0),
+	  mPendingFaces(0),
+	  mDrawCount(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+PointShadowAtlas::~PointShadowAtlas()
+{
+	glDeleteFramebuffers(1, &mLayeredFBO);
+	glDeleteFramebuffers(1, &mLayerFBO);
+	glDeleteTextures(1, &mDepth);
+}
+
+//-----------------------------------------------------------------------------
+// Creates the depth array (numSlots * 6 layers) and its framebuffers
+//-----------------------------------------------------------------------------
+bool PointShadowAtlas::init(int faceResolution, int numSlots)
+{
+	mFaceResolution = faceResolution;
+	mNumSlots = numSlots;
+	mSlotOwner.assign(mNumSlots, -1);
+
+	if (!mDepthShader.loadShaders("shaders/point_shadow.vert", "shaders/point_shadow.geom", "shaders/point_shadow.frag"))
+		return false;
+
+	glGenTextures(1, &mDepth);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mDepth);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, mFaceResolution, mFaceResolution, mNumSlots * NUM_FACES, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// Layered framebuffer: the geometry shader routes triangles with gl_Layer
+	glGenFramebuffers(1, &mLayeredFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, mLayeredFBO);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mDepth, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	bool complete = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+	// Single layer framebuffer: clearing a layered attachment would clear every face
+	glGenFramebuffers(1, &mLayerFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, mLayerFBO);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mDepth, 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	complete = complete && (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (!complete)
+	{
+		std::cerr << "Point shadow framebuffer is incomplete!" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Registers a shadowed point light
+//-----------------------------------------------------------------------------
+int PointShadowAtlas::addLight(const glm::vec3& position, float radius, int owner)
+{
+	Light light;
+	light.position = position;
+	light.radius = radius;
+	light.owner = owner;
+	light.slot = -1;
+	light.importance = 0.0f;
+	for (int f = 0; f < NUM_FACES; f++)
+	{
+		light.dirty[f] = true;
+		light.moved[f] = false;
+		light.dirtySince[f] = mFrame;
+		light.scheduled[f] = false;
+	}
+
+	mLights.push_back(light);
+	return (int)mLights.size() - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Moving a light invalidates all of its faces
+//-----------------------------------------------------------------------------
+void PointShadowAtlas::setLightPosition(int light, const glm::vec3& position)
+{
+	if (mLights[light].position == position)
+		return;
+
+	mLights[light].position = position;
+	markAllFaces(mLights[light], true);
+}
+
+//-----------------------------------------------------------------------------
+// Flags every face of every light, the casters may have changed shape
+//-----------------------------------------------------------------------------
+void PointShadowAtlas::invalidate()
+{
+	for (size_t i = 0; i < mLights.size(); i++)
+		markAllFaces(mLights[i], false);
+}
+
+//-----------------------------------------------------------------------------
+// Flags every face of a light as needing a refresh
+//-----------------------------------------------------------------------------
+void PointShadowAtlas::markAllFaces(Light& light, bool moved)
+{
+	for (int f = 0; f < NUM_FACES; f++)
+	{
+		if (!light.dirty[f])
+			light.dirtySince[f] = mFrame;
+		light.dirty[f] = true;
+		light.moved[f] = light.moved[f] || moved;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Flags the faces a moving caster (old or new position) touches
+//-----------------------------------------------------------------------------
+void PointShadowAtlas::markCaster(int caster, const glm::vec3& center, float radius)
+{
+	for (size_t i = 0; i < mLights.size(); i++)
+	{
+		Light& light = mLights[i];
+		if (light.slot < 0 || light.owner == caster)
+			continue;
+
+		for (int f = 0; f < NUM_FACES; f++)
+		{
+			if (!faceIntersectsSphere(light, f, center, radius))
+				continue;
+
+			if (!light.dirty[f])
+				light.dirtySince[f] = mFrame;
+			light.dirty[f] = true;
+			light.moved[f] = true;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Tests a sphere against the 90 degree pyramid of a cube face, limited to the
+// light radius.  The side planes of face axis a are (a - b) and (a + b) for
+// both perpendicular axes b.
+//-----------------------------------------------------------------------------
+bool PointShadowAtlas::faceIntersectsSphere(const Light& light, int face, const glm::vec3& center, float radius) const
+{
+	glm::vec3 c = center - light.position;
+	if (glm::length(c) > light.radius + radius)
+		return false;
+
+	const glm::vec3& axis = FACE_AXES[face];
+	const float invSqrt2 = 0.70710678f;
+	for (int b = 0; b < 3; b++)
+	{
+		if (axis[b] != 0.0f)
+			continue;
+
+		glm::vec3 side(0.0f);
+		side[b] = 1.0f;
+		if (glm::dot(c, (axis - side) * invSqrt2) < -radius || glm::dot(c, (axis + side) * invSqrt2) < -radius)
+			return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// View * projection for one cube face of a light
+//-----------------------------------------------------------------------------
+glm::mat4 PointShadowAtlas::faceViewProj(const Light& light, int face) const
+{
+	glm::mat4 proj = glm::perspective(glm::radians(90.0f), 1.0f, SHADOW_NEAR_PLANE, light.radius);
+	glm::mat4 view = glm::lookAt(light.position, light.position + FACE_AXES[face], FACE_UPS[face]);
+	return proj * view;
+}
+
+//-----------------------------------------------------------------------------
+// Detects moving casters, hands out slots to the most important lights and
+// picks at most mFaceBudget dirty faces to refresh this frame
+//-----------------------------------------------------------------------------
+void PointShadowAtlas::update(const Camera& camera, float aspect, float nearPlane, float farPlane, const std::vector<ShadowCaster>& casters)
+{
+	mFrame++;
+
+	glm::mat4 viewProj = glm::perspective(glm::radians(camera.getFOV()), aspect, nearPlane, farPlane) * camera.getViewMatrix();
+	float projScale = 1.0f / glm::tan(glm::radians(camera.getFOV()) * 0.5f);
+	const glm::vec3& cameraPos = camera.getPosition();
+
+	// Light importance: how much of the screen its influence covers, closer is better
+	std::vector<int> order;
+	for (size_t i = 0; i < mLights.size(); i++)
+	{
+		Light& light = mLights[i];
+		light.importance = 0.0f;
+		if (sphereInFrustum(viewProj, light.position, light.radius))
+		{
+			float d = glm::length(light.position - cameraPos);
+			light.importance = screenCoverage(cameraPos, projScale, light.position, light.radius) / (1.0f + d / light.radius);
+		}
+		if (light.importance > 0.0f)
+			order.push_back((int)i);
+	}
+	std::sort(order.begin(), order.end(), [this](int a, int b) { return mLights[a].importance > mLights[b].importance; });
+
+	// Slot assignment with hysteresis so two similar lights do not trade slots every frame
+	for (size_t k = 0; k < order.size() && k < (size_t)mNumSlots; k++)
+	{
+		Light& light = mLights[order[k]];
+		if (light.slot >= 0)
+			continue;
+
+		int slot = -1;
+		for (int s = 0; s < mNumSlots && slot < 0; s++)
+		{
+			if (mSlotOwner[s] < 0)
+				slot = s;
+		}
+
+		if (slot < 0)
+		{
+			// Steal the slot of the least important holder if we clearly beat it
+			int weakest = -1;
+			for (int s = 0; s < mNumSlots; s++)
+			{
+				if (weakest < 0 || mLights[mSlotOwner[s]].importance < mLights[mSlotOwner[weakest]].importance)
+					weakest = s;
+			}
+			if (light.importance <= mLights[mSlotOwner[weakest]].importance * SLOT_HYSTERESIS)
+				continue;
+
+			mLights[mSlotOwner[weakest]].slot = -1;
+			slot = weakest;
+		}
+
+		mSlotOwner[slot] = order[k];
+		light.slot = slot;
+		markAllFaces(light, false);
+	}
+
+	// Dynamic casters whose transform changed dirty the faces they left and entered
+	if (mPrevModels.size() != casters.size())
+		mPrevModels.assign(casters.size(), glm::mat4(0.0f));
+
+	for (size_t i = 0; i < casters.size(); i++)
+	{
+		const ShadowCaster& caster = casters[i];
+		if (caster.isStatic || caster.mesh == NULL || !caster.mesh->isLoaded() || mPrevModels[i] == caster.model)
+			continue;
+
+		glm::vec3 center;
+		float radius;
+		ShadowCaster previous = caster;
+		previous.model = mPrevModels[i];
+		previous.getBoundingSphere(center, radius);
+		markCaster((int)i, center, radius);
+		caster.getBoundingSphere(center, radius);
+		markCaster((int)i, center, radius);
+
+		mPrevModels[i] = caster.model;
+	}
+
+	// Score dirty faces.  Faces outside the view stay dirty until they matter.
+	struct Candidate
+	{
+		int light;
+		int face;
+		float score;
+	};
+	std::vector<Candidate> candidates;
+	mPendingFaces = 0;
+
+	for (size_t i = 0; i < mLights.size(); i++)
+	{
+		Light& light = mLights[i];
+		for (int f = 0; f < NUM_FACES; f++)
+			light.scheduled[f] = false;
+
+		if (light.slot < 0)
+			continue;
+
+		for (int f = 0; f < NUM_FACES; f++)
+		{
+			if (!light.dirty[f])
+				continue;
+			mPendingFaces++;
+
+			// Sphere bounding the part of the light volume seen through this face
+			glm::vec3 center = light.position + FACE_AXES[f] * (light.radius * 0.5f);
+			float radius = light.radius * 0.85f;
+			if (!sphereInFrustum(viewProj, center, radius))
+				continue;
+
+			float d = glm::length(center - cameraPos);
+			float score = screenCoverage(cameraPos, projScale, center, radius) / (1.0f + d / light.radius);
+			score *= light.moved[f] ? MOVED_WEIGHT : 1.0f;
+			score *= 1.0f + AGE_WEIGHT * (float)(mFrame - light.dirtySince[f]);
+
+			Candidate candidate = { (int)i, f, score };
+			candidates.push_back(candidate);
+		}
+	}
+
+	size_t count = std::min(candidates.size(), (size_t)std::max(mFaceBudget, 0));
+	std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+					  [](const Candidate& a, const Candidate& b) { return a.score > b.score; });
+
+	for (size_t k = 0; k < count; k++)
+		mLights[candidates[k].light].scheduled[candidates[k].face] = true;
+}
+
+//-----------------------------------------------------------------------------
+// Renders the scheduled faces, one layered pass per light
+//-----------------------------------------------------------------------------
+void PointShadowAtlas::render(const std::vector<ShadowCaster>& casters)
+{
+	mFacesRendered = 0;
+	mDrawCount = 0;
+	mDrawnCasters.clear();
+	mCasterDrawn.assign(casters.size(), false);
+
+	// The caller's framebuffer and viewport are restored at the end
+	GLint framebuffer = 0;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glViewport(0, 0, mFaceResolution, mFaceResolution);
+
+	mDepthShader.use();
+
+	for (size_t i = 0; i < mLights.size(); i++)
+	{
+		Light& light = mLights[i];
+		if (light.slot < 0)
+			continue;
+
+		int faces[NUM_FACES];
+		int faceCount = 0;
+		for (int f = 0; f < NUM_FACES; f++)
+		{
+			if (light.scheduled[f])
+				faces[faceCount++] = f;
+		}
+		if (faceCount == 0)
+			continue;
+
+		// Clear only the faces we are about to redraw
+		glBindFramebuffer(GL_FRAMEBUFFER, mLayerFBO);
+		for (int k = 0; k < faceCount; k++)
+		{
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mDepth, 0, light.slot * NUM_FACES + faces[k]);
+			glClear(GL_DEPTH_BUFFER_BIT);
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, mLayeredFBO);
+		mDepthShader.setUniform("lightPos", light.position);
+		mDepthShader.setUniform("farPlane", light.radius);
+		mDepthShader.setUniform("faceCount", (GLint)faceCount);
+		for (int k = 0; k < faceCount; k++)
+		{
+			std::ostringstream index;
+			index << "[" << k << "]";
+			mDepthShader.setUniform(("faceViewProj" + index.str()).c_str(), faceViewProj(light, faces[k]));
+			mDepthShader.setUniform(("faceLayer" + index.str()).c_str(), (GLint)(light.slot * NUM_FACES + faces[k]));
+		}
+
+		for (size_t c = 0; c < casters.size(); c++)
+		{
+			const ShadowCaster& caster = casters[c];
+			if (caster.mesh == NULL || (int)c == light.owner)
+				continue;
+
+			glm::vec3 center;
+			float radius;
+			caster.getBoundingSphere(center, radius);
+
+			bool touchesFace = false;
+			for (int k = 0; k < faceCount && !touchesFace; k++)
+				touchesFace = faceIntersectsSphere(light, faces[k], center, radius);
+			if (!touchesFace)
+				continue;
+
+			if (!mCasterDrawn[c])
+			{
+				mCasterDrawn[c] = true;
+				mDrawnCasters.push_back((int)c);
+			}
+			if (!caster.mesh->isLoaded())
+				continue;
+
+			mDepthShader.setUniform("model", caster.model);
+			caster.mesh->drawPositions();
+			mDrawCount++;
+		}
+
+		for (int k = 0; k < faceCount; k++)
+		{
+			light.dirty[faces[k]] = false;
+			light.moved[faces[k]] = false;
+		}
+		mFacesRendered += faceCount;
+		mPendingFaces -= faceCount;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)framebuffer);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+//-----------------------------------------------------------------------------
+// Binds the face array to the given texture unit.
+// NOTE: Shader must be currently active first.
+//-----------------------------------------------------------------------------
+void PointShadowAtlas::bind(ShaderProgram& shader, GLuint texUnit)
+{
+	glActiveTexture(GL_TEXTURE0 + texUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mDepth);
+	shader.setUniform("pointShadowMap", (GLint)texUnit);
+}
+
+//-----------------------------------------------------------------------------
+// Unbinds the face array from the given texture unit
+//-----------------------------------------------------------------------------
+void PointShadowAtlas::unbind(GLuint texUnit)
+{
+	glActiveTexture(GL_TEXTURE0 + texUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
@@ -0,0 +1,338 @@
+//-----------------------------------------------------------------------------
+// Draw packets sorted by 64-bit keys
+//-----------------------------------------------------------------------------
+#include "RenderQueue.h"
+#include <algorithm>
+
+namespace
+{
+	// Field widths and positions (bits)
+	const int PASS_SHIFT = 62;
+	const int PROGRAM_BITS = 6;
+	const int TEXTURE_BITS = 12;
+	const int MATERIAL_BITS = 8;
+	const int MESH_BITS = 12;
+	const int DEPTH_BITS = 24;
+
+	// Opaque : state, then depth
+	const int OPAQUE_DEPTH_SHIFT = 0;
+	const int OPAQUE_MESH_SHIFT = OPAQUE_DEPTH_SHIFT + DEPTH_BITS;
+	const int OPAQUE_MATERIAL_SHIFT = OPAQUE_MESH_SHIFT + MESH_BITS;
+	const int OPAQUE_TEXTURE_SHIFT = OPAQUE_MATERIAL_SHIFT + MATERIAL_BITS;
+	const int OPAQUE_PROGRAM_SHIFT = OPAQUE_TEXTURE_SHIFT + TEXTURE_BITS;
+
+	// Transparent : depth, then state
+	const int TRANSPARENT_MESH_SHIFT = 0;
+	const int TRANSPARENT_MATERIAL_SHIFT = TRANSPARENT_MESH_SHIFT + MESH_BITS;
+	const int TRANSPARENT_TEXTURE_SHIFT = TRANSPARENT_MATERIAL_SHIFT + MATERIAL_BITS;
+	const int TRANSPARENT_PROGRAM_SHIFT = TRANSPARENT_TEXTURE_SHIFT + TEXTURE_BITS;
+	const int TRANSPARENT_DEPTH_SHIFT = TRANSPARENT_PROGRAM_SHIFT + PROGRAM_BITS;
+
+	static_assert(OPAQUE_PROGRAM_SHIFT + PROGRAM_BITS <= PASS_SHIFT, "opaque key fields overlap the pass");
+	static_assert(TRANSPARENT_DEPTH_SHIFT + DEPTH_BITS <= PASS_SHIFT, "transparent key fields overlap the pass");
+
+	const int RADIX_BITS = 8;
+	const int RADIX_PASSES = 64 / RADIX_BITS;
+	const int RADIX_BUCKETS = 1 << RADIX_BITS;
+
+	// Packets per block of a parallel sort, and fewer than this sort on one thread
+	const size_t SORT_BLOCK_SIZE = 8192;
+	const size_t PARALLEL_SORT_MIN = 2 * SORT_BLOCK_SIZE;
+
+	inline int digit(uint64_t key, int shift)
+	{
+		return (int)((key >> shift) & (RADIX_BUCKETS - 1));
+	}
+
+	inline uint64_t field(int value, int bits, int shift)
+	{
+		return (uint64_t)((unsigned)value & ((1u << bits) - 1)) << shift;
+	}
+
+	inline int getField(uint64_t key, int bits, int shift)
+	{
+		return (int)((key >> shift) & ((1u << bits) - 1));
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+RenderQueue::RenderQueue()
+	: mNear(0.1f),
+	  mFar(100.0f)
+{
+	mStats.draws = mStats.programChanges = mStats.textureChanges = mStats.materialChanges = mStats.meshChanges = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+RenderQueue::~RenderQueue()
+{
+}
+
+//-----------------------------------------------------------------------------
+// Empties the queue for a new frame (the memory is kept)
+//-----------------------------------------------------------------------------
+void RenderQueue::clear()
+{
+	mPackets.clear();
+}
+
+//-----------------------------------------------------------------------------
+// Queues a draw
+//-----------------------------------------------------------------------------
+void RenderQueue::add(Pass pass, int program, int texture, int material, int mesh, float depth, int object)
+{
+	mPackets.push_back(makePacket(pass, program, texture, material, mesh, depth, object));
+}
+
+//-----------------------------------------------------------------------------
+// Adds count packets at the end, for the caller to fill
+//-----------------------------------------------------------------------------
+RenderQueue::Packet* RenderQueue::append(size_t count)
+{
+	size_t first = mPackets.size();
+	mPackets.resize(first + count);
+	return mPackets.data() + first;
+}
+
+//-----------------------------------------------------------------------------
+// Packs a draw into a key.  Ids must be below the MAX_ constants; the depth
+// is quantized over the depth range.
+//-----------------------------------------------------------------------------
+RenderQueue::Packet RenderQueue::makePacket(Pass pass, int program, int texture, int material, int mesh, float depth, int object) const
+{
+	const uint32_t maxDepth = (1u << DEPTH_BITS) - 1;
+	float t = (depth - mNear) / (mFar - mNear);
+	uint32_t quantized = (uint32_t)(std::min(std::max(t, 0.0f), 1.0f) * (float)maxDepth);
+
+	Packet packet;
+	packet.object = object;
+	packet.key = (uint64_t)pass << PASS_SHIFT;
+	if (pass == PASS_OPAQUE)
+	{
+		packet.key |= field(program, PROGRAM_BITS, OPAQUE_PROGRAM_SHIFT) |
+					  field(texture, TEXTURE_BITS, OPAQUE_TEXTURE_SHIFT) |
+					  field(material, MATERIAL_BITS, OPAQUE_MATERIAL_SHIFT) |
+					  field(mesh, MESH_BITS, OPAQUE_MESH_SHIFT) |
+					  field((int)quantized, DEPTH_BITS, OPAQUE_DEPTH_SHIFT);
+	}
+	else
+	{
+		packet.key |= field((int)(maxDepth - quantized), DEPTH_BITS, TRANSPARENT_DEPTH_SHIFT) |
+					  field(program, PROGRAM_BITS, TRANSPARENT_PROGRAM_SHIFT) |
+					  field(texture, TEXTURE_BITS, TRANSPARENT_TEXTURE_SHIFT) |
+					  field(material, MATERIAL_BITS, TRANSPARENT_MATERIAL_SHIFT) |
+					  field(mesh, MESH_BITS, TRANSPARENT_MESH_SHIFT);
+	}
+	return packet;
+}
+
+//-----------------------------------------------------------------------------
+// LSD radix sort, 8 bits per pass.  The histograms of every digit are counted
+// in one sweep, and a digit that is the same in every key (the high bits of a
+// frame with one program, say) costs no pass.  Stable, so equal keys keep
+// their submission order.
+//-----------------------------------------------------------------------------
+void RenderQueue::sort(JobSystem* jobs)
+{
+	size_t count = mPackets.size();
+	if (count < 2)
+		return;
+
+	mScratch.resize(count);
+	if (jobs && jobs->getNumWorkers() > 0 && count >= PARALLEL_SORT_MIN)
+	{
+		sortBlocks(*jobs);
+		return;
+	}
+
+	std::vector<size_t> histograms(RADIX_PASSES * RADIX_BUCKETS, 0);
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t key = mPackets[i].key;
+		for (int pass = 0; pass < RADIX_PASSES; pass++)
+			histograms[pass * RADIX_BUCKETS + ((key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1))]++;
+	}
+
+	for (int pass = 0; pass < RADIX_PASSES; pass++)
+	{
+		size_t* histogram = &histograms[pass * RADIX_BUCKETS];
+		int shift = pass * RADIX_BITS;
+		if (histogram[(mPackets[0].key >> shift) & (RADIX_BUCKETS - 1)] == count)
+			continue;
+
+		// Counts to bucket starts
+		size_t offset = 0;
+		for (int b = 0; b < RADIX_BUCKETS; b++)
+		{
+			size_t n = histogram[b];
+			histogram[b] = offset;
+			offset += n;
+		}
+
+		for (size_t i = 0; i < count; i++)
+			mScratch[histogram[(mPackets[i].key >> shift) & (RADIX_BUCKETS - 1)]++] = mPackets[i];
+		mPackets.swap(mScratch);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// The same passes over blocks of packets in parallel : each block counts its
+// digits, and scatters its packets from where the same digits of the blocks
+// before it end, which keeps the sort stable.  The bits that differ from the
+// first key tell which passes to skip.
+//-----------------------------------------------------------------------------
+void RenderQueue::sortBlocks(JobSystem& jobs)
+{
+	size_t count = mPackets.size();
+	size_t numBlocks = (count + SORT_BLOCK_SIZE - 1) / SORT_BLOCK_SIZE;
+	std::vector<size_t> offsets(numBlocks * RADIX_BUCKETS);
+
+	std::vector<uint64_t> blockChanges(numBlocks, 0);
+	uint64_t firstKey = mPackets[0].key;
+	jobs.parallelFor(0, numBlocks, 1, [&](size_t first, size_t last)
+	{
+		for (size_t b = first; b < last; b++)
+		{
+			size_t end = std::min(count, (b + 1) * SORT_BLOCK_SIZE);
+			for (size_t i = b * SORT_BLOCK_SIZE; i < end; i++)
+				blockChanges[b] |= mPackets[i].key ^ firstKey;
+		}
+	});
+	uint64_t changes = 0;
+	for (size_t b = 0; b < numBlocks; b++)
+		changes |= blockChanges[b];
+
+	for (int pass = 0; pass < RADIX_PASSES; pass++)
+	{
+		int shift = pass * RADIX_BITS;
+		if (digit(changes, shift) == 0)
+			continue;
+
+		jobs.parallelFor(0, numBlocks, 1, [&](size_t first, size_t last)
+		{
+			for (size_t b = first; b < last; b++)
+			{
+				size_t* blockCounts = &offsets[b * RADIX_BUCKETS];
+				std::fill(blockCounts, blockCounts + RADIX_BUCKETS, 0);
+				size_t end = std::min(count, (b + 1) * SORT_BLOCK_SIZE);
+				for (size_t i = b * SORT_BLOCK_SIZE; i < end; i++)
+					blockCounts[digit(mPackets[i].key, shift)]++;
+			}
+		});
+
+		// Counts to starts, bucket by bucket, block by block
+		size_t offset = 0;
+		for (int d = 0; d < RADIX_BUCKETS; d++)
+		{
+			for (size_t b = 0; b < numBlocks; b++)
+			{
+				size_t n = offsets[b * RADIX_BUCKETS + d];
+				offsets[b * RADIX_BUCKETS + d] = offset;
+				offset += n;
+			}
+		}
+
+		jobs.parallelFor(0, numBlocks, 1, [&](size_t first, size_t last)
+		{
+			for (size_t b = first; b < last; b++)
+			{
+				size_t* blockOffsets = &offsets[b * RADIX_BUCKETS];
+				size_t end = std::min(count, (b + 1) * SORT_BLOCK_SIZE);
+				for (size_t i = b * SORT_BLOCK_SIZE; i < end; i++)
+					mScratch[blockOffsets[digit(mPackets[i].key, shift)]++] = mPackets[i];
+			}
+		});
+		mPackets.swap(mScratch);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// State changes between consecutive packets, then the draw.  A new program
+// sets the texture, material and mesh again (programs may not share them).
+//-----------------------------------------------------------------------------
+const RenderQueue::Stats& RenderQueue::submit(const Callbacks& callbacks)
+{
+	mStats.draws = mStats.programChanges = mStats.textureChanges = mStats.materialChanges = mStats.meshChanges = 0;
+
+	for (size_t i = 0; i < mPackets.size(); i++)
+	{
+		const Packet& packet = mPackets[i];
+		uint64_t previous = i > 0 ? mPackets[i - 1].key : 0;
+		bool first = i == 0;
+
+		bool program = first || getProgram(packet.key) != getProgram(previous);
+		if (program)
+		{
+			mStats.programChanges++;
+			if (callbacks.setProgram)
+				callbacks.setProgram(packet);
+		}
+		if (program || getTexture(packet.key) != getTexture(previous))
+		{
+			mStats.textureChanges++;
+			if (callbacks.setTexture)
+				callbacks.setTexture(packet);
+		}
+		if (program || getMaterial(packet.key) != getMaterial(previous))
+		{
+			mStats.materialChanges++;
+			if (callbacks.setMaterial)
+				callbacks.setMaterial(packet);
+		}
+		if (program || getMesh(packet.key) != getMesh(previous))
+		{
+			mStats.meshChanges++;
+			if (callbacks.setMesh)
+				callbacks.setMesh(packet);
+		}
+
+		mStats.draws++;
+		if (callbacks.draw)
+			callbacks.draw(packet);
+	}
+	return mStats;
+}
+
+//-----------------------------------------------------------------------------
+// Key fields
+//-----------------------------------------------------------------------------
+RenderQueue::Pass RenderQueue::getPass(uint64_t key)
+{
+	return (Pass)(key >> PASS_SHIFT);
+}
+
+//-----------------------------------------------------------------------------
+// Program id of a key
+//-----------------------------------------------------------------------------
+int RenderQueue::getProgram(uint64_t key)
+{
+	return getField(key, PROGRAM_BITS, getPass(key) == PASS_OPAQUE ? OPAQUE_PROGRAM_SHIFT : TRANSPARENT_PROGRAM_SHIFT);
+}
+
+//-----------------------------------------------------------------------------
+// Texture id of a key
+//-----------------------------------------------------------------------------
+int RenderQueue::getTexture(uint64_t key)
+{
+	return getField(key, TEXTURE_BITS, getPass(key) == PASS_OPAQUE ? OPAQUE_TEXTURE_SHIFT : TRANSPARENT_TEXTURE_SHIFT);
+}
+
+//-----------------------------------------------------------------------------
+// Material id of a key
+//-----------------------------------------------------------------------------
+int RenderQueue::getMaterial(uint64_t key)
+{
+	return getField(key, MATERIAL_BITS, getPass(key) == PASS_OPAQUE ? OPAQUE_MATERIAL_SHIFT : TRANSPARENT_MATERIAL_SHIFT);
+}
+
+//-----------------------------------------------------------------------------
+// Mesh id of a key
+//-----------------------------------------------------------------------------
+int RenderQueue::getMesh(uint64_t key)
+{
+	return getField(key, MESH_BITS, getPass(key) == PASS_OPAQUE ? OPAQUE_MESH_SHIFT : TRANSPARENT_MESH_SHIFT);
+}
@@ -0,0 +1,170 @@
+//-----------------------------------------------------------------------------
+// Video memory budget of meshes and textures
+//-----------------------------------------------------------------------------
+#include "ResourceBudget.h"
+#include <iostream>
+
+#define GLEW_STATIC
+#include "GL/glew.h"
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+ResourceBudget::ResourceBudget()
+	: mMemoryBudget(0),
+	  mExternalBytes(0),
+	  mCpuBytes(0),
+	  mGpuBytes(0),
+	  mDriverFreeBytes(0),
+	  mNumResident(0),
+	  mEvictions(0),
+	  mReloads(0),
+	  mFrame(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+ResourceBudget::~ResourceBudget()
+{
+}
+
+//-----------------------------------------------------------------------------
+// Tracks a resource, once
+//-----------------------------------------------------------------------------
+void ResourceBudget::add(GpuResource* resource, const std::string& name)
+{
+	if (resource == NULL || findEntry(resource) >= 0)
+		return;
+
+	Entry entry;
+	entry.resource = resource;
+	entry.name = name;
+	entry.lastUsed = -1;
+	mEntries.push_back(entry);
+}
+
+//-----------------------------------------------------------------------------
+// Stops tracking a resource, as it is
+//-----------------------------------------------------------------------------
+void ResourceBudget::remove(GpuResource* resource)
+{
+	int index = findEntry(resource);
+	if (index >= 0)
+		mEntries.erase(mEntries.begin() + index);
+}
+
+//-----------------------------------------------------------------------------
+// Stamps the resource with this frame, reloading it first if it was evicted
+//-----------------------------------------------------------------------------
+bool ResourceBudget::use(GpuResource* resource)
+{
+	int index = findEntry(resource);
+	if (index < 0)
+		return resource != NULL && resource->isResident();
+
+	Entry& entry = mEntries[index];
+	entry.lastUsed = mFrame;
+	if (entry.resource->isResident())
+		return true;
+	if (!entry.resource->canEvict())
+		return false;
+
+	mReloads++;
+	if (!entry.resource->reload())
+	{
+		std::cerr << "Error: cannot reload " << entry.name << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Totals, then least recently drawn first out until the budget holds
+//-----------------------------------------------------------------------------
+void ResourceBudget::update()
+{
+	mCpuBytes = 0;
+	mGpuBytes = mExternalBytes;
+	mNumResident = 0;
+	for (size_t i = 0; i < mEntries.size(); i++)
+	{
+		const GpuResource* resource = mEntries[i].resource;
+		mCpuBytes += resource->getCpuMemorySize();
+		mGpuBytes += resource->getGpuMemorySize();
+		if (resource->isResident())
+			mNumResident++;
+	}
+
+	if (mMemoryBudget > 0)
+	{
+		while (mGpuBytes > mMemoryBudget && evictLeastRecent())
+			;
+	}
+
+	mDriverFreeBytes = queryDriverFreeBytes();
+	mFrame++;
+}
+
+//-----------------------------------------------------------------------------
+// Evicts the resident resource drawn longest ago, if not this frame.  False
+// when there is none.
+//-----------------------------------------------------------------------------
+bool ResourceBudget::evictLeastRecent()
+{
+	int oldest = -1;
+	for (int i = 0; i < (int)mEntries.size(); i++)
+	{
+		const Entry& entry = mEntries[i];
+		if (entry.lastUsed == mFrame || !entry.resource->isResident() || !entry.resource->canEvict())
+			continue;
+		if (oldest < 0 || entry.lastUsed < mEntries[oldest].lastUsed)
+			oldest = i;
+	}
+	if (oldest < 0)
+		return false;
+
+	GpuResource* resource = mEntries[oldest].resource;
+	mCpuBytes -= resource->getCpuMemorySize();
+	mGpuBytes -= resource->getGpuMemorySize();
+	mNumResident--;
+	resource->evict();
+	mEvictions++;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Index of a resource in mEntries, -1 if it is not tracked
+//-----------------------------------------------------------------------------
+int ResourceBudget::findEntry(const GpuResource* resource) const
+{
+	for (int i = 0; i < (int)mEntries.size(); i++)
+	{
+		if (mEntries[i].resource == resource)
+			return i;
+	}
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Video memory still available according to the driver.  Both extensions
+// report kilobytes; ATI_meminfo gives the free total of the texture pool
+// first.
+//-----------------------------------------------------------------------------
+size_t ResourceBudget::queryDriverFreeBytes()
+{
+	if (GLEW_NVX_gpu_memory_info)
+	{
+		GLint freeKB = 0;
+		glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &freeKB);
+		return (size_t)freeKB * 1024;
+	}
+	if (GLEW_ATI_meminfo)
+	{
+		GLint info[4] = { 0, 0, 0, 0 };
+		glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, info);
+		return (size_t)info[0] * 1024;
+	}
+	return 0;
+}
@@ -0,0 +1,962 @@
+//-----------------------------------------------------------------------------
+// Scene description : assets, instances, materials and lights
+//-----------------------------------------------------------------------------
+#include "SceneFile.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+#include <unordered_set>
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	// Binary form
+	const unsigned SCENE_MAGIC = 0x424e4353;		// "SCNB"
+	const unsigned SCENE_VERSION = 1;
+	const size_t INSTANCE_RECORD_SIZE = 3 * 4 + 14 * 4;	// mesh, texture, material, 14 floats
+	const size_t LIGHT_RECORD_SIZE = 2 * 4 + 16 * 4;	// type, instance, 16 floats
+
+	// Bytes of text per parsing job, binary instance records per decoding job
+	const size_t TEXT_CHUNK_SIZE = 256 * 1024;
+	const size_t DECODE_GRAIN = 4096;
+
+	double msSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	// Little endian, like the other containers
+	unsigned readU32(const unsigned char* p)
+	{
+		return (unsigned)p[0] | ((unsigned)p[1] << 8) | ((unsigned)p[2] << 16) | ((unsigned)p[3] << 24);
+	}
+
+	float readF32(const unsigned char* p)
+	{
+		unsigned bits = readU32(p);
+		float value;
+		memcpy(&value, &bits, 4);
+		return value;
+	}
+
+	void writeU32(std::vector<unsigned char>& out, unsigned value)
+	{
+		out.push_back((unsigned char)value);
+		out.push_back((unsigned char)(value >> 8));
+		out.push_back((unsigned char)(value >> 16));
+		out.push_back((unsigned char)(value >> 24));
+	}
+
+	void writeF32(std::vector<unsigned char>& out, float value)
+	{
+		unsigned bits;
+		memcpy(&bits, &value, 4);
+		writeU32(out, bits);
+	}
+
+	void writeString(std::vector<unsigned char>& out, const std::string& value)
+	{
+		writeU32(out, (unsigned)value.size());
+		out.insert(out.end(), value.begin(), value.end());
+	}
+
+	void writeVec3(std::vector<unsigned char>& out, const glm::vec3& value)
+	{
+		writeF32(out, value.x);
+		writeF32(out, value.y);
+		writeF32(out, value.z);
+	}
+
+	// Bounds checked reads of the binary form
+	struct Reader
+	{
+		const unsigned char* pos;
+		const unsigned char* end;
+		bool ok;
+
+		bool has(size_t bytes)			{ ok = ok && (size_t)(end - pos) >= bytes; return ok; }
+		unsigned u32()					{ if (!has(4)) return 0; pos += 4; return readU32(pos - 4); }
+		float f32()						{ if (!has(4)) return 0.0f; pos += 4; return readF32(pos - 4); }
+		glm::vec3 vec3()				{ float x = f32(), y = f32(); return glm::vec3(x, y, f32()); }
+		std::string string()
+		{
+			unsigned size = u32();
+			if (!has(size))
+				return std::string();
+			pos += size;
+			return std::string((const char*)pos - size, size);
+		}
+	};
+
+	// Whitespace separated tokens of one line, up to a # comment.  The text
+	// ends with a NUL, so numbers can be read in place.
+	class Tokens
+	{
+	public:
+		Tokens(const char* begin, const char* end) : mPos(begin), mEnd(end) {}
+
+		bool next(std::string_view& token)
+		{
+			while (mPos < mEnd && (*mPos == ' ' || *mPos == '\t' || *mPos == '\r'))
+				mPos++;
+			if (mPos == mEnd || *mPos == '#')
+				return false;
+
+			const char* start = mPos;
+			while (mPos < mEnd && *mPos != ' ' && *mPos != '\t' && *mPos != '\r' && *mPos != '#')
+				mPos++;
+			token = std::string_view(start, mPos - start);
+			return true;
+		}
+
+		// The next token if it is a number, otherwise nothing is consumed
+		bool number(float& value)
+		{
+			const char* saved = mPos;
+			std::string_view token;
+			if (next(token))
+			{
+				char* numberEnd;
+				float parsed = strtof(token.data(), &numberEnd);
+				if (numberEnd == token.data() + token.size())
+				{
+					value = parsed;
+					return true;
+				}
+			}
+			mPos = saved;
+			return false;
+		}
+
+		bool vec3(glm::vec3& value)
+		{
+			return number(value.x) && number(value.y) && number(value.z);
+		}
+
+	private:
+		const char* mPos;
+		const char* mEnd;
+	};
+
+	// A name of the text form from base, a single token numbered when taken
+	std::string uniqueName(std::string base, std::unordered_set<std::string>& used)
+	{
+		std::replace_if(base.begin(), base.end(), [](char c) { return c == ' ' || c == '\t' || c == '#'; }, '_');
+		if (base.empty())
+			base = "unnamed";
+
+		std::string name = base;
+		for (int n = 1; !used.insert(name).second; n++)
+			name = base + std::to_string(n);
+		return name;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Statements of a range of lines, names left unresolved
+//-----------------------------------------------------------------------------
+struct SceneFile::TextChunk
+{
+	struct Asset		{ std::string_view name, file; int line; };
+	struct RawMaterial	{ Material material; int line; };
+	struct RawInstance	{ Instance instance; std::string_view mesh, texture, material, name; int line; };
+	struct RawLight		{ Light light; std::string_view follow; int line; };
+
+	const char* begin;
+	const char* end;
+	int firstLine;				// of the file, set once every chunk is parsed
+	int numLines;
+
+	std::vector<Asset> meshes, textures;
+	std::vector<RawMaterial> materials;
+	std::vector<RawInstance> instances;
+	std::vector<RawLight> lights;
+
+	std::string error;			// the first, with errorLine counted in the chunk
+	int errorLine;
+
+	void parse();
+	bool parseStatement(Tokens& tokens, std::string_view keyword, int line);
+	void fail(int line, const std::string& message);
+};
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+SceneFile::SceneFile()
+{
+	mTimings.readMs = 0.0;
+	mTimings.parseMs = 0.0;
+	mTimings.resolveMs = 0.0;
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+SceneFile::~SceneFile()
+{
+}
+
+//-----------------------------------------------------------------------------
+// Reads the whole file, then parses it in the form its first bytes tell
+//-----------------------------------------------------------------------------
+bool SceneFile::load(const std::string& fileName, JobSystem* jobs)
+{
+	clear();
+	mTimings.readMs = 0.0;
+	mTimings.parseMs = 0.0;
+	mTimings.resolveMs = 0.0;
+
+	Clock::time_point start = Clock::now();
+	std::ifstream fin(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+	if (!fin)
+	{
+		std::cerr << "Error opening scene '" << fileName << "'" << std::endl;
+		return false;
+	}
+	std::string contents((size_t)fin.tellg(), '\0');
+	fin.seekg(0);
+	if (!fin.read(&contents[0], (std::streamsize)contents.size()))
+	{
+		std::cerr << "Error reading scene '" << fileName << "'" << std::endl;
+		return false;
+	}
+	mTimings.readMs = msSince(start);
+
+	bool loaded;
+	if (contents.size() >= 4 && readU32((const unsigned char*)contents.data()) == SCENE_MAGIC)
+		loaded = parseBinary(contents, fileName, jobs);
+	else
+		loaded = parseText(contents, fileName, jobs);
+
+	if (!loaded)
+		clear();
+	return loaded;
+}
+
+//-----------------------------------------------------------------------------
+// Chunks of whole lines parsed on the jobs, then their names resolved in file
+// order: assets, materials, then instances (in parallel), then lights
+//-----------------------------------------------------------------------------
+bool SceneFile::parseText(const std::string& text, const std::string& fileName, JobSystem* jobs)
+{
+	Clock::time_point start = Clock::now();
+
+	std::vector<TextChunk> chunks;
+	const char* data = text.c_str();
+	const char* textEnd = data + text.size();
+	for (const char* chunkBegin = data; chunkBegin < textEnd; )
+	{
+		const char* chunkEnd = chunkBegin + std::min(TEXT_CHUNK_SIZE, (size_t)(textEnd - chunkBegin));
+		while (chunkEnd < textEnd && chunkEnd[-1] != '\n')
+			chunkEnd++;
+
+		TextChunk chunk;
+		chunk.begin = chunkBegin;
+		chunk.end = chunkEnd;
+		chunks.push_back(chunk);
+		chunkBegin = chunkEnd;
+	}
+
+	std::function<void(size_t, size_t)> parseChunks = [&chunks](size_t first, size_t last)
+	{
+		for (size_t c = first; c < last; c++)
+			chunks[c].parse();
+	};
+	if (jobs)
+		jobs->parallelFor(0, chunks.size(), 1, parseChunks);
+	else
+		parseChunks(0, chunks.size());
+
+	int line = 1;
+	for (size_t c = 0; c < chunks.size(); c++)
+	{
+		chunks[c].firstLine = line;
+		line += chunks[c].numLines;
+		if (!chunks[c].error.empty())
+		{
+			std::cerr << "Error in scene '" << fileName << "' line " << chunks[c].firstLine + chunks[c].errorLine
+					  << ": " << chunks[c].error << std::endl;
+			return false;
+		}
+	}
+	mTimings.parseMs = msSince(start);
+
+	// Names, which may be used before they are declared
+	start = Clock::now();
+	std::unordered_map<std::string_view, int> meshNames, textureNames, materialNames, instanceNames;
+	std::string error;
+	int errorLine = 0;
+	for (size_t c = 0; c < chunks.size() && error.empty(); c++)
+	{
+		const TextChunk& chunk = chunks[c];
+		for (size_t i = 0; i < chunk.meshes.size(); i++)
+		{
+			if (!meshNames.emplace(chunk.meshes[i].name, addMesh(std::string(chunk.meshes[i].file))).second && error.empty())
+			{
+				error = "mesh '" + std::string(chunk.meshes[i].name) + "' declared twice";
+				errorLine = chunk.firstLine + chunk.meshes[i].line;
+			}
+		}
+		for (size_t i = 0; i < chunk.textures.size(); i++)
+		{
+			if (!textureNames.emplace(chunk.textures[i].name, addTexture(std::string(chunk.textures[i].file))).second && error.empty())
+			{
+				error = "texture '" + std::string(chunk.textures[i].name) + "' declared twice";
+				errorLine = chunk.firstLine + chunk.textures[i].line;
+			}
+		}
+		for (size_t i = 0; i < chunk.materials.size(); i++)
+		{
+			const Material& material = chunk.materials[i].material;	// the chunk's name outlives the map
+			if (!materialNames.emplace(material.name, addMaterial(material)).second && error.empty())
+			{
+				error = "material '" + material.name + "' declared twice";
+				errorLine = chunk.firstLine + chunk.materials[i].line;
+			}
+		}
+	}
+
+	// Instances : each chunk's at its offset, names looked up concurrently
+	std::vector<size_t> offsets(chunks.size());
+	size_t numInstances = 0;
+	for (size_t c = 0; c < chunks.size(); c++)
+	{
+		offsets[c] = numInstances;
+		numInstances += chunks[c].instances.size();
+	}
+	mInstances.resize(numInstances);
+
+	std::function<void(size_t, size_t)> resolveChunks = [&](size_t first, size_t last)
+	{
+		for (size_t c = first; c < last; c++)
+		{
+			TextChunk& chunk = chunks[c];
+			for (size_t i = 0; i < chunk.instances.size(); i++)
+			{
+				const TextChunk::RawInstance& raw = chunk.instances[i];
+				Instance& instance = mInstances[offsets[c] + i];
+				instance = raw.instance;
+
+				std::unordered_map<std::string_view, int>::const_iterator found;
+				if ((found = meshNames.find(raw.mesh)) != meshNames.end())
+					instance.mesh = found->second;
+				else
+					chunk.fail(raw.line, "unknown mesh '" + std::string(raw.mesh) + "'");
+
+				if (raw.texture == "-")
+					instance.texture = -1;
+				else if ((found = textureNames.find(raw.texture)) != textureNames.end())
+					instance.texture = found->second;
+				else
+					chunk.fail(raw.line, "unknown texture '" + std::string(raw.texture) + "'");
+
+				if ((found = materialNames.find(raw.material)) != materialNames.end())
+					instance.material = found->second;
+				else
+					chunk.fail(raw.line, "unknown material '" + std::string(raw.material) + "'");
+			}
+		}
+	};
+	if (error.empty())
+	{
+		if (jobs)
+			jobs->parallelFor(0, chunks.size(), 1, resolveChunks);
+		else
+			resolveChunks(0, chunks.size());
+	}
+
+	for (size_t c = 0; c < chunks.size() && error.empty(); c++)
+	{
+		const TextChunk& chunk = chunks[c];
+		if (!chunk.error.empty())
+		{
+			error = chunk.error;
+			errorLine = chunk.firstLine + chunk.errorLine;
+		}
+		for (size_t i = 0; i < chunk.instances.size() && error.empty(); i++)
+		{
+			const TextChunk::RawInstance& raw = chunk.instances[i];
+			if (!raw.name.empty() && !instanceNames.emplace(raw.name, (int)(offsets[c] + i)).second)
+			{
+				error = "instance '" + std::string(raw.name) + "' named twice";
+				errorLine = chunk.firstLine + raw.line;
+			}
+		}
+	}
+
+	for (size_t c = 0; c < chunks.size() && error.empty(); c++)
+	{
+		const TextChunk& chunk = chunks[c];
+		for (size_t i = 0; i < chunk.lights.size() && error.empty(); i++)
+		{
+			Light light = chunk.lights[i].light;
+			if (!chunk.lights[i].follow.empty())
+			{
+				std::unordered_map<std::string_view, int>::const_iterator found = instanceNames.find(chunk.lights[i].follow);
+				if (found == instanceNames.end())
+				{
+					error = "unknown instance '" + std::string(chunk.lights[i].follow) + "'";
+					errorLine = chunk.firstLine + chunk.lights[i].line;
+					break;
+				}
+				light.instance = found->second;
+			}
+			addLight(light);
+		}
+	}
+	mTimings.resolveMs = msSince(start);
+
+	if (!error.empty())
+	{
+		std::cerr << "Error in scene '" << fileName << "' line " << errorLine << ": " << error << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Header and variable size tables in order, then the fixed size instance
+// records decoded on the jobs
+//-----------------------------------------------------------------------------
+bool SceneFile::parseBinary(const std::string& bytes, const std::string& fileName, JobSystem* jobs)
+{
+	Clock::time_point start = Clock::now();
+
+	Reader reader;
+	reader.pos = (const unsigned char*)bytes.data();
+	reader.end = reader.pos + bytes.size();
+	reader.ok = true;
+
+	reader.u32();	// magic
+	unsigned version = reader.u32();
+	if (version != SCENE_VERSION)
+	{
+		std::cerr << "Error: scene '" << fileName << "' is version " << version << ", expected " << SCENE_VERSION << std::endl;
+		return false;
+	}
+
+	unsigned numMeshes = reader.u32();
+	unsigned numTextures = reader.u32();
+	unsigned numMaterials = reader.u32();
+	unsigned numInstances = reader.u32();
+	unsigned numLights = reader.u32();
+
+	for (unsigned i = 0; i < numMeshes && reader.ok; i++)
+	{
+		mMeshes.push_back(reader.string());
+		mMeshIndex.emplace(mMeshes.back(), (int)i);
+	}
+	for (unsigned i = 0; i < numTextures && reader.ok; i++)
+	{
+		mTextures.push_back(reader.string());
+		mTextureIndex.emplace(mTextures.back(), (int)i);
+	}
+	for (unsigned i = 0; i < numMaterials && reader.ok; i++)
+	{
+		Material material;
+		material.name = reader.string();
+		material.ambient = reader.vec3();
+		material.specular = reader.vec3();
+		material.shininess = reader.f32();
+		mMaterials.push_back(material);
+	}
+
+	const unsigned char* records = reader.pos;
+	if (!reader.has((size_t)numInstances * INSTANCE_RECORD_SIZE) || !reader.has((size_t)numInstances * INSTANCE_RECORD_SIZE + (size_t)numLights * LIGHT_RECORD_SIZE))
+	{
+		std::cerr << "Error: scene '" << fileName << "' is truncated" << std::endl;
+		return false;
+	}
+	reader.pos += (size_t)numInstances * INSTANCE_RECORD_SIZE;
+
+	mInstances.resize(numInstances);
+	std::atomic<bool> valid(true);
+	std::function<void(size_t, size_t)> decode = [&](size_t first, size_t last)
+	{
+		for (size_t i = first; i < last; i++)
+		{
+			const unsigned char* p = records + i * INSTANCE_RECORD_SIZE;
+			Instance& instance = mInstances[i];
+			instance.mesh = (int)readU32(p);
+			instance.texture = (int)readU32(p + 4);
+			instance.material = (int)readU32(p + 8);
+			instance.position = glm::vec3(readF32(p + 12), readF32(p + 16), readF32(p + 20));
+			instance.rotation = glm::quat(readF32(p + 36), readF32(p + 24), readF32(p + 28), readF32(p + 32));
+			instance.scale = glm::vec3(readF32(p + 40), readF32(p + 44), readF32(p + 48));
+			instance.spinAxis = glm::vec3(readF32(p + 52), readF32(p + 56), readF32(p + 60));
+			instance.spinSpeed = readF32(p + 64);
+
+			if (instance.mesh < 0 || instance.mesh >= (int)numMeshes || instance.texture < -1 || instance.texture >= (int)numTextures ||
+				instance.material < 0 || instance.material >= (int)numMaterials)
+				valid = false;
+		}
+	};
+	if (jobs)
+		jobs->parallelFor(0, numInstances, DECODE_GRAIN, decode);
+	else
+		decode(0, numInstances);
+
+	for (unsigned i = 0; i < numLights; i++)
+	{
+		Light light;
+		light.type = reader.u32() == LIGHT_POINT ? LIGHT_POINT : LIGHT_SUN;
+		light.instance = (int)reader.u32();
+		light.position = reader.vec3();
+		light.direction = reader.vec3();
+		light.radius = reader.f32();
+		light.ambient = reader.vec3();
+		light.diffuse = reader.vec3();
+		light.specular = reader.vec3();
+		if (light.instance < -1 || light.instance >= (int)numInstances)
+			valid = false;
+		mLights.push_back(light);
+	}
+	mTimings.parseMs = msSince(start);
+
+	if (!reader.ok || !valid)
+	{
+		std::cerr << "Error: scene '" << fileName << "' is corrupt" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Names from the file names (instances only when a light follows them);
+// numbers keep 7 significant digits
+//-----------------------------------------------------------------------------
+bool SceneFile::saveText(const std::string& fileName) const
+{
+	std::ofstream fout(fileName);
+	if (!fout)
+	{
+		std::cerr << "Error creating '" << fileName << "'" << std::endl;
+		return false;
+	}
+
+	std::unordered_set<std::string> usedMeshNames, usedTextureNames, usedMaterialNames;
+	std::vector<std::string> meshNames, textureNames, materialNames;
+	for (size_t i = 0; i < mMeshes.size(); i++)
+	{
+		meshNames.push_back(uniqueName(std::filesystem::path(mMeshes[i]).stem().string(), usedMeshNames));
+		fout << "mesh " << meshNames[i] << " " << mMeshes[i] << "\n";
+	}
+	for (size_t i = 0; i < mTextures.size(); i++)
+	{
+		textureNames.push_back(uniqueName(std::filesystem::path(mTextures[i]).stem().string(), usedTextureNames));
+		fout << "texture " << textureNames[i] << " " << mTextures[i] << "\n";
+	}
+
+	char line[512];
+	for (size_t i = 0; i < mMaterials.size(); i++)
+	{
+		const Material& m = mMaterials[i];
+		materialNames.push_back(uniqueName(m.name, usedMaterialNames));
+		snprintf(line, sizeof(line), "material %s ambient %.7g %.7g %.7g specular %.7g %.7g %.7g shininess %.7g\n",
+				 materialNames[i].c_str(), m.ambient.x, m.ambient.y, m.ambient.z, m.specular.x, m.specular.y, m.specular.z, m.shininess);
+		fout << line;
+	}
+
+	std::vector<bool> followed(mInstances.size(), false);
+	for (size_t i = 0; i < mLights.size(); i++)
+	{
+		if (mLights[i].instance >= 0)
+			followed[mLights[i].instance] = true;
+	}
+
+	for (size_t i = 0; i < mInstances.size(); i++)
+	{
+		const Instance& instance = mInstances[i];
+		fout << "instance " << meshNames[instance.mesh] << " " << (instance.texture < 0 ? "-" : textureNames[instance.texture])
+			 << " " << materialNames[instance.material];
+		if (followed[i])
+			fout << " name instance" << i;
+
+		snprintf(line, sizeof(line), " position %.7g %.7g %.7g", instance.position.x, instance.position.y, instance.position.z);
+		fout << line;
+		if (instance.scale != glm::vec3(1.0f))
+		{
+			if (instance.scale.x == instance.scale.y && instance.scale.x == instance.scale.z)
+				snprintf(line, sizeof(line), " scale %.7g", instance.scale.x);
+			else
+				snprintf(line, sizeof(line), " scale %.7g %.7g %.7g", instance.scale.x, instance.scale.y, instance.scale.z);
+			fout << line;
+		}
+		if (fabsf(instance.rotation.w) < 1.0f)
+		{
+			float angle = 2.0f * acosf(glm::clamp(instance.rotation.w, -1.0f, 1.0f));
+			glm::vec3 axis = glm::normalize(glm::vec3(instance.rotation.x, instance.rotation.y, instance.rotation.z));
+			snprintf(line, sizeof(line), " rotate %.7g %.7g %.7g %.7g", axis.x, axis.y, axis.z, glm::degrees(angle));
+			fout << line;
+		}
+		if (instance.spinSpeed != 0.0f)
+		{
+			snprintf(line, sizeof(line), " spin %.7g %.7g %.7g %.7g", instance.spinAxis.x, instance.spinAxis.y, instance.spinAxis.z, instance.spinSpeed);
+			fout << line;
+		}
+		fout << "\n";
+	}
+
+	for (size_t i = 0; i < mLights.size(); i++)
+	{
+		const Light& light = mLights[i];
+		if (light.type == LIGHT_SUN)
+			snprintf(line, sizeof(line), "light sun direction %.7g %.7g %.7g", light.direction.x, light.direction.y, light.direction.z);
+		else
+			snprintf(line, sizeof(line), "light point position %.7g %.7g %.7g radius %.7g", light.position.x, light.position.y, light.position.z, light.radius);
+		fout << line;
+		if (light.instance >= 0)
+			fout << " follow instance" << light.instance;
+		snprintf(line, sizeof(line), " ambient %.7g %.7g %.7g diffuse %.7g %.7g %.7g specular %.7g %.7g %.7g\n",
+				 light.ambient.x, light.ambient.y, light.ambient.z, light.diffuse.x, light.diffuse.y, light.diffuse.z,
+				 light.specular.x, light.specular.y, light.specular.z);
+		fout << line;
+	}
+	return (bool)fout;
+}
+
+//-----------------------------------------------------------------------------
+// Magic, version, the five counts, then the tables in order
+//-----------------------------------------------------------------------------
+bool SceneFile::saveBinary(const std::string& fileName) const
+{
+	std::vector<unsigned char> out;
+	out.reserve(64 + mInstances.size() * INSTANCE_RECORD_SIZE + mLights.size() * LIGHT_RECORD_SIZE);
+	writeU32(out, SCENE_MAGIC);
+	writeU32(out, SCENE_VERSION);
+	writeU32(out, (unsigned)mMeshes.size());
+	writeU32(out, (unsigned)mTextures.size());
+	writeU32(out, (unsigned)mMaterials.size());
+	writeU32(out, (unsigned)mInstances.size());
+	writeU32(out, (unsigned)mLights.size());
+
+	for (size_t i = 0; i < mMeshes.size(); i++)
+		writeString(out, mMeshes[i]);
+	for (size_t i = 0; i < mTextures.size(); i++)
+		writeString(out, mTextures[i]);
+	for (size_t i = 0; i < mMaterials.size(); i++)
+	{
+		writeString(out, mMaterials[i].name);
+		writeVec3(out, mMaterials[i].ambient);
+		writeVec3(out, mMaterials[i].specular);
+		writeF32(out, mMaterials[i].shininess);
+	}
+
+	for (size_t i = 0; i < mInstances.size(); i++)
+	{
+		const Instance& instance = mInstances[i];
+		writeU32(out, (unsigned)instance.mesh);
+		writeU32(out, (unsigned)instance.texture);
+		writeU32(out, (unsigned)instance.material);
+		writeVec3(out, instance.position);
+		writeF32(out, instance.rotation.x);
+		writeF32(out, instance.rotation.y);
+		writeF32(out, instance.rotation.z);
+		writeF32(out, instance.rotation.w);
+		writeVec3(out, instance.scale);
+		writeVec3(out, instance.spinAxis);
+		writeF32(out, instance.spinSpeed);
+	}
+
+	for (size_t i = 0; i < mLights.size(); i++)
+	{
+		const Light& light = mLights[i];
+		writeU32(out, (unsigned)light.type);
+		writeU32(out, (unsigned)light.instance);
+		writeVec3(out, light.position);
+		writeVec3(out, light.direction);
+		writeF32(out, light.radius);
+		writeVec3(out, light.ambient);
+		writeVec3(out, light.diffuse);
+		writeVec3(out, light.specular);
+	}
+
+	std::ofstream fout(fileName, std::ios::out | std::ios::binary);
+	if (!fout)
+	{
+		std::cerr << "Error creating '" << fileName << "'" << std::endl;
+		return false;
+	}
+	fout.write((const char*)&out[0], (std::streamsize)out.size());
+	return (bool)fout;
+}
+
+//-----------------------------------------------------------------------------
+// Empties the scene
+//-----------------------------------------------------------------------------
+void SceneFile::clear()
+{
+	mMeshes.clear();
+	mTextures.clear();
+	mMaterials.clear();
+	mInstances.clear();
+	mLights.clear();
+	mMeshIndex.clear();
+	mTextureIndex.clear();
+}
+
+//-----------------------------------------------------------------------------
+// Adds a mesh file, once
+//-----------------------------------------------------------------------------
+int SceneFile::addMesh(const std::string& fileName)
+{
+	std::pair<std::unordered_map<std::string, int>::iterator, bool> added = mMeshIndex.emplace(fileName, (int)mMeshes.size());
+	if (added.second)
+		mMeshes.push_back(fileName);
+	return added.first->second;
+}
+
+//-----------------------------------------------------------------------------
+// Adds a texture file, once
+//-----------------------------------------------------------------------------
+int SceneFile::addTexture(const std::string& fileName)
+{
+	std::pair<std::unordered_map<std::string, int>::iterator, bool> added = mTextureIndex.emplace(fileName, (int)mTextures.size());
+	if (added.second)
+		mTextures.push_back(fileName);
+	return added.first->second;
+}
+
+//-----------------------------------------------------------------------------
+// Adds a material
+//-----------------------------------------------------------------------------
+int SceneFile::addMaterial(const Material& material)
+{
+	mMaterials.push_back(material);
+	return (int)mMaterials.size() - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Adds an instance
+//-----------------------------------------------------------------------------
+int SceneFile::addInstance(const Instance& instance)
+{
+	mInstances.push_back(instance);
+	return (int)mInstances.size() - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Adds a light
+//-----------------------------------------------------------------------------
+int SceneFile::addLight(const Light& light)
+{
+	mLights.push_back(light);
+	return (int)mLights.size() - 1;
+}
+
+//-----------------------------------------------------------------------------
+// A white material, the defaults of the text form
+//-----------------------------------------------------------------------------
+SceneFile::Material SceneFile::makeMaterial(const std::string& name)
+{
+	Material material;
+	material.name = name;
+	material.ambient = glm::vec3(1.0f);
+	material.specular = glm::vec3(0.6f);
+	material.shininess = 32.0f;
+	return material;
+}
+
+//-----------------------------------------------------------------------------
+// An instance at the origin, unrotated and unscaled
+//-----------------------------------------------------------------------------
+SceneFile::Instance SceneFile::makeInstance(int mesh, int texture, int material)
+{
+	Instance instance;
+	instance.mesh = mesh;
+	instance.texture = texture;
+	instance.material = material;
+	instance.position = glm::vec3(0.0f);
+	instance.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	instance.scale = glm::vec3(1.0f);
+	instance.spinAxis = glm::vec3(0.0f, 1.0f, 0.0f);
+	instance.spinSpeed = 0.0f;
+	return instance;
+}
+
+//-----------------------------------------------------------------------------
+// A white light : a sun straight down, or a point light at the origin
+//-----------------------------------------------------------------------------
+SceneFile::Light SceneFile::makeLight(LightType type)
+{
+	Light light;
+	light.type = type;
+	light.position = glm::vec3(0.0f);
+	light.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+	light.radius = 20.0f;
+	light.instance = -1;
+	light.ambient = glm::vec3(0.0f);
+	light.diffuse = glm::vec3(1.0f);
+	light.specular = glm::vec3(1.0f);
+	return light;
+}
+
+//-----------------------------------------------------------------------------
+// Line by line.  Stops at the first error.
+//-----------------------------------------------------------------------------
+void SceneFile::TextChunk::parse()
+{
+	numLines = 0;
+	errorLine = 0;
+	for (const char* lineBegin = begin; lineBegin < end && error.empty(); )
+	{
+		const char* lineEnd = (const char*)memchr(lineBegin, '\n', end - lineBegin);
+		if (lineEnd == NULL)
+			lineEnd = end;
+
+		Tokens tokens(lineBegin, lineEnd);
+		std::string_view keyword;
+		if (tokens.next(keyword) && !parseStatement(tokens, keyword, numLines) && error.empty())
+			fail(numLines, "cannot parse '" + std::string(keyword) + "' statement");
+
+		numLines++;
+		lineBegin = lineEnd + 1;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// One statement, after its keyword.  False on a syntax error.
+//-----------------------------------------------------------------------------
+bool SceneFile::TextChunk::parseStatement(Tokens& tokens, std::string_view keyword, int line)
+{
+	std::string_view token;
+	if (keyword == "mesh" || keyword == "texture")
+	{
+		Asset asset;
+		asset.line = line;
+		if (!tokens.next(asset.name) || !tokens.next(asset.file) || tokens.next(token))
+			return false;
+		(keyword == "mesh" ? meshes : textures).push_back(asset);
+		return true;
+	}
+
+	if (keyword == "material")
+	{
+		std::string_view name;
+		if (!tokens.next(name))
+			return false;
+
+		RawMaterial raw;
+		raw.material = makeMaterial(std::string(name));
+		raw.line = line;
+		while (tokens.next(token))
+		{
+			bool ok = false;
+			if (token == "ambient")
+				ok = tokens.vec3(raw.material.ambient);
+			else if (token == "specular")
+				ok = tokens.vec3(raw.material.specular);
+			else if (token == "shininess")
+				ok = tokens.number(raw.material.shininess);
+			if (!ok)
+				return false;
+		}
+		materials.push_back(raw);
+		return true;
+	}
+
+	if (keyword == "instance")
+	{
+		RawInstance raw;
+		raw.instance = makeInstance(-1, -1, -1);
+		raw.line = line;
+		if (!tokens.next(raw.mesh) || !tokens.next(raw.texture) || !tokens.next(raw.material))
+			return false;
+
+		Instance& instance = raw.instance;
+		while (tokens.next(token))
+		{
+			bool ok = false;
+			glm::vec3 axis;
+			float angle;
+			if (token == "name")
+			{
+				ok = tokens.next(raw.name);
+			}
+			else if (token == "position")
+			{
+				ok = tokens.vec3(instance.position);
+			}
+			else if (token == "scale")
+			{
+				ok = tokens.number(instance.scale.x);
+				instance.scale.y = instance.scale.z = instance.scale.x;
+				if (ok && tokens.number(instance.scale.y))
+					ok = tokens.number(instance.scale.z);
+			}
+			else if (token == "rotate")
+			{
+				ok = tokens.vec3(axis) && tokens.number(angle) && glm::length(axis) > 0.0f;
+				if (ok)
+					instance.rotation = glm::angleAxis(glm::radians(angle), glm::normalize(axis)) * instance.rotation;
+			}
+			else if (token == "spin")
+			{
+				ok = tokens.vec3(axis) && tokens.number(instance.spinSpeed) && glm::length(axis) > 0.0f;
+				if (ok)
+					instance.spinAxis = glm::normalize(axis);
+			}
+			if (!ok)
+				return false;
+		}
+		instances.push_back(raw);
+		return true;
+	}
+
+	if (keyword == "light")
+	{
+		if (!tokens.next(token) || (token != "sun" && token != "point"))
+			return false;
+
+		RawLight raw;
+		raw.light = makeLight(token == "sun" ? LIGHT_SUN : LIGHT_POINT);
+		raw.line = line;
+		while (tokens.next(token))
+		{
+			bool ok = false;
+			if (token == "direction")
+				ok = tokens.vec3(raw.light.direction);
+			else if (token == "position")
+				ok = tokens.vec3(raw.light.position);
+			else if (token == "radius")
+				ok = tokens.number(raw.light.radius);
+			else if (token == "follow")
+				ok = tokens.next(raw.follow);
+			else if (token == "ambient")
+				ok = tokens.vec3(raw.light.ambient);
+			else if (token == "diffuse")
+				ok = tokens.vec3(raw.light.diffuse);
+			else if (token == "specular")
+				ok = tokens.vec3(raw.light.specular);
+			if (!ok)
+				return false;
+		}
+		lights.push_back(raw);
+		return true;
+	}
+
+	fail(line, "unknown statement '" + std::string(keyword) + "'");
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Keeps the first error
+//-----------------------------------------------------------------------------
+void SceneFile::TextChunk::fail(int line, const std::string& message)
+{
+	if (error.empty())
+	{
+		error = message;
+		errorLine = line;
+	}
+}
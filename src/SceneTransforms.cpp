@@ -0,0 +1,357 @@
+//-----------------------------------------------------------------------------
+// Transforms of the scene objects, stored as structure of arrays
+//-----------------------------------------------------------------------------
+#include "SceneTransforms.h"
+#include <atomic>
+#include <bitset>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCENE_TRANSFORMS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	bool gSimdEnabled = true;
+
+	// Dirty words per job of a parallel update (2048 objects)
+	const size_t PARALLEL_WORDS = 64;
+
+#ifdef SCENE_TRANSFORMS_SSE2
+	// x, y, z of a register (a column of a mat3)
+	inline void store3(float* dest, __m128 v)
+	{
+		_mm_storel_pi((__m64*)dest, v);
+		_mm_store_ss(dest + 2, _mm_movehl_ps(v, v));
+	}
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+SceneTransforms::SceneTransforms()
+	: mCount(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+SceneTransforms::~SceneTransforms()
+{
+}
+
+//-----------------------------------------------------------------------------
+// Room for count objects without reallocating
+//-----------------------------------------------------------------------------
+void SceneTransforms::reserve(size_t count)
+{
+	size_t padded = (count + 3) & ~(size_t)3;
+	for (int c = 0; c < 3; c++)
+	{
+		mPosition[c].reserve(padded);
+		mScale[c].reserve(padded);
+	}
+	for (int c = 0; c < 4; c++)
+		mRotation[c].reserve(padded);
+	mWorld.reserve(padded);
+	mNormal.reserve(padded);
+	mDirty.reserve((padded + 31) / 32);
+}
+
+//-----------------------------------------------------------------------------
+// New object, its matrices are built by the next update()
+//-----------------------------------------------------------------------------
+SceneTransforms::Entity SceneTransforms::add(const glm::vec3& position, const glm::vec3& scale, const glm::quat& rotation)
+{
+	// Four identity transforms at a time, so that update() never reads past the end
+	if (mCount == mWorld.size())
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			mPosition[c].resize(mCount + 4, 0.0f);
+			mScale[c].resize(mCount + 4, 1.0f);
+		}
+		for (int c = 0; c < 4; c++)
+			mRotation[c].resize(mCount + 4, c == 3 ? 1.0f : 0.0f);
+		mWorld.resize(mCount + 4, glm::mat4(1.0f));
+		mNormal.resize(mCount + 4, glm::mat3(1.0f));
+		mDirty.resize((mCount + 4 + 31) / 32, 0);
+	}
+
+	Entity entity = (Entity)mCount++;
+	setTransform(entity, position, rotation, scale);
+	return entity;
+}
+
+//-----------------------------------------------------------------------------
+// Removes every object
+//-----------------------------------------------------------------------------
+void SceneTransforms::clear()
+{
+	mCount = 0;
+	for (int c = 0; c < 3; c++)
+	{
+		mPosition[c].clear();
+		mScale[c].clear();
+	}
+	for (int c = 0; c < 4; c++)
+		mRotation[c].clear();
+	mWorld.clear();
+	mNormal.clear();
+	mDirty.clear();
+}
+
+//-----------------------------------------------------------------------------
+// Setters store the component and flag the object for update()
+//-----------------------------------------------------------------------------
+void SceneTransforms::setPosition(Entity entity, const glm::vec3& position)
+{
+	for (int c = 0; c < 3; c++)
+		mPosition[c][entity] = position[c];
+	markDirty(entity);
+}
+
+//-----------------------------------------------------------------------------
+// Unit quaternion
+//-----------------------------------------------------------------------------
+void SceneTransforms::setRotation(Entity entity, const glm::quat& rotation)
+{
+	mRotation[0][entity] = rotation.x;
+	mRotation[1][entity] = rotation.y;
+	mRotation[2][entity] = rotation.z;
+	mRotation[3][entity] = rotation.w;
+	markDirty(entity);
+}
+
+//-----------------------------------------------------------------------------
+// Per axis, none may be zero (the normal matrix divides by it)
+//-----------------------------------------------------------------------------
+void SceneTransforms::setScale(Entity entity, const glm::vec3& scale)
+{
+	for (int c = 0; c < 3; c++)
+		mScale[c][entity] = scale[c];
+	markDirty(entity);
+}
+
+//-----------------------------------------------------------------------------
+// All three at once
+//-----------------------------------------------------------------------------
+void SceneTransforms::setTransform(Entity entity, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+	setPosition(entity, position);
+	setRotation(entity, rotation);
+	setScale(entity, scale);
+}
+
+//-----------------------------------------------------------------------------
+// Position in world space
+//-----------------------------------------------------------------------------
+glm::vec3 SceneTransforms::getPosition(Entity entity) const
+{
+	return glm::vec3(mPosition[0][entity], mPosition[1][entity], mPosition[2][entity]);
+}
+
+//-----------------------------------------------------------------------------
+// Unit quaternion
+//-----------------------------------------------------------------------------
+glm::quat SceneTransforms::getRotation(Entity entity) const
+{
+	return glm::quat(mRotation[3][entity], mRotation[0][entity], mRotation[1][entity], mRotation[2][entity]);
+}
+
+//-----------------------------------------------------------------------------
+// Per axis
+//-----------------------------------------------------------------------------
+glm::vec3 SceneTransforms::getScale(Entity entity) const
+{
+	return glm::vec3(mScale[0][entity], mScale[1][entity], mScale[2][entity]);
+}
+
+//-----------------------------------------------------------------------------
+// Objects do not share anything, so with a job system the dirty words are
+// split between threads
+//-----------------------------------------------------------------------------
+size_t SceneTransforms::update(JobSystem* jobs)
+{
+	if (!jobs || mDirty.size() <= PARALLEL_WORDS)
+		return updateWords(0, mDirty.size());
+
+	std::atomic<size_t> updated(0);
+	jobs->parallelFor(0, mDirty.size(), PARALLEL_WORDS, [this, &updated](size_t first, size_t last)
+	{
+		updated += updateWords(first, last);
+	});
+	return updated;
+}
+
+//-----------------------------------------------------------------------------
+// The vectors keep their capacity, so refilling the same ones does not allocate
+//-----------------------------------------------------------------------------
+void SceneTransforms::copyMatrices(std::vector<glm::mat4>& world, std::vector<glm::mat3>& normal) const
+{
+	world.assign(mWorld.begin(), mWorld.begin() + mCount);
+	normal.assign(mNormal.begin(), mNormal.begin() + mCount);
+}
+
+//-----------------------------------------------------------------------------
+// Walks the dirty bits a word at a time.  With SSE2 a group of four with two
+// or more changed objects is rebuilt whole (the others get the same matrices
+// again); lone changes, and everything without SSE2, go one by one.
+//-----------------------------------------------------------------------------
+size_t SceneTransforms::updateWords(size_t firstWord, size_t lastWord)
+{
+	size_t updated = 0;
+	for (size_t w = firstWord; w < lastWord; w++)
+	{
+		uint32_t bits = mDirty[w];
+		if (bits == 0)
+			continue;
+
+		mDirty[w] = 0;
+		updated += std::bitset<32>(bits).count();
+
+		size_t base = w * 32;
+		for (int group = 0; group < 32; group += 4)
+		{
+			uint32_t groupBits = (bits >> group) & 0xF;
+			if (groupBits == 0)
+				continue;
+
+#ifdef SCENE_TRANSFORMS_SSE2
+			if (gSimdEnabled && (groupBits & (groupBits - 1)) != 0)
+			{
+				updateFour(base + group);
+				continue;
+			}
+#endif
+			for (int i = 0; i < 4; i++)
+			{
+				if (groupBits & (1u << i))
+					updateOne(base + group + i);
+			}
+		}
+	}
+	return updated;
+}
+
+//-----------------------------------------------------------------------------
+// Matrices of one object.  The columns of the world matrix are the rotation
+// columns times the scale, those of the normal matrix divided by it:
+// (R S)^-T = R S^-1 for a rotation R.
+//-----------------------------------------------------------------------------
+void SceneTransforms::updateOne(size_t index)
+{
+	float x = mRotation[0][index], y = mRotation[1][index], z = mRotation[2][index], w = mRotation[3][index];
+	float xx = x * x, yy = y * y, zz = z * z;
+	float xy = x * y, xz = x * z, yz = y * z;
+	float wx = w * x, wy = w * y, wz = w * z;
+
+	glm::vec3 rotation[3];
+	rotation[0] = glm::vec3(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy));
+	rotation[1] = glm::vec3(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx));
+	rotation[2] = glm::vec3(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy));
+
+	glm::mat4& world = mWorld[index];
+	glm::mat3& normal = mNormal[index];
+	for (int c = 0; c < 3; c++)
+	{
+		float scale = mScale[c][index];
+		world[c] = glm::vec4(rotation[c] * scale, 0.0f);
+		normal[c] = rotation[c] * (1.0f / scale);
+	}
+	world[3] = glm::vec4(mPosition[0][index], mPosition[1][index], mPosition[2][index], 1.0f);
+}
+
+//-----------------------------------------------------------------------------
+// Same for objects first..first+3, a lane each: every matrix element is
+// computed for the four objects at once, then the registers are transposed
+// into columns
+//-----------------------------------------------------------------------------
+void SceneTransforms::updateFour(size_t first)
+{
+#ifdef SCENE_TRANSFORMS_SSE2
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+
+	__m128 x = _mm_loadu_ps(&mRotation[0][first]);
+	__m128 y = _mm_loadu_ps(&mRotation[1][first]);
+	__m128 z = _mm_loadu_ps(&mRotation[2][first]);
+	__m128 w = _mm_loadu_ps(&mRotation[3][first]);
+
+	__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+	__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+	__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+	// rotation[column][row]
+	__m128 rotation[3][3];
+	rotation[0][0] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+	rotation[0][1] = _mm_mul_ps(two, _mm_add_ps(xy, wz));
+	rotation[0][2] = _mm_mul_ps(two, _mm_sub_ps(xz, wy));
+	rotation[1][0] = _mm_mul_ps(two, _mm_sub_ps(xy, wz));
+	rotation[1][1] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+	rotation[1][2] = _mm_mul_ps(two, _mm_add_ps(yz, wx));
+	rotation[2][0] = _mm_mul_ps(two, _mm_add_ps(xz, wy));
+	rotation[2][1] = _mm_mul_ps(two, _mm_sub_ps(yz, wx));
+	rotation[2][2] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+
+	for (int c = 0; c < 3; c++)
+	{
+		__m128 scale = _mm_loadu_ps(&mScale[c][first]);
+		__m128 a = _mm_mul_ps(rotation[c][0], scale);
+		__m128 b = _mm_mul_ps(rotation[c][1], scale);
+		__m128 d = _mm_mul_ps(rotation[c][2], scale);
+		__m128 e = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(a, b, d, e);
+		_mm_storeu_ps(&mWorld[first][c][0], a);
+		_mm_storeu_ps(&mWorld[first + 1][c][0], b);
+		_mm_storeu_ps(&mWorld[first + 2][c][0], d);
+		_mm_storeu_ps(&mWorld[first + 3][c][0], e);
+
+		__m128 inverse = _mm_div_ps(one, scale);
+		a = _mm_mul_ps(rotation[c][0], inverse);
+		b = _mm_mul_ps(rotation[c][1], inverse);
+		d = _mm_mul_ps(rotation[c][2], inverse);
+		e = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(a, b, d, e);
+		store3(&mNormal[first][c][0], a);
+		store3(&mNormal[first + 1][c][0], b);
+		store3(&mNormal[first + 2][c][0], d);
+		store3(&mNormal[first + 3][c][0], e);
+	}
+
+	__m128 a = _mm_loadu_ps(&mPosition[0][first]);
+	__m128 b = _mm_loadu_ps(&mPosition[1][first]);
+	__m128 d = _mm_loadu_ps(&mPosition[2][first]);
+	__m128 e = one;
+	_MM_TRANSPOSE4_PS(a, b, d, e);
+	_mm_storeu_ps(&mWorld[first][3][0], a);
+	_mm_storeu_ps(&mWorld[first + 1][3][0], b);
+	_mm_storeu_ps(&mWorld[first + 2][3][0], d);
+	_mm_storeu_ps(&mWorld[first + 3][3][0], e);
+#else
+	for (size_t i = first; i < first + 4; i++)
+		updateOne(i);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// True when update() uses SSE2
+//-----------------------------------------------------------------------------
+bool SceneTransforms::hasSimd()
+{
+#ifdef SCENE_TRANSFORMS_SSE2
+	return gSimdEnabled;
+#else
+	return false;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Turns the SSE2 path on or off (for benchmarks)
+//-----------------------------------------------------------------------------
+void SceneTransforms::setSimdEnabled(bool enabled)
+{
+	gSimdEnabled = enabled;
+}
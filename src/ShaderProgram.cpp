@@ -2,18 +2,33 @@
 // GLSL shader manager class
 //-----------------------------------------------------------------------------
 #include "ShaderProgram.h"
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 
 #include <glm/gtc/type_ptr.hpp>
 
+namespace
+{
+	// Every live program, for reloadFile()
+	std::vector<ShaderProgram*> gPrograms;
+
+	const GLenum STAGE_TYPES[] = { GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER, GL_COMPUTE_SHADER };
+}
+
 //-----------------------------------------------------------------------------
 // Constructor
 //-----------------------------------------------------------------------------
 ShaderProgram::ShaderProgram()
-	: mHandle(0)
-{}
+	: mHandle(0),
+	  mPending(0)
+{
+	for (int stage = 0; stage < PROGRAM; stage++)
+		mPendingShaders[stage] = 0;
+	gPrograms.push_back(this);
+}
 
 
 //-----------------------------------------------------------------------------
@@ -21,6 +36,9 @@ ShaderProgram::ShaderProgram()
 //-----------------------------------------------------------------------------
 ShaderProgram::~ShaderProgram()
 {
+	gPrograms.erase(std::find(gPrograms.begin(), gPrograms.end(), this));
+	discardPending();
+
 	// Delete the program
 	glDeleteProgram(mHandle);
 }
@@ -30,43 +48,242 @@ ShaderProgram::~ShaderProgram()
 //-----------------------------------------------------------------------------
 bool ShaderProgram::loadShaders(const char* vsFilename, const char* fsFilename)
 {
-	string vsString = fileToString(vsFilename);
-	string fsString = fileToString(fsFilename);
-	const GLchar* vsSourcePtr = vsString.c_str();
-	const GLchar* fsSourcePtr = fsString.c_str();
-
-	GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-	GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
+	return loadShaders(vsFilename, NULL, fsFilename);
+}
 
-	glShaderSource(vs, 1, &vsSourcePtr, NULL);
-	glShaderSource(fs, 1, &fsSourcePtr, NULL);
+//-----------------------------------------------------------------------------
+// Loads vertex, geometry (may be NULL) and fragment (may be NULL) shaders
+//-----------------------------------------------------------------------------
+bool ShaderProgram::loadShaders(const char* vsFilename, const char* gsFilename, const char* fsFilename)
+{
+	discardPending();
+	mFileName[VERTEX] = vsFilename;
+	mFileName[GEOMETRY] = gsFilename != NULL ? gsFilename : "";
+	mFileName[FRAGMENT] = fsFilename != NULL ? fsFilename : "";
+	mFileName[COMPUTE] = "";
+
+	GLuint shaders[PROGRAM];
+	GLuint program = buildProgram(shaders);
+	if (program == 0)
+	{
+		std::cerr << "Unable to create shader program!" << std::endl;
+		return false;
+	}
 
-	glCompileShader(vs);
-	checkCompileErrors(vs, VERTEX);
+	checkProgram(program, shaders);
+	replaceProgram(program);
 
-	glCompileShader(fs);
-	checkCompileErrors(fs, FRAGMENT);
+	return true;
+}
 
-	mHandle = glCreateProgram();
-	if (mHandle == 0)
+//-----------------------------------------------------------------------------
+// Loads a compute shader, a program of its own
+//-----------------------------------------------------------------------------
+bool ShaderProgram::loadComputeShader(const char* csFilename)
+{
+	discardPending();
+	mFileName[VERTEX] = "";
+	mFileName[GEOMETRY] = "";
+	mFileName[FRAGMENT] = "";
+	mFileName[COMPUTE] = csFilename;
+
+	GLuint shaders[PROGRAM];
+	GLuint program = buildProgram(shaders);
+	if (program == 0)
 	{
 		std::cerr << "Unable to create shader program!" << std::endl;
 		return false;
 	}
 
-	glAttachShader(mHandle, vs);
-	glAttachShader(mHandle, fs);
+	bool linked = checkProgram(program, shaders);
+	replaceProgram(program);
 
-	glLinkProgram(mHandle);
-	checkCompileErrors(mHandle, PROGRAM);
+	return linked;
+}
+
+//-----------------------------------------------------------------------------
+// Creates, compiles and links the shaders of the files.  With parallel shader
+// compilation the driver does the work on its own threads and nothing waits
+// until the status is queried.
+//-----------------------------------------------------------------------------
+GLuint ShaderProgram::buildProgram(GLuint shaders[PROGRAM])
+{
+	for (int stage = 0; stage < PROGRAM; stage++)
+	{
+		shaders[stage] = 0;
+		if (mFileName[stage].empty())
+			continue;
 
+		string source = fileToString(mFileName[stage]);
+		const GLchar* sourcePtr = source.c_str();
 
-	glDeleteShader(vs);
-	glDeleteShader(fs);
+		shaders[stage] = glCreateShader(STAGE_TYPES[stage]);
+		glShaderSource(shaders[stage], 1, &sourcePtr, NULL);
+		glCompileShader(shaders[stage]);
+	}
+
+	GLuint program = glCreateProgram();
+	for (int stage = 0; stage < PROGRAM; stage++)
+	{
+		if (program != 0 && shaders[stage] != 0)
+			glAttachShader(program, shaders[stage]);
+	}
+	if (program != 0 && !mFeedbackVaryings.empty())
+	{
+		std::vector<const GLchar*> names;
+		for (const string& name : mFeedbackVaryings)
+			names.push_back(name.c_str());
+		glTransformFeedbackVaryings(program, (GLsizei)names.size(), names.data(), GL_INTERLEAVED_ATTRIBS);
+	}
+	if (program != 0)
+		glLinkProgram(program);
+	else
+		checkProgram(0, shaders);	// deletes the shaders
+
+	return program;
+}
+
+//-----------------------------------------------------------------------------
+// Compile and link errors of a program built by buildProgram(), which lets go
+// of its shaders
+//-----------------------------------------------------------------------------
+bool ShaderProgram::checkProgram(GLuint program, GLuint shaders[PROGRAM])
+{
+	bool result = true;
+	for (int stage = 0; stage < PROGRAM; stage++)
+	{
+		if (shaders[stage] == 0)
+			continue;
+
+		if (program != 0 && !checkCompileErrors(shaders[stage], (ShaderType)stage))
+		{
+			std::cerr << "  in " << mFileName[stage] << std::endl;
+			result = false;
+		}
+		glDeleteShader(shaders[stage]);
+		shaders[stage] = 0;
+	}
+
+	return program != 0 && checkCompileErrors(program, PROGRAM) && result;
+}
+
+//-----------------------------------------------------------------------------
+// True once the link status can be read without waiting
+//-----------------------------------------------------------------------------
+bool ShaderProgram::isBuilt(GLuint program) const
+{
+	if (!GLEW_KHR_parallel_shader_compile && !GLEW_ARB_parallel_shader_compile)
+		return true;	// the status query blocks, as on the first load
+
+	GLint done = GL_FALSE;
+	glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+	return done != GL_FALSE;
+}
 
+//-----------------------------------------------------------------------------
+// Takes a linked program in place of the current one.  Uniform locations may
+// have moved; uniform block bindings are program state and set again.
+//-----------------------------------------------------------------------------
+void ShaderProgram::replaceProgram(GLuint program)
+{
+	glDeleteProgram(mHandle);
+	mHandle = program;
 	mUniformLocations.clear();
 
-	return true;
+	for (std::map<string, GLuint>::const_iterator it = mUniformBlocks.begin(); it != mUniformBlocks.end(); ++it)
+	{
+		GLuint index = glGetUniformBlockIndex(mHandle, it->first.c_str());
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(mHandle, index, it->second);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Drops a rebuild in progress
+//-----------------------------------------------------------------------------
+void ShaderProgram::discardPending()
+{
+	if (mPending == 0)
+		return;
+
+	for (int stage = 0; stage < PROGRAM; stage++)
+	{
+		glDeleteShader(mPendingShaders[stage]);
+		mPendingShaders[stage] = 0;
+	}
+	glDeleteProgram(mPending);
+	mPending = 0;
+}
+
+//-----------------------------------------------------------------------------
+// True when one of the stages comes from the file
+//-----------------------------------------------------------------------------
+bool ShaderProgram::usesFile(const string& fileName) const
+{
+	std::filesystem::path path = std::filesystem::path(fileName).lexically_normal();
+	for (int stage = 0; stage < PROGRAM; stage++)
+	{
+		if (!mFileName[stage].empty() && std::filesystem::path(mFileName[stage]).lexically_normal() == path)
+			return true;
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Starts rebuilding the programs that use a file.  A rebuild already in
+// progress starts over with the new contents.
+//-----------------------------------------------------------------------------
+int ShaderProgram::reloadFile(const string& fileName)
+{
+	int count = 0;
+	for (size_t i = 0; i < gPrograms.size(); i++)
+	{
+		ShaderProgram* shader = gPrograms[i];
+		if (shader->mHandle == 0 || !shader->usesFile(fileName))
+			continue;
+
+		shader->discardPending();
+		shader->mPending = shader->buildProgram(shader->mPendingShaders);
+		if (shader->mPending != 0)
+			count++;
+	}
+	return count;
+}
+
+//-----------------------------------------------------------------------------
+// Swaps in the rebuilt programs that are linked.  One that failed is deleted
+// and the program it was meant to replace stays in use.
+//-----------------------------------------------------------------------------
+int ShaderProgram::updateReloads()
+{
+	int count = 0;
+	for (size_t i = 0; i < gPrograms.size(); i++)
+	{
+		ShaderProgram* shader = gPrograms[i];
+		if (shader->mPending == 0 || !shader->isBuilt(shader->mPending))
+			continue;
+
+		GLuint program = shader->mPending;
+		shader->mPending = 0;
+		if (shader->checkProgram(program, shader->mPendingShaders))
+		{
+			shader->replaceProgram(program);
+			std::cout << "Reloaded shader program";
+			for (int stage = 0; stage < PROGRAM; stage++)
+			{
+				if (!shader->mFileName[stage].empty())
+					std::cout << " " << shader->mFileName[stage];
+			}
+			std::cout << std::endl;
+			count++;
+		}
+		else
+		{
+			glDeleteProgram(program);
+			std::cerr << "Keeping the previous shader program" << std::endl;
+		}
+	}
+	return count;
 }
 
 //-----------------------------------------------------------------------------
@@ -110,9 +327,9 @@ void ShaderProgram::use()
 }
 
 //-----------------------------------------------------------------------------
-// Checks for shader compiler errors
+// Checks for shader compiler errors, true when there are none
 //-----------------------------------------------------------------------------
-void  ShaderProgram::checkCompileErrors(GLuint shader, ShaderType type)
+bool  ShaderProgram::checkCompileErrors(GLuint shader, ShaderType type)
 {
 	int status = 0;
 
@@ -145,6 +362,7 @@ void  ShaderProgram::checkCompileErrors(GLuint shader, ShaderType type)
 		}
 	}
 
+	return status != GL_FALSE;
 }
 
 //-----------------------------------------------------------------------------
@@ -182,6 +400,15 @@ void ShaderProgram::setUniform(const GLchar* name, const glm::vec4& v)
 	glUniform4f(loc, v.x, v.y, v.z, v.w);
 }
 
+//-----------------------------------------------------------------------------
+// Sets a glm::mat3 shader uniform
+//-----------------------------------------------------------------------------
+void ShaderProgram::setUniform(const GLchar* name, const glm::mat3& m)
+{
+	GLint loc = getUniformLocation(name);
+	glUniformMatrix3fv(loc, 1, GL_FALSE, glm::value_ptr(m));
+}
+
 //-----------------------------------------------------------------------------
 // Sets a glm::mat4 shader uniform
 //-----------------------------------------------------------------------------
@@ -225,6 +452,18 @@ void ShaderProgram::setUniformSampler(const GLchar* name, const GLint& slot)
 	glUniform1i(loc, slot);
 }
 
+//-----------------------------------------------------------------------------
+// Points a uniform block at a GL_UNIFORM_BUFFER binding point
+//-----------------------------------------------------------------------------
+void ShaderProgram::setUniformBlock(const GLchar* name, GLuint binding)
+{
+	mUniformBlocks[name] = binding;
+
+	GLuint index = glGetUniformBlockIndex(mHandle, name);
+	if (index != GL_INVALID_INDEX)
+		glUniformBlockBinding(mHandle, index, binding);
+}
+
 //-----------------------------------------------------------------------------
 // Returns the uniform identifier given it's string name.
 // NOTE: Shader must be currently active first.
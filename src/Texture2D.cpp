@@ -2,16 +2,26 @@
 // Simple 2D texture class
 //-----------------------------------------------------------------------------
 #include "Texture2D.h"
+#include <algorithm>
 #include <iostream>
 #include <cassert>
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image/stb_image.h"
+#include "ImageDecoder.h"
 
 //-----------------------------------------------------------------------------
 // Constructor
 //-----------------------------------------------------------------------------
 Texture2D::Texture2D()
-	: mTexture(0)
+	: mTexture(0),
+	  mFormat(CompressedImage::FORMAT_UNKNOWN),
+	  mInternalFormat(0),
+	  mSrgb(false),
+	  mWidth(0),
+	  mHeight(0),
+	  mNumLevels(0),
+	  mBaseLevel(0),
+	  mBindlessHandle(0),
+	  mMemorySize(0),
+	  mGenerateMipMaps(true)
 {
 }
 
@@ -20,28 +30,53 @@ Texture2D::Texture2D()
 //-----------------------------------------------------------------------------
 Texture2D::~Texture2D()
 {
+	if (mBindlessHandle != 0)
+		glMakeTextureHandleNonResidentARB(mBindlessHandle);
 	glDeleteTextures(1, &mTexture);
 }
 
 //-----------------------------------------------------------------------------
-// Load a texture with a given filename using stb image loader
-// http://nothings.org/stb_image.h
+// Load a texture with a given filename using the image decoders (stb image
+// loader http://nothings.org/stb_image.h, or a faster backend when built in).
+// The decoder writes the rows bottom first, as GL expects.
 // Creates mip maps if generateMipMaps is true.
+// .dds and .ktx2 files are uploaded compressed with the mip levels they hold.
 //-----------------------------------------------------------------------------
 bool Texture2D::loadTexture(const string& fileName, bool generateMipMaps)
 {
-	int width, height, components;
-
-	// Use stbi image library to load our image
-	unsigned char* imageData = stbi_load(fileName.c_str(), &width, &height, &components, STBI_rgb_alpha);
+	if (CompressedImage::isContainerFile(fileName))
+	{
+		CompressedImage image;
+		if (!image.loadFromFile(fileName) || !uploadCompressed(image))
+			return false;
+		mFileName = fileName;
+		return true;
+	}
 
-	if (imageData == NULL)
+	int width, height;
+	std::vector<unsigned char> imageData;
+	if (!ImageDecoder::loadFile(fileName, imageData, width, height, true))
 	{
 		std::cerr << "Error loading texture '" << fileName << "'" << std::endl;
 		return false;
 	}
 
-	// Invert image
+	bool result = uploadImage(&imageData[0], width, height, generateMipMaps);
+
+	if (result)
+	{
+		mFileName = fileName;
+		mGenerateMipMaps = generateMipMaps;
+	}
+
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+// Invert image rows so the first row in memory is the bottom of the image
+//-----------------------------------------------------------------------------
+void Texture2D::flipVertical(unsigned char* imageData, int width, int height)
+{
 	int widthInBytes = width * 4;
 	unsigned char *top = NULL;
 	unsigned char *bottom = NULL;
@@ -60,10 +95,169 @@ bool Texture2D::loadTexture(const string& fileName, bool generateMipMaps)
 			bottom++;
 		}
 	}
+}
+
+//-----------------------------------------------------------------------------
+// Creates the GL texture from already decoded (and flipped) RGBA pixels.
+// Mip maps are built on the CPU (gamma correct box filter) rather than with
+// glGenerateMipmap, whose cost and quality depend on the driver.
+// Must be called on the thread that owns the GL context.
+//-----------------------------------------------------------------------------
+bool Texture2D::uploadImage(const unsigned char* imageData, int width, int height, bool generateMipMaps)
+{
+	std::vector<MipGenerator::Level> mipLevels;
+	if (generateMipMaps)
+		MipGenerator::generate(imageData, width, height, MipGenerator::FILTER_BOX, true, mipLevels);
+
+	return uploadImage(imageData, width, height, mipLevels);
+}
+
+//-----------------------------------------------------------------------------
+// Same with prebuilt mip levels (1 and smaller).  Storage for every level is
+// allocated first and then filled with glTexSubImage2D.
+//-----------------------------------------------------------------------------
+bool Texture2D::uploadImage(const unsigned char* imageData, int width, int height, const std::vector<MipGenerator::Level>& mipLevels)
+{
+	if (!allocate(CompressedImage::FORMAT_RGBA8, false, width, height, 1 + (int)mipLevels.size()))
+		return false;
+
+	uploadRegion(0, 0, width, height, imageData, (size_t)width * height * 4);
+	for (size_t i = 0; i < mipLevels.size(); i++)
+	{
+		const MipGenerator::Level& level = mipLevels[i];
+		uploadRegion((int)i + 1, 0, level.width, level.height, &level.pixels[0], level.pixels.size());
+	}
+
+	return true;
+}
 
-	glGenTextures(1, &mTexture);
+//-----------------------------------------------------------------------------
+// Allocates every level (undefined contents) and sets the sampling state.
+// Level sizes halve down from width x height like the cooked chains do.
+//-----------------------------------------------------------------------------
+bool Texture2D::allocate(CompressedImage::Format format, bool srgb, int width, int height, int numLevels)
+{
+	if (!create(format, srgb, width, height, numLevels))
+		return false;
+
+	for (int i = numLevels - 1; i >= 0; i--)
+		allocateLevel(i);
+	setBaseLevel(0);
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Sets the format and sampling state, with no level resident yet
+//-----------------------------------------------------------------------------
+bool Texture2D::create(CompressedImage::Format format, bool srgb, int width, int height, int numLevels)
+{
+	GLenum internalFormat = getInternalFormat(format, srgb);
+	if (internalFormat == 0 || numLevels <= 0 || !isFormatSupported(format, srgb))
+	{
+		std::cerr << "Error: " << CompressedImage::getFormatName(format) << (srgb ? " sRGB" : "")
+				  << " textures are not supported by this driver" << std::endl;
+		return false;
+	}
+
+	if (mTexture == 0)
+		glGenTextures(1, &mTexture);
 	glBindTexture(GL_TEXTURE_2D, mTexture); // all upcoming GL_TEXTURE_2D operations will affect our texture object (mTexture)
 
+	setLevelParameters(numLevels);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, numLevels);	// past MAX_LEVEL : incomplete
+
+	glBindTexture(GL_TEXTURE_2D, 0); // unbind texture when done so we don't accidentally mess up our mTexture
+
+	mFormat = format;
+	mInternalFormat = internalFormat;
+	mSrgb = srgb;
+	mWidth = width;
+	mHeight = height;
+	mNumLevels = numLevels;
+	mBaseLevel = numLevels;
+	mMemorySize = 0;
+
+	// Define level 0 once so the driver lays its mip tree out from the real
+	// size: guessed from a coarse level first, the tree is off by a texel on
+	// odd sizes and the levels already filled get lost when it is rebuilt
+	// (Mesa).  Redefined empty, level 0 takes no memory until it is streamed.
+	allocateLevel(0);
+	freeLevel(0);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Defines a level with undefined contents
+//-----------------------------------------------------------------------------
+void Texture2D::allocateLevel(int level)
+{
+	int levelWidth = std::max(1, mWidth >> level);
+	int levelHeight = std::max(1, mHeight >> level);
+	size_t size = CompressedImage::getLevelSize(mFormat, levelWidth, levelHeight);
+
+	glBindTexture(GL_TEXTURE_2D, mTexture);
+	if (mFormat == CompressedImage::FORMAT_RGBA8)
+		glTexImage2D(GL_TEXTURE_2D, level, mInternalFormat, levelWidth, levelHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	else
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, mInternalFormat, levelWidth, levelHeight, 0, (GLsizei)size, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	mMemorySize += size;
+}
+
+//-----------------------------------------------------------------------------
+// Releases the storage of a level by redefining it empty.  Raise the base
+// level past it first.
+//-----------------------------------------------------------------------------
+void Texture2D::freeLevel(int level)
+{
+	int levelWidth = std::max(1, mWidth >> level);
+	int levelHeight = std::max(1, mHeight >> level);
+
+	glBindTexture(GL_TEXTURE_2D, mTexture);
+	if (mFormat == CompressedImage::FORMAT_RGBA8)
+		glTexImage2D(GL_TEXTURE_2D, level, mInternalFormat, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	else
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, mInternalFormat, 0, 0, 0, 0, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	mMemorySize -= CompressedImage::getLevelSize(mFormat, levelWidth, levelHeight);
+}
+
+//-----------------------------------------------------------------------------
+// Finest level the sampler may use
+//-----------------------------------------------------------------------------
+void Texture2D::setBaseLevel(int level)
+{
+	glBindTexture(GL_TEXTURE_2D, mTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	mBaseLevel = level;
+}
+
+//-----------------------------------------------------------------------------
+// Fills rows of an allocated level.  From a pixel unpack buffer the copy is
+// queued and runs asynchronously; from client memory it completes before
+// returning.
+//-----------------------------------------------------------------------------
+void Texture2D::uploadRegion(int level, int y, int width, int height, const GLvoid* data, size_t size)
+{
+	glBindTexture(GL_TEXTURE_2D, mTexture);
+	if (mFormat == CompressedImage::FORMAT_RGBA8)
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	else
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, y, width, height, mInternalFormat, (GLsizei)size, data);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Wrapping/filtering options of the bound texture.  Trilinear filtering when
+// there are mip levels; MAX_LEVEL is set since a chain may stop before 1x1.
+//-----------------------------------------------------------------------------
+void Texture2D::setLevelParameters(int numLevels)
+{
 	// Set the texture wrapping/filtering options (on the currently bound texture object)
 	// GL_CLAMP_TO_EDGE
 	// GL_REPEAT
@@ -73,20 +267,105 @@ bool Texture2D::loadTexture(const string& fileName, bool generateMipMaps)
 	// GL_NEAREST
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, numLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+}
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, imageData);
+//-----------------------------------------------------------------------------
+// Block formats need GL_EXT_texture_compression_s3tc (BC1, BC3),
+// GL_EXT_texture_sRGB for their sRGB variants and GL_ARB_texture_compression_bptc
+// (BC7).  BC5 (RGTC) and RGBA8 are core.
+//-----------------------------------------------------------------------------
+bool Texture2D::isFormatSupported(CompressedImage::Format format, bool srgb)
+{
+	switch (format)
+	{
+	case CompressedImage::FORMAT_BC1:
+	case CompressedImage::FORMAT_BC3:	return GLEW_EXT_texture_compression_s3tc && (!srgb || GLEW_EXT_texture_sRGB);
+	case CompressedImage::FORMAT_BC5:	return !srgb;
+	case CompressedImage::FORMAT_BC7:	return GLEW_ARB_texture_compression_bptc || GLEW_VERSION_4_2;
+	case CompressedImage::FORMAT_RGBA8:	return true;
+	default:							return false;
+	}
+}
 
-	if (generateMipMaps)
-		glGenerateMipmap(GL_TEXTURE_2D);
+//-----------------------------------------------------------------------------
+// Uploads a cooked image and all its mip levels.  Block compressed levels
+// stay compressed in video memory (4:1 to 8:1 against RGBA8).
+//-----------------------------------------------------------------------------
+bool Texture2D::uploadCompressed(const CompressedImage& image)
+{
+	if (!allocate(image.getFormat(), image.isSRGB(), image.getWidth(), image.getHeight(), image.getNumLevels()))
+		return false;
 
-	stbi_image_free(imageData);
-	glBindTexture(GL_TEXTURE_2D, 0); // unbind texture when done so we don't accidentally mess up our mTexture
+	for (int i = 0; i < image.getNumLevels(); i++)
+	{
+		const CompressedImage::Level& level = image.getLevel(i);
+		uploadRegion(i, 0, level.width, level.height, image.getData() + level.offset, level.size);
+	}
 
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+// GL internal format of a cooked format, 0 if there is none
+//-----------------------------------------------------------------------------
+GLenum Texture2D::getInternalFormat(CompressedImage::Format format, bool srgb)
+{
+	switch (format)
+	{
+	case CompressedImage::FORMAT_BC1:	return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+	case CompressedImage::FORMAT_BC3:	return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case CompressedImage::FORMAT_BC5:	return GL_COMPRESSED_RG_RGTC2;
+	case CompressedImage::FORMAT_BC7:	return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB : GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+	case CompressedImage::FORMAT_RGBA8:	return srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+	default:							return 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Creates the handle (which freezes the texture) and makes it resident so
+// shaders can sample it without binding
+//-----------------------------------------------------------------------------
+GLuint64 Texture2D::getResidentHandle()
+{
+	if (mBindlessHandle == 0 && mTexture != 0 && isBindlessSupported())
+	{
+		mBindlessHandle = glGetTextureHandleARB(mTexture);
+		if (mBindlessHandle != 0)
+			glMakeTextureHandleResidentARB(mBindlessHandle);
+	}
+
+	return mBindlessHandle;
+}
+
+//-----------------------------------------------------------------------------
+// Deletes the texture object; the file name is kept for reload()
+//-----------------------------------------------------------------------------
+void Texture2D::evict()
+{
+	if (!canEvict())
+		return;
+
+	glDeleteTextures(1, &mTexture);
+	mTexture = 0;
+	mNumLevels = mBaseLevel = 0;
+	mMemorySize = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Loads the file again, as it was first loaded
+//-----------------------------------------------------------------------------
+bool Texture2D::reload()
+{
+	if (mFileName.empty())
+		return false;
+	string fileName = mFileName;
+	return loadTexture(fileName, mGenerateMipMaps);
+}
+
 //-----------------------------------------------------------------------------
 // Bind the texture unit passed in as the active texture in the shader
 //-----------------------------------------------------------------------------
@@ -0,0 +1,175 @@
+//-----------------------------------------------------------------------------
+// 2D texture array class
+//-----------------------------------------------------------------------------
+#include "Texture2DArray.h"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <cassert>
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+Texture2DArray::Texture2DArray()
+	: mTexture(0),
+	  mFormat(CompressedImage::FORMAT_UNKNOWN),
+	  mInternalFormat(0),
+	  mWidth(0),
+	  mHeight(0),
+	  mNumLayers(0),
+	  mNumLevels(0),
+	  mMemorySize(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+Texture2DArray::~Texture2DArray()
+{
+	glDeleteTextures(1, &mTexture);
+}
+
+//-----------------------------------------------------------------------------
+// Allocates every level of every layer, finest first, and sets the sampling
+// state (repeat, trilinear when there are mip levels)
+//-----------------------------------------------------------------------------
+bool Texture2DArray::create(CompressedImage::Format format, bool srgb, int width, int height, int numLayers, int numLevels)
+{
+	GLenum internalFormat = Texture2D::getInternalFormat(format, srgb);
+	if (internalFormat == 0 || !Texture2D::isFormatSupported(format, srgb))
+	{
+		std::cerr << "Error: " << CompressedImage::getFormatName(format) << (srgb ? " sRGB" : "")
+				  << " textures are not supported by this driver" << std::endl;
+		return false;
+	}
+	if (numLayers <= 0 || numLayers > getMaxLayers() || numLevels <= 0)
+	{
+		std::cerr << "Error: cannot create a texture array of " << numLayers << " layers" << std::endl;
+		return false;
+	}
+
+	if (mTexture == 0)
+		glGenTextures(1, &mTexture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mTexture);
+
+	mMemorySize = 0;
+	for (int level = 0; level < numLevels; level++)
+	{
+		int levelWidth = std::max(1, width >> level);
+		int levelHeight = std::max(1, height >> level);
+		size_t layerSize = CompressedImage::getLevelSize(format, levelWidth, levelHeight);
+
+		if (format == CompressedImage::FORMAT_RGBA8)
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internalFormat, levelWidth, levelHeight, numLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		else
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, internalFormat, levelWidth, levelHeight, numLayers, 0,
+								   (GLsizei)(layerSize * numLayers), NULL);
+		mMemorySize += layerSize * numLayers;
+	}
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, numLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	mFormat = format;
+	mInternalFormat = internalFormat;
+	mWidth = width;
+	mHeight = height;
+	mNumLayers = numLayers;
+	mNumLevels = numLevels;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Copies level by level on the GPU with glCopyImageSubData (GL 4.3 or
+// ARB_copy_image).  Older drivers read every level back and upload it again,
+// which is only meant for load time.
+//-----------------------------------------------------------------------------
+bool Texture2DArray::copyTexture(const Texture2D& texture, int layer, int x, int y)
+{
+	if (texture.getFormat() != mFormat || Texture2D::getInternalFormat(texture.getFormat(), texture.isSRGB()) != mInternalFormat ||
+		texture.getNumLevels() < mNumLevels || layer < 0 || layer >= mNumLayers ||
+		x < 0 || y < 0 || x + texture.getWidth() > mWidth || y + texture.getHeight() > mHeight)
+	{
+		std::cerr << "Error: texture does not fit layer " << layer << " of the texture array" << std::endl;
+		return false;
+	}
+
+	bool copyImage = GLEW_ARB_copy_image || GLEW_VERSION_4_3;
+	std::vector<unsigned char> pixels;
+	for (int level = 0; level < mNumLevels; level++)
+	{
+		int levelWidth = std::max(1, texture.getWidth() >> level);
+		int levelHeight = std::max(1, texture.getHeight() >> level);
+
+		if (copyImage)
+		{
+			glCopyImageSubData(texture.getId(), GL_TEXTURE_2D, level, 0, 0, 0,
+							   mTexture, GL_TEXTURE_2D_ARRAY, level, x >> level, y >> level, layer,
+							   levelWidth, levelHeight, 1);
+			continue;
+		}
+
+		size_t size = CompressedImage::getLevelSize(mFormat, levelWidth, levelHeight);
+		pixels.resize(size);
+		glBindTexture(GL_TEXTURE_2D, texture.getId());
+		if (mFormat == CompressedImage::FORMAT_RGBA8)
+			glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+		else
+			glGetCompressedTexImage(GL_TEXTURE_2D, level, &pixels[0]);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		uploadRegion(level, layer, x >> level, y >> level, levelWidth, levelHeight, &pixels[0], size);
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Fills a rectangle of an allocated level
+//-----------------------------------------------------------------------------
+void Texture2DArray::uploadRegion(int level, int layer, int x, int y, int width, int height, const GLvoid* data, size_t size)
+{
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mTexture);
+	if (mFormat == CompressedImage::FORMAT_RGBA8)
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, x, y, layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	else
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, x, y, layer, width, height, 1, mInternalFormat, (GLsizei)size, data);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Layers a driver can hold in one array
+//-----------------------------------------------------------------------------
+int Texture2DArray::getMaxLayers()
+{
+	GLint maxLayers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+	return maxLayers;
+}
+
+//-----------------------------------------------------------------------------
+// Bind the texture unit passed in as the active texture in the shader
+//-----------------------------------------------------------------------------
+void Texture2DArray::bind(GLuint texUnit)
+{
+	assert(texUnit >= 0 && texUnit < 32);
+
+	glActiveTexture(GL_TEXTURE0 + texUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mTexture);
+}
+
+//-----------------------------------------------------------------------------
+// Unbind the texture unit passed in as the active texture in the shader
+//-----------------------------------------------------------------------------
+void Texture2DArray::unbind(GLuint texUnit)
+{
+	glActiveTexture(GL_TEXTURE0 + texUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
@@ -0,0 +1,267 @@
+//-----------------------------------------------------------------------------
+// Packs textures into the layers of texture arrays
+//-----------------------------------------------------------------------------
+#include "TextureAtlas.h"
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+	const int DEFAULT_MAX_LAYER_SIZE = 2048;
+	const int MAX_CELLS_ACROSS = 4;		// smallest packed texture: a quarter of the layer across
+
+	bool isPowerOfTwo(int n)
+	{
+		return n > 0 && (n & (n - 1)) == 0;
+	}
+
+	// Levels of a full chain down to 1x1
+	int getFullChainLevels(int size)
+	{
+		int levels = 1;
+		while (size > 1)
+		{
+			size >>= 1;
+			levels++;
+		}
+		return levels;
+	}
+
+	// Every other bit of a Z order index
+	int compactBits(size_t bits)
+	{
+		int value = 0;
+		for (int bit = 0; bits != 0; bit++, bits >>= 2)
+			value |= (int)(bits & 1) << bit;
+		return value;
+	}
+
+	bool isSameFormat(const Texture2D& a, const Texture2D& b)
+	{
+		return a.getFormat() == b.getFormat() && a.isSRGB() == b.isSRGB();
+	}
+
+	bool isSameSize(const Texture2D& a, const Texture2D& b)
+	{
+		return a.getWidth() == b.getWidth() && a.getHeight() == b.getHeight() && a.getNumLevels() == b.getNumLevels();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+TextureAtlas::TextureAtlas()
+	: mMaxLayerSize(DEFAULT_MAX_LAYER_SIZE),
+	  mNumBuilt(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+TextureAtlas::~TextureAtlas()
+{
+}
+
+//-----------------------------------------------------------------------------
+// Power of two textures with their full mip chain can share layers, the
+// others need a layer of their own size
+//-----------------------------------------------------------------------------
+int TextureAtlas::add(const std::shared_ptr<Texture2D>& texture)
+{
+	if (!texture || !texture->isComplete() || std::max(texture->getWidth(), texture->getHeight()) > mMaxLayerSize)
+		return -1;
+
+	for (int i = mNumBuilt; i < (int)mEntries.size(); i++)
+	{
+		if (mEntries[i].texture == texture)
+			return i;
+	}
+
+	int width = texture->getWidth();
+	int height = texture->getHeight();
+	int cellSize = std::max(width, height);
+	bool packable = isPowerOfTwo(width) && isPowerOfTwo(height) && texture->getNumLevels() == getFullChainLevels(cellSize);
+
+	Entry entry;
+	entry.texture = texture;
+	entry.cell = packable ? cellSize : 0;
+	entry.x = entry.y = 0;
+	entry.placement.array = -1;
+	entry.placement.layer = 0;
+	entry.placement.rect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	mEntries.push_back(entry);
+	return (int)mEntries.size() - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Groups the new entries by format (and by size when they are not packable),
+// then lays out and fills an array per group
+//-----------------------------------------------------------------------------
+bool TextureAtlas::build()
+{
+	std::vector<std::vector<int> > cellGroups, layerGroups;
+	for (int i = mNumBuilt; i < (int)mEntries.size(); i++)
+	{
+		const Texture2D& texture = *mEntries[i].texture;
+		bool packable = mEntries[i].cell > 0;
+		std::vector<std::vector<int> >& groups = packable ? cellGroups : layerGroups;
+
+		size_t group = 0;
+		while (group < groups.size())
+		{
+			const Texture2D& first = *mEntries[groups[group][0]].texture;
+			if (isSameFormat(first, texture) && (packable || isSameSize(first, texture)))
+				break;
+			group++;
+		}
+		if (group == groups.size())
+			groups.push_back(std::vector<int>());
+		groups[group].push_back(i);
+	}
+
+	bool result = true;
+	for (size_t i = 0; i < cellGroups.size(); i++)
+		result = packCells(cellGroups[i]) && result;
+	for (size_t i = 0; i < layerGroups.size(); i++)
+		result = packLayers(layerGroups[i]) && result;
+
+	mNumBuilt = (int)mEntries.size();
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+// Power of two cells, largest first, follow each other in Z order: every cell
+// starts at a multiple of its own size, like in a quadtree.  An array takes
+// the cells down to a quarter of its largest one across; smaller ones start
+// the next array.
+//-----------------------------------------------------------------------------
+bool TextureAtlas::packCells(std::vector<int>& entries)
+{
+	std::stable_sort(entries.begin(), entries.end(), [this](int a, int b) { return mEntries[a].cell > mEntries[b].cell; });
+
+	bool blockFormat = mEntries[entries[0]].texture->getFormat() != CompressedImage::FORMAT_RGBA8;
+	size_t maxLayers = (size_t)Texture2DArray::getMaxLayers();
+	bool result = true;
+
+	size_t first = 0;
+	while (first < entries.size())
+	{
+		int layerSize = mEntries[entries[first]].cell;
+		size_t layerArea = (size_t)layerSize * layerSize;
+		size_t offset = 0;			// of the next cell, in texels along the Z order curve
+		int numLevels = mEntries[entries[first]].texture->getNumLevels();
+
+		size_t last = first;
+		while (last < entries.size() && mEntries[entries[last]].cell * MAX_CELLS_ACROSS >= layerSize && offset / layerArea < maxLayers)
+		{
+			Entry& entry = mEntries[entries[last]];
+			const Texture2D& texture = *entry.texture;
+			entry.placement.layer = (int)(offset / layerArea);
+			entry.x = compactBits(offset % layerArea);
+			entry.y = compactBits((offset % layerArea) >> 1);
+			offset += (size_t)entry.cell * entry.cell;
+
+			// Levels while the cell is a texel across, or while a block format
+			// texture smaller than the layer is still whole blocks
+			int levels = texture.getNumLevels();
+			if (blockFormat && (texture.getWidth() != layerSize || texture.getHeight() != layerSize))
+				levels = std::max(1, getFullChainLevels(std::min(texture.getWidth(), texture.getHeight())) - 2);
+			numLevels = std::min(numLevels, levels);
+			last++;
+		}
+
+		std::vector<int> arrayEntries(entries.begin() + first, entries.begin() + last);
+		int numLayers = (int)((offset + layerArea - 1) / layerArea);
+		result = createArray(arrayEntries, layerSize, layerSize, numLayers, numLevels) && result;
+		first = last;
+	}
+
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+// Textures of one size, a layer each
+//-----------------------------------------------------------------------------
+bool TextureAtlas::packLayers(std::vector<int>& entries)
+{
+	const Texture2D& texture = *mEntries[entries[0]].texture;
+	size_t maxLayers = (size_t)Texture2DArray::getMaxLayers();
+	bool result = true;
+
+	for (size_t first = 0; first < entries.size(); first += maxLayers)
+	{
+		size_t last = std::min(entries.size(), first + maxLayers);
+		std::vector<int> arrayEntries(entries.begin() + first, entries.begin() + last);
+		for (size_t i = 0; i < arrayEntries.size(); i++)
+			mEntries[arrayEntries[i]].placement.layer = (int)i;
+
+		result = createArray(arrayEntries, texture.getWidth(), texture.getHeight(), (int)arrayEntries.size(), texture.getNumLevels()) && result;
+	}
+
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+// Creates an array, copies the laid out entries into it and lets go of their
+// textures
+//-----------------------------------------------------------------------------
+bool TextureAtlas::createArray(const std::vector<int>& entries, int width, int height, int numLayers, int numLevels)
+{
+	const Texture2D& first = *mEntries[entries[0]].texture;
+	std::unique_ptr<Texture2DArray> textureArray(new Texture2DArray());
+	if (!textureArray->create(first.getFormat(), first.isSRGB(), width, height, numLayers, numLevels))
+		return false;
+
+	bool result = true;
+	int index = (int)mArrays.size();
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		Entry& entry = mEntries[entries[i]];
+		const Texture2D& texture = *entry.texture;
+		if (textureArray->copyTexture(texture, entry.placement.layer, entry.x, entry.y))
+		{
+			entry.placement.array = index;
+			entry.placement.rect = glm::vec4((float)entry.x / width, (float)entry.y / height,
+											 (float)texture.getWidth() / width, (float)texture.getHeight() / height);
+		}
+		else
+			result = false;
+		entry.texture.reset();
+	}
+
+	mArrays.push_back(std::move(textureArray));
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+// Forgets every entry and deletes the arrays
+//-----------------------------------------------------------------------------
+void TextureAtlas::clear()
+{
+	mEntries.clear();
+	mArrays.clear();
+	mNumBuilt = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Layers of every array
+//-----------------------------------------------------------------------------
+int TextureAtlas::getNumLayers() const
+{
+	int layers = 0;
+	for (size_t i = 0; i < mArrays.size(); i++)
+		layers += mArrays[i]->getNumLayers();
+	return layers;
+}
+
+//-----------------------------------------------------------------------------
+// Video memory of every array
+//-----------------------------------------------------------------------------
+size_t TextureAtlas::getMemorySize() const
+{
+	size_t size = 0;
+	for (size_t i = 0; i < mArrays.size(); i++)
+		size += mArrays[i]->getMemorySize();
+	return size;
+}
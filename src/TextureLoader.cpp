@@ -0,0 +1,1052 @@
+//-----------------------------------------------------------------------------
+// Texture loading and streaming service
+//-----------------------------------------------------------------------------
+#include "TextureLoader.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include "ImageDecoder.h"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	typedef std::chrono::duration<double, std::milli> Ms;
+
+	const size_t DEFAULT_SEGMENT_SIZE = 4 * 1024 * 1024;
+	const int DEFAULT_NUM_SEGMENTS = 8;
+	const size_t UPLOAD_ALIGNMENT = 64;
+
+	const int TAIL_SIZE = 64;				// levels this size and smaller are loaded up front and never evicted
+	const int MAX_STREAMING_LEVELS = 4;		// level loads in flight at once
+}
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+TextureLoader::TextureLoader(JobSystem& jobs)
+	: mJobs(jobs),
+	  mSegmentSize(DEFAULT_SEGMENT_SIZE),
+	  mNumSegments(DEFAULT_NUM_SEGMENTS),
+	  mAllowPersistent(true),
+	  mUploadBudget(0),
+	  mMemoryBudget(0),
+	  mLoading(false),
+	  mDeduped(false),
+	  mFrame(0),
+	  mReadJobs(0),
+	  mDecodeJobs(0),
+	  mCancel(false),
+	  mEmpty(std::make_shared<Texture2D>()),
+	  mMipFilter(MipGenerator::FILTER_BOX),
+	  mGammaCorrectMips(true),
+	  mResidentBytes(0),
+	  mPendingLevels(0),
+	  mStreamingLevels(0)
+{
+	mStats.requests = mStats.uniqueFiles = mStats.uniqueImages = mStats.compressedImages = 0;
+	mStats.memorySize = mStats.uploadedBytes = 0;
+	mStats.updates = 0;
+	mStats.readMs = mStats.decodeMs = 0.0;
+}
+
+//-----------------------------------------------------------------------------
+// Destructor - abandons the jobs in progress
+//-----------------------------------------------------------------------------
+TextureLoader::~TextureLoader()
+{
+	mCancel = true;
+	mRing.shutdown();	// workers waiting for a segment give up
+	mJobs.wait(mJobHandles);
+
+	for (size_t i = 0; i < mImages.size(); i++)
+		releaseSource(&mImages[i]);
+}
+
+//-----------------------------------------------------------------------------
+// Staging ring layout.  Images larger than a segment are split in bands of rows.
+//-----------------------------------------------------------------------------
+void TextureLoader::setUploadRing(size_t segmentSize, int numSegments, bool allowPersistent)
+{
+	mSegmentSize = segmentSize;
+	mNumSegments = numSegments;
+	mAllowPersistent = allowPersistent;
+}
+
+//-----------------------------------------------------------------------------
+// Normalizes a path so "textures/a.png" and "./textures/a.png" match
+//-----------------------------------------------------------------------------
+std::string TextureLoader::canonicalPath(const std::string& fileName)
+{
+	std::error_code ec;
+	std::filesystem::path path = std::filesystem::weakly_canonical(fileName, ec);
+	return ec ? fileName : path.string();
+}
+
+//-----------------------------------------------------------------------------
+// Cooked replacement of a source image, or the file name itself if there is none
+//-----------------------------------------------------------------------------
+std::string TextureLoader::cookedPath(const std::string& fileName) const
+{
+	if (mCookedDirectory.empty() || CompressedImage::isContainerFile(fileName))
+		return fileName;
+
+	std::filesystem::path cooked = std::filesystem::path(mCookedDirectory) / std::filesystem::path(fileName).stem();
+	cooked += ".dds";
+
+	std::error_code ec;
+	return std::filesystem::exists(cooked, ec) ? cooked.string() : fileName;
+}
+
+//-----------------------------------------------------------------------------
+// 64 bit FNV-1a hash of the raw file contents
+//-----------------------------------------------------------------------------
+unsigned long long TextureLoader::hashBytes(const std::vector<unsigned char>& bytes)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < bytes.size(); i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+//-----------------------------------------------------------------------------
+// Queues a texture.  Requests for a path that is already known are free.
+//-----------------------------------------------------------------------------
+TextureLoader::Handle TextureLoader::request(const std::string& fileName, bool generateMipMaps)
+{
+	if (mLoading)
+	{
+		std::cerr << "Error: texture '" << fileName << "' requested while loading" << std::endl;
+		return INVALID_HANDLE;
+	}
+
+	std::string loadPath = cookedPath(fileName);
+	std::string path = canonicalPath(loadPath);
+
+	std::map<std::string, int>::iterator it = mFileByPath.find(path);
+	int file;
+	if (it != mFileByPath.end())
+	{
+		file = it->second;
+		mFiles[file].generateMipMaps = mFiles[file].generateMipMaps || generateMipMaps;
+	}
+	else
+	{
+		File entry;
+		entry.path = loadPath;
+		entry.sourcePath = fileName;
+		entry.generateMipMaps = generateMipMaps;
+		entry.hash = 0;
+		entry.image = -1;
+		entry.loaded = false;
+		entry.reloading = false;
+
+		file = (int)mFiles.size();
+		mFiles.push_back(entry);
+		mFileTexture.push_back(mEmpty);
+		mFileByPath[path] = file;
+	}
+
+	mRequestFile.push_back(file);
+	return (Handle)mRequestFile.size() - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Reads and hashes the pending files on the pool, update() takes it from there
+//-----------------------------------------------------------------------------
+void TextureLoader::startLoading()
+{
+	if (mLoading)
+		return;
+
+	mPendingFiles.clear();
+	for (size_t f = 0; f < mFiles.size(); f++)
+	{
+		if (!mFiles[f].loaded)
+			mPendingFiles.push_back((int)f);
+	}
+	if (mPendingFiles.empty())
+		return;
+
+	if (!mRing.isValid() && !mRing.init(mSegmentSize, mNumSegments, mAllowPersistent))
+	{
+		std::cerr << "Error creating the texture upload ring" << std::endl;
+		return;
+	}
+
+	mLoading = true;
+	mDeduped = false;
+	mStats.uploadedBytes = 0;
+	mStats.updates = 0;
+	mLoadStart = Clock::now();
+
+	{
+		std::lock_guard<std::mutex> lock(mBatchMutex);
+		mReadJobs = (int)mPendingFiles.size();
+	}
+
+	for (size_t i = 0; i < mPendingFiles.size(); i++)
+	{
+		File* file = &mFiles[mPendingFiles[i]];
+		spawn([this, file]
+		{
+			std::ifstream fin(file->path, std::ios::in | std::ios::binary);
+			if (fin)
+			{
+				file->bytes.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+				file->hash = hashBytes(file->bytes);
+			}
+
+			std::lock_guard<std::mutex> lock(mBatchMutex);
+			mReadJobs--;
+			mBatchReady.notify_all();
+		});
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Jobs read files and wait for staging segments: background jobs, kept until
+// done so the destructor can wait for them
+//-----------------------------------------------------------------------------
+void TextureLoader::spawn(std::function<void()> task)
+{
+	mJobHandles.erase(std::remove_if(mJobHandles.begin(), mJobHandles.end(),
+									 [this](const JobSystem::JobHandle& job) { return mJobs.isDone(job); }),
+					  mJobHandles.end());
+	mJobHandles.push_back(mJobs.spawnBackground(task));
+}
+
+//-----------------------------------------------------------------------------
+// Content dedup of the files read (serial, cheap), then decodes or parses the
+// unique images in parallel
+//-----------------------------------------------------------------------------
+void TextureLoader::dedupFiles()
+{
+	mDeduped = true;
+	mReadDone = Clock::now();
+
+	std::vector<int> newImages;
+	for (size_t i = 0; i < mPendingFiles.size(); i++)
+	{
+		File& file = mFiles[mPendingFiles[i]];
+		file.loaded = true;
+
+		if (file.bytes.empty())
+		{
+			std::cerr << "Error loading texture '" << file.path << "'" << std::endl;
+			continue;
+		}
+
+		std::map<unsigned long long, int>::iterator it = mImageByHash.find(file.hash);
+		if (it != mImageByHash.end() && mImages[it->second].texture)	// not released
+		{
+			file.image = it->second;
+			mImages[file.image].generateMipMaps = mImages[file.image].generateMipMaps || file.generateMipMaps;
+			file.bytes.clear();
+			continue;
+		}
+
+		Image image;
+		image.index = (int)mImages.size();
+		image.file = mPendingFiles[i];
+		image.generateMipMaps = file.generateMipMaps;
+		image.keepSource = mMemoryBudget > 0;
+		image.format = CompressedImage::FORMAT_UNKNOWN;
+		image.srgb = false;
+		image.width = image.height = image.numLevels = image.tailLevel = 0;
+		image.isCompressed = false;
+		image.created = false;
+		image.residentLevel = 0;
+		image.jobPending = true;
+		image.failed = false;
+		image.jobBytes = 0;
+		image.wantedLevel = 0;
+		image.lastVisible = -1;
+		image.texture = std::make_shared<Texture2D>();
+
+		file.image = image.index;
+		mImageByHash[file.hash] = file.image;
+		newImages.push_back(file.image);
+		mImages.push_back(image);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mBatchMutex);
+		mDecodeJobs = (int)newImages.size();
+		mDecodeDone = mReadDone;
+	}
+
+	for (size_t i = 0; i < newImages.size(); i++)
+	{
+		Image* image = &mImages[newImages[i]];
+		File* file = &mFiles[image->file];
+		spawn([this, image, file]
+		{
+			if (!mCancel)
+				decodeImage(image, file);
+
+			std::lock_guard<std::mutex> lock(mBatchMutex);
+			if (--mDecodeJobs == 0)
+				mDecodeDone = Clock::now();
+			mBatchReady.notify_all();
+		});
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Worker: decodes (or parses) one image and stages its levels, all of them or
+// just the tail when streaming under a memory budget.  Broken cooked files and
+// formats the driver cannot sample fall back to the source image.
+//-----------------------------------------------------------------------------
+void TextureLoader::decodeImage(Image* image, File* file)
+{
+	bool fromSource = false;
+	if (CompressedImage::isContainerFile(file->path))
+	{
+		bool parsed = image->compressed.loadFromMemory(&file->bytes[0], file->bytes.size(), file->path);
+		std::vector<unsigned char>().swap(file->bytes);
+
+		if (parsed && !Texture2D::isFormatSupported(image->compressed.getFormat(), image->compressed.isSRGB()))
+		{
+			std::cerr << "Error: " << CompressedImage::getFormatName(image->compressed.getFormat()) << (image->compressed.isSRGB() ? " sRGB" : "")
+					  << " textures are not supported by this driver" << std::endl;
+			parsed = false;
+		}
+
+		if (parsed)
+		{
+			image->format = image->compressed.getFormat();
+			image->srgb = image->compressed.isSRGB();
+			image->width = image->compressed.getWidth();
+			image->height = image->compressed.getHeight();
+			image->numLevels = image->compressed.getNumLevels();
+			image->isCompressed = CompressedImage::getBlockBytes(image->format) > 0;
+		}
+		else
+		{
+			image->compressed = CompressedImage();
+			if (file->sourcePath == file->path)
+			{
+				Batch batch;
+				batch.segment = -1;
+				batch.used = 0;
+				submitFailed(batch, image);
+				return;
+			}
+			fromSource = true;
+		}
+	}
+
+	if (image->numLevels == 0)
+	{
+		int width = 0, height = 0;
+		bool decoded = false;
+		if (fromSource)
+		{
+			decoded = ImageDecoder::loadFile(file->sourcePath, image->pixels, width, height, false);
+		}
+		else if (ImageDecoder::getImageSize(&file->bytes[0], file->bytes.size(), width, height) && width > 0 && height > 0)
+		{
+			// Nothing to build from it or to keep: one copy, straight into the ring
+			if (!image->generateMipMaps && !image->keepSource && (size_t)width * height * 4 <= mRing.getSegmentSize())
+			{
+				if (!decodeToRing(image, file, width, height))
+					std::cerr << "Error decoding texture '" << file->path << "'" << std::endl;
+				std::vector<unsigned char>().swap(file->bytes);
+				return;
+			}
+
+			image->pixels.resize((size_t)width * height * 4);
+			decoded = ImageDecoder::decodeImage(&file->bytes[0], file->bytes.size(), &image->pixels[0], (size_t)width * 4, false);
+		}
+		std::vector<unsigned char>().swap(file->bytes);
+
+		if (!decoded)
+		{
+			std::cerr << "Error decoding texture '" << (fromSource ? file->sourcePath : file->path) << "'" << std::endl;
+			std::vector<unsigned char>().swap(image->pixels);
+			Batch batch;
+			batch.segment = -1;
+			batch.used = 0;
+			submitFailed(batch, image);
+			return;
+		}
+
+		// Filtering commutes with the vertical flip, which is folded into the copies to the ring
+		if (image->generateMipMaps)
+			MipGenerator::generate(&image->pixels[0], width, height, mMipFilter, mGammaCorrectMips, image->mipLevels);
+
+		image->format = CompressedImage::FORMAT_RGBA8;
+		image->width = width;
+		image->height = height;
+		image->numLevels = 1 + (int)image->mipLevels.size();
+	}
+
+	image->tailLevel = 0;
+	while (image->tailLevel < image->numLevels - 1 &&
+		   std::max(image->width >> image->tailLevel, image->height >> image->tailLevel) > TAIL_SIZE)
+		image->tailLevel++;
+
+	stageLevels(image, image->numLevels - 1, image->keepSource ? image->tailLevel : 0);
+
+	if (!image->keepSource)
+		releaseSource(image);
+}
+
+//-----------------------------------------------------------------------------
+// Worker: decodes a single level image into a ring segment, bottom row first,
+// as its only job.  False when it could not be decoded.
+//-----------------------------------------------------------------------------
+bool TextureLoader::decodeToRing(Image* image, const File* file, int width, int height)
+{
+	Batch batch;
+	batch.segment = mRing.acquire();
+	batch.used = 0;
+	if (batch.segment < 0)
+		return true;	// shut down
+
+	size_t rowBytes = (size_t)width * 4;
+	if (!ImageDecoder::decodeImage(&file->bytes[0], file->bytes.size(), mRing.getData(batch.segment), rowBytes, true))
+	{
+		submitFailed(batch, image);	// hands the segment back
+		return false;
+	}
+
+	image->format = CompressedImage::FORMAT_RGBA8;
+	image->width = width;
+	image->height = height;
+	image->numLevels = 1;
+	image->tailLevel = 0;
+
+	Upload upload;
+	upload.image = image->index;
+	upload.level = 0;
+	upload.y = 0;
+	upload.width = width;
+	upload.height = height;
+	upload.offset = 0;
+	upload.size = rowBytes * height;
+	upload.levelDone = true;
+	upload.jobDone = true;
+	upload.failed = false;
+	batch.uploads.push_back(upload);
+	batch.used = upload.size;
+	submit(batch);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Worker: stages levels coarsest..finest, coarse ones first, as one job.
+// False when a level could not be staged, the levels before it still are.
+//-----------------------------------------------------------------------------
+bool TextureLoader::stageLevels(Image* image, int coarsestLevel, int finestLevel)
+{
+	Batch batch;
+	batch.segment = -1;
+	batch.used = 0;
+
+	for (int level = coarsestLevel; level >= finestLevel; level--)
+	{
+		if (!streamLevel(batch, image, level))
+		{
+			submitFailed(batch, image);
+			return false;
+		}
+		batch.uploads.back().levelDone = true;
+	}
+
+	batch.uploads.back().jobDone = true;
+	submit(batch);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Worker: copies the rows of a level into ring segments, acquiring a new
+// segment whenever the current one is full.  Rows are block rows for
+// compressed levels.
+//-----------------------------------------------------------------------------
+bool TextureLoader::streamLevel(Batch& batch, Image* image, int level)
+{
+	LevelSource source = getLevelSource(image, level);
+	size_t segmentSize = mRing.getSegmentSize();
+	if (source.rowBytes > segmentSize)
+	{
+		std::cerr << "Error: texture rows of " << source.rowBytes << " bytes do not fit the upload segments" << std::endl;
+		return false;
+	}
+
+	int numRows = (source.height + source.blockHeight - 1) / source.blockHeight;
+	int row = 0;
+	while (row < numRows)
+	{
+		if (batch.segment < 0)
+		{
+			batch.segment = mRing.acquire();
+			batch.used = 0;
+			if (batch.segment < 0)
+				return false;
+		}
+
+		int count = std::min(numRows - row, (int)((segmentSize - batch.used) / source.rowBytes));
+		if (count == 0)
+		{
+			submit(batch);
+			continue;
+		}
+
+		unsigned char* dest = mRing.getData(batch.segment) + batch.used;
+		for (int r = 0; r < count; r++)
+		{
+			int from = source.flip ? numRows - 1 - (row + r) : row + r;
+			memcpy(dest + r * source.rowBytes, source.data + from * source.rowBytes, source.rowBytes);
+		}
+
+		Upload upload;
+		upload.image = image->index;
+		upload.level = level;
+		upload.y = row * source.blockHeight;
+		upload.width = source.width;
+		upload.height = std::min(count * source.blockHeight, source.height - upload.y);
+		upload.offset = batch.used;
+		upload.size = count * source.rowBytes;
+		upload.levelDone = false;
+		upload.jobDone = false;
+		upload.failed = false;
+		batch.uploads.push_back(upload);
+
+		batch.used = std::min(segmentSize, (batch.used + upload.size + UPLOAD_ALIGNMENT - 1) & ~(UPLOAD_ALIGNMENT - 1));
+		row += count;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Where the rows of a level are kept: stb images are top row first and get
+// flipped on the way to the ring, cooked ones are stored bottom row first
+//-----------------------------------------------------------------------------
+TextureLoader::LevelSource TextureLoader::getLevelSource(const Image* image, int level) const
+{
+	LevelSource source;
+	source.blockHeight = 1;
+	source.flip = true;
+
+	if (image->pixels.empty())
+	{
+		const CompressedImage::Level& cooked = image->compressed.getLevel(level);
+		source.data = image->compressed.getData() + cooked.offset;
+		source.width = cooked.width;
+		source.height = cooked.height;
+		source.blockHeight = image->isCompressed ? 4 : 1;
+		source.flip = false;
+	}
+	else if (level == 0)
+	{
+		source.data = &image->pixels[0];
+		source.width = image->width;
+		source.height = image->height;
+	}
+	else
+	{
+		const MipGenerator::Level& mip = image->mipLevels[level - 1];
+		source.data = &mip.pixels[0];
+		source.width = mip.width;
+		source.height = mip.height;
+	}
+
+	source.rowBytes = CompressedImage::getLevelSize(image->format, source.width, source.blockHeight);
+	return source;
+}
+
+//-----------------------------------------------------------------------------
+// Frees the system memory copy of an image
+//-----------------------------------------------------------------------------
+void TextureLoader::releaseSource(Image* image)
+{
+	std::vector<unsigned char>().swap(image->pixels);
+	std::vector<MipGenerator::Level>().swap(image->mipLevels);
+	image->compressed = CompressedImage();
+}
+
+//-----------------------------------------------------------------------------
+// Worker: hands a filled segment to the GL thread and starts a new batch
+//-----------------------------------------------------------------------------
+void TextureLoader::submit(Batch& batch)
+{
+	std::lock_guard<std::mutex> lock(mBatchMutex);
+	mBatches.push_back(batch);
+	mBatchReady.notify_all();
+
+	batch.segment = -1;
+	batch.used = 0;
+	batch.uploads.clear();
+}
+
+//-----------------------------------------------------------------------------
+// Worker: ends a job that failed, after what it staged so far (the batch may
+// have no segment), so the GL thread clears its pending job
+//-----------------------------------------------------------------------------
+void TextureLoader::submitFailed(Batch& batch, const Image* image)
+{
+	Upload upload;
+	upload.image = image->index;
+	upload.level = upload.y = upload.width = upload.height = 0;
+	upload.offset = upload.size = 0;
+	upload.levelDone = false;
+	upload.jobDone = true;
+	upload.failed = true;
+	batch.uploads.push_back(upload);
+	submit(batch);
+}
+
+//-----------------------------------------------------------------------------
+// Issues the copies of the staged segments, oldest first, until the upload
+// budget is spent, then streams levels in and out of the memory budget.
+//-----------------------------------------------------------------------------
+bool TextureLoader::update()
+{
+	if (!mRing.isValid())
+		return false;	// nothing was ever loaded
+
+	if (mLoading)
+		mStats.updates++;
+	mRing.update();
+
+	if (mLoading && !mDeduped)
+	{
+		std::unique_lock<std::mutex> lock(mBatchMutex);
+		bool readDone = mReadJobs == 0;
+		lock.unlock();
+		if (readDone)
+			dedupFiles();
+	}
+
+	bool completed = false;
+	size_t uploaded = 0;
+	while (mUploadBudget == 0 || uploaded < mUploadBudget)
+	{
+		Batch batch;
+		{
+			std::lock_guard<std::mutex> lock(mBatchMutex);
+			if (mBatches.empty())
+				break;
+			batch.uploads.swap(mBatches.front().uploads);
+			batch.segment = mBatches.front().segment;
+			batch.used = mBatches.front().used;
+			mBatches.pop_front();
+		}
+
+		completed = uploadBatch(batch) || completed;
+		uploaded += batch.used;
+		mStats.uploadedBytes += batch.used;
+	}
+
+	updateResidency();
+	mFrame++;
+
+	if (completed)
+		publish();
+
+	if (mLoading && mDeduped)
+	{
+		bool done;
+		{
+			std::lock_guard<std::mutex> lock(mBatchMutex);
+			done = mDecodeJobs == 0 && mBatches.empty();
+		}
+		if (done)
+		{
+			finishLoading();
+			completed = true;
+		}
+	}
+
+	return completed;
+}
+
+//-----------------------------------------------------------------------------
+// Uploads one segment.  Textures are created on their first band, levels
+// allocated on theirs, and the base level moves down once a level is complete.
+// True when a texture got its first level.
+//-----------------------------------------------------------------------------
+bool TextureLoader::uploadBatch(Batch& batch)
+{
+	// Storage first: allocating with NULL data must not see the unpack buffer
+	for (size_t i = 0; i < batch.uploads.size(); i++)
+	{
+		const Upload& upload = batch.uploads[i];
+		Image& image = mImages[upload.image];
+		if (upload.failed || (!image.created && !image.jobPending))
+			continue;	// nothing staged, or creation failed
+
+		if (!image.created)
+		{
+			image.created = image.texture->create(image.format, image.srgb, image.width, image.height, image.numLevels);
+			image.residentLevel = image.numLevels;
+			if (!image.created)
+			{
+				image.jobPending = false;
+				continue;
+			}
+		}
+
+		if (upload.y == 0)
+			image.texture->allocateLevel(upload.level);
+	}
+
+	bool firstLevel = false;
+	const unsigned char* base = batch.segment >= 0 ? (const unsigned char*)mRing.beginUpload(batch.segment) : NULL;
+	for (size_t i = 0; i < batch.uploads.size(); i++)
+	{
+		const Upload& upload = batch.uploads[i];
+		Image& image = mImages[upload.image];
+		if (upload.failed)
+		{
+			// get() keeps the levels it has, reload() may try the file again
+			if (image.jobBytes > 0)
+				mStreamingLevels--;
+			image.jobPending = false;
+			image.jobBytes = 0;
+			image.failed = true;
+			continue;
+		}
+		if (!image.created)
+			continue;
+
+		image.texture->uploadRegion(upload.level, upload.y, upload.width, upload.height, base + upload.offset, upload.size);
+		if (upload.levelDone)
+		{
+			firstLevel = firstLevel || image.residentLevel == image.numLevels;
+			image.texture->setBaseLevel(upload.level);
+			image.residentLevel = upload.level;
+		}
+		if (upload.jobDone)
+		{
+			if (image.jobBytes > 0)
+				mStreamingLevels--;
+			image.jobPending = false;
+			image.jobBytes = 0;
+		}
+	}
+	if (batch.segment >= 0)
+		mRing.endUpload(batch.segment);
+
+	return firstLevel;
+}
+
+//-----------------------------------------------------------------------------
+// Streams in one finer level for the textures that need it most (largest gap
+// between wanted and resident level first), evicting unneeded levels when the
+// budget is full.  Textures that were not seen this frame only need their tail.
+//-----------------------------------------------------------------------------
+void TextureLoader::updateResidency()
+{
+	mResidentBytes = 0;
+	mPendingLevels = 0;
+	for (size_t i = 0; i < mImages.size(); i++)
+	{
+		if (mImages[i].created)
+			mResidentBytes += mImages[i].texture->getMemorySize();
+	}
+	if (mMemoryBudget == 0)
+		return;
+
+	size_t loadingBytes = 0;
+	std::vector<std::pair<int, int> > loads;	// (missing levels, image)
+	for (size_t i = 0; i < mImages.size(); i++)
+	{
+		const Image& image = mImages[i];
+		if (!image.created || !image.keepSource || image.failed)
+			continue;
+
+		loadingBytes += image.jobBytes;
+		int missing = image.residentLevel - getWantedLevel(image);
+		if (missing <= 0)
+			continue;
+
+		mPendingLevels += missing;
+		if (!image.jobPending)
+			loads.push_back(std::make_pair(missing, (int)i));
+	}
+	std::sort(loads.begin(), loads.end(), std::greater<std::pair<int, int> >());
+
+	for (size_t i = 0; i < loads.size() && mStreamingLevels < MAX_STREAMING_LEVELS; i++)
+	{
+		Image* image = &mImages[loads[i].second];
+		int level = image->residentLevel - 1;
+		size_t bytes = getLevelSize(*image, level);
+		while (mResidentBytes + loadingBytes + bytes > mMemoryBudget && evictLevel(image->index))
+			;
+		if (mResidentBytes + loadingBytes + bytes > mMemoryBudget)
+			continue;	// the budget is full of levels in use, a smaller level may still fit
+
+		image->jobPending = true;
+		image->jobBytes = bytes;
+		loadingBytes += bytes;
+		mStreamingLevels++;
+		spawn([this, image, level]
+		{
+			if (!mCancel)
+				stageLevels(image, level, level);
+		});
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Frees the finest level of the least recently seen texture that has more
+// than it needs.  False when there is nothing to evict.
+//-----------------------------------------------------------------------------
+bool TextureLoader::evictLevel(int keepImage)
+{
+	int victim = -1;
+	for (size_t i = 0; i < mImages.size(); i++)
+	{
+		const Image& image = mImages[i];
+		if ((int)i == keepImage || !image.created || !image.keepSource || image.jobPending ||
+			image.residentLevel >= getWantedLevel(image))
+			continue;
+
+		if (victim < 0 || image.lastVisible < mImages[victim].lastVisible ||
+			(image.lastVisible == mImages[victim].lastVisible &&
+			 getLevelSize(image, image.residentLevel) > getLevelSize(mImages[victim], mImages[victim].residentLevel)))
+			victim = (int)i;
+	}
+	if (victim < 0)
+		return false;
+
+	Image& image = mImages[victim];
+	int level = image.residentLevel;
+	image.texture->setBaseLevel(level + 1);
+	image.texture->freeLevel(level);
+	image.residentLevel = level + 1;
+	mResidentBytes -= getLevelSize(image, level);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Finest level a texture needs now, never coarser than its tail
+//-----------------------------------------------------------------------------
+int TextureLoader::getWantedLevel(const Image& image) const
+{
+	if (image.lastVisible != mFrame)
+		return image.tailLevel;
+	return std::min(image.wantedLevel, image.tailLevel);
+}
+
+//-----------------------------------------------------------------------------
+// Video memory of one level
+//-----------------------------------------------------------------------------
+size_t TextureLoader::getLevelSize(const Image& image, int level)
+{
+	return CompressedImage::getLevelSize(image.format, std::max(1, image.width >> level), std::max(1, image.height >> level));
+}
+
+//-----------------------------------------------------------------------------
+// Records the finest level a texture needs this frame: the one whose texels
+// are about the size of a pixel, like the sampler would pick (rounded down
+// since trilinear filtering also reads the next finer level)
+//-----------------------------------------------------------------------------
+void TextureLoader::markVisible(Handle handle, float screenPixels)
+{
+	if (handle < 0 || handle >= (Handle)mRequestFile.size())
+		return;
+
+	int index = mFiles[mRequestFile[handle]].image;
+	if (index < 0 || !mImages[index].created)
+		return;
+
+	Image& image = mImages[index];
+	int level = image.numLevels - 1;
+	if (screenPixels > 0.0f)
+	{
+		float texels = (float)std::max(image.width, image.height);
+		level = std::max(0, std::min(level, (int)floorf(log2f(texels / screenPixels))));
+	}
+
+	if (image.lastVisible != mFrame)
+		image.wantedLevel = level;
+	else
+		image.wantedLevel = std::min(image.wantedLevel, level);
+	image.lastVisible = mFrame;
+}
+
+//-----------------------------------------------------------------------------
+// Points every file at its texture once that has a level
+//-----------------------------------------------------------------------------
+void TextureLoader::publish()
+{
+	for (size_t f = 0; f < mFiles.size(); f++)
+	{
+		int image = mFiles[f].image;
+		bool ready = image >= 0 && mImages[image].created && mImages[image].residentLevel < mImages[image].numLevels;
+		if (ready || !mFiles[f].reloading)
+			mFileTexture[f] = ready ? mImages[image].texture : mEmpty;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Every image of the batch is decoded and its initial levels uploaded
+//-----------------------------------------------------------------------------
+void TextureLoader::finishLoading()
+{
+	mLoading = false;
+	for (size_t i = 0; i < mPendingFiles.size(); i++)
+		mFiles[mPendingFiles[i]].reloading = false;
+	publish();
+
+	mStats.requests = (int)mRequestFile.size();
+	mStats.uniqueFiles = (int)mFiles.size();
+	mStats.uniqueImages = (int)mImages.size();
+	mStats.compressedImages = 0;
+	mStats.memorySize = 0;
+	for (size_t i = 0; i < mImages.size(); i++)
+	{
+		if (mImages[i].isCompressed)
+			mStats.compressedImages++;
+		if (mImages[i].texture)	// not released
+			mStats.memorySize += mImages[i].texture->getMemorySize();
+	}
+	mStats.readMs = Ms(mReadDone - mLoadStart).count();
+	mStats.decodeMs = Ms(mDecodeDone - mReadDone).count();
+
+	std::cout << "Textures: " << mStats.requests << " requests, " << mStats.uniqueFiles << " files, "
+			  << mStats.uniqueImages << " unique images (" << mStats.compressedImages << " block compressed, "
+			  << mStats.memorySize / (1024 * 1024) << " MB";
+	if (mMemoryBudget > 0)
+		std::cout << " resident of a " << mMemoryBudget / (1024 * 1024) << " MB budget";
+	std::cout << ") on " << mJobs.getNumWorkers() << " threads ("
+			  << "read " << mStats.readMs << " ms, "
+			  << "decode+mips " << mStats.decodeMs << " ms, "
+			  << mStats.uploadedBytes / (1024 * 1024) << " MB through " << (mRing.isPersistent() ? "persistent" : "orphaned")
+			  << " pixel buffers, done after " << Ms(Clock::now() - mLoadStart).count() << " ms / "
+			  << mStats.updates << " updates)" << std::endl;
+}
+
+//-----------------------------------------------------------------------------
+// Loads every pending file before returning
+//-----------------------------------------------------------------------------
+void TextureLoader::loadAll()
+{
+	startLoading();
+
+	size_t budget = mUploadBudget;
+	mUploadBudget = 0;
+	while (mLoading)
+	{
+		if (update())
+			continue;
+
+		// Until a worker submits a segment; wake up now and then to recycle the fenced ones
+		std::unique_lock<std::mutex> lock(mBatchMutex);
+		mBatchReady.wait_for(lock, std::chrono::milliseconds(1), [this] { return !mBatches.empty(); });
+	}
+	mUploadBudget = budget;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the texture of a request
+//-----------------------------------------------------------------------------
+std::shared_ptr<Texture2D> TextureLoader::get(Handle handle) const
+{
+	if (handle < 0 || handle >= (Handle)mRequestFile.size())
+		return std::shared_ptr<Texture2D>();
+
+	return mFileTexture[mRequestFile[handle]];	// binds texture 0 until ready, like a Texture2D that failed
+}
+
+//-----------------------------------------------------------------------------
+// Forgets the texture and the decoded levels of the image of a request.  The
+// GL texture goes away with the last shared pointer to it.
+//-----------------------------------------------------------------------------
+void TextureLoader::release(Handle handle)
+{
+	if (mLoading || handle < 0 || handle >= (Handle)mRequestFile.size())
+		return;
+
+	int index = mFiles[mRequestFile[handle]].image;
+	if (index < 0 || !mImages[index].created || mImages[index].jobPending)
+		return;
+
+	Image& image = mImages[index];
+	image.created = false;
+	image.texture.reset();
+	releaseSource(&image);
+	publish();
+}
+
+//-----------------------------------------------------------------------------
+// Files read from a path, or cooked from it
+//-----------------------------------------------------------------------------
+std::vector<int> TextureLoader::findFiles(const std::string& fileName) const
+{
+	std::string path = canonicalPath(fileName);
+	std::vector<int> files;
+	for (size_t f = 0; f < mFiles.size(); f++)
+	{
+		if (canonicalPath(mFiles[f].path) == path || canonicalPath(mFiles[f].sourcePath) == path)
+			files.push_back((int)f);
+	}
+	return files;
+}
+
+//-----------------------------------------------------------------------------
+// Marks the files read from a path as not loaded.  An image no other file
+// uses is forgotten (its texture lives on in get() until replaced), so the
+// new contents are decoded even when they hash the same.  An image whose job
+// failed has no job pending, so a broken file is read again once fixed.
+//-----------------------------------------------------------------------------
+bool TextureLoader::reload(const std::string& fileName)
+{
+	if (mLoading)
+		return false;
+
+	std::vector<int> files = findFiles(fileName);
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		int index = mFiles[files[i]].image;
+		if (index >= 0 && mImages[index].jobPending)
+			return false;
+	}
+
+	std::string path = canonicalPath(fileName);
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		File& file = mFiles[files[i]];
+		if (canonicalPath(file.sourcePath) == path)
+			file.path = file.sourcePath;	// newer than its cooked copy
+		int index = file.image;
+		file.image = -1;
+		file.loaded = false;
+		file.reloading = true;
+		file.hash = 0;
+		std::vector<unsigned char>().swap(file.bytes);
+		if (index < 0)
+			continue;
+
+		bool shared = false;
+		for (size_t f = 0; f < mFiles.size() && !shared; f++)
+			shared = mFiles[f].image == index;
+		if (shared)
+			continue;
+
+		for (std::map<unsigned long long, int>::iterator it = mImageByHash.begin(); it != mImageByHash.end(); )
+		{
+			if (it->second == index)
+				it = mImageByHash.erase(it);
+			else
+				++it;
+		}
+		Image& image = mImages[index];
+		image.created = false;
+		image.texture.reset();
+		releaseSource(&image);
+	}
+
+	return !files.empty();
+}
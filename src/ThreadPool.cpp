@@ -0,0 +1,85 @@
+//-----------------------------------------------------------------------------
+// Minimal fixed size thread pool
+//-----------------------------------------------------------------------------
+#include "ThreadPool.h"
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+// Constructor - starts the worker threads
+//-----------------------------------------------------------------------------
+ThreadPool::ThreadPool(unsigned numThreads)
+	: mActive(0),
+	  mStop(false)
+{
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned i = 0; i < numThreads; i++)
+		mWorkers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+//-----------------------------------------------------------------------------
+// Destructor - finishes the queued tasks and joins the workers
+//-----------------------------------------------------------------------------
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mTaskReady.notify_all();
+
+	for (size_t i = 0; i < mWorkers.size(); i++)
+		mWorkers[i].join();
+}
+
+//-----------------------------------------------------------------------------
+// Queues a task for the next free worker
+//-----------------------------------------------------------------------------
+void ThreadPool::enqueue(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mTasks.push_back(task);
+	}
+	mTaskReady.notify_one();
+}
+
+//-----------------------------------------------------------------------------
+// Blocks until the queue is empty and no worker is busy
+//-----------------------------------------------------------------------------
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mAllDone.wait(lock, [this] { return mTasks.empty() && mActive == 0; });
+}
+
+//-----------------------------------------------------------------------------
+// Worker thread body
+//-----------------------------------------------------------------------------
+void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mTaskReady.wait(lock, [this] { return mStop || !mTasks.empty(); });
+			if (mTasks.empty())
+				return;		// mStop and nothing left to do
+
+			task = mTasks.front();
+			mTasks.pop_front();
+			mActive++;
+		}
+
+		task();
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mActive--;
+			if (mTasks.empty() && mActive == 0)
+				mAllDone.notify_all();
+		}
+	}
+}
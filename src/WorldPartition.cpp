@@ -0,0 +1,592 @@
+//-----------------------------------------------------------------------------
+// World partition : a grid of scene cells streamed in around the camera
+//-----------------------------------------------------------------------------
+#include "WorldPartition.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "glm/gtc/matrix_transform.hpp"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const char* INDEX_FILE = "world.index";
+	const char* PALETTE_FILE = "palette.scene";
+
+	// Something to start a job for, nearest first
+	struct Request
+	{
+		float priority;
+		bool isCell;
+		long long cell;
+		int mesh;
+
+		bool operator < (const Request& rhs) const		{ return priority < rhs.priority; }
+	};
+}
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+WorldPartition::WorldPartition(JobSystem& jobs)
+	: mJobs(jobs),
+	  mOpen(false),
+	  mCellSize(1.0f),
+	  mMinX(0), mMinZ(0), mMaxX(-1), mMaxZ(-1),
+	  mLoadRadius(100.0f),
+	  mUnloadRadius(120.0f),
+	  mIoBudget(4),
+	  mUploadBudget(4 * 1024 * 1024),
+	  mMaxMeshes(INT_MAX),
+	  mWarnedMaxMeshes(false)
+{
+	mStats = Stats();
+}
+
+//-----------------------------------------------------------------------------
+// Destructor
+//-----------------------------------------------------------------------------
+WorldPartition::~WorldPartition()
+{
+	close();
+}
+
+//-----------------------------------------------------------------------------
+// Reads the index and the palette
+//-----------------------------------------------------------------------------
+bool WorldPartition::open(const std::string& directory)
+{
+	close();
+
+	const std::string indexFile = (std::filesystem::path(directory) / INDEX_FILE).string();
+	std::ifstream fin(indexFile);
+	if (!fin)
+	{
+		std::cerr << "Error opening world index '" << indexFile << "'" << std::endl;
+		return false;
+	}
+
+	bool hasSize = false, hasCells = false;
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(fin, line))
+	{
+		lineNumber++;
+		std::string::size_type comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+
+		std::istringstream tokens(line);
+		std::string statement;
+		if (!(tokens >> statement))
+			continue;
+
+		bool ok;
+		if (statement == "cellsize")
+			ok = hasSize = (tokens >> mCellSize) && mCellSize > 0.0f;
+		else if (statement == "cells")
+			ok = hasCells = (tokens >> mMinX >> mMinZ >> mMaxX >> mMaxZ) && mMinX <= mMaxX && mMinZ <= mMaxZ;
+		else
+			ok = false;
+		if (!ok)
+		{
+			std::cerr << "Error in world index '" << indexFile << "' line " << lineNumber << ": " << line << std::endl;
+			return false;
+		}
+	}
+	if (!hasSize || !hasCells)
+	{
+		std::cerr << "Error in world index '" << indexFile << "': cellsize and cells are required" << std::endl;
+		return false;
+	}
+
+	// Cells refer to the palette by file and by name
+	if (!mPalette.load((std::filesystem::path(directory) / PALETTE_FILE).string()))
+		return false;
+	if (mPalette.getMaterials().empty())
+		mPalette.addMaterial(SceneFile::makeMaterial("default"));
+	for (size_t t = 0; t < mPalette.getTextures().size(); t++)
+		mPaletteTextures[mPalette.getTextures()[t]] = (int)t;
+	for (size_t m = 0; m < mPalette.getMaterials().size(); m++)
+		mPaletteMaterials[mPalette.getMaterials()[m].name] = (int)m;
+
+	mDirectory = directory;
+	mOpen = true;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Drops every cell and mesh, once their jobs are done
+//-----------------------------------------------------------------------------
+void WorldPartition::close()
+{
+	for (auto& entry : mCells)
+		mJobs.wait(entry.second.job);
+	for (size_t m = 0; m < mMeshes.size(); m++)
+		mJobs.wait(mMeshes[m].job);
+	mJobs.wait(mOrphanJobs);
+
+	mCells.clear();
+	mMeshes.clear();
+	mFreeMeshSlots.clear();
+	mMeshIndex.clear();
+	mOrphanJobs.clear();
+	mInstances.clear();
+	mPalette.clear();
+	mPaletteTextures.clear();
+	mPaletteMaterials.clear();
+	mStats = Stats();
+	mWarnedMaxMeshes = false;
+	mOpen = false;
+}
+
+//-----------------------------------------------------------------------------
+// The unload radius is kept beyond the load radius
+//-----------------------------------------------------------------------------
+void WorldPartition::setRadii(float loadRadius, float unloadRadius)
+{
+	mLoadRadius = std::max(loadRadius, 0.0f);
+	mUnloadRadius = std::max(unloadRadius, mLoadRadius);
+}
+
+//-----------------------------------------------------------------------------
+// Streams around the camera
+//-----------------------------------------------------------------------------
+bool WorldPartition::update(const glm::vec3& cameraPosition)
+{
+	if (!mOpen)
+		return false;
+
+	Clock::time_point start = Clock::now();
+
+	pollJobs();
+	bool changed = unloadFar(cameraPosition);
+	queueNear(cameraPosition);
+	startJobs();
+	uploadMeshes();
+	changed = finishCells() || changed;
+	freeUnusedMeshes();
+
+	if (changed)
+	{
+		mInstances.clear();
+		for (const auto& entry : mCells)
+		{
+			if (entry.second.state == CELL_LOADED)
+				mInstances.insert(mInstances.end(), entry.second.instances.begin(), entry.second.instances.end());
+		}
+	}
+
+	mStats.loadedCells = 0;
+	mStats.pendingCells = 0;
+	mStats.cpuBytes = mInstances.capacity() * sizeof(Instance);
+	for (const auto& entry : mCells)
+	{
+		if (entry.second.state == CELL_LOADED)
+			mStats.loadedCells++;
+		else
+			mStats.pendingCells++;
+		mStats.cpuBytes += entry.second.instances.capacity() * sizeof(Instance);
+	}
+	mStats.meshes = 0;
+	mStats.gpuBytes = 0;
+	for (const MeshSlot& slot : mMeshes)
+	{
+		if (slot.mesh && (slot.state == MESH_PARSED || slot.state == MESH_UPLOADED))
+		{
+			mStats.meshes++;
+			mStats.cpuBytes += slot.mesh->getCpuMemorySize() + slot.occluder->capacity() * sizeof(glm::vec3);
+			mStats.gpuBytes += slot.mesh->getGpuMemorySize();
+		}
+	}
+	mStats.jobsInFlight = countJobsInFlight();
+	mStats.updateMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	return changed;
+}
+
+//-----------------------------------------------------------------------------
+// Cells of the world, from the index
+//-----------------------------------------------------------------------------
+void WorldPartition::getCellRange(int& minX, int& minZ, int& maxX, int& maxZ) const
+{
+	minX = mMinX;
+	minZ = mMinZ;
+	maxX = mMaxX;
+	maxZ = mMaxZ;
+}
+
+//-----------------------------------------------------------------------------
+// cell_<x>_<z>.sceneb in the world directory
+//-----------------------------------------------------------------------------
+std::string WorldPartition::cellFileName(int x, int z) const
+{
+	return (std::filesystem::path(mDirectory) / ("cell_" + std::to_string(x) + "_" + std::to_string(z) + ".sceneb")).string();
+}
+
+//-----------------------------------------------------------------------------
+// From the position to the nearest point of the cell, on the ground plane
+//-----------------------------------------------------------------------------
+float WorldPartition::cellDistance(int x, int z, const glm::vec3& position) const
+{
+	float dx = std::max(std::max(x * mCellSize - position.x, position.x - (x + 1) * mCellSize), 0.0f);
+	float dz = std::max(std::max(z * mCellSize - position.z, position.z - (z + 1) * mCellSize), 0.0f);
+	return std::sqrt(dx * dx + dz * dz);
+}
+
+//-----------------------------------------------------------------------------
+// Background job : loads a cell file and builds its instances.  Textures and
+// materials are looked up in the palette, which does not change while open.
+//-----------------------------------------------------------------------------
+void WorldPartition::readCell(const std::string& fileName, CellData& data) const
+{
+	std::error_code ec;
+	if (!std::filesystem::exists(fileName, ec))
+		return;		// empty cell
+
+	SceneFile scene;
+	if (!scene.load(fileName))
+		return;
+
+	std::vector<int> textures(scene.getTextures().size(), -1);
+	for (size_t t = 0; t < textures.size(); t++)
+	{
+		std::unordered_map<std::string, int>::const_iterator found = mPaletteTextures.find(scene.getTextures()[t]);
+		if (found != mPaletteTextures.end())
+			textures[t] = found->second;
+		else
+			std::cerr << "World cell '" << fileName << "': texture " << scene.getTextures()[t] << " is not in the palette" << std::endl;
+	}
+	std::vector<int> materials(scene.getMaterials().size(), 0);
+	for (size_t m = 0; m < materials.size(); m++)
+	{
+		std::unordered_map<std::string, int>::const_iterator found = mPaletteMaterials.find(scene.getMaterials()[m].name);
+		if (found != mPaletteMaterials.end())
+			materials[m] = found->second;
+	}
+
+	data.meshes = scene.getMeshes();
+	data.instances.resize(scene.getInstances().size());
+	for (size_t i = 0; i < data.instances.size(); i++)
+	{
+		const SceneFile::Instance& source = scene.getInstances()[i];
+		Instance& instance = data.instances[i];
+		instance.mesh = nullptr;
+		instance.occluder = nullptr;
+		instance.meshId = source.mesh;
+		instance.texture = source.texture >= 0 ? textures[source.texture] : -1;
+		instance.material = materials[source.material];
+		instance.worldMatrix = glm::translate(glm::mat4(1.0f), source.position) * glm::mat4_cast(source.rotation)
+							 * glm::scale(glm::mat4(1.0f), source.scale);
+		instance.normalMatrix = glm::transpose(glm::inverse(glm::mat3(instance.worldMatrix)));
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Cells read : their meshes are needed.  Meshes parsed : ready to upload.
+//-----------------------------------------------------------------------------
+void WorldPartition::pollJobs()
+{
+	for (auto& entry : mCells)
+	{
+		Cell& cell = entry.second;
+		if (cell.state != CELL_READING || !mJobs.isDone(cell.job))
+			continue;
+
+		cell.job.reset();
+		for (const std::string& fileName : cell.data->meshes)
+			cell.meshes.push_back(acquireMesh(fileName));
+		cell.instances.swap(cell.data->instances);
+		cell.data.reset();
+		cell.state = CELL_MESHES;
+	}
+
+	for (MeshSlot& slot : mMeshes)
+	{
+		if (slot.state != MESH_PARSING || !mJobs.isDone(slot.job))
+			continue;
+
+		slot.job.reset();
+		slot.state = slot.mesh->getCpuMemorySize() > 0 ? MESH_PARSED : MESH_FAILED;
+	}
+
+	mOrphanJobs.erase(std::remove_if(mOrphanJobs.begin(), mOrphanJobs.end(),
+									 [this](const JobSystem::JobHandle& job) { return mJobs.isDone(job); }),
+					  mOrphanJobs.end());
+}
+
+//-----------------------------------------------------------------------------
+// Drops the cells past the unload radius; true if one was drawn
+//-----------------------------------------------------------------------------
+bool WorldPartition::unloadFar(const glm::vec3& position)
+{
+	bool changed = false;
+	for (auto it = mCells.begin(); it != mCells.end(); )
+	{
+		Cell& cell = it->second;
+		cell.distance = cellDistance(cell.x, cell.z, position);
+		if (cell.distance <= mUnloadRadius)
+		{
+			++it;
+			continue;
+		}
+
+		// A read in progress finishes on its own, its data is dropped with the job
+		if (cell.job)
+			mOrphanJobs.push_back(cell.job);
+		if (cell.state == CELL_LOADED)
+		{
+			changed = true;
+			mStats.cellUnloads++;
+		}
+		releaseMeshes(cell);
+		it = mCells.erase(it);
+	}
+	return changed;
+}
+
+//-----------------------------------------------------------------------------
+// Queues the cells of the world within the load radius
+//-----------------------------------------------------------------------------
+void WorldPartition::queueNear(const glm::vec3& position)
+{
+	int minX = std::max(mMinX, (int)std::floor((position.x - mLoadRadius) / mCellSize));
+	int maxX = std::min(mMaxX, (int)std::floor((position.x + mLoadRadius) / mCellSize));
+	int minZ = std::max(mMinZ, (int)std::floor((position.z - mLoadRadius) / mCellSize));
+	int maxZ = std::min(mMaxZ, (int)std::floor((position.z + mLoadRadius) / mCellSize));
+
+	for (int z = minZ; z <= maxZ; z++)
+	{
+		for (int x = minX; x <= maxX; x++)
+		{
+			float distance = cellDistance(x, z, position);
+			if (distance > mLoadRadius || mCells.count(cellKey(x, z)))
+				continue;
+
+			Cell& cell = mCells[cellKey(x, z)];
+			cell.x = x;
+			cell.z = z;
+			cell.state = CELL_QUEUED;
+			cell.distance = distance;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Reads of queued cells and parses of queued meshes, nearest first, as long
+// as the I/O budget allows
+//-----------------------------------------------------------------------------
+void WorldPartition::startJobs()
+{
+	int slots = mIoBudget - countJobsInFlight();
+	if (slots <= 0)
+		return;
+
+	for (MeshSlot& slot : mMeshes)
+		slot.priority = 1e30f;
+	std::vector<Request> requests;
+	for (auto& entry : mCells)
+	{
+		Cell& cell = entry.second;
+		if (cell.state == CELL_QUEUED)
+			requests.push_back({ cell.distance, true, entry.first, -1 });
+		else if (cell.state == CELL_MESHES)
+		{
+			for (int m : cell.meshes)
+				mMeshes[m].priority = std::min(mMeshes[m].priority, cell.distance);
+		}
+	}
+	for (size_t m = 0; m < mMeshes.size(); m++)
+	{
+		if (mMeshes[m].state == MESH_QUEUED && mMeshes[m].refs > 0)
+			requests.push_back({ mMeshes[m].priority, false, 0, (int)m });
+	}
+
+	// Only the nearest ones start, the others wait for a later update
+	size_t count = std::min(requests.size(), (size_t)slots);
+	std::partial_sort(requests.begin(), requests.begin() + count, requests.end());
+	for (size_t r = 0; r < count; r++)
+	{
+		if (requests[r].isCell)
+		{
+			Cell& cell = mCells[requests[r].cell];
+			std::shared_ptr<CellData> data = std::make_shared<CellData>();
+			std::string fileName = cellFileName(cell.x, cell.z);
+			cell.data = data;
+			cell.job = mJobs.spawnBackground([this, fileName, data] { readCell(fileName, *data); });
+			cell.state = CELL_READING;
+			mStats.cellLoads++;
+		}
+		else
+		{
+			MeshSlot& slot = mMeshes[requests[r].mesh];
+			Mesh* mesh = slot.mesh.get();
+			std::vector<glm::vec3>* occluder = slot.occluder.get();
+			std::string fileName = slot.fileName;
+			slot.job = mJobs.spawnBackground([mesh, occluder, fileName]
+			{
+				mesh->parseOBJ(fileName);
+				OcclusionCuller::loadOccluder(fileName, *occluder);
+			});
+			slot.state = MESH_PARSING;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Vertex buffers of the parsed meshes, nearest first, up to the byte budget
+//-----------------------------------------------------------------------------
+void WorldPartition::uploadMeshes()
+{
+	std::vector<std::pair<float, int> > parsed;
+	for (size_t m = 0; m < mMeshes.size(); m++)
+	{
+		if (mMeshes[m].state == MESH_PARSED && mMeshes[m].refs > 0)
+			parsed.push_back(std::make_pair(mMeshes[m].priority, (int)m));
+	}
+	std::sort(parsed.begin(), parsed.end());
+
+	mStats.uploadedBytes = 0;
+	for (size_t p = 0; p < parsed.size(); p++)
+	{
+		if (p > 0 && mStats.uploadedBytes >= mUploadBudget)
+			break;
+
+		MeshSlot& slot = mMeshes[parsed[p].second];
+		mStats.uploadedBytes += slot.mesh->getCpuMemorySize();
+		slot.state = slot.mesh->upload() ? MESH_UPLOADED : MESH_FAILED;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Cells whose meshes are all in show up; true if any did
+//-----------------------------------------------------------------------------
+bool WorldPartition::finishCells()
+{
+	bool changed = false;
+	for (auto& entry : mCells)
+	{
+		Cell& cell = entry.second;
+		if (cell.state != CELL_MESHES)
+			continue;
+
+		bool ready = true;
+		for (int m : cell.meshes)
+			ready = ready && (mMeshes[m].state == MESH_UPLOADED || mMeshes[m].state == MESH_FAILED);
+		if (!ready)
+			continue;
+
+		// Instances of meshes that failed to load are left out
+		std::vector<Instance> instances;
+		instances.reserve(cell.instances.size());
+		for (Instance instance : cell.instances)
+		{
+			int slot = cell.meshes[instance.meshId];
+			if (mMeshes[slot].state != MESH_UPLOADED)
+				continue;
+			instance.meshId = slot;
+			instance.mesh = mMeshes[slot].mesh.get();
+			instance.occluder = mMeshes[slot].occluder->empty() ? nullptr : mMeshes[slot].occluder.get();
+			instances.push_back(instance);
+		}
+		cell.instances.swap(instances);
+		cell.state = CELL_LOADED;
+		changed = true;
+	}
+	return changed;
+}
+
+//-----------------------------------------------------------------------------
+// The slot of a mesh file, queued for loading if no cell used it yet
+//-----------------------------------------------------------------------------
+int WorldPartition::acquireMesh(const std::string& fileName)
+{
+	std::unordered_map<std::string, int>::iterator found = mMeshIndex.find(fileName);
+	if (found != mMeshIndex.end())
+	{
+		mMeshes[found->second].refs++;
+		return found->second;
+	}
+
+	// Slots are reused, the lowest first, so mesh ids stay below the most
+	// meshes ever loaded at once
+	int slot;
+	if (!mFreeMeshSlots.empty())
+	{
+		std::vector<int>::iterator lowest = std::min_element(mFreeMeshSlots.begin(), mFreeMeshSlots.end());
+		slot = *lowest;
+		mFreeMeshSlots.erase(lowest);
+	}
+	else
+	{
+		slot = (int)mMeshes.size();
+		mMeshes.push_back(MeshSlot());
+	}
+
+	MeshSlot& mesh = mMeshes[slot];
+	mesh.fileName = fileName;
+	mesh.mesh.reset(new Mesh());
+	mesh.occluder.reset(new std::vector<glm::vec3>());
+	mesh.state = MESH_QUEUED;
+	if (slot >= mMaxMeshes)
+	{
+		// Never loaded : its instances are left out like those of a broken mesh
+		mesh.state = MESH_FAILED;
+		if (!mWarnedMaxMeshes)
+			std::cerr << "World: more than " << mMaxMeshes << " meshes at once, the instances of '" << fileName
+					  << "' and of any mesh past them are left out" << std::endl;
+		mWarnedMaxMeshes = true;
+	}
+	mesh.refs = 1;
+	mesh.priority = 1e30f;
+	mMeshIndex[fileName] = slot;
+	return slot;
+}
+
+//-----------------------------------------------------------------------------
+// A dropped cell lets go of its meshes
+//-----------------------------------------------------------------------------
+void WorldPartition::releaseMeshes(Cell& cell)
+{
+	for (int m : cell.meshes)
+		mMeshes[m].refs--;
+	cell.meshes.clear();
+}
+
+//-----------------------------------------------------------------------------
+// Meshes no cell uses any more, unless still being parsed
+//-----------------------------------------------------------------------------
+void WorldPartition::freeUnusedMeshes()
+{
+	for (size_t m = 0; m < mMeshes.size(); m++)
+	{
+		MeshSlot& slot = mMeshes[m];
+		if (!slot.mesh || slot.refs > 0 || slot.state == MESH_PARSING)
+			continue;
+
+		mMeshIndex.erase(slot.fileName);
+		slot.fileName.clear();
+		slot.mesh.reset();
+		slot.occluder.reset();
+		slot.job.reset();
+		slot.state = MESH_FAILED;
+		mFreeMeshSlots.push_back((int)m);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Cell reads and mesh parses not done yet
+//-----------------------------------------------------------------------------
+int WorldPartition::countJobsInFlight()
+{
+	int count = (int)mOrphanJobs.size();
+	for (const auto& entry : mCells)
+		count += entry.second.state == CELL_READING ? 1 : 0;
+	for (const MeshSlot& slot : mMeshes)
+		count += slot.state == MESH_PARSING ? 1 : 0;
+	return count;
+}
@@ -0,0 +1,237 @@
+//-----------------------------------------------------------------------------
+// drawblockcheck - DrawData against the DrawBlock layout of the lit pass
+//
+// Compiles and links lighting_dir.vert / lighting_dir.frag on a hidden window
+// with the bindless path compiled out (the fallback every driver without
+// ARB_bindless_texture runs), then again as shipped when the driver has the
+// extension.  For each program the std140 offsets the driver reports for the
+// members of DrawBlock, the array stride and the block size must match
+// offsetof(DrawData, ...), sizeof(DrawData) and MAX_DRAWS.  Mismatches go to
+// stderr, the exit code is 1 on any mismatch or compile / link error.  Run
+// from the build dir.
+//
+//   drawblockcheck [shader dir]   (default: shaders)
+//-----------------------------------------------------------------------------
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GLFW/glfw3.h"
+
+#include "DrawData.h"
+
+namespace
+{
+	const char* BINDLESS_EXTENSION = "#extension GL_ARB_bindless_texture : enable";
+	const char* BINDLESS_BLOCK = "#ifdef GL_ARB_bindless_texture";
+
+	bool readFile(const std::string& fileName, std::string& source)
+	{
+		std::ifstream file(fileName);
+		if (!file)
+		{
+			fprintf(stderr, "cannot read %s\n", fileName.c_str());
+			return false;
+		}
+		std::stringstream stream;
+		stream << file.rdbuf();
+		source = stream.str();
+		return true;
+	}
+
+	// Drivers with the extension define its macro whether or not it is
+	// enabled, so the bindless blocks are compiled out by hand.  Lines are
+	// kept so that the compiler logs point into the file.
+	std::string withoutBindless(std::string source)
+	{
+		const std::string extension = BINDLESS_EXTENSION;
+		const std::string block = BINDLESS_BLOCK;
+		size_t pos = source.find(extension);
+		if (pos != std::string::npos)
+			source.replace(pos, extension.size(), "");
+		while ((pos = source.find(block)) != std::string::npos)
+			source.replace(pos, block.size(), "#if 0");
+		return source;
+	}
+
+	GLuint compile(GLenum stage, const std::string& source, const char* name)
+	{
+		GLuint shader = glCreateShader(stage);
+		const char* sourcePtr = source.c_str();
+		glShaderSource(shader, 1, &sourcePtr, NULL);
+		glCompileShader(shader);
+
+		GLint status = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+		if (!status)
+		{
+			GLint length = 0;
+			glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+			std::string log(length > 0 ? length : 1, '\0');
+			glGetShaderInfoLog(shader, (GLsizei)log.size(), NULL, &log[0]);
+			fprintf(stderr, "%s does not compile:\n%s\n", name, log.c_str());
+			glDeleteShader(shader);
+			return 0;
+		}
+		return shader;
+	}
+
+	GLuint link(const std::string& vsSource, const std::string& fsSource)
+	{
+		GLuint vs = compile(GL_VERTEX_SHADER, vsSource, "lighting_dir.vert");
+		GLuint fs = compile(GL_FRAGMENT_SHADER, fsSource, "lighting_dir.frag");
+		if (vs == 0 || fs == 0)
+		{
+			glDeleteShader(vs);
+			glDeleteShader(fs);
+			return 0;
+		}
+
+		GLuint program = glCreateProgram();
+		glAttachShader(program, vs);
+		glAttachShader(program, fs);
+		glLinkProgram(program);
+		glDeleteShader(vs);
+		glDeleteShader(fs);
+
+		GLint status = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (!status)
+		{
+			GLint length = 0;
+			glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+			std::string log(length > 0 ? length : 1, '\0');
+			glGetProgramInfoLog(program, (GLsizei)log.size(), NULL, &log[0]);
+			fprintf(stderr, "lighting_dir does not link:\n%s\n", log.c_str());
+			glDeleteProgram(program);
+			return 0;
+		}
+		return program;
+	}
+
+	bool expect(const char* variant, const char* what, GLint actual, size_t expected)
+	{
+		if (actual == (GLint)expected)
+			return true;
+		fprintf(stderr, "%s: %s is %d in DrawBlock, %d in DrawData\n", variant, what, actual, (int)expected);
+		return false;
+	}
+
+	// Offsets, stride and size of DrawBlock against DrawData
+	bool checkLayout(GLuint program, const char* variant)
+	{
+		GLuint block = glGetUniformBlockIndex(program, "DrawBlock");
+		if (block == GL_INVALID_INDEX)
+		{
+			fprintf(stderr, "%s: no DrawBlock in lighting_dir\n", variant);
+			return false;
+		}
+
+		// The members of the first entry, and one of the second for the stride
+		const char* names[] = {
+			"draws[0].diffuseHandle",
+			"draws[0].textureSource",
+			"draws[0].layer",
+			"draws[0].rect",
+			"draws[1].diffuseHandle"
+		};
+		const GLsizei count = sizeof(names) / sizeof(names[0]);
+		GLuint indices[count];
+		glGetUniformIndices(program, count, names, indices);
+		for (GLsizei i = 0; i < count; i++)
+		{
+			if (indices[i] == GL_INVALID_INDEX)
+			{
+				fprintf(stderr, "%s: no %s in DrawBlock\n", variant, names[i]);
+				return false;
+			}
+		}
+		GLint offsets[count];
+		glGetActiveUniformsiv(program, count, indices, GL_UNIFORM_OFFSET, offsets);
+
+		GLint blockSize = 0;
+		glGetActiveUniformBlockiv(program, block, GL_UNIFORM_BLOCK_DATA_SIZE, &blockSize);
+
+		bool ok = true;
+		ok &= expect(variant, "diffuseHandle offset", offsets[0], offsetof(DrawData, diffuseHandle));
+		ok &= expect(variant, "textureSource offset", offsets[1], offsetof(DrawData, textureSource));
+		ok &= expect(variant, "layer offset", offsets[2], offsetof(DrawData, layer));
+		ok &= expect(variant, "rect offset", offsets[3], offsetof(DrawData, rect));
+		ok &= expect(variant, "entry stride", offsets[4] - offsets[0], sizeof(DrawData));
+		ok &= expect(variant, "block size", blockSize, MAX_DRAWS * sizeof(DrawData));
+		if (ok)
+			fprintf(stderr, "%s: DrawBlock matches DrawData (%d bytes, %d draws)\n", variant, (int)sizeof(DrawData), MAX_DRAWS);
+		return ok;
+	}
+
+	bool checkVariant(const std::string& vsSource, const std::string& fsSource, const char* variant)
+	{
+		GLuint program = link(vsSource, fsSource);
+		if (program == 0)
+		{
+			fprintf(stderr, "%s: lighting_dir does not build\n", variant);
+			return false;
+		}
+		bool ok = checkLayout(program, variant);
+		glDeleteProgram(program);
+		return ok;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Checks the fallback, and the bindless program where the driver has it
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	if (argc > 2)
+	{
+		fprintf(stderr, "usage: drawblockcheck [shader dir]\n");
+		return 1;
+	}
+	const std::string shaderDir = argc > 1 ? argv[1] : "shaders";
+
+	std::string vsSource, fsSource;
+	if (!readFile(shaderDir + "/lighting_dir.vert", vsSource) || !readFile(shaderDir + "/lighting_dir.frag", fsSource))
+		return 1;
+
+	if (!glfwInit())
+		return 1;
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+	GLFWwindow* window = glfwCreateWindow(64, 64, "drawblockcheck", NULL, NULL);
+	if (window == NULL)
+	{
+		fprintf(stderr, "cannot create an OpenGL 3.3 context\n");
+		glfwTerminate();
+		return 1;
+	}
+	glfwMakeContextCurrent(window);
+
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK)
+	{
+		fprintf(stderr, "cannot initialize GLEW\n");
+		glfwTerminate();
+		return 1;
+	}
+
+	bool ok = checkVariant(vsSource, withoutBindless(fsSource), "fallback");
+	if (GLEW_ARB_bindless_texture)
+		ok &= checkVariant(vsSource, fsSource, "bindless");
+	else
+		fprintf(stderr, "bindless: not checked, no ARB_bindless_texture\n");
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+//-----------------------------------------------------------------------------
+// scenecook - scene description converter
+//
+// Loads a scene in either form and writes it in the other one: the text form
+// (authoring) becomes the binary form the application loads fastest, the
+// binary form becomes text again for editing.  Names are not kept in the
+// binary form; the text written back names assets after their files.
+//
+//   scenecook [-text | -binary] [-j threads] -o output scene
+//
+// Without -text or -binary the output is binary unless the input already is.
+//-----------------------------------------------------------------------------
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "JobSystem.h"
+#include "SceneFile.h"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	typedef std::chrono::duration<double, std::milli> Ms;
+
+	struct Options
+	{
+		std::string format;		// "text", "binary", or empty : the other one
+		int numThreads;			// -1 : one per hardware thread
+		std::string output;
+		std::string input;
+	};
+
+	void printUsage()
+	{
+		std::cerr << "usage: scenecook [-text | -binary] [-j threads] -o output scene" << std::endl;
+	}
+
+	bool parseOptions(int argc, char** argv, Options& options)
+	{
+		options.numThreads = -1;
+
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "-text")
+				options.format = "text";
+			else if (arg == "-binary")
+				options.format = "binary";
+			else if (arg == "-j" && i + 1 < argc)
+				options.numThreads = atoi(argv[++i]);
+			else if (arg == "-o" && i + 1 < argc)
+				options.output = argv[++i];
+			else if (!arg.empty() && arg[0] == '-')
+				return false;
+			else if (options.input.empty())
+				options.input = arg;
+			else
+				return false;
+		}
+
+		return !options.output.empty() && !options.input.empty();
+	}
+
+	bool isBinary(const std::string& fileName)
+	{
+		char magic[4] = {};
+		std::ifstream fin(fileName, std::ios::in | std::ios::binary);
+		fin.read(magic, 4);
+		return fin && magic[0] == 'S' && magic[1] == 'C' && magic[2] == 'N' && magic[3] == 'B';
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Converts the input scene
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage();
+		return 1;
+	}
+
+	// The calling thread plus workers; -j 1 loads on this thread only
+	std::unique_ptr<JobSystem> jobs;
+	if (options.numThreads != 1)
+		jobs.reset(new JobSystem(options.numThreads > 1 ? (unsigned)options.numThreads - 1 : 0));
+
+	bool binary = options.format.empty() ? !isBinary(options.input) : options.format == "binary";
+
+	Clock::time_point start = Clock::now();
+	SceneFile scene;
+	if (!scene.load(options.input, jobs.get()))
+		return 1;
+	double loadMs = Ms(Clock::now() - start).count();
+
+	start = Clock::now();
+	if (!(binary ? scene.saveBinary(options.output) : scene.saveText(options.output)))
+		return 1;
+	double saveMs = Ms(Clock::now() - start).count();
+
+	const SceneFile::Timings& timings = scene.getTimings();
+	std::cout << "scenecook: " << options.input << " -> " << options.output << " (" << (binary ? "binary" : "text") << "): "
+			  << scene.getInstances().size() << " instances, " << scene.getMeshes().size() << " meshes, "
+			  << scene.getTextures().size() << " textures, " << scene.getMaterials().size() << " materials, "
+			  << scene.getLights().size() << " lights" << std::endl
+			  << "scenecook: loaded in " << loadMs << " ms (read " << timings.readMs << " parse " << timings.parseMs
+			  << " resolve " << timings.resolveMs << "), saved in " << saveMs << " ms" << std::endl;
+	return 0;
+}
@@ -0,0 +1,218 @@
+//-----------------------------------------------------------------------------
+// texcook - offline texture cooker
+//
+// Decodes source images, builds their mip chain, block compresses every level
+// and writes a .dds per image that Texture2D / TextureLoader upload directly.
+//
+//   texcook [-f auto|bc1|bc3|bc5|bc7|rgba8] [-mip box|kaiser] [-linear] [-srgb]
+//           [-nomips] [-j threads] -o outDir images...
+//
+// auto picks BC1 for opaque images and BC3 when any pixel is translucent;
+// rgba8 keeps the prebuilt mips uncompressed.  Mips are filtered in linear
+// light unless -linear is given (data textures; implied by bc5).
+// Images are stored bottom row first, like the uncompressed upload path.
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image/stb_image.h"
+
+#include "BlockCompressor.h"
+#include "CompressedImage.h"
+#include "MipGenerator.h"
+
+namespace
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	typedef std::chrono::duration<double, std::milli> Ms;
+
+	struct Options
+	{
+		std::string format;
+		MipGenerator::Filter mipFilter;
+		bool gammaCorrect;
+		bool srgb;
+		bool mipmaps;
+		unsigned numThreads;
+		std::string outDir;
+		std::vector<std::string> inputs;
+	};
+
+	void printUsage()
+	{
+		std::cerr << "usage: texcook [-f auto|bc1|bc3|bc5|bc7|rgba8] [-mip box|kaiser] [-linear] [-srgb]" << std::endl
+				  << "               [-nomips] [-j threads] -o outDir images..." << std::endl;
+	}
+
+	bool parseOptions(int argc, char** argv, Options& options)
+	{
+		options.format = "auto";
+		options.mipFilter = MipGenerator::FILTER_KAISER;
+		options.gammaCorrect = true;
+		options.srgb = false;
+		options.mipmaps = true;
+		options.numThreads = 0;
+
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "-f" && i + 1 < argc)
+				options.format = argv[++i];
+			else if (arg == "-mip" && i + 1 < argc)
+			{
+				std::string filter = argv[++i];
+				if (filter != "box" && filter != "kaiser")
+					return false;
+				options.mipFilter = (filter == "box") ? MipGenerator::FILTER_BOX : MipGenerator::FILTER_KAISER;
+			}
+			else if (arg == "-linear")
+				options.gammaCorrect = false;
+			else if (arg == "-srgb")
+				options.srgb = true;
+			else if (arg == "-nomips")
+				options.mipmaps = false;
+			else if (arg == "-j" && i + 1 < argc)
+				options.numThreads = (unsigned)atoi(argv[++i]);
+			else if (arg == "-o" && i + 1 < argc)
+				options.outDir = argv[++i];
+			else if (!arg.empty() && arg[0] == '-')
+				return false;
+			else
+				options.inputs.push_back(arg);
+		}
+
+		return !options.outDir.empty() && !options.inputs.empty();
+	}
+
+	CompressedImage::Format chooseFormat(const std::string& name, const unsigned char* rgba, int width, int height)
+	{
+		if (name == "bc1")	return CompressedImage::FORMAT_BC1;
+		if (name == "bc3")	return CompressedImage::FORMAT_BC3;
+		if (name == "bc5")	return CompressedImage::FORMAT_BC5;
+		if (name == "bc7")	return CompressedImage::FORMAT_BC7;
+		if (name == "rgba8")	return CompressedImage::FORMAT_RGBA8;
+		if (name != "auto")	return CompressedImage::FORMAT_UNKNOWN;
+
+		size_t numPixels = (size_t)width * height;
+		for (size_t i = 0; i < numPixels; i++)
+		{
+			if (rgba[i * 4 + 3] != 255)
+				return CompressedImage::FORMAT_BC3;
+		}
+		return CompressedImage::FORMAT_BC1;
+	}
+
+	void flipVertical(unsigned char* rgba, int width, int height)
+	{
+		size_t rowBytes = (size_t)width * 4;
+		for (int row = 0; row < height / 2; row++)
+			std::swap_ranges(rgba + row * rowBytes, rgba + (row + 1) * rowBytes, rgba + (height - row - 1) * rowBytes);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Cooks every input image into outDir/<name>.dds
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage();
+		return 1;
+	}
+
+	std::error_code ec;
+	std::filesystem::create_directories(options.outDir, ec);
+
+	BlockCompressor compressor(options.numThreads);
+	std::cout << "texcook: " << compressor.getNumThreads() << " threads, "
+			  << (BlockCompressor::hasSimd() ? "SSE2" : "scalar") << " palette search, "
+			  << MipGenerator::getFilterName(options.mipFilter) << (options.gammaCorrect ? " gamma correct" : " linear")
+			  << " mips" << std::endl;
+
+	size_t totalSource = 0, totalCooked = 0;
+	int failures = 0;
+	Clock::time_point start = Clock::now();
+
+	for (size_t i = 0; i < options.inputs.size(); i++)
+	{
+		const std::string& input = options.inputs[i];
+		Clock::time_point imageStart = Clock::now();
+
+		int width, height, components;
+		unsigned char* pixels = stbi_load(input.c_str(), &width, &height, &components, STBI_rgb_alpha);
+		if (pixels == NULL)
+		{
+			std::cerr << "Error loading '" << input << "': " << stbi_failure_reason() << std::endl;
+			failures++;
+			continue;
+		}
+
+		CompressedImage::Format format = chooseFormat(options.format, pixels, width, height);
+		if (format == CompressedImage::FORMAT_UNKNOWN)
+		{
+			std::cerr << "Error: unknown format '" << options.format << "'" << std::endl;
+			stbi_image_free(pixels);
+			printUsage();
+			return 1;
+		}
+
+		flipVertical(pixels, width, height);
+
+		std::vector<MipGenerator::Level> mipLevels;
+		if (options.mipmaps)
+		{
+			bool gammaCorrect = options.gammaCorrect && format != CompressedImage::FORMAT_BC5;
+			MipGenerator::generate(pixels, width, height, options.mipFilter, gammaCorrect, mipLevels);
+		}
+
+		CompressedImage image;
+		image.create(format, options.srgb && format != CompressedImage::FORMAT_BC5, width, height);
+
+		size_t sourceBytes = 0;
+		for (size_t level = 0; level <= mipLevels.size(); level++)
+		{
+			const unsigned char* rgba = (level == 0) ? pixels : &mipLevels[level - 1].pixels[0];
+			int levelWidth = (level == 0) ? width : mipLevels[level - 1].width;
+			int levelHeight = (level == 0) ? height : mipLevels[level - 1].height;
+			size_t levelBytes = (size_t)levelWidth * levelHeight * 4;
+
+			if (format == CompressedImage::FORMAT_RGBA8)
+				memcpy(image.addLevel(), rgba, levelBytes);
+			else
+				compressor.compress(rgba, levelWidth, levelHeight, format, image.addLevel());
+			sourceBytes += levelBytes;
+		}
+		stbi_image_free(pixels);
+
+		std::string output = (std::filesystem::path(options.outDir) / std::filesystem::path(input).stem()).string() + ".dds";
+		if (!image.saveDDS(output))
+		{
+			failures++;
+			continue;
+		}
+
+		totalSource += sourceBytes;
+		totalCooked += image.getDataSize();
+		std::cout << output << ": " << width << "x" << height << " " << CompressedImage::getFormatName(format)
+				  << (image.isSRGB() ? " sRGB" : "") << ", " << image.getNumLevels() << " levels, "
+				  << sourceBytes / 1024 << " KB -> " << image.getDataSize() / 1024 << " KB ("
+				  << Ms(Clock::now() - imageStart).count() << " ms)" << std::endl;
+	}
+
+	if (totalCooked > 0)
+	{
+		std::cout << "texcook: " << totalSource / 1024 << " KB RGBA8 -> " << totalCooked / 1024 << " KB ("
+				  << (double)totalSource / totalCooked << "x smaller) in " << Ms(Clock::now() - start).count() << " ms" << std::endl;
+	}
+
+	return failures == 0 ? 0 : 1;
+}
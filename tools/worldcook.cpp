@@ -0,0 +1,289 @@
+//-----------------------------------------------------------------------------
+// worldcook - generates a streamed world for WorldPartition
+//
+// An N x N grid of cells centered on the origin, written into the output
+// directory: world.index, palette.scene (textures and materials), and per
+// cell a terrain tile (an OBJ of its own, so every cell has data to stream)
+// with its occluder proxy, and a binary scene placing it with buildings, fences and lamp posts from
+// models/.  The hills flatten out towards the origin, left free for the main
+// scene.  Paths in the files are relative to the directory the application
+// runs from, so run worldcook from there with a relative output directory.
+//
+//   worldcook [-n cells per side] [-s cell size] [-seed n] -o directory
+//   (default: 32 cells of 32 units)
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "glm/glm.hpp"
+#include "OcclusionCuller.h"
+#include "SceneFile.h"
+
+namespace
+{
+	const int TERRAIN_QUADS = 16;			// per side of a cell
+	const int OCCLUDER_QUADS = 4;			// per side of the tile's occluder proxy
+	const float TERRAIN_UV_REPEAT = 8.0f;	// world units per repeat of the ground texture
+	const float FLAT_RADIUS = 48.0f;		// no hills closer to the origin, ramping up to
+	const float HILLS_RADIUS = 96.0f;
+	const float CLEAR_RADIUS = 64.0f;		// no props closer to the origin
+	const float BUILDING_CHANCE = 0.4f;
+	const float BUILDING_SCALE = 0.5f;
+	const float FENCE_LENGTH = 9.0f;		// of models/fence.obj, along z
+
+	struct Options
+	{
+		int numCells;
+		float cellSize;
+		unsigned seed;
+		std::string output;
+	};
+
+	void printUsage()
+	{
+		std::cerr << "usage: worldcook [-n cells per side] [-s cell size] [-seed n] -o directory" << std::endl;
+	}
+
+	bool parseOptions(int argc, char** argv, Options& options)
+	{
+		options.numCells = 32;
+		options.cellSize = 32.0f;
+		options.seed = 1234;
+
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "-n" && i + 1 < argc)
+				options.numCells = atoi(argv[++i]);
+			else if (arg == "-s" && i + 1 < argc)
+				options.cellSize = (float)atof(argv[++i]);
+			else if (arg == "-seed" && i + 1 < argc)
+				options.seed = (unsigned)atol(argv[++i]);
+			else if (arg == "-o" && i + 1 < argc)
+				options.output = argv[++i];
+			else
+				return false;
+		}
+
+		return !options.output.empty() && options.numCells > 0 && options.cellSize > 0.0f;
+	}
+
+	// Rolling hills, flat around the origin
+	float terrainHeight(float x, float z)
+	{
+		float r = std::sqrt(x * x + z * z);
+		float t = glm::clamp((r - FLAT_RADIUS) / (HILLS_RADIUS - FLAT_RADIUS), 0.0f, 1.0f);
+		float hills = 3.0f * std::sin(x * 0.05f) * std::cos(z * 0.04f) + 1.5f * std::sin(x * 0.13f + z * 0.09f) + 1.5f;
+		return t * t * (3.0f - 2.0f * t) * hills - 0.05f;	// just under the main scene's ground
+	}
+
+	// The tile of a cell, in cell space from its corner
+	bool writeTerrain(const std::string& fileName, float originX, float originZ, float cellSize)
+	{
+		FILE* file = fopen(fileName.c_str(), "w");
+		if (!file)
+		{
+			std::cerr << "Cannot write " << fileName << std::endl;
+			return false;
+		}
+
+		const float step = cellSize / TERRAIN_QUADS;
+		const float e = step * 0.5f;
+		fprintf(file, "# worldcook terrain tile at %g %g\n", originX, originZ);
+		for (int j = 0; j <= TERRAIN_QUADS; j++)
+		{
+			for (int i = 0; i <= TERRAIN_QUADS; i++)
+			{
+				float x = i * step, z = j * step;
+				float wx = originX + x, wz = originZ + z;
+				glm::vec3 normal = glm::normalize(glm::vec3(terrainHeight(wx - e, wz) - terrainHeight(wx + e, wz), 2.0f * e,
+															terrainHeight(wx, wz - e) - terrainHeight(wx, wz + e)));
+				fprintf(file, "v %.4f %.4f %.4f\n", x, terrainHeight(wx, wz), z);
+				fprintf(file, "vt %.4f %.4f\n", wx / TERRAIN_UV_REPEAT, wz / TERRAIN_UV_REPEAT);
+				fprintf(file, "vn %.4f %.4f %.4f\n", normal.x, normal.y, normal.z);
+			}
+		}
+
+		// Two counter-clockwise triangles per quad, seen from above
+		for (int j = 0; j < TERRAIN_QUADS; j++)
+		{
+			for (int i = 0; i < TERRAIN_QUADS; i++)
+			{
+				int a = j * (TERRAIN_QUADS + 1) + i + 1;
+				int b = a + 1, c = a + TERRAIN_QUADS + 1, d = c + 1;
+				fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, c, c, c, b, b, b);
+				fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", b, b, b, c, c, c, d, d, d);
+			}
+		}
+
+		bool ok = !ferror(file);
+		fclose(file);
+		return ok;
+	}
+
+	// A coarse copy of the tile for OcclusionCuller, each corner at the lowest
+	// height around it so that it stays under the tile
+	bool writeTerrainOccluder(const std::string& fileName, float originX, float originZ, float cellSize)
+	{
+		FILE* file = fopen(fileName.c_str(), "w");
+		if (!file)
+		{
+			std::cerr << "Cannot write " << fileName << std::endl;
+			return false;
+		}
+
+		const float step = cellSize / TERRAIN_QUADS;
+		const int ratio = TERRAIN_QUADS / OCCLUDER_QUADS;
+		fprintf(file, "# worldcook terrain occluder at %g %g\n", originX, originZ);
+		for (int j = 0; j <= OCCLUDER_QUADS; j++)
+		{
+			for (int i = 0; i <= OCCLUDER_QUADS; i++)
+			{
+				float lowest = 1e30f;
+				for (int fj = std::max((j - 1) * ratio, 0); fj <= std::min((j + 1) * ratio, TERRAIN_QUADS); fj++)
+				{
+					for (int fi = std::max((i - 1) * ratio, 0); fi <= std::min((i + 1) * ratio, TERRAIN_QUADS); fi++)
+						lowest = std::min(lowest, terrainHeight(originX + fi * step, originZ + fj * step));
+				}
+				fprintf(file, "v %.4f %.4f %.4f\n", i * ratio * step, lowest - 0.05f, j * ratio * step);
+			}
+		}
+
+		for (int j = 0; j < OCCLUDER_QUADS; j++)
+		{
+			for (int i = 0; i < OCCLUDER_QUADS; i++)
+			{
+				int a = j * (OCCLUDER_QUADS + 1) + i + 1;
+				int b = a + 1, c = a + OCCLUDER_QUADS + 1, d = c + 1;
+				fprintf(file, "f %d %d %d\n", a, c, b);
+				fprintf(file, "f %d %d %d\n", b, c, d);
+			}
+		}
+
+		bool ok = !ferror(file);
+		fclose(file);
+		return ok;
+	}
+
+	SceneFile::Instance place(int mesh, int texture, int material, float x, float z, float yawDegrees, float scale)
+	{
+		SceneFile::Instance instance = SceneFile::makeInstance(mesh, texture, material);
+		instance.position = glm::vec3(x, terrainHeight(x, z), z);
+		instance.rotation = glm::angleAxis(glm::radians(yawDegrees), glm::vec3(0.0f, 1.0f, 0.0f));
+		instance.scale = glm::vec3(scale);
+		return instance;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Writes the index, the palette and every cell
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage();
+		return 1;
+	}
+
+	std::error_code ec;
+	std::filesystem::create_directories(options.output, ec);
+	const std::filesystem::path directory(options.output);
+	const int first = -options.numCells / 2;
+	const int last = first + options.numCells - 1;
+	const float size = options.cellSize;
+
+	std::ofstream index((directory / "world.index").string());
+	index << "# worldcook -n " << options.numCells << " -s " << size << " -seed " << options.seed << "\n"
+		  << "cellsize " << size << "\n"
+		  << "cells " << first << " " << first << " " << last << " " << last << "\n";
+	if (!index)
+	{
+		std::cerr << "Cannot write " << (directory / "world.index").string() << std::endl;
+		return 1;
+	}
+
+	SceneFile palette;
+	palette.addTexture("textures/ground.jpg");
+	palette.addTexture("textures/building.png");
+	palette.addTexture("textures/fence.png");
+	palette.addTexture("textures/lamp_post_diffuse.png");
+	palette.addMaterial(SceneFile::makeMaterial("default"));
+	SceneFile::Material terrain = SceneFile::makeMaterial("terrain");
+	terrain.specular = glm::vec3(0.1f);
+	terrain.shininess = 8.0f;
+	palette.addMaterial(terrain);
+	if (!palette.saveText((directory / "palette.scene").string()))
+		return 1;
+
+	std::mt19937 random(options.seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	size_t numInstances = 0;
+	for (int cz = first; cz <= last; cz++)
+	{
+		for (int cx = first; cx <= last; cx++)
+		{
+			const float x0 = cx * size, z0 = cz * size;
+			const std::string suffix = std::to_string(cx) + "_" + std::to_string(cz);
+			const std::string terrainFile = (directory / ("terrain_" + suffix + ".obj")).generic_string();
+			if (!writeTerrain(terrainFile, x0, z0, size) ||
+				!writeTerrainOccluder(OcclusionCuller::getOccluderFile(terrainFile), x0, z0, size))
+				return 1;
+
+			// Names resolve against the palette, by file and by material name
+			SceneFile cell;
+			int ground = cell.addTexture("textures/ground.jpg");
+			int defaultMaterial = cell.addMaterial(SceneFile::makeMaterial("default"));
+			int terrainMaterial = cell.addMaterial(SceneFile::makeMaterial("terrain"));
+			SceneFile::Instance tile = SceneFile::makeInstance(cell.addMesh(terrainFile), ground, terrainMaterial);
+			tile.position = glm::vec3(x0, 0.0f, z0);
+			cell.addInstance(tile);
+
+			float cellCenterX = x0 + size * 0.5f, cellCenterZ = z0 + size * 0.5f;
+			if (std::sqrt(cellCenterX * cellCenterX + cellCenterZ * cellCenterZ) > CLEAR_RADIUS)
+			{
+				// A lamp post at each quarter along the road on the cell's low z edge
+				int lampPost = cell.addMesh("models/lampPost.obj");
+				int lampTexture = cell.addTexture("textures/lamp_post_diffuse.png");
+				cell.addInstance(place(lampPost, lampTexture, defaultMaterial, x0 + size * 0.25f, z0 + 1.5f, unit(random) * 360.0f, 1.0f));
+				cell.addInstance(place(lampPost, lampTexture, defaultMaterial, x0 + size * 0.75f, z0 + 1.5f, unit(random) * 360.0f, 1.0f));
+
+				// Maybe a building on the low x half, turned to fit the cell
+				if (unit(random) < BUILDING_CHANCE)
+				{
+					int building = cell.addMesh("models/building.obj");
+					int buildingTexture = cell.addTexture("textures/building.png");
+					float yaw = unit(random) < 0.5f ? 90.0f : 270.0f;
+					cell.addInstance(place(building, buildingTexture, defaultMaterial, x0 + size * 0.3f, z0 + size * 0.55f, yaw, BUILDING_SCALE));
+				}
+
+				// A run of fences along z on the high x half
+				int numFences = (int)(unit(random) * 3.0f);
+				if (numFences > 0)
+				{
+					int fence = cell.addMesh("models/fence.obj");
+					int fenceTexture = cell.addTexture("textures/fence.png");
+					float fenceX = x0 + size * (0.7f + 0.2f * unit(random));
+					for (int f = 0; f < numFences; f++)
+						cell.addInstance(place(fence, fenceTexture, defaultMaterial, fenceX, z0 + 4.0f + FENCE_LENGTH * (f + 0.5f), 0.0f, 1.0f));
+				}
+			}
+
+			numInstances += cell.getInstances().size();
+			if (!cell.saveBinary((directory / ("cell_" + suffix + ".sceneb")).string()))
+				return 1;
+		}
+	}
+
+	std::cout << "worldcook: " << options.numCells << "x" << options.numCells << " cells of " << size << " in "
+			  << options.output << ", " << numInstances << " instances" << std::endl;
+	return 0;
+}